@@ -0,0 +1,595 @@
+#include "Benchmarks.h"
+#include "..\Shared\tracing.h"
+#include <map>
+#include <random>
+#include <algorithm>
+#include <thread>
+#include "..\Shared\Logger.h"
+#include "..\DebugCore\FlatIndex.h"
+#include "..\DebugCore\Debugger.h"
+#include "..\DebugCore\PatternSet.h"
+#include "..\DebugCore\SigParser.h"
+
+//the metadata dispenser of the installed v4 runtime, the search benchmarks emit their modules with it
+static HRESULT GetDispenser(ComPtr<IMetaDataDispenser> &dispenser)
+{
+	ComPtr<ICLRMetaHost> metahost;
+	auto hr = CLRCreateInstance(CLSID_CLRMetaHost, IID_ICLRMetaHost, &metahost);
+	if (hr != S_OK) return hr;
+
+	ComPtr<ICLRRuntimeInfo> runtime;
+	hr = metahost->GetRuntime(L"v4.0.30319", IID_ICLRRuntimeInfo, &runtime);
+	if (hr != S_OK) return hr;
+
+	return runtime->GetInterface(CLSID_CorMetaDataDispenser, IID_IMetaDataDispenser, &dispenser);
+}
+
+//a type of a synthetic module: Get<m>/Set<m> instance methods (alternating) and field<f> fields
+static HRESULT EmitType(IMetaDataEmit *emit, const wchar_t *typeName, ULONG numMethods, ULONG numFields)
+{
+	//instance void (int32), and int32
+	const COR_SIGNATURE methodSig[] = { IMAGE_CEE_CS_CALLCONV_HASTHIS, 1, ELEMENT_TYPE_VOID, ELEMENT_TYPE_I4 };
+	const COR_SIGNATURE fieldSig[] = { IMAGE_CEE_CS_CALLCONV_FIELD, ELEMENT_TYPE_I4 };
+
+	mdTypeDef typeDef;
+	auto hr = emit->DefineTypeDef(typeName, tdPublic | tdClass, mdTypeRefNil, nullptr, &typeDef);
+	if (hr != S_OK) return hr;
+
+	wchar_t name[64];
+	for (ULONG method = 0; method < numMethods; method++)
+	{
+		swprintf_s(name, L"%s%u", method % 2 ? L"Set" : L"Get", method);
+		mdMethodDef methodDef;
+		hr = emit->DefineMethod(typeDef, name, mdPublic | mdHideBySig, methodSig, sizeof(methodSig), 0, miIL | miManaged, &methodDef);
+		if (hr != S_OK) return hr;
+	}
+
+	for (ULONG field = 0; field < numFields; field++)
+	{
+		swprintf_s(name, L"field%u", field);
+		mdFieldDef fieldDef;
+		hr = emit->DefineField(typeDef, name, fdPrivate, fieldSig, sizeof(fieldSig), ELEMENT_TYPE_VOID, nullptr, 0, &fieldDef);
+		if (hr != S_OK) return hr;
+	}
+	return S_OK;
+}
+
+//a synthetic module in memory: types Bench.<module>.Ns<n>.Type<t>, typesPerNamespace types to a namespace, see EmitType
+static HRESULT EmitScope(IMetaDataDispenser *dispenser, const wchar_t *module, ULONG numTypes, ULONG typesPerNamespace, ULONG methodsPerType, ULONG fieldsPerType,
+	ComPtr<IMetaDataImport2> &scope)
+{
+	ComPtr<IMetaDataEmit> emit;
+	auto hr = dispenser->DefineScope(CLSID_CorMetaDataRuntime, 0, IID_IMetaDataEmit, &emit);
+	if (hr != S_OK) return hr;
+
+	wchar_t typeName[256];
+	for (ULONG type = 0; type < numTypes; type++)
+	{
+		swprintf_s(typeName, L"Bench.%s.Ns%u.Type%u", module, type / typesPerNamespace, type);
+		hr = EmitType(emit.Get(), typeName, methodsPerType, fieldsPerType);
+		if (hr != S_OK) return hr;
+	}
+
+	return emit->QueryInterface(IID_IMetaDataImport2, &scope);
+}
+
+//numModules modules of EmitScope, named <prefix><n>, false (and said so) if there's no dispenser or emitting fails
+static bool EmitScopes(const wchar_t *benchmark, const wchar_t *prefix, ULONG numModules, ULONG numTypes, ULONG typesPerNamespace, ULONG methodsPerType, ULONG fieldsPerType,
+	vector<ComPtr<IMetaDataImport2>> &scopes)
+{
+	ComPtr<IMetaDataDispenser> dispenser;
+	auto hr = GetDispenser(dispenser);
+	if (hr != S_OK)
+	{
+		wprintf_s(L"\n%s: no metadata dispenser (0x%08x), is .NET 4 installed?\n", benchmark, hr);
+		LOG(L"%s: no metadata dispenser (0x%08x)\n", benchmark, hr);
+		return false;
+	}
+
+	scopes.resize(numModules);
+	wchar_t moduleName[32];
+	for (ULONG module = 0; module < numModules; module++)
+	{
+		swprintf_s(moduleName, L"%s%u", prefix, module);
+		hr = EmitScope(dispenser.Get(), moduleName, numTypes, typesPerNamespace, methodsPerType, fieldsPerType, scopes[module]);
+		if (hr != S_OK)
+		{
+			wprintf_s(L"\n%s: emitting module %u failed (0x%08x)\n", benchmark, module, hr);
+			LOG(L"%s: emitting module %u failed (0x%08x)\n", benchmark, module, hr);
+			return false;
+		}
+	}
+	return true;
+}
+
+//the tracer's peak working set so far in MB
+static double PeakWorkingSetMB()
+{
+	PROCESS_MEMORY_COUNTERS memoryCounters;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &memoryCounters, sizeof(memoryCounters))) return 0.0;
+	return memoryCounters.PeakWorkingSetSize / 1048576.0;
+}
+
+void Benchmarks::Run()
+{
+	wprintf_s(L"Running benchmarks (synthetic data)...\n");
+	LOG(L"Benchmarks (synthetic data)\n");
+
+	BreakpointLookup();
+	ParallelScan();
+	FilterMatching();
+	LazyNaming();
+	PastCaps();
+	ExceptionalExits();
+}
+
+LONGLONG Benchmarks::Now()
+{
+	LARGE_INTEGER now;
+	QueryPerformanceCounter(&now);
+	return now.QuadPart;
+}
+
+double Benchmarks::NsPer(LONGLONG start, LONGLONG end, size_t ops)
+{
+	LARGE_INTEGER freq;
+	VERIFY(QueryPerformanceFrequency(&freq));
+	return (double)(end - start) * 1e9 / (double)freq.QuadPart / (double)ops;
+}
+
+void Benchmarks::BreakpointLookup()
+{
+	const size_t lookups = 10000000;
+	const size_t sizes[] = { 1000, 10000, 100000 };
+
+	wprintf_s(L"\nBreakpoint lookup (%Iu hits, random order)\n%10s %12s %12s\n", lookups, L"breakpoints", L"map ns/hit", L"flat ns/hit");
+	LOG(L"Breakpoint lookup (%Iu hits, random order)\n", lookups);
+
+	std::mt19937 random(42);
+	for (auto sizeIt = std::begin(sizes); sizeIt != std::end(sizes); ++sizeIt)
+	{
+		//keys are heap pointers, like the breakpoint interface pointers
+		vector<unique_ptr<char[]>> objects;
+		vector<ULONG64> keys;
+		for (size_t i = 0; i < *sizeIt; i++)
+		{
+			objects.push_back(unique_ptr<char[]>(new char[48]));
+			keys.push_back(FlatIndex::KeyOf(objects.back().get()));
+		}
+
+		std::map<ULONG64, ULONG> tree;
+		FlatIndex flat;
+		flat.Reserve(keys.size());
+		for (size_t i = 0; i < keys.size(); i++)
+		{
+			tree[keys[i]] = (ULONG)i;
+			flat.Insert(keys[i], (ULONG)i);
+		}
+
+		vector<ULONG64> hits(lookups);
+		std::uniform_int_distribution<size_t> pick(0, keys.size() - 1);
+		for (auto hitIt = hits.begin(); hitIt != hits.end(); ++hitIt) *hitIt = keys[pick(random)];
+
+		//the slot sums keep the lookups from being optimized away, and must agree
+		ULONG64 treeSum = 0;
+		auto start = Now();
+		for (auto hitIt = hits.begin(); hitIt != hits.end(); ++hitIt) treeSum += tree.find(*hitIt)->second;
+		auto treeEnd = Now();
+
+		ULONG64 flatSum = 0;
+		for (auto hitIt = hits.begin(); hitIt != hits.end(); ++hitIt) flatSum += flat.Find(*hitIt);
+		auto flatEnd = Now();
+
+		auto treeNs = NsPer(start, treeEnd, lookups);
+		auto flatNs = NsPer(treeEnd, flatEnd, lookups);
+		wprintf_s(L"%10Iu %12.1f %12.1f%s\n", *sizeIt, treeNs, flatNs, treeSum == flatSum ? L"" : L"  MISMATCH");
+		LOG(L"%Iu breakpoints: map %.1f ns/hit, flat %.1f ns/hit%s\n", *sizeIt, treeNs, flatNs, treeSum == flatSum ? L"" : L" MISMATCH");
+	}
+}
+
+void Benchmarks::ParallelScan()
+{
+	const ULONG moduleCounts[] = { 1, 4, 16, 64 };
+	const ULONG typesPerModule = 500;
+	const ULONG methodsPerType = 20;
+
+	vector<ComPtr<IMetaDataImport2>> allScopes;
+	if (!EmitScopes(L"Method search", L"M", moduleCounts[_countof(moduleCounts) - 1], typesPerModule, 100, methodsPerType, 4, allScopes)) return;
+
+	//every type is in the namespace, the getters (half the methods) are found
+	auto search = [](const vector<ComPtr<IMetaDataImport2>> &scopes, bool parallel, size_t &numFound) -> double
+	{
+		//a debugger of its own, nothing an earlier search read is reused
+		auto debugger = unique_ptr<Debugger>(new Debugger(OPMODE_NONE));
+		vector<MethodFilter> filters(1);
+		filters[0].namespaceFilter = L"Bench.";
+		filters[0].methodFilter = L"Get";
+		vector<shared_ptr<MethodInfo>> found;
+
+		auto start = Now();
+		debugger->SearchScopes(filters, scopes, parallel, found);
+		auto end = Now();
+
+		numFound = found.size();
+		return NsPer(start, end, 1) / 1e6;
+	};
+
+	size_t warmFound;
+	search(allScopes, false, warmFound);
+
+	//the time from attach to armed, less what needs a target: enumerating its modules, and setting the breakpoints
+	wprintf_s(L"\nMethod search by module count (%u methods a module, %u threads; setting breakpoints isn't included, it needs a target)\n%10s %12s %12s %8s %10s\n",
+		typesPerModule * methodsPerType, std::thread::hardware_concurrency(), L"modules", L"serial ms", L"parallel ms", L"speedup", L"found");
+	LOG(L"Method search by module count (%u methods a module, %u threads, breakpoint setting excluded)\n", typesPerModule * methodsPerType, std::thread::hardware_concurrency());
+	for (auto countIt = std::begin(moduleCounts); countIt != std::end(moduleCounts); ++countIt)
+	{
+		vector<ComPtr<IMetaDataImport2>> scopes(allScopes.begin(), allScopes.begin() + *countIt);
+
+		size_t serialFound, parallelFound;
+		auto serialMs = search(scopes, false, serialFound);
+		auto parallelMs = search(scopes, true, parallelFound);
+		auto speedup = parallelMs > 0.0 ? serialMs / parallelMs : 0.0;
+
+		wprintf_s(L"%10u %12.1f %12.1f %7.1fx %10Iu%s\n", *countIt, serialMs, parallelMs, speedup, serialFound, serialFound == parallelFound ? L"" : L"  MISMATCH");
+		LOG(L"%u modules: serial %.1f ms, parallel %.1f ms (%.1fx), %Iu/%Iu methods found\n", *countIt, serialMs, parallelMs, speedup, serialFound, parallelFound);
+	}
+}
+
+void Benchmarks::FilterMatching()
+{
+	const size_t numNames = 100000;
+	const int passes = 10;
+	const wchar_t *kinds[] = { L"Order", L"Customer", L"Invoice" };
+
+	std::mt19937 random(42);
+	vector<std::wstring> names;
+	wchar_t name[128];
+	for (size_t i = 0; i < numNames; i++)
+	{
+		swprintf_s(name, L"Company.Area%u.Sub%u.%sRepository%Iu", random() % 16, random() % 8, kinds[random() % 3], i);
+		names.push_back(name);
+	}
+
+	wprintf_s(L"\nFilter matching (%Iu type names)\n%10s %12s %12s\n", numNames, L"filters", L"wcsncmp ns", L"compiled ns");
+	LOG(L"Filter matching (%Iu type names)\n", numNames);
+
+	//prefix filters, the only kind the wcsncmp loop had: a namespace, and a class (the full name) on every other one
+	const size_t filterCounts[] = { 1, 8, 32 };
+	for (auto countIt = std::begin(filterCounts); countIt != std::end(filterCounts); ++countIt)
+	{
+		vector<std::wstring> namespaceFilters, classFilters;
+		for (size_t filter = 0; filter < *countIt; filter++)
+		{
+			swprintf_s(name, L"Company.Area%Iu.", filter % 16);
+			namespaceFilters.push_back(name);
+			swprintf_s(name, L"Company.Area%Iu.Sub%Iu.%s", filter % 16, filter % 8, kinds[filter % 3]);
+			classFilters.push_back(filter % 2 ? name : L"");
+		}
+
+		PatternSet namespaces, classes;
+		std::wstring error;
+		for (size_t filter = 0; filter < *countIt; filter++)
+		{
+			namespaces.Add(namespaceFilters[filter].c_str(), error);
+			classes.Add(classFilters[filter].c_str(), error);
+		}
+
+		//as the search did before the patterns were compiled: both prefixes against the full name, per filter
+		size_t loopMatches = 0;
+		auto start = Now();
+		for (int pass = 0; pass < passes; pass++)
+		{
+			for (auto nameIt = names.begin(); nameIt != names.end(); ++nameIt)
+			{
+				auto className = nameIt->c_str();
+				for (size_t filter = 0; filter < *countIt; filter++)
+				{
+					auto classFilterName = classFilters[filter].empty() ? nullptr : classFilters[filter].c_str();
+					auto namespaceFilterName = namespaceFilters[filter].c_str();
+					if (((classFilterName == nullptr) || (wcsncmp(className, classFilterName, wcslen(classFilterName)) == 0))
+						&& ((namespaceFilterName == nullptr) || (wcsncmp(className, namespaceFilterName, wcslen(namespaceFilterName)) == 0))) loopMatches++;
+				}
+			}
+		}
+		auto loopEnd = Now();
+
+		//as ScanType does now
+		size_t compiledMatches = 0;
+		vector<bool> namespaceMatches, nameMatches;
+		std::wstring namespaceName;
+		for (int pass = 0; pass < passes; pass++)
+		{
+			for (auto nameIt = names.begin(); nameIt != names.end(); ++nameIt)
+			{
+				auto className = nameIt->c_str();
+				auto namespaceEnd = wcsrchr(className, L'.');
+				namespaceName.assign(className, namespaceEnd ? namespaceEnd - className : 0);
+				namespaces.Classify(namespaceName.c_str(), namespaceMatches, L'.');
+				classes.Classify(className, nameMatches);
+				for (size_t filter = 0; filter < *countIt; filter++)
+				{
+					if (namespaceMatches[filter] && nameMatches[filter]) compiledMatches++;
+				}
+			}
+		}
+		auto compiledEnd = Now();
+
+		auto loopNs = NsPer(start, loopEnd, numNames * passes);
+		auto compiledNs = NsPer(loopEnd, compiledEnd, numNames * passes);
+		wprintf_s(L"%10Iu %12.1f %12.1f%s\n", *countIt, loopNs, compiledNs, loopMatches == compiledMatches ? L"" : L"  MISMATCH");
+		LOG(L"%Iu prefix filters: wcsncmp %.1f ns/name, compiled %.1f ns/name, %Iu/%Iu matches%s\n", *countIt, loopNs, compiledNs, loopMatches / passes, compiledMatches / passes,
+			loopMatches == compiledMatches ? L"" : L" MISMATCH");
+	}
+
+	//globs, a regex and exclusions, which the wcsncmp loop can't express
+	const wchar_t *classPatterns[] = { L"*Repository1?", L"*.Order*,!*7", L"/Sub[0-3]\\.Invoice/", L"Company.Area1.,!Company.Area1.Sub1.", L"*Customer*", L"", L"!*Repository5*", L"Company.*.Sub2.*" };
+	PatternSet mixed;
+	std::wstring error;
+	for (auto patternIt = std::begin(classPatterns); patternIt != std::end(classPatterns); ++patternIt) mixed.Add(*patternIt, error);
+
+	size_t mixedMatches = 0;
+	vector<bool> matches;
+	auto start = Now();
+	for (int pass = 0; pass < passes; pass++)
+	{
+		for (auto nameIt = names.begin(); nameIt != names.end(); ++nameIt)
+		{
+			mixed.Classify(nameIt->c_str(), matches);
+			mixedMatches += std::count(matches.begin(), matches.end(), true);
+		}
+	}
+	auto mixedNs = NsPer(start, Now(), numNames * passes);
+	wprintf_s(L"%10s %12s %12.1f\n", L"8 mixed", L"-", mixedNs);
+	LOG(L"8 glob/regex/exclusion filters: compiled %.1f ns/name, %Iu matches\n", mixedNs, mixedMatches / passes);
+}
+
+void Benchmarks::LazyNaming()
+{
+	const ULONG numModules = 8;
+	const ULONG numTypes = 2000;
+	const ULONG methodsPerType = 20;
+	const ULONG page = 256;
+
+	vector<ComPtr<IMetaDataImport2>> scopes;
+	if (!EmitScopes(L"Discovery naming", L"L", numModules, numTypes, 100, methodsPerType, 4, scopes)) return;
+
+	//both passes look for the getters (half the methods)
+	vector<MethodFilter> filters(1);
+	filters[0].namespaceFilter = L"Bench.";
+	filters[0].methodFilter = L"Get";
+	auto peakBefore = PeakWorkingSetMB();
+
+	//lazy first, the peak working set only goes up: the search now, only the methods found are formatted
+	auto debugger = unique_ptr<Debugger>(new Debugger(OPMODE_NONE));
+	vector<shared_ptr<MethodInfo>> found;
+	auto lazyStart = Now();
+	debugger->SearchScopes(filters, scopes, false, found);
+	auto lazyEnd = Now();
+	auto lazyPeak = PeakWorkingSetMB();
+	auto numFound = found.size();
+	found.clear();
+	debugger.reset();
+
+	//as discovery did before names were formatted lazily: every type name and every method signature formatted and copied into
+	//the name cache, whether or not the filters want the type, then the same filter applied
+	//(it doesn't build method infos for the methods it matches, the search above does)
+	FilterPatterns patterns;
+	std::wstring error;
+	patterns.namespaces.Add(filters[0].namespaceFilter, error);
+	patterns.classes.Add(filters[0].classFilter, error);
+	patterns.methods.Add(filters[0].methodFilter, error);
+
+	auto eagerStart = Now();
+	vector<map<mdToken, shared_ptr<wchar_t>>> tokenCaches(scopes.size());
+	size_t numNames = 0;
+	size_t numMatched = 0;
+	vector<mdTypeDef> types(page);
+	vector<mdMethodDef> methods(page);
+	vector<bool> namespaceMatches, nameMatches;
+	std::wstring namespaceName;
+	wchar_t className[1024];
+	wchar_t methodName[1024];
+	for (size_t module = 0; module < scopes.size(); module++)
+	{
+		auto modMeta = scopes[module].Get();
+		auto &tokenCache = tokenCaches[module];
+
+		ULONG numTypesRead;
+		HCORENUM typeEnum = nullptr;
+		while ((modMeta->EnumTypeDefs(&typeEnum, types.data(), (ULONG)types.size(), &numTypesRead) == S_OK) && numTypesRead)
+		{
+			for (ULONG typeIt = 0; typeIt < numTypesRead; typeIt++)
+			{
+				ULONG classNameLen;
+				DWORD typeDefFlags;
+				mdToken baseType;
+				if (modMeta->GetTypeDefProps(types[typeIt], className, _countof(className), &classNameLen, &typeDefFlags, &baseType) != S_OK) continue;
+
+				auto nameCopy = new wchar_t[classNameLen + 1];
+				VERIFY(wcscpy_s(nameCopy, classNameLen + 1, className) == 0);
+				tokenCache[types[typeIt]] = shared_ptr<wchar_t>(nameCopy, std::default_delete<wchar_t[]>());
+				numNames++;
+
+				auto namespaceEnd = wcsrchr(className, L'.');
+				namespaceName.assign(className, namespaceEnd ? namespaceEnd - className : 0);
+				patterns.namespaces.Classify(namespaceName.c_str(), namespaceMatches, L'.');
+				patterns.classes.Classify(className, nameMatches);
+				auto typeMatches = namespaceMatches[0] && nameMatches[0];
+
+				ULONG numMethods;
+				HCORENUM methodEnum = nullptr;
+				while ((modMeta->EnumMethods(&methodEnum, types[typeIt], methods.data(), (ULONG)methods.size(), &numMethods) == S_OK) && numMethods)
+				{
+					for (ULONG methodIt = 0; methodIt < numMethods; methodIt++)
+					{
+						mdTypeDef mdClass;
+						ULONG methodNameLen;
+						DWORD methodAttrFlags;
+						PCCOR_SIGNATURE methodSig;
+						ULONG methodSigSize;
+						ULONG methodRVA;
+						DWORD methodImplFlags;
+						if (modMeta->GetMethodProps(methods[methodIt], &mdClass, methodName, _countof(methodName), &methodNameLen, &methodAttrFlags, &methodSig, &methodSigSize, &methodRVA, &methodImplFlags) != S_OK) continue;
+
+						auto mSigP = unique_ptr<SigParser>(new SigParser(className, methodSig, methodSigSize, methodName, modMeta, methods[methodIt], methodImplFlags, methodAttrFlags));
+						auto namebufsize = wcslen(mSigP->Signature()) + 1;
+						auto methodNameCopy = new wchar_t[namebufsize];
+						VERIFY(wcscpy_s(methodNameCopy, namebufsize, mSigP->Signature()) == 0);
+						tokenCache[methods[methodIt]] = shared_ptr<wchar_t>(methodNameCopy, std::default_delete<wchar_t[]>());
+						numNames++;
+
+						if (!typeMatches) continue;
+						patterns.methods.Classify(methodName, nameMatches);
+						if (nameMatches[0]) numMatched++;
+					}
+				}
+				modMeta->CloseEnum(methodEnum);
+			}
+		}
+		modMeta->CloseEnum(typeEnum);
+	}
+	auto eagerEnd = Now();
+	auto eagerPeak = PeakWorkingSetMB();
+	tokenCaches.clear();
+
+	auto lazyMs = NsPer(lazyStart, lazyEnd, 1) / 1e6;
+	auto eagerMs = NsPer(eagerStart, eagerEnd, 1) / 1e6;
+	wprintf_s(L"\nDiscovery naming (%u modules, %u methods, the getters found, serial; peak working set %.1f MB before)\n%10s %12s %12s %12s %10s\n%10s %12.1f %12.1f %12Iu %10Iu\n%10s %12.1f %12.1f %12Iu %10Iu%s\n",
+		numModules, numModules * numTypes * methodsPerType, peakBefore, L"", L"ms", L"peak MB", L"names", L"found",
+		L"eager", eagerMs, eagerPeak, numNames, numMatched, L"lazy", lazyMs, lazyPeak, numFound, numFound, numFound == numMatched ? L"" : L"  MISMATCH");
+	LOG(L"Discovery naming (%u modules, %u methods, same filter): eager %.1f ms, peak %.1f MB, %Iu names formatted, %Iu matched; lazy %.1f ms, peak %.1f MB, %Iu found (peak before %.1f MB)\n",
+		numModules, numModules * numTypes * methodsPerType, eagerMs, eagerPeak, numNames, numMatched, lazyMs, lazyPeak, numFound, peakBefore);
+}
+
+void Benchmarks::PastCaps()
+{
+	//the caps discovery had: 20480 types per module, 12800 methods per type, 500 fields per type
+	const ULONG numTypes = 25000;
+	const ULONG methodsPerType = 40;
+	const ULONG bigMethods = 13000;
+	const ULONG bigFields = 600;
+
+	vector<ComPtr<IMetaDataImport2>> scopes;
+	if (!EmitScopes(L"Past the caps", L"Caps", 1, numTypes, 1000, methodsPerType, 0, scopes)) return;
+
+	//and one type with more methods and fields than the caps
+	ComPtr<IMetaDataEmit> emit;
+	auto hr = scopes[0]->QueryInterface(IID_IMetaDataEmit, &emit);
+	if (hr == S_OK) hr = EmitType(emit.Get(), L"Bench.Big.Type", bigMethods, bigFields);
+	if (hr != S_OK)
+	{
+		wprintf_s(L"\nPast the caps: emitting the big type failed (0x%08x)\n", hr);
+		LOG(L"Past the caps: emitting the big type failed (0x%08x)\n", hr);
+		return;
+	}
+
+	//Get38 is the one method of each type named so (Get380 etc. don't exist), every method of the big type, dumping its last field
+	auto debugger = unique_ptr<Debugger>(new Debugger(OPMODE_FIELDS));
+	vector<MethodFilter> filters(2);
+	filters[0].namespaceFilter = L"Bench.Caps0.";
+	filters[0].methodFilter = L"Get38";
+	filters[1].classFilter = L"Bench.Big.Type";
+	filters[1].fields.push_back(L"field599");
+	vector<shared_ptr<MethodInfo>> found;
+
+	auto start = Now();
+	debugger->SearchScopes(filters, scopes, false, found);
+	auto end = Now();
+	auto peak = PeakWorkingSetMB();
+
+	size_t numDumping = 0;
+	for (auto methodIt = filters[1].matched.begin(); methodIt != filters[1].matched.end(); ++methodIt)
+	{
+		if ((*methodIt)->fieldsToReadOnBP.size() == 1) numDumping++;
+	}
+
+	auto complete = (filters[0].matched.size() == numTypes) && (filters[1].matched.size() == bigMethods) && (numDumping == bigMethods);
+	auto searchMs = NsPer(start, end, 1) / 1e6;
+	wprintf_s(L"\nPast the caps (%u types, %u methods, a type with %u methods and %u fields) in %.1f ms, peak working set %.1f MB\n  types found %Iu/%u, methods of the big type %Iu/%u, dumping field599 %Iu/%u: %s\n",
+		numTypes + 1, numTypes * methodsPerType + bigMethods, bigMethods, bigFields, searchMs, peak,
+		filters[0].matched.size(), numTypes, filters[1].matched.size(), bigMethods, numDumping, bigMethods, complete ? L"all found" : L"MISSING");
+	LOG(L"Past the caps (%u types, %u methods, a type with %u methods and %u fields): %.1f ms, peak %.1f MB, types %Iu/%u, big type methods %Iu/%u, field599 %Iu/%u, %s\n",
+		numTypes + 1, numTypes * methodsPerType + bigMethods, bigMethods, bigFields, searchMs, peak,
+		filters[0].matched.size(), numTypes, filters[1].matched.size(), bigMethods, numDumping, bigMethods, complete ? L"all found" : L"MISSING");
+}
+
+void Benchmarks::ExceptionalExits()
+{
+	//ticks are microseconds, as in the folded file
+	const double timerFreq = 1000000.0;
+	const DWORD threadId = 1;
+	const wchar_t *names[] = { L"Bench.Outer()", L"Bench.Middle()", L"Bench.Thrower()" };
+
+	//entry and exit breakpoint of each method, its group is its index
+	vector<shared_ptr<MethodInfo>> methods;
+	vector<shared_ptr<BreakpointInfo>> bpSlots;
+	for (ULONG method = 0; method < 3; method++)
+	{
+		methods.push_back(shared_ptr<MethodInfo>(new MethodInfo(0, 0, 0, 0, nullptr, 0, 0, 0, 0, 0, names[method])));
+		for (auto exit = 0; exit < 2; exit++)
+		{
+			auto bpInfo = shared_ptr<BreakpointInfo>(new BreakpointInfo{});
+			bpInfo->method = methods.back();
+			bpInfo->ilOffset = exit ? 1 : 0;
+			bpInfo->CILInstruction = exit ? CEE_RET : CEE_NOP;
+			bpInfo->slot = (ULONG)bpSlots.size();
+			bpInfo->methodSlot = method;
+			bpSlots.push_back(bpInfo);
+		}
+	}
+
+	CallGraph callGraph;
+	callGraph.Reset(64);
+	TraceSettings settings;
+	settings.blockWhenBufferFull = true;
+
+	//Outer => Middle => Thrower returns, then Thrower throws and Outer catches: Thrower and Middle unwind
+	{
+		EventAggregator aggregator((OPMODE)(OPMODE_TIMINGS | OPMODE_CALLGRAPH), timerFreq, bpSlots, &callGraph, nullptr, nullptr, settings);
+		aggregator.Start();
+		aggregator.EmitBreakpoint(0, 0, threadId);
+		aggregator.EmitBreakpoint(100, 2, threadId);
+		aggregator.EmitBreakpoint(200, 4, threadId);
+		aggregator.EmitBreakpoint(300, 5, threadId);
+		aggregator.EmitBreakpoint(400, 4, threadId);
+		aggregator.EmitThrown(600, threadId, 2, RuleEngine::NoRule);
+		aggregator.EmitHandlerFound(650, threadId, 0, EventAggregator::UnwindToHandler);
+		aggregator.EmitException(700, TRACE_EVENT_EXCEPTION_UNWIND, threadId);
+		aggregator.EmitBreakpoint(1000, 1, threadId);
+		aggregator.Stop();
+	}
+
+	//the outermost call is the edge without a caller
+	double rootMicroSeconds = 0.0;
+	for (auto edgeIt = callGraph.Edges().begin(); edgeIt != callGraph.Edges().end(); ++edgeIt)
+	{
+		if (edgeIt->caller == CallGraph::NoCaller) rootMicroSeconds += edgeIt->totalTime * 1000000.0;
+	}
+
+	//add up the self times of the folded stacks, as a flame graph does
+	wchar_t tempPath[MAX_PATH];
+	wchar_t fileName[MAX_PATH];
+	ULONG64 foldedMicroSeconds = 0;
+	auto written = GetTempPathW(MAX_PATH, tempPath) && GetTempFileNameW(tempPath, L"fld", 0, fileName) && callGraph.WriteFolded(fileName) == S_OK;
+	if (written)
+	{
+		FILE *folded = nullptr;
+		if (_wfopen_s(&folded, fileName, L"rb") == 0)
+		{
+			char line[512];
+			while (fgets(line, sizeof(line), folded))
+			{
+				auto count = strrchr(line, ' ');
+				if (count) foldedMicroSeconds += _strtoui64(count + 1, nullptr, 10);
+			}
+			fclose(folded);
+		}
+		DeleteFileW(fileName);
+	}
+
+	//each of the stacks is rounded to a microsecond
+	auto difference = (double)foldedMicroSeconds - rootMicroSeconds;
+	auto match = written && difference < (double)callGraph.Contexts().size() && -difference < (double)callGraph.Contexts().size();
+	wprintf_s(L"\nCalls left through an exception: folded stacks %llu us, outermost call %.0f us: %s\n", foldedMicroSeconds, rootMicroSeconds, match ? L"match" : L"MISMATCH");
+	LOG(L"Calls left through an exception: folded stacks %llu us, outermost call %.0f us, %s\n", foldedMicroSeconds, rootMicroSeconds, match ? L"match" : L"MISMATCH");
+}
@@ -0,0 +1,29 @@
+#include <Windows.h>
+
+#pragma once
+
+//micro benchmarks of the debugger's hot paths on synthetic data, no target process needed (--bench)
+//each prints the time per operation of the current implementation next to the one it replaced
+class Benchmarks
+{
+public:
+	static void Run();
+private:
+	Benchmarks();
+
+	//breakpoint lookup on a hit: FlatIndex vs the std::map it replaced, at 1k/10k/100k breakpoints
+	static void BreakpointLookup();
+	//method search over 1 to 64 modules emitted in memory: the workers vs one module after the other
+	static void ParallelScan();
+	//type names classified against the filters: compiled PatternSets vs a wcsncmp per filter, on 100k names
+	static void FilterMatching();
+	//discovery formatting every type and method signature up front, as it used to, vs the search formatting only what it finds
+	static void LazyNaming();
+	//a search through more types, methods and fields than discovery's old fixed arrays held, 1M methods: is everything found
+	static void PastCaps();
+	//a traced call left through an exception: do the folded stacks still add up to the time of the outermost call
+	static void ExceptionalExits();
+
+	static LONGLONG Now();
+	static double NsPer(LONGLONG start, LONGLONG end, size_t ops);
+};
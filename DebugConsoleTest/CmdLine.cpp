@@ -1,5 +1,6 @@
 #include "..\Shared\tracing.h"
 #include "CmdLine.h"
+#include "SessionController.h"
 
 #include "..\Shared\stdstringsplit.h"
 
@@ -13,17 +14,38 @@ CmdLine::CmdLine(int argc, wchar_t * argv[]) : parseSuccess(E_FAIL)
 		("help,h", "print help messages")
 		("processes,p", "print available .NET processes")
 		("runtimes,r", "print installed .NET runtime (CLR) versions")
+		("bench", "run the micro benchmarks of the tracing hot paths on synthetic data, no process needed (results also go to the output file)")
 		("attach,a", po::value<int>(), "Attach to process with specified pId")
 		("outfile,o", po::value<std::string>(), "output file (default: tracer.log)")
+		("plan", po::value<std::string>(), "instrumentation plan file: saved after the breakpoints are set, a later attach to the same build with the same filters skips the method search")
 		("mtiming", "mode of operation: timing")
 		("mstats", "mode of operation: deep statistics")
-		("fn", po::value<std::string>(), "filter namespace")
+		("mcallgraph", "mode of operation: timing, with call counts and times per caller => callee")
+		("fn", po::value<std::string>(), "filter namespace (filters are a prefix, a glob like *Repository, a regex like /^Get/, comma separated, !term excludes)")
 		("fc", po::value<std::string>(), "filter fully qualified classname")
 		("fm", po::value<std::string>(), "filter method")
+		("fa", po::value<std::string>(), "filter assembly name, e.g. MyCompany.* (other assemblies aren't searched at all)")
 		("df", po::value<std::string>(), "fields to dump - comma seperated")
+		("when", po::value<std::string>(), "dump fields only when this holds, e.g. \"id == 42 && name contains 'x'\" (arguments by name or argN, fields of the class)")
 		("pSQL", "preset filter: SQL trace (overrides commandline filters)")
 		("pAD", "preset filter: AD trace (overrides commandline filters)")
 		("config", po::value<std::string>(), "use config file for settings")
+		("buffer", po::value<unsigned int>(), "event buffer size in events (default: 65536)")
+		("block", "stall the target when the event buffer is full (default: drop events)")
+		("sample", po::value<unsigned int>(), "sampling: deactivate a method's breakpoints after this many hits per window")
+		("window", po::value<unsigned int>(), "sampling window in ms (default: 1000)")
+		("budget", po::value<double>(), "overhead budget in % of wall time, the methods suspending the target most are deactivated to stay under it")
+		("maxpause", po::value<unsigned int>(), "longest the target is stopped at a time while setting/activating breakpoints in ms (default: 100)")
+		("hitcost", po::value<double>(), "estimated debugger round trip per breakpoint hit in us, for the overhead budget (default: 50)")
+		("duration", po::value<unsigned int>(), "stop tracing after this many seconds")
+		("max-hits", po::value<unsigned long long>(), "stop tracing after this many breakpoint hits")
+		("until-time", po::value<std::string>(), "stop tracing at this local time (HH:MM or HH:MM:SS)")
+		("snapshot", po::value<unsigned int>(), "report the busiest methods every this many seconds while tracing")
+		("interval", po::value<unsigned int>(), "timeline interval in ms, 0 = totals only (default: 1000)")
+		("timelinekb", po::value<unsigned int>(), "memory for the timeline in KB, intervals get merged when it's full (default: 8192)")
+		("edges", po::value<unsigned int>(), "call graph: maximum number of distinct caller => callee edges and stacks (default: 65536)")
+		("threads", po::value<std::string>(), "trace only these threads - comma seperated OS thread ids, #managed ids or names (Worker* for a prefix)")
+		("skip-threads", po::value<std::string>(), "don't trace these threads - same format as --threads")
 #ifdef _DEBUG
 		("pTEST", "preset filter: Unit Test")
 #endif
@@ -39,9 +61,17 @@ void CmdLine::PrintOptions()
 	printOptions;
 	std::cout << std::endl << "Example usage:" << std::endl;
 	std::cout << "-dump .NET processes\n\t -p" << std::endl;
+	std::cout << "-measure the tracing hot paths on this machine\n\t --bench" << std::endl;
 	std::cout << "-find and dump all ToString* methods in process with Id 1001\n\t -a 1001 --fm ToString" << std::endl;
 	std::cout << "-select preset SQL trace filter and attach to process 1001\n\t -a 1001 --pSQL" << std::endl;
 	std::cout << "-find and time all methods in namespace RuurdKeizer.* in process with Id 1001\n\t -a 1001 --fn RuurdKeizer. --mtiming" << std::endl;
+	std::cout << "-time all methods in namespace RuurdKeizer.*, but trace at most 100 calls per method per second\n\t -a 1001 --fn RuurdKeizer. --mtiming --sample 100" << std::endl;
+	std::cout << "-time all methods in namespace RuurdKeizer.*, deactivating the hottest ones when the target is suspended more than 2% of the time\n\t -a 1001 --fn RuurdKeizer. --mtiming --budget 2" << std::endl;
+	std::cout << "-time all methods in namespace RuurdKeizer.* and show which instrumented callees they spend their time in\n\t -a 1001 --fn RuurdKeizer. --mcallgraph" << std::endl;
+	std::cout << "-time all methods in namespace RuurdKeizer.* for 10 minutes, with a snapshot every minute\n\t -a 1001 --fn RuurdKeizer. --mtiming --duration 600 --snapshot 60" << std::endl;
+	std::cout << "-time all methods of the *Repository classes in namespace RuurdKeizer.*, except the property getters\n\t -a 1001 --fn RuurdKeizer. --fc *Repository --fm !get_* --mtiming" << std::endl;
+	std::cout << "-time all methods in namespace RuurdKeizer.*, reusing the methods and breakpoints found by the previous attach to the same build\n\t -a 1001 --fn RuurdKeizer. --mtiming --plan tracer.plan" << std::endl;
+	std::cout << "-time all methods in namespace RuurdKeizer.*, searching only the RuurdKeizer assemblies\n\t -a 1001 --fa RuurdKeizer.* --fn RuurdKeizer. --mtiming" << std::endl;
 	std::cout << "-find RunExecuteReader* methods in process 1001, and dump _commandText\n\t -a 1001 --fm RunExecuteReader --df _commandText" << std::endl;
 }
 
@@ -98,6 +128,54 @@ void CmdLine::FillConfig()
 		wcscpy_s(retval->OutfileName, wcslen(coutf) + 1, coutf);
 	}
 
+	if (vm.count("plan"))
+	{
+		auto planfile = vm["plan"].as<std::string>();
+		std::wstring planw;
+		planw.assign(planfile.begin(), planfile.end());
+
+		retval->PlanFile = new wchar_t[planw.size() + 1];
+		wcscpy_s(retval->PlanFile, planw.size() + 1, planw.c_str());
+	}
+
+	if (vm.count("buffer")) retval->Settings.eventBufferSize = vm["buffer"].as<unsigned int>();
+	if (vm.count("block")) retval->Settings.blockWhenBufferFull = true;
+	if (vm.count("sample")) retval->Settings.sampleHits = vm["sample"].as<unsigned int>();
+	if (vm.count("window") && vm["window"].as<unsigned int>()) retval->Settings.sampleWindowMs = vm["window"].as<unsigned int>();
+	if (vm.count("budget")) retval->Settings.overheadBudget = vm["budget"].as<double>() / 100.0;
+	if (vm.count("hitcost")) retval->Settings.hitCostMicroSeconds = vm["hitcost"].as<double>();
+	if (vm.count("maxpause") && vm["maxpause"].as<unsigned int>()) retval->Settings.maxPauseMs = vm["maxpause"].as<unsigned int>();
+	if (vm.count("duration")) retval->Session.durationSeconds = vm["duration"].as<unsigned int>();
+	if (vm.count("max-hits")) retval->Session.maxHits = vm["max-hits"].as<unsigned long long>();
+	if (vm.count("snapshot")) retval->Session.snapshotSeconds = vm["snapshot"].as<unsigned int>();
+	if (vm.count("until-time"))
+	{
+		auto until = vm["until-time"].as<std::string>();
+		std::wstring untilw;
+		untilw.assign(until.begin(), until.end());
+
+		retval->Session.untilSet = SessionController::ParseTimeOfDay(untilw.c_str(), retval->Session.untilSecondOfDay);
+		if (!retval->Session.untilSet) std::cout << "Ignoring --until-time " << until << ", expected HH:MM or HH:MM:SS" << std::endl;
+	}
+
+	if (vm.count("interval")) retval->Settings.intervalMs = vm["interval"].as<unsigned int>();
+	if (vm.count("timelinekb") && vm["timelinekb"].as<unsigned int>()) retval->Settings.timelineKB = vm["timelinekb"].as<unsigned int>();
+	if (vm.count("edges") && vm["edges"].as<unsigned int>()) retval->Settings.maxCallEdges = vm["edges"].as<unsigned int>();
+	if (vm.count("threads"))
+	{
+		auto threads = vm["threads"].as<std::string>();
+		std::wstring threadsw;
+		threadsw.assign(threads.begin(), threads.end());
+		ParseThreadSelectors(threadsw.c_str(), false, retval->Threads);
+	}
+	if (vm.count("skip-threads"))
+	{
+		auto threads = vm["skip-threads"].as<std::string>();
+		std::wstring threadsw;
+		threadsw.assign(threads.begin(), threads.end());
+		ParseThreadSelectors(threadsw.c_str(), true, retval->Threads);
+	}
+
 	auto filter = new BPFilter{};
 
 	if (vm.count("fn"))
@@ -130,6 +208,16 @@ void CmdLine::FillConfig()
 		filter->methodFilter = new wchar_t[wcslen(wfm) + 1];
 		wcscpy_s(filter->methodFilter, wcslen(wfm) + 1, wfm);
 	}
+	if (vm.count("fa"))
+	{
+		auto fa = vm["fa"].as<std::string>();
+		std::wstring faw;
+		faw.assign(fa.begin(), fa.end());
+		auto wfa = faw.c_str();
+
+		filter->assemblyFilter = new wchar_t[wcslen(wfa) + 1];
+		wcscpy_s(filter->assemblyFilter, wcslen(wfa) + 1, wfa);
+	}
 
 	//parse fields to dump
 	if (vm.count("df"))
@@ -158,6 +246,18 @@ void CmdLine::FillConfig()
 		}
 	}
 
+	//condition for the field dump
+	if (vm.count("when"))
+	{
+		auto when = vm["when"].as<std::string>();
+		std::wstring whenw;
+		whenw.assign(when.begin(), when.end());
+		auto wwhen = whenw.c_str();
+
+		filter->predicate = new wchar_t[wcslen(wwhen) + 1];
+		wcscpy_s(filter->predicate, wcslen(wwhen) + 1, wwhen);
+	}
+
 	retval->Breakpoints.push_back(shared_ptr<BPFilter>(filter));
 
 	config = shared_ptr<Config>(retval);
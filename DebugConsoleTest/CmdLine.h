@@ -23,8 +23,9 @@ public:
 	OPMODE getOpMode() {
 		int op = OPMODE_NONE;
 		if (vm.count("mtiming")) op |= OPMODE_TIMINGS;
-		if (vm.count("df")) op |= OPMODE_FIELDS;
+		if (vm.count("df") || vm.count("when")) op |= OPMODE_FIELDS;
 		if (vm.count("mstats")) op |= OPMODE_STATS;
+		if (vm.count("mcallgraph")) op |= OPMODE_TIMINGS | OPMODE_CALLGRAPH;
 
 		return op;
 	};
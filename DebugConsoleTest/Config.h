@@ -2,6 +2,9 @@
 #include <memory>
 
 #include "..\Shared\DebugMode.h"
+#include "..\Shared\TraceSettings.h"
+#include "..\Shared\TraceRule.h"
+#include "..\Shared\ThreadSelector.h"
 
 #pragma once
 
@@ -13,13 +16,20 @@ struct BPFilter
 	wchar_t *namespaceFilter;
 	wchar_t *classFilter;
 	wchar_t *methodFilter;
+	wchar_t *assemblyFilter;	//assembly name (file name without extension), modules of other assemblies aren't searched
 	vector<const wchar_t*> fieldsToDump;
+	wchar_t *group;		//breakpoint group the methods belong to, for the trace rules
+	bool held;			//the group's breakpoints stay off until a rule activates them
+	wchar_t *predicate;	//fields are only dumped on the hits it holds for
 
 	~BPFilter()
 	{
+		if (predicate) delete[] predicate;
+		if (group) delete[] group;
 		if (namespaceFilter) delete[] namespaceFilter;
 		if (classFilter) delete[] classFilter;
 		if (methodFilter) delete[] methodFilter;
+		if (assemblyFilter) delete[] assemblyFilter;
 		for (auto fieldIt = fieldsToDump.begin(); fieldIt != fieldsToDump.end(); ++fieldIt)
 		{
 			delete[] *fieldIt;
@@ -27,15 +37,31 @@ struct BPFilter
 	}
 };
 
+//when a tracing session ends on its own, and how often it reports in between
+struct SessionLimits
+{
+	unsigned int durationSeconds;	//0 = until stopped
+	ULONGLONG maxHits;				//0 = no limit
+	bool untilSet;
+	unsigned int untilSecondOfDay;	//local time
+	unsigned int snapshotSeconds;	//0 = report at the end only
+};
+
 struct Config
 {
 	vector<shared_ptr<BPFilter>> Breakpoints;
 	OPMODE OperatingMode;
 	wchar_t* OutfileName;
+	wchar_t* PlanFile;		//instrumentation plan, reused by the next attach to the same build
+	TraceSettings Settings;
+	SessionLimits Session;
+	vector<TraceRule> Rules;
+	vector<ThreadSelector> Threads;
 
 	~Config()
 	{
 		if (OutfileName) delete[] OutfileName;
+		if (PlanFile) delete[] PlanFile;
 	}
 };
 
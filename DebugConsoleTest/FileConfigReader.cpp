@@ -1,7 +1,21 @@
 #include "FileConfigReader.h"
+#include "SessionController.h"
 #include "..\Shared\tracing.h"
 
 
+//comma separated names, empty ones are skipped
+static void SplitNames(const wchar_t *value, vector<std::wstring> &names)
+{
+	std::wstring list(value);
+	for (size_t start = 0; start <= list.size();)
+	{
+		auto end = list.find(L',', start);
+		if (end == std::wstring::npos) end = list.size();
+		if (end > start) names.push_back(list.substr(start, end - start));
+		start = end + 1;
+	}
+}
+
 FileConfigReader::FileConfigReader(const wchar_t *fileName) : config(nullptr)
 {
 	ParseConfig(fileName);
@@ -63,12 +77,55 @@ bool FileConfigReader::ParseConfig(const wchar_t *fileName)
 							{
 								if ((wcscmp(L"timings", localAttrName) == 0) && (wcscmp(L"1", localAttrValue) == 0)) mode |= OPMODE_TIMINGS;
 								if ((wcscmp(L"stats", localAttrName) == 0) && (wcscmp(L"1", localAttrValue) == 0)) mode |= OPMODE_STATS;
+								if ((wcscmp(L"callgraph", localAttrName) == 0) && (wcscmp(L"1", localAttrValue) == 0)) mode |= OPMODE_TIMINGS | OPMODE_CALLGRAPH;
 								if (wcscmp(L"outputfile", localAttrName) == 0)
 								{
 									auto outfile = new wchar_t[localAttrValueLen + 1];
 									wcscpy_s(outfile, localAttrValueLen + 1, localAttrValue);
 									newConfig->OutfileName = outfile;
 								}
+								if (wcscmp(L"plan", localAttrName) == 0)
+								{
+									auto planfile = new wchar_t[localAttrValueLen + 1];
+									wcscpy_s(planfile, localAttrValueLen + 1, localAttrValue);
+									newConfig->PlanFile = planfile;
+								}
+								if (wcscmp(L"buffer", localAttrName) == 0)
+								{
+									auto bufferSize = wcstoul(localAttrValue, nullptr, 10);
+									if (bufferSize) newConfig->Settings.eventBufferSize = bufferSize;
+								}
+								if (wcscmp(L"sample", localAttrName) == 0) newConfig->Settings.sampleHits = wcstoul(localAttrValue, nullptr, 10);
+								if (wcscmp(L"window", localAttrName) == 0)
+								{
+									auto window = wcstoul(localAttrValue, nullptr, 10);
+									if (window) newConfig->Settings.sampleWindowMs = window;
+								}
+								if (wcscmp(L"budget", localAttrName) == 0) newConfig->Settings.overheadBudget = wcstod(localAttrValue, nullptr) / 100.0;
+								if (wcscmp(L"hitcost", localAttrName) == 0) newConfig->Settings.hitCostMicroSeconds = wcstod(localAttrValue, nullptr);
+								if (wcscmp(L"maxpause", localAttrName) == 0)
+								{
+									auto maxPause = wcstoul(localAttrValue, nullptr, 10);
+									if (maxPause) newConfig->Settings.maxPauseMs = maxPause;
+								}
+								if (wcscmp(L"duration", localAttrName) == 0) newConfig->Session.durationSeconds = wcstoul(localAttrValue, nullptr, 10);
+								if (wcscmp(L"maxhits", localAttrName) == 0) newConfig->Session.maxHits = _wcstoui64(localAttrValue, nullptr, 10);
+								if (wcscmp(L"until", localAttrName) == 0) newConfig->Session.untilSet = SessionController::ParseTimeOfDay(localAttrValue, newConfig->Session.untilSecondOfDay);
+								if (wcscmp(L"snapshot", localAttrName) == 0) newConfig->Session.snapshotSeconds = wcstoul(localAttrValue, nullptr, 10);
+								if (wcscmp(L"interval", localAttrName) == 0) newConfig->Settings.intervalMs = wcstoul(localAttrValue, nullptr, 10);
+								if (wcscmp(L"timelinekb", localAttrName) == 0)
+								{
+									auto timelineKB = wcstoul(localAttrValue, nullptr, 10);
+									if (timelineKB) newConfig->Settings.timelineKB = timelineKB;
+								}
+								if (wcscmp(L"edges", localAttrName) == 0)
+								{
+									auto maxEdges = wcstoul(localAttrValue, nullptr, 10);
+									if (maxEdges) newConfig->Settings.maxCallEdges = maxEdges;
+								}
+								if (wcscmp(L"threads", localAttrName) == 0) ParseThreadSelectors(localAttrValue, false, newConfig->Threads);
+								if (wcscmp(L"skipthreads", localAttrName) == 0) ParseThreadSelectors(localAttrValue, true, newConfig->Threads);
+								if (wcscmp(L"overflow", localAttrName) == 0) newConfig->Settings.blockWhenBufferFull = (wcscmp(L"block", localAttrValue) == 0);
 							}
 						} while (xmlReader->MoveToNextAttribute() == S_OK);
 					}
@@ -107,6 +164,28 @@ bool FileConfigReader::ParseConfig(const wchar_t *fileName)
 									wcscpy_s(methodFilt, localAttrValueLen + 1, localAttrValue);
 									newFilter->methodFilter = methodFilt;
 								}
+								if (wcscmp(L"assembly", localAttrName) == 0)
+								{
+									auto assemblyFilt = new wchar_t[localAttrValueLen + 1];
+									wcscpy_s(assemblyFilt, localAttrValueLen + 1, localAttrValue);
+									newFilter->assemblyFilter = assemblyFilt;
+								}
+								if (wcscmp(L"group", localAttrName) == 0)
+								{
+									auto groupName = new wchar_t[localAttrValueLen + 1];
+									wcscpy_s(groupName, localAttrValueLen + 1, localAttrValue);
+									newFilter->group = groupName;
+								}
+								if (wcscmp(L"armed", localAttrName) == 0) newFilter->held = (wcscmp(L"0", localAttrValue) == 0);
+								if (wcscmp(L"when", localAttrName) == 0)
+								{
+									auto predicate = new wchar_t[localAttrValueLen + 1];
+									wcscpy_s(predicate, localAttrValueLen + 1, localAttrValue);
+									newFilter->predicate = predicate;
+
+									//a predicate gates the field dump, it implies field mode
+									anyFilterWithFields = true;
+								}
 								if (wcscmp(L"fields", localAttrName) == 0) 
 								{	
 									auto wstr = std::wstring(localAttrValue);
@@ -143,6 +222,54 @@ bool FileConfigReader::ParseConfig(const wchar_t *fileName)
 					}
 				}
 
+				else if ((wcscmp(L"Rule", localName) == 0) && (depth == 2))
+				{
+					//found rule element, conditions and actions are attributes
+					TraceRule newRule;
+
+					UINT numAttributes = 0;
+					if ((xmlReader->GetAttributeCount(&numAttributes) == S_OK) && numAttributes && (xmlReader->MoveToFirstAttribute() == S_OK))
+					{
+						const wchar_t *localAttrName;
+						const wchar_t *localAttrValue;
+						UINT localAttrNameLen;
+						UINT localAttrValueLen;
+						do
+						{
+							if ((xmlReader->GetQualifiedName(&localAttrName, &localAttrNameLen) == S_OK) && (xmlReader->GetValue(&localAttrValue, &localAttrValueLen) == S_OK))
+							{
+								if (wcscmp(L"name", localAttrName) == 0) newRule.name = localAttrValue;
+								if (wcscmp(L"method", localAttrName) == 0) newRule.method = localAttrValue;
+								if (wcscmp(L"caller", localAttrName) == 0) newRule.caller = localAttrValue;
+								if (wcscmp(L"exception", localAttrName) == 0) newRule.exception = localAttrValue;
+								if (wcscmp(L"latency", localAttrName) == 0) newRule.latencyMs = wcstod(localAttrValue, nullptr);
+								if (wcscmp(L"hits", localAttrName) == 0)
+								{
+									auto hits = wcstoul(localAttrValue, nullptr, 10);
+									if (hits) newRule.hits = hits;
+								}
+								if (wcscmp(L"repeat", localAttrName) == 0) newRule.repeat = (wcscmp(L"1", localAttrValue) == 0);
+								if (wcscmp(L"activate", localAttrName) == 0) SplitNames(localAttrValue, newRule.activate);
+								if (wcscmp(L"deactivate", localAttrName) == 0) SplitNames(localAttrValue, newRule.deactivate);
+								if (wcscmp(L"heap", localAttrName) == 0) newRule.heapHistogram = (wcscmp(L"1", localAttrValue) == 0);
+								if (wcscmp(L"stack", localAttrName) == 0) newRule.captureStack = (wcscmp(L"1", localAttrValue) == 0);
+								if (wcscmp(L"stop", localAttrName) == 0) newRule.stopSession = (wcscmp(L"1", localAttrValue) == 0);
+							}
+						} while (xmlReader->MoveToNextAttribute() == S_OK);
+					}
+
+					//a rule needs something to trigger on
+					if (newRule.method.empty() && newRule.exception.empty())
+					{
+						TRACE(L"Rule without method or exception, skipped\n");
+					}
+					else
+					{
+						if (newRule.name.empty()) newRule.name = L"#" + std::to_wstring(newConfig->Rules.size() + 1);
+						newConfig->Rules.push_back(newRule);
+					}
+				}
+
 				if (xmlReader->IsEmptyElement()) depth--;
 
 				break;
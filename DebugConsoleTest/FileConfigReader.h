@@ -21,6 +21,6 @@ public:
 private:
 	bool ParseConfig(const wchar_t * fileName);
 	shared_ptr<Config> config;
-	const wchar_t* helpString = L"<Config timings=\"1\" stats=\"0\" outputfile=\"output.log\">\n\t<Filter namespace=\"System\" class=\"System.Object\" method=\"ToString\" fields=\"field1,field2\" />\n</Config>";
+	const wchar_t* helpString = L"<Config timings=\"1\" stats=\"0\" callgraph=\"0\" outputfile=\"output.log\" plan=\"tracer.plan\" buffer=\"65536\" overflow=\"drop|block\" sample=\"0\" window=\"1000\" budget=\"2\" hitcost=\"50\" maxpause=\"100\" edges=\"65536\" interval=\"1000\" timelinekb=\"8192\" duration=\"600\" maxhits=\"0\" until=\"14:30\" snapshot=\"60\" threads=\"1234,#12,Worker*\" skipthreads=\"Timer\">\n\t<Filter assembly=\"mscorlib\" namespace=\"System\" class=\"System.Object\" method=\"ToString,/^Get/,!get_*\" fields=\"field1,field2\" when=\"_id == 42 &amp;&amp; name contains 'x'\" group=\"objects\" armed=\"1\" />\n\t<Rule name=\"slow\" method=\"System.Object::ToString\" caller=\"\" exception=\"\" latency=\"100\" hits=\"1\" repeat=\"0\" activate=\"group1,group2\" deactivate=\"\" heap=\"0\" stack=\"1\" stop=\"0\" />\n</Config>";
 };
 
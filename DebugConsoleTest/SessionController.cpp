@@ -0,0 +1,185 @@
+#include "SessionController.h"
+#include "..\Shared\tracing.h"
+
+HANDLE SessionController::stopEvent = nullptr;
+HANDLE SessionController::doneEvent = nullptr;
+
+SessionController::SessionController(const SessionLimits &limits, unsigned int maintainMs) : limits(limits), maintainMs(maintainMs), wakeEvent(nullptr)
+{
+	stopEvent = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+	doneEvent = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+	VERIFY(SetConsoleCtrlHandler(CtrlHandler, TRUE));
+}
+
+SessionController::~SessionController()
+{
+	SetEvent(doneEvent);
+	VERIFY(SetConsoleCtrlHandler(CtrlHandler, FALSE));
+
+	CloseHandle(stopEvent);
+	CloseHandle(doneEvent);
+	stopEvent = nullptr;
+	doneEvent = nullptr;
+}
+
+BOOL WINAPI SessionController::CtrlHandler(DWORD ctrlType)
+{
+	if (!stopEvent) return FALSE;
+
+	SetEvent(stopEvent);
+
+	switch (ctrlType)
+	{
+	case CTRL_C_EVENT:
+	case CTRL_BREAK_EVENT:
+		return TRUE;
+	default:
+		//the process ends when we return, hold on until the breakpoints are gone and the debugger detached
+		WaitForSingleObject(doneEvent, INFINITE);
+		return TRUE;
+	}
+}
+
+const wchar_t *SessionController::Describe(SessionEnd end)
+{
+	switch (end)
+	{
+	case SESSION_END_KEY: return L"key pressed";
+	case SESSION_END_CTRL: return L"interrupted";
+	case SESSION_END_DURATION: return L"duration reached";
+	case SESSION_END_MAX_HITS: return L"hit limit reached";
+	case SESSION_END_UNTIL_TIME: return L"end time reached";
+	case SESSION_END_RULE: return L"stopped by a rule";
+	default: return L"?";
+	}
+}
+
+bool SessionController::ParseTimeOfDay(const wchar_t *time, unsigned int &secondOfDay)
+{
+	unsigned int hours = 0, minutes = 0, seconds = 0;
+	auto fields = swscanf_s(time, L"%u:%u:%u", &hours, &minutes, &seconds);
+	if (fields < 2 || hours > 23 || minutes > 59 || seconds > 59) return false;
+
+	secondOfDay = hours * 3600 + minutes * 60 + seconds;
+	return true;
+}
+
+void SessionController::WakeOn(HANDLE event, function<bool()> handler)
+{
+	wakeEvent = event;
+	wake = handler;
+}
+
+//consumes the pending console input, true if a key went down (focus and mouse events are ignored)
+bool SessionController::KeyPressed(HANDLE input)
+{
+	INPUT_RECORD records[16];
+	DWORD pending = 0;
+	while (GetNumberOfConsoleInputEvents(input, &pending) && pending)
+	{
+		DWORD read = 0;
+		if (!ReadConsoleInput(input, records, 16, &read)) return false;
+
+		for (DWORD record = 0; record < read; record++)
+		{
+			if (records[record].EventType == KEY_EVENT && records[record].Event.KeyEvent.bKeyDown) return true;
+		}
+	}
+	return false;
+}
+
+SessionEnd SessionController::Run(function<void()> maintain, function<ULONGLONG()> totalHits, function<void(double)> snapshot)
+{
+	const DWORD hitCheckMs = 250;
+	const ULONGLONG never = (ULONGLONG)-1;
+
+	auto start = GetTickCount64();
+
+	//stop time, the earlier of duration and time of day
+	ULONGLONG deadline = 0;
+	auto deadlineEnd = SESSION_END_DURATION;
+	if (limits.durationSeconds) deadline = start + (ULONGLONG)limits.durationSeconds * 1000;
+	if (limits.untilSet)
+	{
+		SYSTEMTIME now;
+		GetLocalTime(&now);
+
+		//already past it today means tomorrow
+		auto nowSecond = (unsigned int)(now.wHour * 3600 + now.wMinute * 60 + now.wSecond);
+		auto untilMs = (ULONGLONG)(limits.untilSecondOfDay > nowSecond ? limits.untilSecondOfDay - nowSecond : limits.untilSecondOfDay + 86400 - nowSecond) * 1000 - now.wMilliseconds;
+		if (!deadline || start + untilMs < deadline)
+		{
+			deadline = start + untilMs;
+			deadlineEnd = SESSION_END_UNTIL_TIME;
+		}
+	}
+
+	//key presses only count with a console as input, not when redirected
+	auto input = GetStdHandle(STD_INPUT_HANDLE);
+	DWORD inputMode = 0;
+	auto keys = input != INVALID_HANDLE_VALUE && GetConsoleMode(input, &inputMode);
+	if (keys) FlushConsoleInputBuffer(input);
+
+	//the stop event first, a stop wins when more is signaled at once
+	HANDLE waitFor[3] = { stopEvent };
+	DWORD numWaitFor = 1;
+	auto wakeAt = numWaitFor;
+	if (wakeEvent) waitFor[numWaitFor++] = wakeEvent;
+	auto inputAt = numWaitFor;
+	if (keys) waitFor[numWaitFor++] = input;
+
+	auto nextMaintain = start + maintainMs;
+	auto nextHitCheck = start + hitCheckMs;
+	auto nextSnapshot = start + (ULONGLONG)limits.snapshotSeconds * 1000;
+
+	for (;;)
+	{
+		auto now = GetTickCount64();
+
+		//periodic work that's due
+		if (maintainMs && now >= nextMaintain)
+		{
+			maintain();
+			nextMaintain = now + maintainMs;
+		}
+		if (limits.maxHits && now >= nextHitCheck)
+		{
+			if (totalHits() >= limits.maxHits) return SESSION_END_MAX_HITS;
+			nextHitCheck = now + hitCheckMs;
+		}
+		if (limits.snapshotSeconds && now >= nextSnapshot)
+		{
+			snapshot((double)(now - start) / 1000.0);
+			nextSnapshot += (ULONGLONG)limits.snapshotSeconds * 1000;
+		}
+		if (deadline && now >= deadline) return deadlineEnd;
+
+		//sleep until the first of them, or a stop
+		auto wakeUp = never;
+		if (maintainMs) wakeUp = min(wakeUp, nextMaintain);
+		if (limits.maxHits) wakeUp = min(wakeUp, nextHitCheck);
+		if (limits.snapshotSeconds) wakeUp = min(wakeUp, nextSnapshot);
+		if (deadline) wakeUp = min(wakeUp, deadline);
+
+		now = GetTickCount64();
+		auto timeout = wakeUp == never ? INFINITE : (wakeUp > now ? (DWORD)min(wakeUp - now, (ULONGLONG)(INFINITE - 1)) : 0);
+
+		auto waited = WaitForMultipleObjects(numWaitFor, waitFor, FALSE, timeout);
+		if (waited == WAIT_TIMEOUT) continue;
+		if (waited == WAIT_OBJECT_0) return SESSION_END_CTRL;
+
+		if (wakeEvent && (waited == WAIT_OBJECT_0 + wakeAt))
+		{
+			if (wake()) return SESSION_END_RULE;
+			continue;
+		}
+		if (keys && (waited == WAIT_OBJECT_0 + inputAt))
+		{
+			if (KeyPressed(input)) return SESSION_END_KEY;
+			continue;
+		}
+
+		TRACE(L"Waiting for the session to end failed: %u\n", GetLastError());
+		return SESSION_END_CTRL;
+	}
+}
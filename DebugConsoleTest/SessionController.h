@@ -0,0 +1,52 @@
+#include <Windows.h>
+#include <functional>
+#include "Config.h"
+
+#pragma once
+
+using std::function;
+
+//why a tracing session ended
+enum SessionEnd
+{
+	SESSION_END_KEY,		//key pressed
+	SESSION_END_CTRL,		//ctrl-c/ctrl-break, console closed, logoff or shutdown
+	SESSION_END_DURATION,
+	SESSION_END_MAX_HITS,
+	SESSION_END_UNTIL_TIME,
+	SESSION_END_RULE		//a trace rule stopped it
+};
+
+//runs the tracing session on the main thread: blocks on the stop event and the console input until a stop condition
+//is met, only waking up for the periodic work (sampling maintenance, hit limit, snapshots) and signaled work (rule actions)
+class SessionController
+{
+public:
+	SessionController(const SessionLimits &limits, unsigned int maintainMs);
+	~SessionController();	//lets a pending console close go ahead
+
+	//work that's signaled rather than due, handler returns true to end the session
+	void WakeOn(HANDLE event, function<bool()> handler);
+
+	SessionEnd Run(function<void()> maintain, function<ULONGLONG()> totalHits, function<void(double)> snapshot);
+
+	static const wchar_t *Describe(SessionEnd end);
+
+	//"HH:MM" or "HH:MM:SS", local time
+	static bool ParseTimeOfDay(const wchar_t *time, unsigned int &secondOfDay);
+private:
+	SessionController(SessionController const&);
+	void operator=(SessionController const&);
+
+	SessionLimits limits;
+	unsigned int maintainMs;
+	HANDLE wakeEvent;
+	function<bool()> wake;
+
+	bool KeyPressed(HANDLE input);
+
+	//the console control handler runs on its own thread, one session at a time
+	static HANDLE stopEvent;
+	static HANDLE doneEvent;
+	static BOOL WINAPI CtrlHandler(DWORD ctrlType);
+};
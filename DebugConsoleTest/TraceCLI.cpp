@@ -1,7 +1,6 @@
 #include "stdafx.h"
 #include <map>
 #include <stdio.h>
-#include <conio.h>
 #include <vector>
 #include <iostream>
 #include "..\Shared\Logger.h"
@@ -9,11 +8,124 @@
 #include "..\DebugCore\Debugger.h"
 #include "..\DebugCore\ProcessInfo.h"
 #include "CmdLine.h"
+#include "Benchmarks.h"
 #include "PredefinedConfigProviders.h"
 #include "FileConfigReader.h"
+#include "SessionController.h"
 
 using std::unique_ptr;
 
+//busiest methods so far, read while the aggregator keeps counting
+static void PrintSnapshot(Debugger &debugger, OPMODE mode, double elapsed)
+{
+	const size_t maxMethods = 10;
+
+	//hits per method: calls when timing, otherwise all its breakpoint hits
+	vector<shared_ptr<BreakpointInfo>> bpStats;
+	debugger.GetBPStats(bpStats);
+
+	std::map<MethodInfo*, double> methodHits;
+	for (auto bpIt = bpStats.begin(); bpIt != bpStats.end(); ++bpIt)
+	{
+		auto method = (*bpIt)->method.get();
+		if (mode & OPMODE_TIMINGS) methodHits[method] = method->Scaled(method->methodEntered);
+		else methodHits[method] += method->Scaled((*bpIt)->hitCount);
+	}
+
+	vector<std::pair<double, MethodInfo*>> busiest;
+	for (auto methodIt = methodHits.begin(); methodIt != methodHits.end(); ++methodIt)
+	{
+		if (methodIt->second > 0.0) busiest.push_back(std::make_pair(methodIt->second, methodIt->first));
+	}
+	std::sort(busiest.rbegin(), busiest.rend());
+	if (busiest.size() > maxMethods) busiest.resize(maxMethods);
+
+	auto events = debugger.GetEventStats();
+
+	//the aggregator is writing the log, the snapshot goes to it as one text so its lines stay together
+	vector<wchar_t> line(maxLog);
+	std::wstring text;
+
+	_snwprintf_s(line.data(), line.size(), _TRUNCATE, L"## Snapshot at %.0f s, %llu events, %llu dropped\nHits\tHits/s\tTotal (s)\tAvg (ms)\tMethod\n", elapsed, events.emitted, events.dropped);
+	text += line.data();
+	for (auto methodIt = busiest.begin(); methodIt != busiest.end(); ++methodIt)
+	{
+		auto met = methodIt->second;
+		auto total = met->Scaled(met->totalTimeInMethod);
+		auto avg = met->AvgTimeInMethod() * 1000.0;
+
+		_snwprintf_s(line.data(), line.size(), _TRUNCATE, L"%.0f\t%.1f\t%f\t%.3f\t%s\n", methodIt->first, elapsed > 0.0 ? methodIt->first / elapsed : 0.0, total, avg, met->parsedSignature.get());
+		text += line.data();
+	}
+
+	wprintf_s(L"#%s", text.c_str());
+	debugger.LogText(L"%s", text.c_str());
+	std::cout << std::endl;
+}
+
+//objects on the managed heap by type, largest first, the process has to be stopped
+static void LogHeapObjects(MemoryInfo &memInfo)
+{
+	vector<HeapObjectStat> stats;
+	if (memInfo.ManagedHeapStat(stats) != S_OK) return;
+
+	std::sort(stats.begin(), stats.end(), ByTotalSize());
+	LOG(L"Objects on heap:\n");
+	LOG(L"Num\tSize\tName\n");
+	for (auto o : stats)
+	{
+		TRACE(L"%llu\t%llu\t%s\n", o.count, o.size, o.name);
+		LOG(L"%llu\t%llu\t%s\n", o.count, o.size, o.name);
+	}
+}
+
+//methods of the filters by group name
+typedef std::map<std::wstring, vector<shared_ptr<MethodInfo>>> MethodGroups;
+
+//actions of the rules that fired since the last call, true if one of them stops the session
+//the aggregator is writing the log, the lines go to it
+static bool RunRuleActions(Debugger &debugger, const MethodGroups &groups)
+{
+	vector<FiredRule> fired;
+	debugger.TakeFiredRules(fired);
+
+	auto stop = false;
+	for (auto firedIt = fired.begin(); firedIt != fired.end(); ++firedIt)
+	{
+		auto rule = firedIt->rule;
+		debugger.LogText(L"Rule %s: running actions (thread %u)\n", rule->name.c_str(), firedIt->threadId);
+
+		for (auto groupIt = rule->activate.begin(); groupIt != rule->activate.end(); ++groupIt)
+		{
+			auto group = groups.find(*groupIt);
+			if (group != groups.end()) debugger.ActivateMethods(group->second, TRUE);
+			else debugger.LogText(L"Rule %s: no breakpoint group %s\n", rule->name.c_str(), groupIt->c_str());
+		}
+		for (auto groupIt = rule->deactivate.begin(); groupIt != rule->deactivate.end(); ++groupIt)
+		{
+			auto group = groups.find(*groupIt);
+			if (group != groups.end()) debugger.ActivateMethods(group->second, FALSE);
+			else debugger.LogText(L"Rule %s: no breakpoint group %s\n", rule->name.c_str(), groupIt->c_str());
+		}
+
+		if (rule->heapHistogram)
+		{
+			debugger.Stop();
+
+			//too long for the aggregator's text buffer, written right away once the lines queued before it are out
+			debugger.DrainEvents();
+			LOG(L"## Heap at rule %s\n", rule->name.c_str());
+			auto memInfo = unique_ptr<MemoryInfo>(debugger.GetMemoryInfo());
+			LogHeapObjects(*memInfo);
+			debugger.Continue();
+		}
+
+		if (rule->stopSession) stop = true;
+	}
+
+	return stop;
+}
+
 int _tmain(int argc, _TCHAR* argv[])
 {
 	auto cline = unique_ptr<CmdLine>(new CmdLine(argc, argv));
@@ -130,6 +242,13 @@ int _tmain(int argc, _TCHAR* argv[])
 	Logger::CreateLog(config->OutfileName);
 	//write header to log
 	LOG(L"%S\n", VERSIONSTRING);
+
+	if (cline->vm.count("bench"))
+	{
+		Benchmarks::Run();
+		return 0;
+	}
+
 	//write config to log
 	LOG(L"### PARAMETERS\n");
 	auto filterNum = 0;
@@ -138,6 +257,8 @@ int _tmain(int argc, _TCHAR* argv[])
 		filterNum++;
 		auto filt = *filterIt;
 		LOG(L"Filter #%u: namespace %s, class %s, method %s.\n", filterNum, filt->namespaceFilter, filt->classFilter, filt->methodFilter);
+		if (filt->assemblyFilter) LOG(L"  Assemblies %s\n", filt->assemblyFilter);
+		if (filt->group) LOG(L"  Group %s%s\n", filt->group, filt->held ? L", armed by a rule" : L"");
 		if (filt->fieldsToDump.size())
 		{
 			wchar_t fieldBuf[2048] = L"";
@@ -149,8 +270,33 @@ int _tmain(int argc, _TCHAR* argv[])
 			}
 			LOG(L"  Fields dumped on entry: %s\n", fieldBuf);
 		}
+		if (filt->predicate) LOG(L"  Only when: %s\n", filt->predicate);
 	}
 
+	LOG(L"Event buffer: %u events, %s when full\n", config->Settings.eventBufferSize, config->Settings.blockWhenBufferFull ? L"block" : L"drop");
+	if (config->Settings.sampleHits) LOG(L"Sampling: %u hits per method per %u ms\n", config->Settings.sampleHits, config->Settings.sampleWindowMs);
+	LOG(L"Maximum pause: %u ms\n", config->Settings.maxPauseMs);
+	if (config->Session.durationSeconds) LOG(L"Stop after %u s\n", config->Session.durationSeconds);
+	if (config->Session.maxHits) LOG(L"Stop after %llu hits\n", config->Session.maxHits);
+	if (config->Session.untilSet) LOG(L"Stop at %02u:%02u:%02u\n", config->Session.untilSecondOfDay / 3600, (config->Session.untilSecondOfDay / 60) % 60, config->Session.untilSecondOfDay % 60);
+	if (config->Session.snapshotSeconds) LOG(L"Snapshot every %u s\n", config->Session.snapshotSeconds);
+	if (config->Settings.intervalMs) LOG(L"Timeline: %u ms intervals, %u KB\n", config->Settings.intervalMs, config->Settings.timelineKB);
+	for (auto ruleIt = config->Rules.begin(); ruleIt != config->Rules.end(); ++ruleIt)
+	{
+		LOG(L"Rule %s: %s%s%s", ruleIt->name.c_str(), ruleIt->exception.empty() ? L"method " : L"exception ", ruleIt->exception.empty() ? ruleIt->method.c_str() : ruleIt->exception.c_str(), ruleIt->latencyMs > 0.0 ? L" slower than" : L"");
+		if (ruleIt->latencyMs > 0.0) LOG(L" %.1f ms", ruleIt->latencyMs);
+		if (!ruleIt->caller.empty()) LOG(L", called from %s", ruleIt->caller.c_str());
+		LOG(L", every %u times%s\n", ruleIt->hits, ruleIt->repeat ? L"" : L" (once)");
+	}
+	for (auto threadIt = config->Threads.begin(); threadIt != config->Threads.end(); ++threadIt)
+	{
+		auto action = threadIt->skip ? L"Skip" : L"Trace";
+		if (threadIt->kind == THREAD_BY_OS_ID) LOG(L"%s thread %u\n", action, threadIt->id);
+		else if (threadIt->kind == THREAD_BY_MANAGED_ID) LOG(L"%s managed thread %u\n", action, threadIt->id);
+		else LOG(L"%s threads named %s\n", action, threadIt->name.c_str());
+	}
+	if (config->Settings.overheadBudget > 0.0) LOG(L"Overhead budget: %.2f%% of wall time, %.0f us per hit\n", config->Settings.overheadBudget * 100.0, config->Settings.hitCostMicroSeconds);
+
 	//start actual attach
 	if (cline->vm.count("attach"))
 	{
@@ -200,6 +346,10 @@ int _tmain(int argc, _TCHAR* argv[])
 
 		std::cout << "Trying to attach to process with pId " << pId << std::endl;
 
+		//stop conditions and the console control handler, outlives the debugger so closing the console waits for the detach
+		auto maintainMs = config->Settings.sampleHits ? max(config->Settings.sampleWindowMs / 4, 10u) : 0u;
+		SessionController session(config->Session, maintainMs);
+
 		try
 		{
 			unique_ptr<Debugger> debugger;
@@ -215,7 +365,13 @@ int _tmain(int argc, _TCHAR* argv[])
 				return 0;
 			}
 
-			vector<shared_ptr<MethodInfo>> methods;
+			debugger->ApplySettings(config->Settings);
+			debugger->ApplyRules(config->Rules);
+			debugger->ApplyThreadFilter(config->Threads);
+
+			//all filters are searched for in one pass
+			vector<MethodFilter> searchFilters;
+			vector<shared_ptr<BPFilter>> searchedFilters;
 			for (auto bpFilterIt = config->Breakpoints.begin(); bpFilterIt != config->Breakpoints.end(); ++bpFilterIt)
 			{
 				LOG(L"Processing filter...\n");
@@ -229,43 +385,63 @@ int _tmain(int argc, _TCHAR* argv[])
 					continue;
 				}
 
-				debugger->FindManagedMethods(
-					thisFilter->namespaceFilter ? thisFilter->namespaceFilter : nullptr,
-					thisFilter->classFilter ? thisFilter->classFilter : nullptr,
-					thisFilter->methodFilter ? thisFilter->methodFilter : nullptr,
-					thisFilter->fieldsToDump,
-					methods);
+				//parsed once here, resolved per method found
+				shared_ptr<Predicate> predicate;
+				if (thisFilter->predicate)
+				{
+					std::wstring error;
+					predicate = Predicate::Parse(thisFilter->predicate, error);
+					if (!predicate)
+					{
+						wprintf_s(L"Invalid condition %s: %s, fields are dumped on every hit\n", thisFilter->predicate, error.c_str());
+						LOG(L"Invalid condition %s: %s, fields are dumped on every hit\n", thisFilter->predicate, error.c_str());
+					}
+				}
+
+				MethodFilter searchFilter = { thisFilter->namespaceFilter, thisFilter->classFilter, thisFilter->methodFilter, thisFilter->assemblyFilter, thisFilter->fieldsToDump, predicate, thisFilter->held };
+				searchFilters.push_back(searchFilter);
+				searchedFilters.push_back(thisFilter);
 			}
 
-			wprintf_s(L"Found %u methods satisfying the filters\n", methods.size());
-			LOG(L"Found %u methods satisfying the filters\n", methods.size());
+			vector<shared_ptr<MethodInfo>> methods;
+			debugger->UsePlanFile(config->PlanFile);
+			if (searchFilters.size()) debugger->FindManagedMethods(searchFilters, methods);
 
-			//set all breakpoints
-			debugger->Stop();
-			for (auto methodIt = methods.begin(); methodIt != methods.end(); ++methodIt)
+			MethodGroups groups;
+			vector<shared_ptr<MethodInfo>> held;
+			for (size_t filter = 0; filter < searchFilters.size(); filter++)
 			{
-				LOG(L"Found method: %s\n", (*methodIt)->parsedSignature.get());
+				auto &matched = searchFilters[filter].matched;
+				auto thisFilter = searchedFilters[filter];
+				LOG(L"Filter namespace %s, class %s, method %s: %u methods\n", thisFilter->namespaceFilter, thisFilter->classFilter, thisFilter->methodFilter, matched.size());
 
-				if (mode & OPMODE_FIELDS || mode & OPMODE_TIMINGS)
+				//rules (de)activate the methods of a filter by its group
+				if (thisFilter->group)
 				{
-					debugger->SetBPAtEntry(*methodIt, []() -> void { /*do something here once we have our breakpoint to custom delegate mapping in place*/	return;	});
-				}
-				if (mode & OPMODE_TIMINGS)
-				{
-					LOG(L"%u exit breakpoints set\n", debugger->SetBPAtExit(*methodIt, nullptr));
+					auto &group = groups[thisFilter->group];
+					group.insert(group.end(), matched.begin(), matched.end());
 				}
+				if (thisFilter->held) held.insert(held.end(), matched.begin(), matched.end());
+			}
 
-				if (mode & OPMODE_STATS)
-				{
-					TRACE(L"%u BOX breakpoints set\n", debugger->SetBPAtOpCode(*methodIt, nullptr, CEE_BOX));
-					TRACE(L"%u UNBOX breakpoints set\n", debugger->SetBPAtOpCode(*methodIt, nullptr, CEE_UNBOX));
-					TRACE(L"%u UNBOXANY breakpoints set\n", debugger->SetBPAtOpCode(*methodIt, nullptr, CEE_UNBOXANY));
+			wprintf_s(L"Found %u methods satisfying the filters\n", methods.size());
+			LOG(L"Found %u methods satisfying the filters\n", methods.size());
 
-					TRACE(L"%u NEWOBJ breakpoints set\n", debugger->SetBPAtOpCode(*methodIt, nullptr, CEE_NEWOBJ));
-					TRACE(L"%u NEWARR breakpoints set\n", debugger->SetBPAtOpCode(*methodIt, nullptr, CEE_NEWARR));
-				}
+			//set all breakpoints, in bounded pauses of the target
+			debugger->BeginPauseWindow();
+			for (auto methodIt = methods.begin(); methodIt != methods.end(); ++methodIt)
+			{
+				if (debugger->PauseWindowExpired()) debugger->SplitPauseWindow();
+
+				LOG(L"Found method: %s\n", (*methodIt)->parsedSignature.get());
+
+				//the same breakpoints are set in modules loaded later on, by the debugger
+				LOG(L"%u breakpoints set\n", debugger->InstrumentMethod(*methodIt));
 			}
-			debugger->Continue();
+			debugger->EndPauseWindow();
+
+			//the methods and breakpoints found, for the next attach to this build
+			debugger->SavePlan();
 
 			// Test mem stats.
 			debugger->Stop();
@@ -292,25 +468,18 @@ int _tmain(int argc, _TCHAR* argv[])
 					LOG(L"Heap %u (%s): %llx=>%llx\n", i.heap, gentype, i.start, i.end);
 				}
 			}
-			vector<HeapObjectStat> stats;
-			if (memInfo->ManagedHeapStat(stats) == S_OK)
-			{
-				std::sort(stats.begin(), stats.end(), ByTotalSize());
-				LOG(L"Objects on heap:\n");
-				LOG(L"Num\tSize\tName\n");
-				for (auto o : stats)
-				{		
-					TRACE(L"%llu\t%llu\t%s\n", o.count, o.size, o.name);
-					LOG(L"%llu\t%llu\t%s\n", o.count, o.size, o.name);
-				}
-			}
+			LogHeapObjects(*memInfo);
 			debugger->Continue();
 
 
 			if (mode != OPMODE_NONE)
 			{
-				debugger->ActivateBPs(true);
+				debugger->ActivateBPs(true, held);
 				LOG(L"Activating all breakpoints\n");
+
+				auto pauses = debugger->GetPauseStats();
+				wprintf_s(L"Breakpoints set and activated in %u pauses, %.1f ms in total, longest %.1f ms\n", pauses.windows, pauses.totalPause * 1000.0, pauses.maxPause * 1000.0);
+				LOG(L"Breakpoints set and activated in %u pauses, %.1f ms in total, longest %.1f ms\n", pauses.windows, pauses.totalPause * 1000.0, pauses.maxPause * 1000.0);
 			}
 
 
@@ -318,15 +487,47 @@ int _tmain(int argc, _TCHAR* argv[])
 
 			std::cout << std::endl << "Press any key to stop tracing..." << std::endl;
 
-			while (!_kbhit())
-			{
-			}
+			//fired rules wake the session up, their actions need the process stopped
+			if (debugger->RuleEvent()) session.WakeOn(debugger->RuleEvent(), [&debugger, &groups]() { return RunRuleActions(*debugger, groups); });
+
+			//blocks until a stop condition, only waking up for sampling maintenance, the hit limit, snapshots and rule actions
+			auto sessionEnd = session.Run(
+				[&debugger]() { debugger->Maintain(); },
+				[&debugger]() { return (ULONGLONG)debugger->GetTotalHits(); },
+				[&debugger, mode](double elapsed) { PrintSnapshot(*debugger, mode, elapsed); });
+
+			wprintf_s(L"Tracing stopped: %s\n", SessionController::Describe(sessionEnd));
+			LOG(L"Tracing stopped (%s), finishing up.\n", SessionController::Describe(sessionEnd));
+
+			//no more breakpoint callbacks, so the tracer overhead report covers a finished run
+			debugger->ActivateBPs(false);
+
+			//let the aggregator catch up so counts and timings are complete
+			debugger->FlushEvents();
+			auto eventStats = debugger->GetEventStats();
 
-			LOG(L"Tracing stopped, finishing up.\n");
 			LOG(L"### POSTPROCESSING\n");
+			if (mode != OPMODE_NONE)
+			{
+				wprintf_s(L"%llu events traced, %llu dropped (%s when full), %llu log lines dropped, max buffer use %u/%u\n", eventStats.emitted, eventStats.dropped, eventStats.blocking ? L"block" : L"drop", eventStats.droppedText, eventStats.maxDepth, eventStats.capacity);
+				LOG(L"Events: %llu traced, %llu dropped (%s when full), %llu log lines dropped, max buffer use %u/%u\n", eventStats.emitted, eventStats.dropped, eventStats.blocking ? L"block" : L"drop", eventStats.droppedText, eventStats.maxDepth, eventStats.capacity);
+
+				//every time the tracer stopped the target (setting/activating breakpoints, re-arming sampled methods)
+				auto pauses = debugger->GetPauseStats();
+				wprintf_s(L"Target paused %u times for %u breakpoint changes, %.1f ms in total, longest %.1f ms\n", pauses.windows, pauses.toggled, pauses.totalPause * 1000.0, pauses.maxPause * 1000.0);
+				LOG(L"Pauses: %u, %u breakpoint changes, %.1f ms in total, longest %.1f ms\n", pauses.windows, pauses.toggled, pauses.totalPause * 1000.0, pauses.maxPause * 1000.0);
+
+				if (config->Threads.size())
+				{
+					wprintf_s(L"%llu breakpoint hits on skipped threads\n", debugger->GetSkippedThreadHits());
+					LOG(L"Thread filter: %llu breakpoint hits on skipped threads\n", debugger->GetSkippedThreadHits());
+				}
+			}
 
 			if (mode != OPMODE_NONE)
 			{
+				auto sampling = config->Settings.sampleHits != 0;
+
 				//get stats
 				vector<shared_ptr<BreakpointInfo>> bpStats;
 				debugger->GetBPStats(bpStats);
@@ -353,18 +554,299 @@ int _tmain(int argc, _TCHAR* argv[])
 
 					//dump
 					std::cout << "### Timing info" << std::endl;
-					std::cout << "Hits\tMethod\tTotal (s)\tAvg (s)" << std::endl;
+					std::cout << "Hits\tMethod\tTotal (s)\tSelf (s)\tp50 (ms)\tp90 (ms)\tp99 (ms)\tp99.9 (ms)\tMax (ms)" << (sampling ? "\tSampled (%)" : "") << std::endl;
 					LOG(L"## Timing info\n");
-					LOG(L"Hits\tMethod\tTotal (s)\tAvg (s)\n");
+					if (sampling) LOG(L"Sampled: hits and totals are estimates, observed values scaled by the fraction of time the method was traced\n");
+					LOG(L"Hits\tMethod\tTotal (s)\tSelf (s)\tp50 (ms)\tp90 (ms)\tp99 (ms)\tp99.9 (ms)\tMax (ms)%s\n", sampling ? L"\tSampled (%)" : L"");
 					for (auto mIt = timedMethods.rbegin(); mIt != timedMethods.rend(); ++mIt)
 					{
 						auto met = *mIt;
-						wprintf_s(L"%u\t%s\t%f\t%f\n", met->methodEntered, met->parsedSignature.get(), met->avgTimeInMethod * (double)met->methodEntered, met->avgTimeInMethod);
-						LOG(L"%u\t%s\t%f\t%f\n", met->methodEntered, met->parsedSignature.get(), met->avgTimeInMethod * (double)met->methodEntered, met->avgTimeInMethod);
+
+						//percentiles in ms, the histogram records ns
+						double p50 = 0.0, p90 = 0.0, p99 = 0.0, p999 = 0.0, pMax = 0.0;
+						if (met->latency)
+						{
+							p50 = (double)met->latency->ValueAtPercentile(50.0) / 1000000.0;
+							p90 = (double)met->latency->ValueAtPercentile(90.0) / 1000000.0;
+							p99 = (double)met->latency->ValueAtPercentile(99.0) / 1000000.0;
+							p999 = (double)met->latency->ValueAtPercentile(99.9) / 1000000.0;
+							pMax = (double)met->latency->Max() / 1000000.0;
+						}
+
+						//scaled up to all calls when sampling (rate 1 otherwise), percentiles are taken from the sampled calls as is
+						auto hits = met->Scaled(met->methodEntered);
+						auto total = met->Scaled(met->totalTimeInMethod);
+						auto self = met->Scaled(met->selfTimeInMethod);
+
+						if (sampling)
+						{
+							wprintf_s(L"%.0f\t%s\t%f\t%f\t%.3f\t%.3f\t%.3f\t%.3f\t%.3f\t%.1f\n", hits, met->parsedSignature.get(), total, self, p50, p90, p99, p999, pMax, met->sampleRate * 100.0);
+							LOG(L"%.0f\t%s\t%f\t%f\t%.3f\t%.3f\t%.3f\t%.3f\t%.3f\t%.1f\n", hits, met->parsedSignature.get(), total, self, p50, p90, p99, p999, pMax, met->sampleRate * 100.0);
+						}
+						else
+						{
+							wprintf_s(L"%.0f\t%s\t%f\t%f\t%.3f\t%.3f\t%.3f\t%.3f\t%.3f\n", hits, met->parsedSignature.get(), total, self, p50, p90, p99, p999, pMax);
+							LOG(L"%.0f\t%s\t%f\t%f\t%.3f\t%.3f\t%.3f\t%.3f\t%.3f\n", hits, met->parsedSignature.get(), total, self, p50, p90, p99, p999, pMax);
+						}
+					}
+					std::cout << std::endl;
+
+					//activations that were left through an exception, not part of the timings above
+					std::sort(timedMethods.begin(), timedMethods.end(), [](const shared_ptr<MethodInfo> &a, const shared_ptr<MethodInfo> &b) { return a->methodExitThroughException > b->methodExitThroughException; });
+					if (timedMethods.size() && timedMethods.front()->methodExitThroughException)
+					{
+						std::cout << "### Exceptional exits" << std::endl;
+						std::cout << "Exits\tMethod\tp50 (ms)\tp99 (ms)\tMax (ms)" << std::endl;
+						LOG(L"## Exceptional exits\n");
+						LOG(L"Exits\tMethod\tp50 (ms)\tp99 (ms)\tMax (ms)\n");
+						for (auto mIt = timedMethods.begin(); mIt != timedMethods.end() && (*mIt)->methodExitThroughException; ++mIt)
+						{
+							auto met = *mIt;
+
+							double p50 = 0.0, p99 = 0.0, pMax = 0.0;
+							if (met->exceptionLatency)
+							{
+								p50 = (double)met->exceptionLatency->ValueAtPercentile(50.0) / 1000000.0;
+								p99 = (double)met->exceptionLatency->ValueAtPercentile(99.0) / 1000000.0;
+								pMax = (double)met->exceptionLatency->Max() / 1000000.0;
+							}
+
+							auto exits = met->Scaled(met->methodExitThroughException);
+							wprintf_s(L"%.0f\t%s\t%.3f\t%.3f\t%.3f\n", exits, met->parsedSignature.get(), p50, p99, pMax);
+							LOG(L"%.0f\t%s\t%.3f\t%.3f\t%.3f\n", exits, met->parsedSignature.get(), p50, p99, pMax);
+						}
+						std::cout << std::endl;
+					}
+				}
+
+				if (mode & OPMODE_CALLGRAPH)
+				{
+					auto &callGraph = debugger->GetCallGraph();
+
+					//hottest edges by time spent in the callee
+					vector<const CallEdge*> edges;
+					for (auto edgeIt = callGraph.Edges().begin(); edgeIt != callGraph.Edges().end(); ++edgeIt)
+					{
+						edges.push_back(&(*edgeIt));
+					}
+					std::sort(edges.begin(), edges.end(), [](const CallEdge *a, const CallEdge *b) { return a->totalTime > b->totalTime; });
+
+					const size_t maxEdgesShown = 50;
+					std::cout << "### Call graph" << std::endl;
+					std::cout << "Calls\tThrown\tCaller\tCallee\tTotal (s)\tSelf (s)" << std::endl;
+					LOG(L"## Call graph\n");
+					if (callGraph.OverflowCalls()) LOG(L"Edge table full, %llu calls on further edges not recorded\n", callGraph.OverflowCalls());
+					LOG(L"Calls\tThrown\tCaller\tCallee\tTotal (s)\tSelf (s)\n");
+					for (size_t edge = 0; edge < edges.size() && edge < maxEdgesShown; edge++)
+					{
+						auto caller = edges[edge]->callerMethod ? edges[edge]->callerMethod->parsedSignature.get() : L"-";
+						wprintf_s(L"%llu\t%llu\t%s\t%s\t%f\t%f\n", edges[edge]->calls, edges[edge]->throws, caller, edges[edge]->calleeMethod->parsedSignature.get(), edges[edge]->totalTime, edges[edge]->selfTime);
+						LOG(L"%llu\t%llu\t%s\t%s\t%f\t%f\n", edges[edge]->calls, edges[edge]->throws, caller, edges[edge]->calleeMethod->parsedSignature.get(), edges[edge]->totalTime, edges[edge]->selfTime);
+					}
+					if (callGraph.OverflowCalls()) wprintf_s(L"Edge table full, %llu calls on further edges not recorded (see --edges)\n", callGraph.OverflowCalls());
+					std::cout << std::endl;
+
+					//outermost calls followed down along their hottest callee
+					vector<CallPath> paths;
+					callGraph.HottestPaths(10, paths);
+
+					std::cout << "### Hottest paths" << std::endl;
+					std::cout << "Total (s)\tCalls\tPath" << std::endl;
+					LOG(L"## Hottest paths\n");
+					LOG(L"Total (s)\tCalls\tPath\n");
+					for (auto pathIt = paths.begin(); pathIt != paths.end(); ++pathIt)
+					{
+						std::wstring path;
+						for (auto methodIt = pathIt->methods.begin(); methodIt != pathIt->methods.end(); ++methodIt)
+						{
+							if (methodIt != pathIt->methods.begin()) path += L" > ";
+							path += (*methodIt)->parsedSignature.get();
+						}
+
+						wprintf_s(L"%f\t%llu\t%s\n", pathIt->totalTime, pathIt->calls, path.c_str());
+						LOG(L"%f\t%llu\t%s\n", pathIt->totalTime, pathIt->calls, path.c_str());
+					}
+					std::cout << std::endl;
+
+					//self time per unique stack for the flame graph tools, next to the log: tracer.log => tracer.folded
+					std::wstring foldedName = Logger::FileName();
+					auto extension = foldedName.find_last_of(L'.');
+					if (extension != std::wstring::npos && foldedName.find_first_of(L"\\/", extension) == std::wstring::npos) foldedName.resize(extension);
+					foldedName += L".folded";
+
+					if (callGraph.WriteFolded(foldedName.c_str()) == S_OK)
+					{
+						wprintf_s(L"Folded stacks of %u calling contexts written to %s\n", callGraph.Contexts().size(), foldedName.c_str());
+						LOG(L"Folded stacks of %u calling contexts written to %s\n", callGraph.Contexts().size(), foldedName.c_str());
+					}
+					else
+					{
+						wprintf_s(L"Failed to write folded stacks to %s\n", foldedName.c_str());
+						LOG(L"Failed to write folded stacks to %s\n", foldedName.c_str());
+					}
+					if (callGraph.OverflowContexts())
+					{
+						wprintf_s(L"Context table full, %llu calls on further stacks not recorded (see --edges)\n", callGraph.OverflowContexts());
+						LOG(L"Context table full, %llu calls on further stacks not recorded\n", callGraph.OverflowContexts());
+					}
+					std::cout << std::endl;
+				}
+
+				//how selective the conditions were
+				if (mode & OPMODE_FIELDS)
+				{
+					auto header = false;
+					for (auto mIt = methods.begin(); mIt != methods.end(); ++mIt)
+					{
+						auto met = *mIt;
+						if (!met->predicate || !met->predicateTested) continue;
+
+						if (!header)
+						{
+							std::cout << "### Conditions" << std::endl;
+							std::cout << "Tested\tHeld\tMethod\tCondition" << std::endl;
+							LOG(L"## Conditions\n");
+							LOG(L"Tested\tHeld\tMethod\tCondition\n");
+							header = true;
+						}
+						wprintf_s(L"%llu\t%llu\t%s\t%s\n", met->predicateTested, met->predicatePassed, met->parsedSignature.get(), met->predicate->Text().c_str());
+						LOG(L"%llu\t%llu\t%s\t%s\n", met->predicateTested, met->predicatePassed, met->parsedSignature.get(), met->predicate->Text().c_str());
+					}
+					if (header) std::cout << std::endl;
+				}
+
+				//hits per second and p99 per interval of the busiest methods, to find spikes the totals average out
+				auto &timeline = debugger->GetTimeline();
+				if (config->Settings.intervalMs && timeline.Size())
+				{
+					const size_t maxMethods = 5;
+					const size_t maxRows = 60;
+
+					//busiest methods over the whole session
+					vector<std::pair<ULONG64, ULONG>> busiest;
+					vector<vector<TimelinePoint>> series(timeline.Size());
+					ULONG lastInterval = 0;
+					for (ULONG methodSlot = 0; methodSlot < timeline.Size(); methodSlot++)
+					{
+						timeline.Series(methodSlot, series[methodSlot]);
+
+						ULONG64 hits = 0;
+						for (auto pointIt = series[methodSlot].begin(); pointIt != series[methodSlot].end(); ++pointIt)
+						{
+							hits += pointIt->hits;
+							if (pointIt->interval > lastInterval) lastInterval = pointIt->interval;
+						}
+						if (hits) busiest.push_back(std::make_pair(hits, methodSlot));
+					}
+					std::sort(busiest.rbegin(), busiest.rend());
+					if (busiest.size() > maxMethods) busiest.resize(maxMethods);
+
+					//merge intervals for display so the table stays readable
+					auto rowIntervals = (lastInterval + 1 + maxRows - 1) / maxRows;
+					auto rowSeconds = (double)timeline.IntervalMs() * rowIntervals / 1000.0;
+
+					if (busiest.size())
+					{
+						std::cout << "### Timeline" << std::endl;
+						LOG(L"## Timeline\n");
+						wprintf_s(L"%.1f s per row, stored at %u ms intervals in %u KB\n", rowSeconds, timeline.IntervalMs(), timeline.Bytes() / 1024);
+						LOG(L"%.1f s per row, stored at %u ms intervals in %u KB\n", rowSeconds, timeline.IntervalMs(), timeline.Bytes() / 1024);
+						for (size_t method = 0; method < busiest.size(); method++)
+						{
+							wprintf_s(L"#%u\t%s\n", method + 1, timeline.Method(busiest[method].second)->parsedSignature.get());
+							LOG(L"#%u\t%s\n", method + 1, timeline.Method(busiest[method].second)->parsedSignature.get());
+						}
+
+						std::wstring header = L"Time (s)";
+						for (size_t method = 0; method < busiest.size(); method++)
+						{
+							header += L"\t#" + std::to_wstring(method + 1) + L" hits/s\t#" + std::to_wstring(method + 1) + L" p99 (ms)";
+						}
+						wprintf_s(L"%s\n", header.c_str());
+						LOG(L"%s\n", header.c_str());
+
+						vector<size_t> positions(busiest.size(), 0);
+						for (ULONG row = 0; row * rowIntervals <= lastInterval; row++)
+						{
+							wchar_t cell[64];
+							swprintf_s(cell, L"%.1f", row * rowSeconds);
+							std::wstring line = cell;
+
+							for (size_t method = 0; method < busiest.size(); method++)
+							{
+								//the highest p99 of the merged intervals
+								auto &points = series[busiest[method].second];
+								ULONG64 hits = 0, p99 = 0;
+								for (auto &pos = positions[method]; pos < points.size() && points[pos].interval < (row + 1) * rowIntervals; pos++)
+								{
+									hits += points[pos].hits;
+									if (points[pos].p99 > p99) p99 = points[pos].p99;
+								}
+
+								swprintf_s(cell, L"\t%.1f\t%.3f", (double)hits / rowSeconds, (double)p99 / 1000000.0);
+								line += cell;
+							}
+
+							wprintf_s(L"%s\n", line.c_str());
+							LOG(L"%s\n", line.c_str());
+						}
+						std::cout << std::endl;
+					}
+				}
+
+				//methods the overhead governor deactivated, their numbers only cover the time before
+				vector<ShedMethod> shed;
+				debugger->GetShedMethods(shed);
+				if (shed.size())
+				{
+					std::cout << "### Shed by overhead governor" << std::endl;
+					std::cout << "After (s)\tOverhead (%)\tSuspended (s)\tMethod" << std::endl;
+					LOG(L"## Shed by overhead governor\n");
+					LOG(L"After (s)\tOverhead (%%)\tSuspended (s)\tMethod\n");
+					for (auto shedIt = shed.begin(); shedIt != shed.end(); ++shedIt)
+					{
+						wprintf_s(L"%.1f\t%.2f\t%f\t%s\n", shedIt->shedAfter, shedIt->overheadShare * 100.0, shedIt->suspended, shedIt->method->parsedSignature.get());
+						LOG(L"%.1f\t%.2f\t%f\t%s\n", shedIt->shedAfter, shedIt->overheadShare * 100.0, shedIt->suspended, shedIt->method->parsedSignature.get());
 					}
 					std::cout << std::endl;
 				}
 
+				//what the tracer itself cost the target: time from receiving each callback until the target continued
+				auto profiler = debugger->Profiler();
+				if (profiler)
+				{
+					std::cout << "### Tracer overhead" << std::endl;
+					std::cout << "Callback\tCount\tTotal (ms)\tMean (us)\tp50 (us)\tp99 (us)\tp99.9 (us)\tMax (us)" << std::endl;
+					LOG(L"## Tracer overhead\n");
+					LOG(L"Callback\tCount\tTotal (ms)\tMean (us)\tp50 (us)\tp99 (us)\tp99.9 (us)\tMax (us)\n");
+
+					ULONG64 callbacks = 0;
+					double injected = 0.0;
+					for (int kind = 0; kind < CALLBACK_KINDS; kind++)
+					{
+						auto &hist = profiler->Histogram((CallbackKind)kind);
+						if (hist.Count() == 0) continue;
+
+						//histograms record ns
+						auto total = hist.Mean() * (double)hist.Count() / 1000000.0;
+						auto mean = hist.Mean() / 1000.0;
+						auto p50 = (double)hist.ValueAtPercentile(50.0) / 1000.0;
+						auto p99 = (double)hist.ValueAtPercentile(99.0) / 1000.0;
+						auto p999 = (double)hist.ValueAtPercentile(99.9) / 1000.0;
+						auto pMax = (double)hist.Max() / 1000.0;
+
+						callbacks += hist.Count();
+						injected += total;
+
+						wprintf_s(L"%s\t%llu\t%.3f\t%.1f\t%.1f\t%.1f\t%.1f\t%.1f\n", CallbackProfiler::Name((CallbackKind)kind), hist.Count(), total, mean, p50, p99, p999, pMax);
+						LOG(L"%s\t%llu\t%.3f\t%.1f\t%.1f\t%.1f\t%.1f\t%.1f\n", CallbackProfiler::Name((CallbackKind)kind), hist.Count(), total, mean, p50, p99, p999, pMax);
+					}
+
+					wprintf_s(L"Total: %llu callbacks, %.3f ms injected into the target\n", callbacks, injected);
+					LOG(L"Total: %llu callbacks, %.3f ms injected into the target\n", callbacks, injected);
+					std::cout << std::endl;
+				}
+
 				if (mode & OPMODE_STATS)
 				{
 					//sort breakpoints by hitcount
@@ -379,8 +861,8 @@ int _tmain(int argc, _TCHAR* argv[])
 					for (auto bpIt = bpStats.rbegin(); bpIt != bpStats.rend() && (*bpIt)->hitCount > 0; ++bpIt)
 						if ((*bpIt)->CILInstruction == CEE_BOX)
 						{
-							wprintf_s(L"%u\t%s.0x%x\t%s\n", (*bpIt)->hitCount, (*bpIt)->method->parsedSignature.get(), (*bpIt)->ilOffset, debugger->GetName((*bpIt)->typeToken));
-							LOG(L"%u\t%s.0x%x\t%s\n", (*bpIt)->hitCount, (*bpIt)->method->parsedSignature.get(), (*bpIt)->ilOffset, debugger->GetName((*bpIt)->typeToken));
+							wprintf_s(L"%.0f\t%s.0x%x\t%s\n", (*bpIt)->method->Scaled((*bpIt)->hitCount), (*bpIt)->method->parsedSignature.get(), (*bpIt)->ilOffset, debugger->GetName((*bpIt)->typeToken));
+							LOG(L"%.0f\t%s.0x%x\t%s\n", (*bpIt)->method->Scaled((*bpIt)->hitCount), (*bpIt)->method->parsedSignature.get(), (*bpIt)->ilOffset, debugger->GetName((*bpIt)->typeToken));
 						}
 					std::cout << std::endl;
 
@@ -392,8 +874,8 @@ int _tmain(int argc, _TCHAR* argv[])
 					for (auto bpIt = bpStats.rbegin(); bpIt != bpStats.rend() && (*bpIt)->hitCount > 0; ++bpIt)
 						if (CEE_UNBOXOPCODE((*bpIt)->CILInstruction))
 						{
-							wprintf_s(L"%u\t%s.0x%x\t%s\n", (*bpIt)->hitCount, (*bpIt)->method->parsedSignature.get(), (*bpIt)->ilOffset, debugger->GetName((*bpIt)->typeToken));
-							LOG(L"%u\t%s.0x%x\t%s\n", (*bpIt)->hitCount, (*bpIt)->method->parsedSignature.get(), (*bpIt)->ilOffset, debugger->GetName((*bpIt)->typeToken));
+							wprintf_s(L"%.0f\t%s.0x%x\t%s\n", (*bpIt)->method->Scaled((*bpIt)->hitCount), (*bpIt)->method->parsedSignature.get(), (*bpIt)->ilOffset, debugger->GetName((*bpIt)->typeToken));
+							LOG(L"%.0f\t%s.0x%x\t%s\n", (*bpIt)->method->Scaled((*bpIt)->hitCount), (*bpIt)->method->parsedSignature.get(), (*bpIt)->ilOffset, debugger->GetName((*bpIt)->typeToken));
 						}
 					std::cout << std::endl;
 
@@ -405,8 +887,8 @@ int _tmain(int argc, _TCHAR* argv[])
 					for (auto bpIt = bpStats.rbegin(); bpIt != bpStats.rend() && (*bpIt)->hitCount > 0; ++bpIt)
 						if ((*bpIt)->CILInstruction == CEE_NEWOBJ)
 						{
-							wprintf_s(L"%u\t%s.0x%x\t%s\n", (*bpIt)->hitCount, (*bpIt)->method->parsedSignature.get(), (*bpIt)->ilOffset, debugger->GetName((*bpIt)->typeToken));
-							LOG(L"%u\t%s.0x%x\t%s\n", (*bpIt)->hitCount, (*bpIt)->method->parsedSignature.get(), (*bpIt)->ilOffset, debugger->GetName((*bpIt)->typeToken));
+							wprintf_s(L"%.0f\t%s.0x%x\t%s\n", (*bpIt)->method->Scaled((*bpIt)->hitCount), (*bpIt)->method->parsedSignature.get(), (*bpIt)->ilOffset, debugger->GetName((*bpIt)->typeToken));
+							LOG(L"%.0f\t%s.0x%x\t%s\n", (*bpIt)->method->Scaled((*bpIt)->hitCount), (*bpIt)->method->parsedSignature.get(), (*bpIt)->ilOffset, debugger->GetName((*bpIt)->typeToken));
 						}
 					std::cout << std::endl;
 
@@ -418,8 +900,8 @@ int _tmain(int argc, _TCHAR* argv[])
 					for (auto bpIt = bpStats.rbegin(); bpIt != bpStats.rend() && (*bpIt)->hitCount > 0; ++bpIt)
 						if ((*bpIt)->CILInstruction == CEE_NEWARR)
 						{
-							wprintf_s(L"%u\t%s.0x%x\t%s[]\n", (*bpIt)->hitCount, (*bpIt)->method->parsedSignature.get(), (*bpIt)->ilOffset, debugger->GetName((*bpIt)->typeToken));
-							LOG(L"%u\t%s.0x%x\t%s[]\n", (*bpIt)->hitCount, (*bpIt)->method->parsedSignature.get(), (*bpIt)->ilOffset, debugger->GetName((*bpIt)->typeToken));
+							wprintf_s(L"%.0f\t%s.0x%x\t%s[]\n", (*bpIt)->method->Scaled((*bpIt)->hitCount), (*bpIt)->method->parsedSignature.get(), (*bpIt)->ilOffset, debugger->GetName((*bpIt)->typeToken));
+							LOG(L"%.0f\t%s.0x%x\t%s[]\n", (*bpIt)->method->Scaled((*bpIt)->hitCount), (*bpIt)->method->parsedSignature.get(), (*bpIt)->ilOffset, debugger->GetName((*bpIt)->typeToken));
 						}
 					std::cout << std::endl;
 				}
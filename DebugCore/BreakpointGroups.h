@@ -0,0 +1,115 @@
+#include "precompiled.h"
+#include "FlatIndex.h"
+
+#pragma once
+
+//all breakpoints of one method, they're deactivated and re-armed together so entry/exit pairs stay consistent
+struct BreakpointGroup
+{
+	MethodInfo *method;
+	vector<BreakpointInfo*> breakpoints;
+	ULONG firstSlot;	//any breakpoint slot of the group, to refer to the method in trace events
+	bool shed;			//deactivated for good by the overhead governor
+	bool disarmed;		//deactivated by a rule, until a rule activates it again
+};
+
+//breakpoints grouped by method, built together with the breakpoint slots
+class BreakpointGroups
+{
+public:
+	void Build(const map<ICorDebugFunctionBreakpoint*, shared_ptr<BreakpointInfo>> &breakpoints, size_t numSlots)
+	{
+		groups.clear();
+		slotGroups.assign(numSlots, 0);
+
+		FlatIndex methodGroups;
+		methodGroups.Reserve(breakpoints.size());
+		for (auto bpIt = breakpoints.begin(); bpIt != breakpoints.end(); ++bpIt)
+		{
+			auto method = bpIt->second->method.get();
+			auto slot = bpIt->second->slot;
+
+			auto groupId = methodGroups.Find(FlatIndex::KeyOf(method));
+			if (groupId == FlatIndex::NoSlot)
+			{
+				groupId = (ULONG)groups.size();
+				groups.push_back(BreakpointGroup{ method, vector<BreakpointInfo*>(), slot, false, false });
+				methodGroups.Insert(FlatIndex::KeyOf(method), groupId);
+			}
+
+			groups[groupId].breakpoints.push_back(bpIt->second.get());
+			bpIt->second->methodSlot = groupId;
+			if (slot < numSlots) slotGroups[slot] = groupId;
+		}
+	}
+
+	//breakpoints registered after Build (a module loaded while tracing) get groups of their own, appended after the
+	//others, so the groups (and slots) already handed out stay as they are
+	void Append(const vector<shared_ptr<BreakpointInfo>> &breakpoints, size_t numSlots)
+	{
+		slotGroups.resize(numSlots, 0);
+
+		FlatIndex methodGroups;
+		methodGroups.Reserve(breakpoints.size());
+		for (auto bpIt = breakpoints.begin(); bpIt != breakpoints.end(); ++bpIt)
+		{
+			auto method = (*bpIt)->method.get();
+			auto slot = (*bpIt)->slot;
+
+			auto groupId = methodGroups.Find(FlatIndex::KeyOf(method));
+			if (groupId == FlatIndex::NoSlot)
+			{
+				groupId = (ULONG)groups.size();
+				groups.push_back(BreakpointGroup{ method, vector<BreakpointInfo*>(), slot, false, false });
+				methodGroups.Insert(FlatIndex::KeyOf(method), groupId);
+			}
+
+			groups[groupId].breakpoints.push_back(bpIt->get());
+			(*bpIt)->methodSlot = groupId;
+			if (slot < numSlots) slotGroups[slot] = groupId;
+		}
+	}
+
+	//only while the process is synchronized (in a callback, or stopped)
+	void Activate(ULONG group, BOOL active)
+	{
+		auto &bps = groups[group].breakpoints;
+		for (auto bpIt = bps.begin(); bpIt != bps.end(); ++bpIt)
+		{
+			auto bp = *bpIt;
+			if (bp->unloaded || (bp->active == (active != FALSE))) continue;
+
+			if (bp->corBreakpoint->Activate(active) == S_OK) bp->active = active != FALSE;
+			else TRACE(L"Failed to %s breakpoint\n", active ? L"activate" : L"deactivate");
+		}
+	}
+
+	//any breakpoint of the group active, so its activations show up on the shadow stacks
+	bool Armed(ULONG group) const
+	{
+		auto &bps = groups[group].breakpoints;
+		for (auto bpIt = bps.begin(); bpIt != bps.end(); ++bpIt)
+		{
+			if ((*bpIt)->active) return true;
+		}
+		return false;
+	}
+
+	inline ULONG GroupOf(ULONG slot) const
+	{
+		return slotGroups[slot];
+	}
+
+	inline BreakpointGroup &At(ULONG group)
+	{
+		return groups[group];
+	}
+
+	size_t Size() const
+	{
+		return groups.size();
+	}
+private:
+	vector<BreakpointGroup> groups;
+	vector<ULONG> slotGroups;	//breakpoint slot => group
+};
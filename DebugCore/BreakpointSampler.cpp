@@ -0,0 +1,61 @@
+#include "precompiled.h"
+#include "BreakpointSampler.h"
+
+BreakpointSampler::BreakpointSampler(BreakpointGroups &groups, unsigned int quota, unsigned int windowMs, double timerFreq, long long now)
+	: groups(groups), pauses(0), quota(quota), windowStart(now), samplingStart(now)
+{
+	windowTicks = (long long)(timerFreq * (double)windowMs / 1000.0);
+	windows.resize(groups.Size(), SampleWindow{ 0, false, 0, 0 });
+
+	TRACE(L"Sampling %u methods, %u hits per %u ms\n", groups.Size(), quota, windowMs);
+}
+
+bool BreakpointSampler::Pause(ULONG group, long long now)
+{
+	auto &window = windows[group];
+	if (window.paused || groups.At(group).shed || groups.At(group).disarmed) return false;
+
+	//the process is synchronized during a callback, so the breakpoints can be deactivated right away
+	groups.Activate(group, FALSE);
+
+	window.paused = true;
+	window.pausedAt = now;
+	pausedGroups.push_back(group);
+	pauses++;
+
+	return true;
+}
+
+void BreakpointSampler::NextWindow(long long now)
+{
+	for (auto groupIt = pausedGroups.begin(); groupIt != pausedGroups.end(); ++groupIt)
+	{
+		auto &window = windows[*groupIt];
+
+		//shed by the governor or deactivated by a rule in the meantime, stays off
+		auto &group = groups.At(*groupIt);
+		if (!group.shed && !group.disarmed) groups.Activate(*groupIt, TRUE);
+
+		window.pausedTicks += now - window.pausedAt;
+		window.paused = false;
+	}
+	pausedGroups.clear();
+
+	for (auto windowIt = windows.begin(); windowIt != windows.end(); ++windowIt)
+	{
+		windowIt->windowHits = 0;
+	}
+
+	windowStart = now;
+}
+
+void BreakpointSampler::Finish(long long now)
+{
+	auto elapsed = now - samplingStart;
+	for (ULONG group = 0; group < windows.size(); group++)
+	{
+		auto &window = windows[group];
+		auto pausedTicks = window.pausedTicks + (window.paused ? now - window.pausedAt : 0);
+		groups.At(group).method->sampleRate = elapsed > 0 ? (double)(elapsed - pausedTicks) / (double)elapsed : 1.0;
+	}
+}
@@ -0,0 +1,72 @@
+#include "precompiled.h"
+#include "BreakpointGroups.h"
+
+#pragma once
+
+//sampling state of one breakpoint group
+struct SampleWindow
+{
+	ULONG windowHits;
+	bool paused;
+	long long pausedAt;		//QPC ticks
+	long long pausedTicks;	//total time the group was paused
+};
+
+//hit quota sampling: once a method hits its quota within a window, its breakpoints are deactivated until the next window,
+//so the number of debugger round trips per second is bounded no matter how often the method is called
+//not thread safe, the debugger serializes the callbacks and the window maintenance
+class BreakpointSampler
+{
+public:
+	BreakpointSampler(BreakpointGroups &groups, unsigned int quota, unsigned int windowMs, double timerFreq, long long now);
+
+	//callback thread, true if this hit used up the quota and the group got paused
+	inline bool OnHit(ULONG slot, long long now)
+	{
+		auto group = groups.GroupOf(slot);
+		if (++windows[group].windowHits != quota) return false;
+
+		return Pause(group, now);
+	}
+
+	//main thread (process stopped), re-arms paused groups when the window has passed
+	bool WindowElapsed(long long now) const
+	{
+		return now - windowStart >= windowTicks;
+	}
+	void NextWindow(long long now);
+
+	//groups appended while sampling (a module loaded), they start with a fresh quota
+	void Extend()
+	{
+		windows.resize(groups.Size(), SampleWindow{ 0, false, 0, 0 });
+	}
+
+	//ends sampling, stores the effective sample rate in every method
+	void Finish(long long now);
+
+	size_t PausedGroups() const
+	{
+		return pausedGroups.size();
+	}
+
+	ULONG64 Pauses() const
+	{
+		return pauses;
+	}
+private:
+	BreakpointSampler(BreakpointSampler const&);
+	void operator=(BreakpointSampler const&);
+
+	BreakpointGroups &groups;
+	vector<SampleWindow> windows;	//by group
+	vector<ULONG> pausedGroups;
+	ULONG64 pauses;
+
+	ULONG quota;
+	long long windowTicks;
+	long long windowStart;
+	long long samplingStart;
+
+	bool Pause(ULONG group, long long now);
+};
@@ -0,0 +1,108 @@
+#include "precompiled.h"
+#include "CallGraph.h"
+
+void CallGraph::Reset(size_t maxEdges)
+{
+	this->maxEdges = maxEdges;
+	overflowCalls = 0;
+	overflowContexts = 0;
+
+	edges.clear();
+	index.Clear();
+	index.Reserve(maxEdges < 4096 ? maxEdges : 4096);
+
+	contexts.clear();
+	contextIndex.Clear();
+	contextIndex.Reserve(maxEdges < 4096 ? maxEdges : 4096);
+}
+
+void CallGraph::HottestPaths(size_t count, vector<CallPath> &paths) const
+{
+	const size_t maxDepth = 32;
+
+	//outgoing edges of every caller, hottest first
+	vector<const CallEdge*> byCaller;
+	byCaller.reserve(edges.size());
+	for (auto edgeIt = edges.begin(); edgeIt != edges.end(); ++edgeIt)
+	{
+		byCaller.push_back(&(*edgeIt));
+	}
+	std::sort(byCaller.begin(), byCaller.end(), [](const CallEdge *a, const CallEdge *b)
+	{
+		return a->caller != b->caller ? a->caller < b->caller : a->totalTime > b->totalTime;
+	});
+
+	//roots sort last (NoCaller is the highest slot), hottest first
+	ULONG rootCaller = NoCaller;
+	auto rootsBegin = std::lower_bound(byCaller.begin(), byCaller.end(), rootCaller, [](const CallEdge *edge, ULONG caller) { return edge->caller < caller; });
+
+	for (auto rootIt = rootsBegin; rootIt != byCaller.end() && paths.size() < count; ++rootIt)
+	{
+		CallPath path = { vector<MethodInfo*>(), (*rootIt)->calls, (*rootIt)->totalTime };
+		path.methods.push_back((*rootIt)->calleeMethod);
+
+		//follow the hottest callee, a method already on the path ends it (recursion)
+		vector<ULONG> visited(1, (*rootIt)->callee);
+		auto current = (*rootIt)->callee;
+		while (path.methods.size() < maxDepth)
+		{
+			auto next = std::lower_bound(byCaller.begin(), rootsBegin, current, [](const CallEdge *edge, ULONG caller) { return edge->caller < caller; });
+			if (next == rootsBegin || (*next)->caller != current) break;
+			if (std::find(visited.begin(), visited.end(), (*next)->callee) != visited.end()) break;
+
+			current = (*next)->callee;
+			visited.push_back(current);
+			path.methods.push_back((*next)->calleeMethod);
+		}
+
+		paths.push_back(path);
+	}
+}
+
+HRESULT CallGraph::WriteFolded(const wchar_t *fileName) const
+{
+	FILE *folded = nullptr;
+	if (_wfopen_s(&folded, fileName, L"wb") != 0) return E_FAIL;
+
+	vector<const MethodInfo*> stack;
+	std::wstring line;
+	vector<char> utf8;
+	for (auto contextIt = contexts.begin(); contextIt != contexts.end(); ++contextIt)
+	{
+		auto selfMicroSeconds = (ULONG64)(contextIt->selfTime * 1000000.0 + 0.5);
+		if (selfMicroSeconds == 0) continue;
+
+		//parents always have a lower id, walk up to the outermost frame
+		stack.clear();
+		for (auto context = (ULONG)(contextIt - contexts.begin()); context != RootContext; context = contexts[context].parent)
+		{
+			stack.push_back(contexts[context].method);
+		}
+
+		line.clear();
+		for (auto methodIt = stack.rbegin(); methodIt != stack.rend(); ++methodIt)
+		{
+			if (methodIt != stack.rbegin()) line += L';';
+
+			//';' separates the frames
+			auto signature = (*methodIt)->parsedSignature.get();
+			for (auto c = signature; c && *c; c++) line += *c == L';' ? L',' : *c;
+		}
+		line += L' ';
+		line += std::to_wstring(selfMicroSeconds);
+		line += L'\n';
+
+		auto length = WideCharToMultiByte(CP_UTF8, 0, line.c_str(), (int)line.size(), nullptr, 0, nullptr, nullptr);
+		utf8.resize(length);
+		if (length) WideCharToMultiByte(CP_UTF8, 0, line.c_str(), (int)line.size(), utf8.data(), length, nullptr, nullptr);
+
+		if (fwrite(utf8.data(), 1, utf8.size(), folded) != utf8.size())
+		{
+			fclose(folded);
+			return E_FAIL;
+		}
+	}
+
+	VERIFY(fclose(folded) == 0);
+	return S_OK;
+}
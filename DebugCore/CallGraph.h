@@ -0,0 +1,149 @@
+#include "precompiled.h"
+#include "FlatIndex.h"
+
+#pragma once
+
+//aggregated calls from one instrumented method to another, methods are identified by their method slot (breakpoint group)
+struct CallEdge
+{
+	ULONG caller;				//NoCaller when the callee had no instrumented method below it on the stack
+	ULONG callee;
+	MethodInfo *callerMethod;	//nullptr for NoCaller
+	MethodInfo *calleeMethod;
+	ULONG64 calls;
+	ULONG64 throws;				//of the calls, left through an exception
+	double totalTime;			//inclusive, seconds
+	double selfTime;			//exclusive, seconds
+};
+
+//a distinct stack of instrumented methods (calling context), identified by its parent context and its method
+struct ContextNode
+{
+	ULONG parent;				//RootContext for the outermost instrumented frame
+	MethodInfo *method;
+	ULONG64 calls;
+	double selfTime;			//exclusive, seconds
+};
+
+//one of the hottest call chains, from an outermost instrumented method down along the hottest callees
+struct CallPath
+{
+	vector<MethodInfo*> methods;
+	ULONG64 calls;
+	double totalTime;			//of the outermost call
+};
+
+//edge table and calling context tree of the call graph, filled from the shadow stacks on the aggregation thread
+//every distinct stack is interned once as a context, so its size follows the number of unique stacks, not calls
+//memory is bounded: once a table is full, calls on edges or stacks not seen before are only counted
+class CallGraph
+{
+public:
+	static const ULONG NoCaller = (ULONG)-1;
+	static const ULONG RootContext = (ULONG)-1;
+	static const ULONG NoContext = (ULONG)-2;	//context table was full, also for everything called from there
+
+	CallGraph() : maxEdges(0), overflowCalls(0), overflowContexts(0) {}
+
+	void Reset(size_t maxEdges);
+
+	inline void Record(ULONG caller, MethodInfo *callerMethod, ULONG callee, MethodInfo *calleeMethod, double totalTime, double selfTime, bool throughException)
+	{
+		auto key = KeyOf(caller, callee);
+		auto edgeId = index.Find(key);
+		if (edgeId == FlatIndex::NoSlot)
+		{
+			if (edges.size() >= maxEdges)
+			{
+				overflowCalls++;
+				return;
+			}
+
+			edgeId = (ULONG)edges.size();
+			edges.push_back(CallEdge{ caller, callee, callerMethod, calleeMethod, 0, 0, 0.0, 0.0 });
+			index.Insert(key, edgeId);
+		}
+
+		auto &edge = edges[edgeId];
+		edge.calls++;
+		if (throughException) edge.throws++;
+		edge.totalTime += totalTime;
+		edge.selfTime += selfTime;
+	}
+
+	//context of a frame of methodSlot entered from context parent
+	inline ULONG Enter(ULONG parent, ULONG methodSlot, MethodInfo *method)
+	{
+		if (parent == NoContext) return NoContext;
+
+		auto key = KeyOf(parent, methodSlot);
+		auto context = contextIndex.Find(key);
+		if (context == FlatIndex::NoSlot)
+		{
+			if (contexts.size() >= maxEdges)
+			{
+				overflowContexts++;
+				return NoContext;
+			}
+
+			context = (ULONG)contexts.size();
+			contexts.push_back(ContextNode{ parent, method, 0, 0.0 });
+			contextIndex.Insert(key, context);
+		}
+		return context;
+	}
+
+	inline void Leave(ULONG context, double selfTime)
+	{
+		if (context == NoContext) return;
+
+		contexts[context].calls++;
+		contexts[context].selfTime += selfTime;
+	}
+
+	const vector<CallEdge> &Edges() const
+	{
+		return edges;
+	}
+
+	const vector<ContextNode> &Contexts() const
+	{
+		return contexts;
+	}
+
+	//calls that weren't recorded because the edge table was full
+	ULONG64 OverflowCalls() const
+	{
+		return overflowCalls;
+	}
+
+	//frames entered in a context that didn't fit in the table
+	ULONG64 OverflowContexts() const
+	{
+		return overflowContexts;
+	}
+
+	//the count hottest outermost calls, each followed down along its hottest callee
+	void HottestPaths(size_t count, vector<CallPath> &paths) const;
+
+	//folded stacks (outer;inner <self time in us>, UTF-8) as read by the flame graph tools, one line per context
+	HRESULT WriteFolded(const wchar_t *fileName) const;
+private:
+	CallGraph(CallGraph const&);
+	void operator=(CallGraph const&);
+
+	//NoCaller/RootContext + 1 wraps to 0, the callee part keeps the key from being 0
+	static inline ULONG64 KeyOf(ULONG caller, ULONG callee)
+	{
+		return ((ULONG64)(ULONG)(caller + 1) << 32) | (ULONG64)(callee + 1);
+	}
+
+	FlatIndex index;	//(caller, callee) => edge
+	vector<CallEdge> edges;
+	size_t maxEdges;	//also the limit for contexts
+	ULONG64 overflowCalls;
+
+	FlatIndex contextIndex;	//(parent context, method slot) => context
+	vector<ContextNode> contexts;
+	ULONG64 overflowContexts;
+};
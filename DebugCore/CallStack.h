@@ -0,0 +1,161 @@
+#include "precompiled.h"
+#include "FlatIndex.h"
+
+#pragma once
+
+//one activation of an instrumented method
+struct ShadowFrame
+{
+	MethodInfo *method;
+	ULONG methodSlot;		//breakpoint group of the method, identifies it in the call graph
+	ULONG context;			//calling context in the call graph
+	ULONG64 callers;		//rule callers at or below this frame (RuleEngine::CallerBits)
+	long long entryTime;	//QPC ticks at the entry breakpoint
+	long long childTime;	//QPC ticks spent in instrumented callees (inclusive time of closed child frames)
+};
+
+//exception in flight on a thread, from the first chance notification until its unwind begins
+struct ExceptionState
+{
+	bool pending;
+	int thrownAt;	//depth of the throwing frame, NotFound if the method isn't instrumented (or not on the stack)
+	int unwindTo;	//frames at this depth and above get unwound, NotFound until the handler is known
+};
+
+//per thread stack of instrumented method activations, maintained from entry/exit breakpoints
+//every activation has its own frame, so recursive calls don't overwrite each other's entry time
+class ShadowStack
+{
+public:
+	static const int NotFound = -1;
+
+	ShadowStack()
+	{
+		frames.reserve(64);
+		exception = ExceptionState{ false, NotFound, NotFound };
+	}
+
+	ExceptionState exception;
+
+	inline void Push(MethodInfo *method, ULONG methodSlot, ULONG context, ULONG64 callers, long long time)
+	{
+		frames.push_back(ShadowFrame{ method, methodSlot, context, callers, time, 0 });
+	}
+
+	inline ShadowFrame Pop()
+	{
+		ASSERT(!frames.empty());
+
+		auto frame = frames.back();
+		frames.pop_back();
+		return frame;
+	}
+
+	inline ShadowFrame &Top()
+	{
+		ASSERT(!frames.empty());
+
+		return frames.back();
+	}
+
+	inline ShadowFrame &At(size_t depth)
+	{
+		ASSERT(depth < frames.size());
+
+		return frames[depth];
+	}
+
+	inline size_t Depth() const
+	{
+		return frames.size();
+	}
+
+	//innermost activation of method, searched from the top (normally the top frame is the one we want)
+	inline int Find(const MethodInfo *method) const
+	{
+		for (auto depth = (int)frames.size() - 1; depth >= 0; depth--)
+		{
+			if (frames[depth].method == method) return depth;
+		}
+		return NotFound;
+	}
+
+	//innermost activation of a method by breakpoint group, for callbacks that only know the frame's function
+	inline int FindGroup(ULONG methodSlot) const
+	{
+		return FindGroup(methodSlot, (int)frames.size() - 1);
+	}
+
+	//same, only frames at depth from and below
+	inline int FindGroup(ULONG methodSlot, int from) const
+	{
+		if (from >= (int)frames.size()) from = (int)frames.size() - 1;
+
+		for (auto depth = from; depth >= 0; depth--)
+		{
+			if (frames[depth].methodSlot == methodSlot) return depth;
+		}
+		return NotFound;
+	}
+
+	//drop frames above depth (their exit was never seen)
+	inline void Truncate(size_t depth)
+	{
+		if (depth < frames.size()) frames.resize(depth);
+	}
+
+	//drop all activations of method, their exit won't be seen (breakpoints deactivated)
+	void Remove(const MethodInfo *method)
+	{
+		frames.erase(std::remove_if(frames.begin(), frames.end(), [method](const ShadowFrame &frame) { return frame.method == method; }), frames.end());
+	}
+private:
+	vector<ShadowFrame> frames;
+};
+
+//shadow stacks by thread id, a stack is only allocated the first time a thread hits a breakpoint
+class ThreadStacks
+{
+public:
+	ThreadStacks() : lastThreadId(0), lastStack(nullptr) {}
+
+	inline ShadowStack *Get(DWORD threadId)
+	{
+		//consecutive hits are usually on the same thread
+		if (threadId == lastThreadId) return lastStack;
+
+		auto slot = index.Find(threadId);
+		if (slot == FlatIndex::NoSlot)
+		{
+			slot = (ULONG)stacks.size();
+			stacks.push_back(unique_ptr<ShadowStack>(new ShadowStack()));
+			index.Insert(threadId, slot);
+		}
+
+		lastThreadId = threadId;
+		lastStack = stacks[slot].get();
+		return lastStack;
+	}
+
+	void Remove(const MethodInfo *method)
+	{
+		for (auto stackIt = stacks.begin(); stackIt != stacks.end(); ++stackIt)
+		{
+			(*stackIt)->Remove(method);
+		}
+	}
+
+	void Clear()
+	{
+		index.Clear();
+		stacks.clear();
+		lastThreadId = 0;
+		lastStack = nullptr;
+	}
+private:
+	FlatIndex index;
+	vector<unique_ptr<ShadowStack>> stacks;
+
+	DWORD lastThreadId;
+	ShadowStack *lastStack;
+};
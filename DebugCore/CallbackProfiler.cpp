@@ -0,0 +1,34 @@
+#include "precompiled.h"
+#include "CallbackProfiler.h"
+
+CallbackProfiler::CallbackProfiler()
+{
+	LARGE_INTEGER clockFreq;
+	VERIFY(QueryPerformanceFrequency(&clockFreq));
+	nsPerTick = 1000000000.0 / (double)clockFreq.QuadPart;
+}
+
+const wchar_t *CallbackProfiler::Name(CallbackKind kind)
+{
+	switch (kind)
+	{
+	case CALLBACK_BREAKPOINT: return L"Breakpoint (other)";
+	case CALLBACK_BREAKPOINT_ENTRY: return L"Breakpoint (entry)";
+	case CALLBACK_BREAKPOINT_EXIT: return L"Breakpoint (exit)";
+	case CALLBACK_BREAKPOINT_OPCODE: return L"Breakpoint (opcode)";
+	case CALLBACK_BREAKPOINT_SKIPPED: return L"Breakpoint (thread skipped)";
+	case CALLBACK_EXCEPTION: return L"Exception";
+	case CALLBACK_EXCEPTION_UNWIND: return L"ExceptionUnwind";
+	case CALLBACK_LOAD_MODULE: return L"LoadModule";
+	case CALLBACK_UNLOAD_MODULE: return L"UnloadModule";
+	case CALLBACK_LOAD_CLASS: return L"Load/UnloadClass";
+	case CALLBACK_CREATE_THREAD: return L"CreateThread";
+	case CALLBACK_EXIT_THREAD: return L"ExitThread";
+	case CALLBACK_APPDOMAIN: return L"Create/ExitAppDomain";
+	case CALLBACK_ASSEMBLY: return L"Load/UnloadAssembly";
+	case CALLBACK_NAME_CHANGE: return L"NameChange";
+	case CALLBACK_UNMANAGED: return L"Unmanaged";
+	case CALLBACK_OTHER: return L"Other";
+	default: return L"?";
+	}
+}
@@ -0,0 +1,60 @@
+#include "precompiled.h"
+#include "LatencyHistogram.h"
+
+#pragma once
+
+//debugger callback types we time separately, breakpoints are split by breakpoint kind
+enum CallbackKind
+{
+	CALLBACK_BREAKPOINT,			//not one of ours (or not activated yet)
+	CALLBACK_BREAKPOINT_ENTRY,
+	CALLBACK_BREAKPOINT_EXIT,
+	CALLBACK_BREAKPOINT_OPCODE,
+	CALLBACK_BREAKPOINT_SKIPPED,	//on a thread the thread filter skips
+	CALLBACK_EXCEPTION,
+	CALLBACK_EXCEPTION_UNWIND,
+	CALLBACK_LOAD_MODULE,
+	CALLBACK_UNLOAD_MODULE,
+	CALLBACK_LOAD_CLASS,
+	CALLBACK_CREATE_THREAD,
+	CALLBACK_EXIT_THREAD,
+	CALLBACK_APPDOMAIN,
+	CALLBACK_ASSEMBLY,
+	CALLBACK_NAME_CHANGE,
+	CALLBACK_UNMANAGED,
+	CALLBACK_OTHER,
+	CALLBACK_KINDS
+};
+
+//latency the tracer adds to the target: time from entering a callback until the target is continued, per callback kind
+//only recorded from the debugger callback thread (callbacks are serialized)
+class CallbackProfiler
+{
+public:
+	CallbackProfiler();
+
+	static inline long long Now()
+	{
+		LARGE_INTEGER now;
+		QueryPerformanceCounter(&now);
+		return now.QuadPart;
+	}
+
+	inline void Record(CallbackKind kind, long long start)
+	{
+		histograms[kind].Record((ULONG64)((double)(Now() - start) * nsPerTick));
+	}
+
+	const LatencyHistogram &Histogram(CallbackKind kind) const
+	{
+		return histograms[kind];
+	}
+
+	static const wchar_t *Name(CallbackKind kind);
+private:
+	CallbackProfiler(CallbackProfiler const&);
+	void operator=(CallbackProfiler const&);
+
+	double nsPerTick;
+	LatencyHistogram histograms[CALLBACK_KINDS];
+};
@@ -237,7 +237,7 @@ HRESULT STDMETHODCALLTYPE DbgEngDataTarget::ProvideLibrary(/* [in] */ const WCHA
 }
 
 //this will never be called
-void DbgEngDataTarget::OnBreakpointHit(ICorDebugAppDomain &AppDomain, ICorDebugThread &Thread, ICorDebugBreakpoint &Breakpoint)
+CallbackKind DbgEngDataTarget::OnBreakpointHit(ICorDebugAppDomain &AppDomain, ICorDebugThread &Thread, ICorDebugBreakpoint &Breakpoint)
 {
-	return;
+	return CALLBACK_BREAKPOINT;
 }
\ No newline at end of file
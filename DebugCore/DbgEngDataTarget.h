@@ -23,7 +23,7 @@ public:
 	~DbgEngDataTarget() override;
 	ICorDebugProcess* const CorProcess(void) override;
 	ICorDebugProcess5* const CorProcess5(void) override;
-	void OnBreakpointHit(ICorDebugAppDomain &AppDomain, ICorDebugThread &Thread, ICorDebugBreakpoint &pBreakpoint) override;
+	CallbackKind OnBreakpointHit(ICorDebugAppDomain &AppDomain, ICorDebugThread &Thread, ICorDebugBreakpoint &pBreakpoint) override;
 private:
 	ComPtr<IDebugClient> DebugClient;				//dbgeng native debug controller
 
@@ -1,5 +1,10 @@
 #pragma once
 
+#include "LatencyHistogram.h"
+#include "Predicate.h"
+
+struct PlannedMethod;
+
 //user-defined callback (not implemented yet)
 #define customHandler function<void(void)>
 
@@ -218,8 +223,13 @@ struct MethodInfo
 		}
 
 		this->methodEntered = 0;
-		this->avgTimeInMethod = 0.0;
+		this->methodReturned = 0;
+		this->totalTimeInMethod = 0.0;
+		this->selfTimeInMethod = 0.0;
 		this->methodExitThroughException = 0;
+		this->sampleRate = 1.0;
+		this->predicateTested = 0;
+		this->predicatePassed = 0;
 	}
 
 	ULONG32		appDomainId;
@@ -261,10 +271,53 @@ struct MethodInfo
 		return IsMdStatic(methodAttrFlags) != 0;
 	}
 
-	volatile double avgTimeInMethod;
+	volatile double totalTimeInMethod;	//inclusive, every (also recursive) activation counts
+	volatile double selfTimeInMethod;	//exclusive, time in instrumented callees is subtracted
 	volatile unsigned long methodEntered;
+	volatile unsigned long methodReturned;
 	volatile unsigned long methodExitThroughException;
 
+	double AvgTimeInMethod() const
+	{
+		return methodReturned ? totalTimeInMethod / (double)methodReturned : 0.0;
+	}
+
+	//fraction of the traced time the method's breakpoints were armed (1.0 unless sampling)
+	double sampleRate;
+
+	//estimate of a count as if every hit had been traced
+	double Scaled(double observed) const
+	{
+		return sampleRate > 0.0 ? observed / sampleRate : observed;
+	}
+
+	//latency distribution of regular returns (ns), only allocated once the method returns for the first time
+	unique_ptr<LatencyHistogram> latency;
+
+	inline void RecordLatency(ULONG64 nanoSeconds)
+	{
+		if (!latency) latency = unique_ptr<LatencyHistogram>(new LatencyHistogram());
+		latency->Record(nanoSeconds);
+	}
+
+	//duration of activations left through an exception (ns), kept apart so failures don't skew the regular latencies
+	unique_ptr<LatencyHistogram> exceptionLatency;
+
+	inline void RecordExceptionLatency(ULONG64 nanoSeconds)
+	{
+		if (!exceptionLatency) exceptionLatency = unique_ptr<LatencyHistogram>(new LatencyHistogram());
+		exceptionLatency->Record(nanoSeconds);
+	}
+
+	//conditional breakpoint: fields are only dumped when the predicate holds, its operands resolved for this method
+	shared_ptr<Predicate> predicate;
+	vector<PredicateOperand> predicateOperands;
+	ULONG64 predicateTested;	//callback thread only
+	ULONG64 predicatePassed;
+
+	//its part of the instrumentation plan, the IL scans record their breakpoints in it or replay them from it
+	shared_ptr<PlannedMethod> plan;
+
 	MethodInfo(ULONG32 appDomainId, mdModule moduleToken, mdTypeDef classToken, mdMethodDef methodToken, ICorDebugFunction* corFunction,
 		DWORD classFlags, DWORD methodAttrFlags, DWORD methodImplFlags, COR_SIGNATURE methodSigBytes, ULONG methodSigSize, LPCWSTR parsedSignature)
 		: MethodInfo(appDomainId, moduleToken, classToken, methodToken, corFunction, nullptr, nullptr, nullptr, nullptr,
@@ -283,6 +336,15 @@ struct BreakpointInfo
 
 	volatile ULONG hitCount;
 
+	ULONG slot;				   //position in the debugger's breakpoint slot table, assigned when the breakpoints are activated
+	ULONG methodSlot;		   //breakpoint group of the method, assigned together with slot
+
+	ICorDebugFunctionBreakpoint *corBreakpoint;	//owned by the debugger's breakpoint map
+	bool active;			   //activation state as last set by us, so changing a set of breakpoints doesn't need IsActive calls
+	bool unloaded;			   //its module is gone, it can't be activated anymore (kept for the stats)
+
+	long long suspendedTicks;  //estimated time the target was suspended by this breakpoint (QPC ticks), tracked by the overhead governor
+
 	//std vector sorting
 	bool operator < (const BreakpointInfo& str) const
 	{
@@ -304,7 +366,7 @@ struct ByHitCountPtr : public std::binary_function<shared_ptr<BreakpointInfo>, s
 {
 	inline bool operator() (const shared_ptr<BreakpointInfo>& bp1, const shared_ptr<BreakpointInfo>& bp2) const
 	{
-		return (bp1.get()->hitCount < bp2.get()->hitCount);
+		return bp1->method->Scaled(bp1->hitCount) < bp2->method->Scaled(bp2->hitCount);
 	}
 };
 
@@ -312,7 +374,7 @@ struct ByTimeSpentPtr : public std::binary_function<shared_ptr<MethodInfo>, shar
 {
 	inline bool operator() (const shared_ptr<MethodInfo>& m1, const shared_ptr<MethodInfo>& m2) const
 	{
-		return m1.get()->avgTimeInMethod * (double)m1.get()->methodEntered < m2.get()->avgTimeInMethod * (double)m2.get()->methodEntered;
+		return m1->Scaled(m1->totalTimeInMethod) < m2->Scaled(m2->totalTimeInMethod);
 	}
 };
 
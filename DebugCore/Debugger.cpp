@@ -3,7 +3,7 @@
 #include "Debugger.h"
 #include "LegacyManagedDebugger.h"
 
-Debugger::Debugger(OPMODE mode) : pId(0)
+Debugger::Debugger(OPMODE mode) : pId(0), pauseStart(0), pauseStats(), lastEventStats(), watchLoads(false)
 {
 	this->mode = mode;
 
@@ -12,7 +12,7 @@ Debugger::Debugger(OPMODE mode) : pId(0)
 	timerFreq = (double)clockFreq.QuadPart;
 }
 
-Debugger::Debugger(OPMODE mode, DWORD pId) : pId(0)
+Debugger::Debugger(OPMODE mode, DWORD pId) : pId(0), pauseStart(0), pauseStats(), lastEventStats(), watchLoads(false)
 {
 	this->mode = mode;
 
@@ -117,30 +117,48 @@ void Debugger::Stop()
 
 Debugger::~Debugger()
 {
-	BOOL isActive;
+	FlushEvents();
 
 	TRACE(L"Clearing breakpoints\n");
 
+	//only the ones we know to be active need a round trip
+	if (IsAttached()) ActivateBPs(false);
+
 	for (auto bpIt = managedBPs.begin(); bpIt != managedBPs.end(); ++bpIt)
 	{
-		auto corBP = (*bpIt).first;
-		if (corBP->IsActive(&isActive) == S_OK && isActive) corBP->Activate(false);
-		corBP->Release();
+		(*bpIt).first->Release();
 	}
 	managedBPs.clear();
 
 	Detach();
 }
 
-HRESULT Debugger::GetAppDomains(ICorDebugProcess *pProcess, ICorDebugAppDomain **ppDomains, ULONG maxDomains, ULONG *loadedDomains)
+//the ICorDebug enumerators are read a page at a time into out, so there's no cap on how many there are
+template<typename TEnum, typename T>
+static void ReadAll(TEnum *corEnum, vector<ComPtr<T>> &out)
+{
+	T *page[64];
+	ULONG fetched = 0;
+	while (SUCCEEDED(corEnum->Next(_countof(page), page, &fetched)) && fetched)
+	{
+		for (ULONG it = 0; it < fetched; it++)
+		{
+			ComPtr<T> item;
+			item.Attach(page[it]);
+			out.push_back(item);
+		}
+	}
+}
+
+HRESULT Debugger::GetAppDomains(ICorDebugProcess *pProcess, vector<ComPtr<ICorDebugAppDomain>> &domains)
 {
 	ASSERT(pProcess);
 
 	ComPtr<ICorDebugAppDomainEnum> appDomainEnum;
 	if (pProcess->EnumerateAppDomains(&appDomainEnum) == S_OK)
 	{
-		appDomainEnum->Next(maxDomains, ppDomains, loadedDomains);
-		if (!*loadedDomains)
+		ReadAll(appDomainEnum.Get(), domains);
+		if (domains.empty())
 		{
 			TRACE(L"Failed to retreive process app domain enumerator\n");
 			return E_FAIL;
@@ -151,7 +169,7 @@ HRESULT Debugger::GetAppDomains(ICorDebugProcess *pProcess, ICorDebugAppDomain *
 	return E_FAIL;
 }
 
-HRESULT Debugger::GetRuntimeAssemblies(ICorDebugAppDomain *pAppDomain, ICorDebugAssembly **ppAssemblies, ULONG maxAssemblies, ULONG *loadedAssemblies)
+HRESULT Debugger::GetRuntimeAssemblies(ICorDebugAppDomain *pAppDomain, vector<ComPtr<ICorDebugAssembly>> &assemblies)
 {
 	ASSERT(pAppDomain);
 
@@ -159,8 +177,8 @@ HRESULT Debugger::GetRuntimeAssemblies(ICorDebugAppDomain *pAppDomain, ICorDebug
 	ComPtr<ICorDebugAssemblyEnum> assemblyEnum;
 	if (pAppDomain->EnumerateAssemblies(&assemblyEnum) == S_OK)
 	{
-		assemblyEnum->Next(maxAssemblies, ppAssemblies, loadedAssemblies);
-		if (!*loadedAssemblies)
+		ReadAll(assemblyEnum.Get(), assemblies);
+		if (assemblies.empty())
 		{
 			pAppDomain->GetID(&appDomainId);
 			TRACE(L"Failed to retreive assembly enumerator for appdomain %u\n", appDomainId);
@@ -174,15 +192,15 @@ HRESULT Debugger::GetRuntimeAssemblies(ICorDebugAppDomain *pAppDomain, ICorDebug
 	return E_FAIL;
 }
 
-HRESULT Debugger::GetRuntimeModules(ICorDebugAssembly *pAssembly, ICorDebugModule **ppModules, ULONG maxModules, ULONG *loadedModules)
+HRESULT Debugger::GetRuntimeModules(ICorDebugAssembly *pAssembly, vector<ComPtr<ICorDebugModule>> &modules)
 {
 	ASSERT(pAssembly);
 
 	ComPtr<ICorDebugModuleEnum> moduleEnum;
 	if (pAssembly->EnumerateModules(&moduleEnum) == S_OK)
 	{
-		moduleEnum->Next(maxModules, ppModules, loadedModules);
-		if (!*loadedModules)
+		ReadAll(moduleEnum.Get(), modules);
+		if (modules.empty())
 		{
 			TRACE(L"Failed to retreive module enumerator for assembly\n");
 			return E_FAIL;
@@ -193,1016 +211,2695 @@ HRESULT Debugger::GetRuntimeModules(ICorDebugAssembly *pAssembly, ICorDebugModul
 	return E_FAIL;
 }
 
-void Debugger::FindManagedMethods(wchar_t * namespaceFilterName, const wchar_t * classFilterName, const wchar_t * methodFilterName, const vector<const wchar_t *> &fields, vector<shared_ptr<MethodInfo>> &functions)
+//the name of an app domain, assembly or module, of any length
+template<typename T>
+static const wchar_t* NameOf(T *named, vector<wchar_t> &name)
 {
-	TRACE(L"Find methods in target. Namespace filter %s, class filter %s, method filter %s\n", namespaceFilterName, classFilterName, methodFilterName);
-	//wprintf_s(L"Find methods in target. Namespace filter %s, class filter %s, method filter %s\n", namespaceFilterName, classFilterName, methodFilterName);
+	ULONG32 nameLen = 0;
+	if (FAILED(named->GetName(0, &nameLen, nullptr)) || !nameLen) return L"";
 
-	if (DebugClientManaged)
-	{
-		auto pProcess = DebugClientManaged->CorProcess();
-		ASSERT(pProcess);
+	if (nameLen > name.size()) name.resize(nameLen);
+	if (named->GetName((ULONG32)name.size(), &nameLen, name.data()) != S_OK) return L"";
+	return name.data();
+}
+
+//an assembly's name as the filters see it: the file name of its path, without the extension
+static std::wstring AssemblyFileName(const wchar_t *path)
+{
+	std::wstring name(path);
+
+	auto separator = name.find_last_of(L"\\/");
+	if (separator != std::wstring::npos) name.erase(0, separator + 1);
+
+	auto extension = name.find_last_of(L'.');
+	if ((extension != std::wstring::npos) && ((_wcsicmp(name.c_str() + extension, L".dll") == 0) || (_wcsicmp(name.c_str() + extension, L".exe") == 0))) name.erase(extension);
+
+	return name;
+}
 
-		//foreach appDomain
-		ICorDebugAppDomain *appDomains[20];
-		ULONG numDomains = 0;
+//runs work(0) .. work(count - 1) on a pool of threads, each index once
+static void ParallelFor(size_t count, const function<void(size_t)> &work)
+{
+	auto numWorkers = min((size_t)std::thread::hardware_concurrency(), count);
+	if (numWorkers <= 1)
+	{
+		for (size_t index = 0; index < count; index++) work(index);
+		return;
+	}
 
-		if (GetAppDomains(pProcess, appDomains, sizeof(appDomains), &numDomains) == S_OK)
+	std::atomic<size_t> next(0);
+	vector<std::thread> workers;
+	for (size_t worker = 0; worker < numWorkers; worker++)
+	{
+		workers.push_back(std::thread([&]()
 		{
-			for (ULONG domainIt = 0; domainIt < numDomains; domainIt++)
+			for (auto index = next++; index < count; index = next++)
 			{
-				wchar_t domainName[1024];
-				ULONG32 domainNameLen;
-				VERIFY(appDomains[domainIt]->GetName(sizeof(domainName), &domainNameLen, domainName) == S_OK);
-				ULONG32 domainId;
-				VERIFY(appDomains[domainIt]->GetID(&domainId) == S_OK);
-				TRACE(L"Searching domain: %s\n", domainName);
-				LOG(L"Searching domain: %s\n", domainName);
-
-				//foreach assembly
-				ICorDebugAssembly *assemblies[500];
-				ULONG numAssemblies = 0;
-				if (GetRuntimeAssemblies(appDomains[domainIt], assemblies, sizeof(assemblies), &numAssemblies) == S_OK)
+				try
 				{
-					for (ULONG asmIt = 0; asmIt < numAssemblies; asmIt++)
-					{
-						wchar_t assemblyName[1024];
-						ULONG32 assemblyNameLen;
-						VERIFY(assemblies[asmIt]->GetName(sizeof(assemblyName), &assemblyNameLen, assemblyName) == S_OK);
-						TRACE(L"Searching assembly: %s\n", assemblyName);
-						LOG(L"Searching assembly: %s\n", assemblyName);
-						wprintf_s(L".");
-
-						ICorDebugModule *modules[30];
-						ULONG numModules = 0;
-						//foreach module
-						if (GetRuntimeModules(assemblies[asmIt], modules, sizeof(modules), &numModules) == S_OK)
-						{
-							mdModule moduleToken;
-							for (ULONG modIt = 0; modIt < numModules; modIt++)
-							{
-								VERIFY(modules[modIt]->GetToken(&moduleToken) == S_OK);
-
-								//get types
-								ComPtr<IMetaDataImport2> modMeta;
-								if (modules[modIt]->GetMetaDataInterface(IID_IMetaDataImport, &modMeta) == S_OK)
-								{
-									BOOL dynamic = false;
-									modules[modIt]->IsDynamic(&dynamic);
-
-									//foreach type
-									mdTypeDef moduleTypes[20480];
-									ULONG numTypes;
-									HCORENUM corenum = nullptr;
-									if (modMeta->EnumTypeDefs(&corenum, moduleTypes, sizeof(moduleTypes), &numTypes) == S_OK)
-									{
-										HCORENUM typecorenum;
-
-										// add mdTypeDefNil
-										moduleTypes[numTypes] = mdTypeDefNil;
-										numTypes++;
-
-										for (ULONG typeIt = 0; typeIt < numTypes; typeIt++)
-										{
-											//get type info
-											wchar_t className[20480];
-											ULONG classNameLen;
-											DWORD typeDefFlags;
-											mdToken mdBaseType;
-											if ((modMeta->GetTypeDefProps(moduleTypes[typeIt], className, sizeof(className), &classNameLen, &typeDefFlags, &mdBaseType) != S_OK)) continue;
-
-											//cache the type name
-											auto nameCopy = new wchar_t[classNameLen + 1];
-											VERIFY(wcscpy_s(nameCopy, classNameLen + 1, className) == 0);
-											MetaInfo->AddToCache(moduleTypes[typeIt], shared_ptr<wchar_t>(nameCopy));
-
-											if (dynamic)
-											{
-												LOG(L"Type %s found\n", className);
-											}
-
-											//is the type a class ?
-											//if ((!IsTdClass(typeDefFlags)) && (!IsTdInterface(typeDefFlags)))
-											//		continue; 
-
-											auto typeIsFiltered = false;
-
-											//compare name against classname filter
-											if (classFilterName != nullptr)
-											{
-												if (wcsncmp(className, classFilterName, wcslen(classFilterName)) != 0) typeIsFiltered = true;
-											}
-
-											//compare name against namespace filter
-											if (namespaceFilterName != nullptr)
-											{
-												if (wcsncmp(className, namespaceFilterName, wcslen(namespaceFilterName)) != 0) typeIsFiltered = true;
-											}
-
-											//todo: check against baseclass (can this be assigned to baseclass ?)
-
-
-											//get methods
-											typecorenum = nullptr;
-											mdMethodDef methods[12800];
-											ULONG numMethods;
-											if ((modMeta->EnumMethods(&typecorenum, moduleTypes[typeIt], methods, sizeof(methods), &numMethods) == S_OK) && (numMethods > 0))
-											{
-												mdTypeDef mdClass;
-												wchar_t methodName[20480];
-												ULONG methodNameLen;
-												DWORD methodAttrFlags;
-												PCCOR_SIGNATURE methodSig;
-												ULONG methodSigSize;
-												ULONG methodRVA;
-												DWORD methodImplFlags;
-												for (ULONG methodIt = 0; methodIt < numMethods; methodIt++)
-												{
-													//get method info
-													if (modMeta->GetMethodProps(methods[methodIt], &mdClass, methodName, sizeof(methodName), &methodNameLen, &methodAttrFlags, &methodSig, &methodSigSize, &methodRVA, &methodImplFlags) == S_OK)
-													{
-														//parse signature
-														auto mSigP = unique_ptr<SigParser>(new SigParser(className, methodSig, methodSigSize, methodName, modMeta.Get(), methods[methodIt], methodImplFlags, methodAttrFlags));
-
-														if (moduleTypes[typeIt] == mdTypeDefNil)
-														{
-															TRACE(L"Global method: %s\n", methodName);
-														}
-
-														//cache name
-														auto namebufsize = wcslen(mSigP->Signature()) + 1;
-														auto methodNameCopy = new wchar_t[namebufsize];
-														VERIFY(wcscpy_s(methodNameCopy, namebufsize, mSigP->Signature()) == 0);
-														MetaInfo->AddToCache(methods[methodIt], shared_ptr<wchar_t>(methodNameCopy));
-														//TRACE(L"Add to membercache: %s %X\n", methodNameCopy, methods[methodIt]);
-
-														//only came this far to catch the method signature, early out now
-														if (typeIsFiltered) continue;
-
-														//compare name against methodname filter
-														if (methodFilterName != nullptr)
-														{
-															if (wcsncmp(methodName, methodFilterName, wcslen(methodFilterName)) != 0) continue;
-														}
-
-														//methods with no implementation in managed code can't be breaked into
-														if (IsMiForwardRef(methodImplFlags))
-														{
-															LOG(L"Can not instrument method %s because it's a Forward Reference\n", methodName);
-															continue;
-														}
-
-														if (IsMiInternalCall(methodImplFlags))
-														{
-															LOG(L"Can not instrument method %s because it's an internal call (ECALL)\n", methodName);
-															continue;
-														}
-
-														if (IsMiUnmanaged(methodImplFlags))
-														{
-															LOG(L"Can not instrument method %s because it's unmanaged\n", methodName);
-															continue;
-														}
-
-														//abstract methods have no bodies
-														if (IsMdAbstract(methodAttrFlags))
-														{
-															LOG(L"Can not instrument method %s because it's abstract (no body)\n", methodName);
-															continue;
-														}
-
-														//get the corresponding debug function
-														ICorDebugFunction *pFunction;
-														if (modules[modIt]->GetFunctionFromToken(methods[methodIt], &pFunction) == S_OK)
-														{
-															//OutputDebugString(L"Found method:"); OutputDebugString(className); OutputDebugString(L"::"); OutputDebugString(methodName); OutputDebugString(L"\n");													
-															TRACE(L"Found method: %s\n", mSigP->Signature());
-
-															auto newMethodInfo = shared_ptr<MethodInfo>(new MethodInfo(domainId, moduleToken, mdClass, methods[methodIt], pFunction,
-																typeDefFlags, methodAttrFlags, methodImplFlags, *methodSig, methodSigSize, mSigP->Signature()));
-
-															//resolve calling convention
-															ULONG nativeCallingConv;
-															if (modMeta->GetNativeCallConvFromSig(methodSig, methodSigSize, &nativeCallingConv) == S_OK)
-															{
-																newMethodInfo->nativeCallConv = (CorPinvokeMap)nativeCallingConv;
-															}
-															ULONG manCallConv;
-															if (CorSigUncompressCallingConv(methodSig, methodSigSize, &manCallConv) == S_OK)
-															{
-																newMethodInfo->callConv = (CorCallingConvention)manCallConv;
-															}
-
-															functions.push_back(newMethodInfo);
-
-															//find fields to load on BP hit
-															for (auto searchFieldIt = fields.begin(); searchFieldIt != fields.end(); ++searchFieldIt)
-															{
-																HCORENUM fieldCoreEnum = nullptr;
-																mdFieldDef fieldArray[500];
-																ULONG foundFields;
-																if (modMeta->EnumFieldsWithName(&fieldCoreEnum, moduleTypes[typeIt], *searchFieldIt, fieldArray, sizeof(fieldArray), &foundFields) == S_OK)
-																{
-																	//get field info
-																	mdTypeDef mdClassWeAlreadyKnow;
-																	wchar_t fieldName[2048];
-																	ULONG fieldNameLen;
-																	DWORD fieldAttr;
-																	PCCOR_SIGNATURE fieldSig;
-																	ULONG fieldSigSize;
-																	DWORD CPlusTypeFlags; //value type of field
-																	UVCP_CONSTANT fieldValue;
-																	ULONG fieldValueSize;
-																	for (ULONG fieldNum = 0; fieldNum < foundFields; fieldNum++)
-																	{
-																		if (modMeta->GetFieldProps(fieldArray[fieldNum], &mdClassWeAlreadyKnow, fieldName, sizeof(fieldName), &fieldNameLen, &fieldAttr, &fieldSig, &fieldSigSize, &CPlusTypeFlags, &fieldValue, &fieldValueSize) == S_OK)
-																		{
-																			if (IsMdStatic(methodAttrFlags) && !IsFdStatic(fieldAttr))
-																			{
-																				TRACE(L"Found an instance field: %s but it can't be reached by static method %s::%s\n", fieldName, className, methodName);
-																				continue;
-																			}
-
-																			//if the field is a constant parse its value as a string
-																			wchar_t * constantFieldString = nullptr;
-																			if (CPlusTypeFlags && fieldValue)
-																			{
-																				VERIFY(GetConstValue(CPlusTypeFlags, fieldValue, fieldValueSize, &constantFieldString) == S_OK);
-																			}
-
-																			auto sigP = unique_ptr<SigParser>(new SigParser(className, fieldSig, fieldSigSize, fieldName, modMeta.Get(), fieldArray[fieldNum], 0, fieldAttr));
-
-																			TRACE(L"Found field: %s\n", sigP->Signature());
-
-																			auto fieldInfo = shared_ptr<FieldInfo>(new FieldInfo(fieldArray[fieldNum], fieldName, fieldAttr, *fieldSig, fieldSigSize, CPlusTypeFlags, constantFieldString, sigP->Signature()));
-																			newMethodInfo->fieldsToReadOnBP.push_back(fieldInfo);
-																		}
-																	}
-																}
-															}
-														}
-													}
-												}
-											}
-										}
-									}
-								}
-								else
-								{
-									LOG(L"Failed to get metadata for module\n");
-								}
-								modules[modIt]->Release();
-							}
-						}
-						assemblies[asmIt]->Release();
-					}
+					work(index);
+				}
+				catch (...)
+				{
+					TRACE(L"Exception in worker task %u\n", index);
 				}
-				appDomains[domainIt]->Release();
 			}
-		}
+		}));
 	}
+	for (auto workerIt = workers.begin(); workerIt != workers.end(); ++workerIt) workerIt->join();
 }
 
-HRESULT Debugger::SetBPAtEntry(shared_ptr<MethodInfo> pFunction, customHandler handler)
+//compiled once per search, every type and method name is classified against all filters at once
+static void CompilePatterns(vector<MethodFilter> &filters, FilterPatterns &patterns)
 {
-	//direct (high level) function breakpoint
-	ICorDebugFunctionBreakpoint *newBP;
-	if (pFunction->corFunction->CreateBreakpoint(&newBP) == S_OK)
+	for (auto filterIt = filters.begin(); filterIt != filters.end(); ++filterIt)
 	{
-		auto bpInfo = shared_ptr<BreakpointInfo>(new BreakpointInfo{});
-		bpInfo->method = pFunction;
-		bpInfo->ilOffset = 0;
-		bpInfo->userHandler = handler;
-		bpInfo->CILInstruction = CEE_NOP;
-
-		//global cache of BPs
-		managedBPs[newBP] = bpInfo;
-
-		return S_OK;
+		TRACE(L"Find methods in target. Namespace filter %s, class filter %s, method filter %s\n", filterIt->namespaceFilter, filterIt->classFilter, filterIt->methodFilter);
+		filterIt->matched.clear();
+
+		//an invalid pattern matches nothing
+		std::wstring error;
+		if (!patterns.namespaces.Add(filterIt->namespaceFilter, error)) patterns.namespaces.Add(L"!*", error);
+		if (!patterns.classes.Add(filterIt->classFilter, error)) patterns.classes.Add(L"!*", error);
+		if (!patterns.methods.Add(filterIt->methodFilter, error)) patterns.methods.Add(L"!*", error);
+		if (!patterns.assemblies.Add(filterIt->assemblyFilter, error)) patterns.assemblies.Add(L"!*", error);
+		if (!error.empty()) LOG(L"Filter namespace %s, class %s, method %s, assembly %s: %s, the filter matches nothing\n", filterIt->namespaceFilter, filterIt->classFilter, filterIt->methodFilter, filterIt->assemblyFilter, error.c_str());
 	}
+}
 
-	//IL BP
-	ComPtr<ICorDebugCode> code;
-	if (pFunction->corFunction->GetILCode(&code) == S_OK)
-	{
-		if (code->CreateBreakpoint(0, &newBP) == S_OK)
-		{
-			auto bpInfo = shared_ptr<BreakpointInfo>(new BreakpointInfo{});
-			bpInfo->method = pFunction;
-			bpInfo->ilOffset = 0;
-			bpInfo->userHandler = handler;
-			bpInfo->CILInstruction = CEE_NOP;
+//all filters in one pass over the metadata, a method matched by several filters is found once
+void Debugger::FindManagedMethods(vector<MethodFilter> &filters, vector<shared_ptr<MethodInfo>> &functions)
+{
+	FilterPatterns patterns;
+	CompilePatterns(filters, patterns);
 
-			//global cache of BPs
-			managedBPs[newBP] = bpInfo;
+	if (!DebugClientManaged) return;
 
-			return S_OK;
-		}
+	//modules loading from now on might be missed by the enumeration, they're queued and searched on their own
+	{
+		std::lock_guard<std::mutex> lock(callbackLock);
+		loadFilters = filters;
+		loadPatterns = patterns;
+		watchLoads = (mode & (OPMODE_TIMINGS | OPMODE_FIELDS | OPMODE_STATS)) != 0;
+		knownModules.clear();
+		knownMethods.clear();
 	}
 
-	//native breakpoint
-	if (pFunction->corFunction->GetNativeCode(&code) == S_OK)
+	//a plan saved by an earlier attach with the same filters replaces the search of the modules it has
+	if (!planFile.empty())
 	{
-		if (code->CreateBreakpoint(0, &newBP) == S_OK)
+		auto configHash = InstrumentationPlan::Hash(nullptr);
+		for (auto filterIt = filters.begin(); filterIt != filters.end(); ++filterIt)
 		{
-			auto bpInfo = shared_ptr<BreakpointInfo>(new BreakpointInfo{});
-			bpInfo->method = pFunction;
-			bpInfo->ilOffset = 0;
-			bpInfo->userHandler = handler;
-			bpInfo->CILInstruction = CEE_NOP;
-
-			//global cache of BPs
-			managedBPs[newBP] = bpInfo;
-
-			return S_OK;
+			configHash = InstrumentationPlan::Hash(filterIt->namespaceFilter, configHash);
+			configHash = InstrumentationPlan::Hash(filterIt->classFilter, configHash);
+			configHash = InstrumentationPlan::Hash(filterIt->methodFilter, configHash);
+			configHash = InstrumentationPlan::Hash(filterIt->assemblyFilter, configHash);
+			for (auto fieldIt = filterIt->fields.begin(); fieldIt != filterIt->fields.end(); ++fieldIt)
+			{
+				configHash = InstrumentationPlan::Hash(*fieldIt, configHash);
+			}
+			configHash = InstrumentationPlan::Hash(filterIt->predicate ? filterIt->predicate->Text().c_str() : nullptr, configHash);
 		}
+
+		if (plan.Load(planFile.c_str(), configHash)) LOG(L"Loaded instrumentation plan %s: %u modules\n", planFile.c_str(), plan.Size());
+		else LOG(L"No instrumentation plan for these filters in %s, searching all modules\n", planFile.c_str());
 	}
 
-	//ultimate fallback, leverage native debugger
+	LARGE_INTEGER startTime;
+	QueryPerformanceCounter(&startTime);
 
-	TRACE(L"Failed to set breakpoint at function entry\n");
-	return E_FAIL;
-}
+	auto pProcess = DebugClientManaged->CorProcess();
+	ASSERT(pProcess);
 
-int Debugger::SetBPAtExit(shared_ptr<MethodInfo> pFunction, customHandler handler)
-{
-	ComPtr<ICorDebugCode> ilCode;
-	BOOL isIL;
-	int retval = 0;
+	//the modules to search, in the order they're enumerated
+	vector<shared_ptr<ModuleScan>> scans;
 
-	if ((pFunction->corFunction->GetILCode(&ilCode) == S_OK) && (ilCode != nullptr) && (ilCode->IsIL(&isIL) == S_OK) && isIL)
+	//foreach appDomain
+	vector<ComPtr<ICorDebugAppDomain>> appDomains;
+	vector<wchar_t> name(256);
+	if (GetAppDomains(pProcess, appDomains) == S_OK)
 	{
-		//todo: use the non-deprecated GetCode
-		ULONG32 codeSize;
-		if (ilCode->GetSize(&codeSize) == S_OK)
+		for (auto domainIt = appDomains.begin(); domainIt != appDomains.end(); ++domainIt)
 		{
-			auto buffer = new byte[codeSize];
-			ULONG32 returnedCode;
-			if (GetCode(ilCode.Get(), codeSize, buffer, &returnedCode) == S_OK)
+			auto domainName = NameOf(domainIt->Get(), name);
+			ULONG32 domainId;
+			VERIFY((*domainIt)->GetID(&domainId) == S_OK);
+			TRACE(L"Searching domain: %s\n", domainName);
+			LOG(L"Searching domain: %s\n", domainName);
+
+			//foreach assembly
+			vector<ComPtr<ICorDebugAssembly>> assemblies;
+			if (GetRuntimeAssemblies(domainIt->Get(), assemblies) == S_OK)
 			{
-				int lastExitBP = -1;
-				for (ULONG32 codeIt = 0; codeIt < returnedCode; codeIt++)
+				for (auto asmIt = assemblies.begin(); asmIt != assemblies.end(); ++asmIt)
 				{
-					if (EXITOPCODE(buffer[codeIt]))
+					auto assemblyName = NameOf(asmIt->Get(), name);
+					TRACE(L"Searching assembly: %s\n", assemblyName);
+					LOG(L"Searching assembly: %s\n", assemblyName);
+					wprintf_s(L".");
+					auto assemblyFile = AssemblyFileName(assemblyName);
+
+					vector<ComPtr<ICorDebugModule>> modules;
+					//foreach module
+					if (GetRuntimeModules(asmIt->Get(), modules) == S_OK)
 					{
-						ICorDebugFunctionBreakpoint *bp;
-						if (ilCode->CreateBreakpoint(codeIt, &bp) == S_OK)
-						{
-							auto bpInfo = shared_ptr<BreakpointInfo>(new BreakpointInfo{});
-							bpInfo->method = pFunction;
-							bpInfo->ilOffset = codeIt;
-							bpInfo->userHandler = handler;
-							bpInfo->CILInstruction = buffer[codeIt];
-
-							managedBPs[bp] = bpInfo;
-
-							lastExitBP = codeIt;
-							retval++;
-						}
-						else
+						for (auto modIt = modules.begin(); modIt != modules.end(); ++modIt)
 						{
-							LOG(L"Failed to set breakpoint at location %u, trying to find new bind location in the range %u<%u\n", codeIt, lastExitBP + 1, codeIt - 1);
-							//todo: set breakpoint at highest possible IL offset before this one...or get native sequence points and select the right one
-							for (int backIt = codeIt - 1; backIt > lastExitBP; backIt--)
+							auto scan = shared_ptr<ModuleScan>(new ModuleScan{});
+							scan->domainId = domainId;
+							scan->module = *modIt;
+							scan->assemblyName = assemblyFile;
+							VERIFY(scan->module->GetToken(&scan->moduleToken) == S_OK);
+
+							//the metadata is read by the workers, a module's importer is only used by one of them
+							if (scan->module->GetMetaDataInterface(IID_IMetaDataImport, &scan->meta) == S_OK)
 							{
-								if (ilCode->CreateBreakpoint(backIt, &bp) == S_OK)
-								{
-									auto bpInfo = shared_ptr<BreakpointInfo>(new BreakpointInfo{});
-									bpInfo->method = pFunction;
-									bpInfo->ilOffset = backIt;
-									bpInfo->userHandler = handler;
-									bpInfo->CILInstruction = buffer[codeIt];
-
-									managedBPs[bp] = bpInfo;
-
-									lastExitBP = codeIt;
-									retval++;
+								scan->module->IsDynamic(&scan->dynamic);
 
-									LOG(L"Found available exit breakpoint location for IL location %u at location %u\n", codeIt, backIt);
-
-									break;
+								//a dynamic module's MVID isn't stable, it's always searched
+								if (!planFile.empty() && !scan->dynamic && (scan->meta->GetScopeProps(nullptr, 0, nullptr, &scan->mvid) == S_OK))
+								{
+									scan->plan = plan.Record(scan->mvid);
+									scan->replay = scan->plan->loaded;
 								}
+								scans.push_back(scan);
+							}
+							else
+							{
+								LOG(L"Failed to get metadata for module\n");
 							}
 						}
 					}
 				}
 			}
-			delete[] buffer;
 		}
 	}
-	return retval;
-}
-
-HRESULT Debugger::GetCode(ICorDebugCode *code, ULONG32 bufferSize, byte* buffer, ULONG32 *numBytes)
-{
-	ULONG32 maxChunks = 300;
-	ULONG32 numChunks = 0;
-	CodeChunkInfo chunkInfo[300];
 
-	ULONG32 bufferIndex = 0;
-	//try to do it with non deprecated ICorDebugCode2
-	ComPtr<ICorDebugCode2> code2;
-	if (code->QueryInterface(__uuidof(ICorDebugCode2), &code2) == S_OK)
+	//types, methods and signatures of all modules at once
+	ParallelFor(scans.size(), [&](size_t module)
 	{
-		if (code2->GetCodeChunks(maxChunks, &numChunks, chunkInfo) == S_OK)
-		{
-			ASSERT(DebugClientManaged);
-			auto pProcess = DebugClientManaged->CorProcess();
-			ASSERT(pProcess);
+		LARGE_INTEGER scanStart;
+		QueryPerformanceCounter(&scanStart);
 
-			for (ULONG32 chunkId = 0; chunkId < numChunks; chunkId++)
-			{
-				auto thisChunk = chunkInfo[chunkId];
+		if (scans[module]->replay) ReplayModule(*scans[module], filters);
+		else ScanModule(*scans[module], filters, patterns);
 
-				ULONG32 bytesRead = 0;
-				VERIFY(ReadMemory(pProcess, thisChunk.startAddr, buffer + bufferIndex, thisChunk.length, &bytesRead) == S_OK);
+		LARGE_INTEGER scanEnd;
+		QueryPerformanceCounter(&scanEnd);
+		scans[module]->scanTicks = scanEnd.QuadPart - scanStart.QuadPart;
+	});
 
-				*numBytes += bytesRead;
-				bufferIndex += bytesRead;
-			}
-			return S_OK;
-		}
-	}
-	else
-	{ //fall back to deprecated v1 getcode
-		ULONG32 codeSize = 0;
-		if (code->GetSize(&codeSize) == S_OK)
+	//where the search time goes, by assembly (worker time, the workers run in parallel)
+	struct AssemblyTime
+	{
+		ULONG modules;
+		ULONG skipped;
+		size_t found;
+		long long ticks;
+	};
+	map<std::wstring, AssemblyTime> assemblyTimes;
+
+	//merged in module order, so the result doesn't depend on how the workers were scheduled
+	//a module can be listed more than once (shared by app domains), a method is only kept the first time
+	//the methods found are known to the load callbacks, so a module loading meanwhile isn't instrumented twice
+	std::lock_guard<std::mutex> lock(callbackLock);
+	size_t numFound = 0;
+	size_t numReplayed = 0;
+	for (auto scanIt = scans.begin(); scanIt != scans.end(); ++scanIt)
+	{
+		auto &scan = **scanIt;
+
+		for (auto messageIt = scan.messages.begin(); messageIt != scan.messages.end(); ++messageIt)
 		{
-			return code->GetCode(0, codeSize, bufferSize, buffer, numBytes);
+			LOG(L"%s", messageIt->c_str());
 		}
-	}
-	return E_FAIL;
-}
 
-int Debugger::SetBPAtOpCode(shared_ptr<MethodInfo> pFunction, customHandler handler, CEE_OPCODE opcode)
-{
-	ComPtr<ICorDebugCode> ilCode;
-	BOOL isIL;
-	int retval = 0;
+		//its type and method names are looked up by token when they're needed
+		MetaInfo->AddModule(scan.meta.Get());
+		knownModules.insert(FlatIndex::KeyOf(scan.module.Get()));
 
-	if ((pFunction->corFunction->GetILCode(&ilCode) == S_OK) && (ilCode != nullptr) && (ilCode->IsIL(&isIL) == S_OK) && isIL)
-	{
-		//todo: use the non-deprecated GetCode
-		ULONG32 codeSize;
-		if (ilCode->GetSize(&codeSize) == S_OK)
+		//get the corresponding debug function
+		vector<bool> kept(scan.found.size());
+		for (size_t found = 0; found < scan.found.size(); found++)
 		{
-			auto buffer = new byte[codeSize];
-			ULONG32 returnedCode;
-			if (GetCode(ilCode.Get(), codeSize, buffer, &returnedCode) == S_OK)
-			{
-				//retval = S_OK; // not all methods have newobj, getting the IL is enough for success
-				for (ULONG32 codeIt = 0; codeIt < returnedCode; codeIt++)
-				{
-					if (buffer[codeIt] == opcode)
-					{
-						ICorDebugFunctionBreakpoint *bp;
-						//set bp at exact location or nearest greater IL IP
-						auto codeItDelta = codeIt;
-						HRESULT res;
-						do
-						{
-							res = ilCode->CreateBreakpoint(codeItDelta, &bp);
-							codeItDelta++;
-						} while (res != S_OK && codeItDelta < codeSize);
+			auto &method = scan.found[found];
+			if (!knownMethods.insert(std::make_pair(FlatIndex::KeyOf(scan.module.Get()), method->methodToken)).second) continue;
 
-						if (res == S_OK)
-						{
-							auto bpInfo = shared_ptr<BreakpointInfo>(new BreakpointInfo{});
-							bpInfo->method = pFunction;
-							bpInfo->ilOffset = codeIt;
-							bpInfo->userHandler = handler;
-							bpInfo->CILInstruction = opcode;
+			ICorDebugFunction *pFunction;
+			if (scan.module->GetFunctionFromToken(method->methodToken, &pFunction) != S_OK) continue;
 
-							//optional type token
-							if (CEE_HASTYPETOKEN(opcode))
-							{
-								auto metaToken = load<mdToken>(&buffer[codeIt + CEE_OPBYTES(opcode)]);
-								bpInfo->typeToken = metaToken;
+			method->corFunction.Attach(pFunction);
+			functions.push_back(method);
+			kept[found] = true;
+			numFound++;
+		}
 
-								MetaInfo->ResolveTokenAndAddToCache(metaToken, pFunction->corFunction.Get());
-							}
+		//tell each filter what it matched
+		for (auto matchIt = scan.matches.begin(); matchIt != scan.matches.end(); ++matchIt)
+		{
+			if (kept[matchIt->second]) filters[matchIt->first].matched.push_back(scan.found[matchIt->second]);
+		}
 
-							managedBPs[bp] = bpInfo;
+		auto &assemblyTime = assemblyTimes[scan.assemblyName];
+		assemblyTime.modules++;
+		if (scan.skipped) assemblyTime.skipped++;
+		assemblyTime.found += std::count(kept.begin(), kept.end(), true);
+		assemblyTime.ticks += scan.scanTicks;
 
-							retval++;
-						}
-					}
+		//the methods found are added to the plan, the IL scans fill in their breakpoints
+		if (!scan.plan) continue;
+		if (scan.replay) numReplayed++;
+		for (size_t found = 0; found < scan.found.size(); found++)
+		{
+			auto &method = scan.found[found];
+			auto &planned = scan.plan->methods[method->methodToken];
+			if (!planned)
+			{
+				planned = shared_ptr<PlannedMethod>(new PlannedMethod{});
+				planned->methodToken = method->methodToken;
+				planned->signature = method->parsedSignature.get();
+				for (auto fieldIt = method->fieldsToReadOnBP.begin(); fieldIt != method->fieldsToReadOnBP.end(); ++fieldIt)
+				{
+					planned->fields.push_back((*fieldIt)->fieldToken);
 				}
 			}
-			delete[] buffer;
+			method->plan = planned;
+		}
+		if (!scan.replay)
+		{
+			for (auto matchIt = scan.matches.begin(); matchIt != scan.matches.end(); ++matchIt)
+			{
+				auto &planned = *scan.found[matchIt->second]->plan;
+				if (std::find(planned.filters.begin(), planned.filters.end(), matchIt->first) == planned.filters.end()) planned.filters.push_back(matchIt->first);
+			}
 		}
 	}
-	return retval;
-}
 
+	LARGE_INTEGER endTime;
+	QueryPerformanceCounter(&endTime);
+	LOG(L"Searched %u modules (%u from the plan) for %u filters in %.1f ms, %u methods found\n", scans.size(), numReplayed, filters.size(), (double)(endTime.QuadPart - startTime.QuadPart) * 1000.0 / timerFreq, numFound);
 
-void Debugger::ActivateBPs(BOOL active)
-{
-	TRACE(L"%s all %u registered breakpoints\n", active ? L"Activate" : L"Deactivate", managedBPs.size());
+	vector<std::pair<long long, const std::wstring*>> slowest;
+	ULONG numSkipped = 0;
+	for (auto assemblyIt = assemblyTimes.begin(); assemblyIt != assemblyTimes.end(); ++assemblyIt)
+	{
+		slowest.push_back(std::make_pair(assemblyIt->second.ticks, &assemblyIt->first));
+		numSkipped += assemblyIt->second.skipped;
+	}
+	std::sort(slowest.begin(), slowest.end(), [](const std::pair<long long, const std::wstring*> &a, const std::pair<long long, const std::wstring*> &b) { return a.first > b.first; });
 
-	Stop();
-	for (auto bpIt = managedBPs.begin(); bpIt != managedBPs.end(); ++bpIt)
+	LOG(L"%u modules skipped by their assembly or namespaces, search time by assembly:\n", numSkipped);
+	for (auto slowIt = slowest.begin(); slowIt != slowest.end(); ++slowIt)
 	{
-		auto bp = bpIt->first;
-		BOOL state;
-		if ((bp->IsActive(&state) == S_OK) && (state != active))
-		{
-			if (bp->Activate(active) != S_OK)
-			{
-				TRACE(L"Failed to %s breakpoints\n", active ? L"activate " : L"deactivate ");
-			}
-		}
+		auto &assemblyTime = assemblyTimes[*slowIt->second];
+		LOG(L"  %s: %.2f ms, %u modules (%u skipped), %u methods found\n", slowIt->second->c_str(), (double)slowIt->first * 1000.0 / timerFreq, assemblyTime.modules, assemblyTime.skipped, assemblyTime.found);
 	}
-	Continue();
 
-	TRACE(L"Breakpoints %s\n", active ? L"activated" : L"deactivated");
+	//attach cost in memory, to compare searches
+	PROCESS_MEMORY_COUNTERS memoryCounters;
+	if (GetProcessMemoryInfo(GetCurrentProcess(), &memoryCounters, sizeof(memoryCounters)))
+	{
+		LOG(L"Tracer working set after the search: %.1f MB, peak %.1f MB\n", memoryCounters.WorkingSetSize / 1048576.0, memoryCounters.PeakWorkingSetSize / 1048576.0);
+	}
+}
 
-	return;
+//before FindManagedMethods, the plan is read from and saved to path
+void Debugger::UsePlanFile(const wchar_t *path)
+{
+	planFile = path ? path : L"";
 }
 
-void Debugger::OnBreakpointHit(ICorDebugAppDomain &AppDomain, ICorDebugThread &Thread, ICorDebugBreakpoint &Breakpoint)
+//after the breakpoints are set, so the IL scans are in it
+bool Debugger::SavePlan()
 {
-	//time it before anything else
-	LARGE_INTEGER bpTime;
-	if (!QueryPerformanceCounter(&bpTime)) return;
+	if (planFile.empty()) return false;
 
-	auto currentTime = bpTime.QuadPart;
+	if (!plan.Save(planFile.c_str()))
+	{
+		LOG(L"Failed to save instrumentation plan %s\n", planFile.c_str());
+		return false;
+	}
 
-	//is it a function breakpoint (only thing we support) ?
-	ComPtr<ICorDebugFunctionBreakpoint> fBP;
-	if (Breakpoint.QueryInterface(__uuidof(ICorDebugFunctionBreakpoint), &fBP) != S_OK) return;
+	LOG(L"Saved instrumentation plan %s: %u modules\n", planFile.c_str(), plan.Size());
+	return true;
+}
 
-	//is it in our global cache ?
-	auto pos = managedBPs.find(fBP.Get());
-	if (pos == managedBPs.end()) return;
+//the search of FindManagedMethods on metadata scopes that aren't in a target, e.g. emitted in memory (see Benchmarks): on the
+//workers, or one scope after the other on the calling thread, found gets the methods in scope order
+void Debugger::SearchScopes(vector<MethodFilter> &filters, const vector<ComPtr<IMetaDataImport2>> &scopes, bool parallel, vector<shared_ptr<MethodInfo>> &found)
+{
+	FilterPatterns patterns;
+	CompilePatterns(filters, patterns);
 
-	//find the details about this breakpoint
-	auto mInfo = pos->second->method;
+	vector<shared_ptr<ModuleScan>> scans;
+	for (auto scopeIt = scopes.begin(); scopeIt != scopes.end(); ++scopeIt)
+	{
+		auto scan = shared_ptr<ModuleScan>(new ModuleScan{});
+		scan->meta = *scopeIt;
+		VERIFY(scan->meta->GetModuleFromScope(&scan->moduleToken) == S_OK);
+		scans.push_back(scan);
+	}
 
-	//register hit
-	InterlockedIncrement(&(pos->second->hitCount));
+	auto scanModule = [&](size_t module) { ScanModule(*scans[module], filters, patterns); };
+	if (parallel) ParallelFor(scans.size(), scanModule);
+	else for (size_t module = 0; module < scans.size(); module++) scanModule(module);
 
-	//timing
-	if (mode & OPMODE_TIMINGS)
+	for (auto scanIt = scans.begin(); scanIt != scans.end(); ++scanIt)
+	{
+		auto &scan = **scanIt;
+		for (auto matchIt = scan.matches.begin(); matchIt != scan.matches.end(); ++matchIt)
+		{
+			filters[matchIt->first].matched.push_back(scan.found[matchIt->second]);
+		}
+		found.insert(found.end(), scan.found.begin(), scan.found.end());
+	}
+}
+
+//the metadata getters, into a name buffer that's grown when the name doesn't fit
+static HRESULT ReadTypeDef(IMetaDataImport *modMeta, mdTypeDef typeDef, vector<wchar_t> &name, DWORD *typeDefFlags)
+{
+	mdToken baseType;
+	ULONG nameLen = 0;
+	auto hr = modMeta->GetTypeDefProps(typeDef, name.data(), (ULONG)name.size(), &nameLen, typeDefFlags, &baseType);
+	if (SUCCEEDED(hr) && (nameLen > name.size()))
+	{
+		name.resize(nameLen);
+		hr = modMeta->GetTypeDefProps(typeDef, name.data(), (ULONG)name.size(), &nameLen, typeDefFlags, &baseType);
+	}
+	return hr;
+}
+
+static HRESULT ReadMethod(IMetaDataImport *modMeta, mdMethodDef method, mdTypeDef *typeDef, vector<wchar_t> &name, DWORD *attrFlags, PCCOR_SIGNATURE *sig, ULONG *sigSize, DWORD *implFlags)
+{
+	ULONG rva;
+	ULONG nameLen = 0;
+	auto hr = modMeta->GetMethodProps(method, typeDef, name.data(), (ULONG)name.size(), &nameLen, attrFlags, sig, sigSize, &rva, implFlags);
+	if (SUCCEEDED(hr) && (nameLen > name.size()))
 	{
-		auto entryBP = pos->second->IsEntryBreakpoint();
-		auto exitBP = pos->second->IsExitBreakpoint();
+		name.resize(nameLen);
+		hr = modMeta->GetMethodProps(method, typeDef, name.data(), (ULONG)name.size(), &nameLen, attrFlags, sig, sigSize, &rva, implFlags);
+	}
+	return hr;
+}
+
+static HRESULT ReadField(IMetaDataImport *modMeta, mdFieldDef field, vector<wchar_t> &name, DWORD *attr, PCCOR_SIGNATURE *sig, ULONG *sigSize, DWORD *CPlusTypeFlags, UVCP_CONSTANT *value, ULONG *valueSize)
+{
+	mdTypeDef typeDef;
+	ULONG nameLen = 0;
+	auto hr = modMeta->GetFieldProps(field, &typeDef, name.data(), (ULONG)name.size(), &nameLen, attr, sig, sigSize, CPlusTypeFlags, value, valueSize);
+	if (SUCCEEDED(hr) && (nameLen > name.size()))
+	{
+		name.resize(nameLen);
+		hr = modMeta->GetFieldProps(field, &typeDef, name.data(), (ULONG)name.size(), &nameLen, attr, sig, sigSize, CPlusTypeFlags, value, valueSize);
+	}
+	return hr;
+}
 
-		DWORD threadId;
-		if ((exitBP || entryBP) && (Thread.GetID(&threadId) == S_OK))
+//the namespaces of a module's types, from the TypeDef table: the rows only hold string heap offsets, so a namespace is
+//decoded once no matter how many types it has, and no type name is formatted
+static HRESULT ReadNamespaces(IMetaDataImport *modMeta, vector<std::wstring> &namespaces)
+{
+	const ULONG typeDefTable = 2;
+	const ULONG nameColumn = 1;
+	const ULONG namespaceColumn = 2;
+
+	ComPtr<IMetaDataTables> tables;
+	if (modMeta->QueryInterface(IID_IMetaDataTables, &tables) != S_OK) return E_NOINTERFACE;
+
+	ULONG rowSize, numRows, numColumns, keyColumn;
+	const char *tableName;
+	auto hr = tables->GetTableInfo(typeDefTable, &rowSize, &numRows, &numColumns, &keyColumn, &tableName);
+	if (FAILED(hr)) return hr;
+
+	set<ULONG> seenOffsets;
+	set<std::string> names;
+	std::string dotted;
+	for (ULONG row = 1; row <= numRows; row++)
+	{
+		ULONG nameOffset, namespaceOffset;
+		const char *name;
+		const char *namespaceName;
+		if (FAILED(tables->GetColumn(typeDefTable, nameColumn, row, &nameOffset)) || FAILED(tables->GetColumn(typeDefTable, namespaceColumn, row, &namespaceOffset))) return E_FAIL;
+		if (FAILED(tables->GetString(nameOffset, &name))) return E_FAIL;
+
+		//the search takes everything up to the last . of the full name, a name with a . in it adds to the namespace
+		auto nameDot = strrchr(name, '.');
+		if (!nameDot && !seenOffsets.insert(namespaceOffset).second) continue;
+		if (FAILED(tables->GetString(namespaceOffset, &namespaceName))) return E_FAIL;
+
+		if (!nameDot)
 		{
-			auto crudeHash = pos->second->method->methodToken ^ threadId;
+			names.insert(namespaceName);
+			continue;
+		}
 
-			if (exitBP)
-			{
-				//check for pending timer on this methodInfo + threadId get time spent
-				auto timerSearch = pendingTimers.find(crudeHash);
-				if (timerSearch != pendingTimers.end())
-				{
-					auto pendingInfo = (*timerSearch).second;
-					//remove from pending
-					pendingTimers.erase(timerSearch);
+		dotted = namespaceName;
+		if (!dotted.empty()) dotted += '.';
+		dotted.append(name, nameDot - name);
+		names.insert(dotted);
+	}
+
+	for (auto nameIt = names.begin(); nameIt != names.end(); ++nameIt)
+	{
+		auto length = MultiByteToWideChar(CP_UTF8, 0, nameIt->c_str(), (int)nameIt->size(), nullptr, 0);
+		std::wstring wideName(length, L'\0');
+		if (length) MultiByteToWideChar(CP_UTF8, 0, nameIt->c_str(), (int)nameIt->size(), &wideName[0], length);
+		namespaces.push_back(wideName);
+	}
+	return S_OK;
+}
 
-					auto timeDiff = ((double)currentTime - pendingInfo.timeStamp) / timerFreq;
+//the filters that can match anything in a module, decided before its types are enumerated: its assembly against the assembly
+//patterns, and its namespaces against the namespace patterns, false if none can
+bool Debugger::SelectFilters(ModuleScan &scan, const vector<MethodFilter> &filters, const FilterPatterns &patterns)
+{
+	vector<bool> matches;
+	patterns.assemblies.Classify(scan.assemblyName.c_str(), matches);
+	scan.filters.assign(matches.begin(), matches.end());
+	if (std::find(scan.filters.begin(), scan.filters.end(), true) == scan.filters.end()) return false;
 
-					//update methodInfo
-					auto totalTime = (mInfo->avgTimeInMethod * (double)(mInfo->methodEntered - 1)) + timeDiff;
-					mInfo->avgTimeInMethod = totalTime / (double)mInfo->methodEntered;
-				}
-			}
-			else
-			{
-				//create pending timer for this methodInfo + threadId
-				pendingTimers[crudeHash] = PendingTimer{ currentTime, threadId, pos->second->method->methodToken, pos->second->method };
+	//a dynamic module gets new types after it's searched, its namespaces aren't known up front
+	if (scan.dynamic) return true;
 
-				//increment method entered count
-				InterlockedIncrement(&(mInfo->methodEntered));
-			}
+	auto namespaces = NamespacesOf(scan);
+	if (!namespaces) return true;
+
+	vector<bool> reachable(filters.size(), false);
+	for (auto namespaceIt = namespaces->begin(); namespaceIt != namespaces->end(); ++namespaceIt)
+	{
+		patterns.namespaces.Classify(namespaceIt->c_str(), matches, L'.');
+		for (size_t filter = 0; filter < filters.size(); filter++)
+		{
+			if (matches[filter]) reachable[filter] = true;
 		}
 	}
 
-	//no field dumping ? -> return
-	if ((mode & OPMODE_FIELDS) == 0) return;
+	auto any = false;
+	for (size_t filter = 0; filter < filters.size(); filter++)
+	{
+		scan.filters[filter] = scan.filters[filter] && reachable[filter];
+		if (scan.filters[filter]) any = true;
+	}
+	return any;
+}
 
-	//check if this is an entry breakpoint
-	if (!pos->second->IsEntryBreakpoint()) return;
+//read once per module (by MVID), nullptr if the tables can't be read
+shared_ptr<vector<std::wstring>> Debugger::NamespacesOf(ModuleScan &scan)
+{
+	if (IsEqualGUID(scan.mvid, GUID_NULL) && (scan.meta->GetScopeProps(nullptr, 0, nullptr, &scan.mvid) != S_OK)) return nullptr;
 
-	auto process5 = DebugClientManaged->CorProcess5();
-	ASSERT(process5);
+	std::pair<ULONG64, ULONG64> mvidKey;
+	static_assert(sizeof(mvidKey) == sizeof(GUID), "an MVID is two ULONG64");
+	memcpy(&mvidKey, &scan.mvid, sizeof(GUID));
 
-	//do we need an object (for instance fields) ?
-	if (!mInfo->IsStatic() && mInfo->InstanceFieldsInToReadOnBP())
 	{
-		//try to get 'this' pointer
-		ComPtr<ICorDebugObjectValue> thisPtr = nullptr;
+		std::lock_guard<std::mutex> lock(namespaceLock);
+		auto cachedIt = namespaceCache.find(mvidKey);
+		if (cachedIt != namespaceCache.end()) return cachedIt->second;
+	}
 
-		//1 - try to get it from the managed stack
-		ComPtr<ICorDebugFrame> frame2;
-		if (Thread.GetActiveFrame(&frame2) == S_OK)
+	auto namespaces = shared_ptr<vector<std::wstring>>(new vector<std::wstring>());
+	if (ReadNamespaces(scan.meta.Get(), *namespaces) != S_OK)
+	{
+		scan.Log(L"Failed to read the namespaces of module %s, all its types are searched\n", scan.assemblyName.c_str());
+		return nullptr;
+	}
+
+	std::lock_guard<std::mutex> lock(namespaceLock);
+	namespaceCache[mvidKey] = namespaces;
+	return namespaces;
+}
+
+//one module of a method search, runs on a worker: only metadata is read, output is kept in the scan until it's merged
+//the types are enumerated a page at a time, so neither the number of types nor of methods is capped
+void Debugger::ScanModule(ModuleScan &scan, const vector<MethodFilter> &filters, const FilterPatterns &patterns)
+{
+	//the framework assemblies a MyCompany. filter can't match in aren't enumerated at all
+	if (!SelectFilters(scan, filters, patterns))
+	{
+		scan.skipped = true;
+		return;
+	}
+
+	ScanBuffers buffers;
+	buffers.typeMatches.resize(filters.size());
+
+	//foreach type
+	auto types = vector<mdTypeDef>(ScanBuffers::TokenPage);
+	ULONG numTypes;
+	HCORENUM typeEnum = nullptr;
+	while ((scan.meta->EnumTypeDefs(&typeEnum, types.data(), (ULONG)types.size(), &numTypes) == S_OK) && numTypes)
+	{
+		for (ULONG typeIt = 0; typeIt < numTypes; typeIt++)
 		{
-			ComPtr<ICorDebugILFrame> ilFrame;
-			if (frame2.As(&ilFrame) == S_OK)
-			{
-				ComPtr<ICorDebugValue> arg0;
-				if (ilFrame->GetArgument(0, &arg0) == S_OK)
-				{
-					//now to get the actual instance
-					ComPtr<ICorDebugReferenceValue> refThis;
-					if (arg0.As(&refThis) == S_OK)
-					{
-						ComPtr<ICorDebugValue> actualThis;
-						if (refThis->Dereference(&actualThis) == S_OK)
-						{
-							//double check it's an object
-							actualThis.As(&thisPtr);
-						}
-					}
-				}
-			}
+			ScanType(scan, filters, patterns, types[typeIt], buffers);
 		}
+	}
+	scan.meta->CloseEnum(typeEnum);
 
-		//2 - try to get it from the register stack (ECX should have it)
-		if (!thisPtr)
+	//global methods
+	ScanType(scan, filters, patterns, mdTypeDefNil, buffers);
+}
+
+void Debugger::ScanType(ModuleScan &scan, const vector<MethodFilter> &filters, const FilterPatterns &patterns, mdTypeDef typeDef, ScanBuffers &buffers)
+{
+	auto &modMeta = scan.meta;
+
+	//get type info
+	DWORD typeDefFlags;
+	if (ReadTypeDef(modMeta.Get(), typeDef, buffers.className, &typeDefFlags) != S_OK) return;
+	auto className = buffers.className.data();
+
+	if (scan.dynamic)
+	{
+		scan.Log(L"Type %s found\n", className);
+	}
+
+	//is the type a class ?
+	//if ((!IsTdClass(typeDefFlags)) && (!IsTdInterface(typeDefFlags)))
+	//		continue; 
+
+	//classify the namespace (the full name up to the last .) and the full name against the filters
+	auto namespaceEnd = wcsrchr(className, L'.');
+	buffers.namespaceName.assign(className, namespaceEnd ? namespaceEnd - className : 0);
+	patterns.namespaces.Classify(buffers.namespaceName.c_str(), buffers.namespaceMatches, L'.');
+	patterns.classes.Classify(className, buffers.nameMatches);
+
+	auto &typeMatches = buffers.typeMatches;
+	auto typeIsFiltered = true;
+	for (size_t filter = 0; filter < filters.size(); filter++)
+	{
+		typeMatches[filter] = scan.filters[filter] && buffers.namespaceMatches[filter] && buffers.nameMatches[filter];
+		if (typeMatches[filter]) typeIsFiltered = false;
+	}
+
+	//names are formatted when they're looked up (see MetaHelpers), the methods of other types aren't needed
+	if (typeIsFiltered) return;
+
+	//todo: check against baseclass (can this be assigned to baseclass ?)
+
+
+	//get methods, a page at a time
+	auto &methods = buffers.methods;
+	ULONG numMethods;
+	HCORENUM methodEnum = nullptr;
+	while ((modMeta->EnumMethods(&methodEnum, typeDef, methods.data(), (ULONG)methods.size(), &numMethods) == S_OK) && numMethods)
+	{
+		mdTypeDef mdClass;
+		DWORD methodAttrFlags;
+		PCCOR_SIGNATURE methodSig;
+		ULONG methodSigSize;
+		DWORD methodImplFlags;
+		for (ULONG methodIt = 0; methodIt < numMethods; methodIt++)
 		{
-			//try to get a Process5...
-			ComPtr<ICorDebugRegisterSet> registers;
-			if (Thread.GetRegisterSet(&registers) == S_OK)
+			//get method info
+			if (ReadMethod(modMeta.Get(), methods[methodIt], &mdClass, buffers.methodName, &methodAttrFlags, &methodSig, &methodSigSize, &methodImplFlags) != S_OK) continue;
+			auto methodName = buffers.methodName.data();
+
+			if (typeDef == mdTypeDefNil)
 			{
-				CONTEXT threadCtx = CONTEXT{};
-				threadCtx.ContextFlags = CONTEXT_INTEGER;
+				TRACE(L"Global method: %s\n", methodName);
+			}
 
-				if (registers->GetThreadContext(sizeof(threadCtx), (BYTE*)&threadCtx) == S_OK)
-				{
-#ifdef _WIN64
-					auto Ecx = threadCtx.Rcx;
-#else
-					auto Ecx = threadCtx.Ecx;
-#endif
-					process5->GetObjectW(Ecx, &thisPtr);
-				}
+			//compare name against the methodname filters of the filters the type passed
+			patterns.methods.Classify(methodName, buffers.nameMatches);
+			auto &methodMatches = buffers.methodMatches;
+			methodMatches.clear();
+			for (ULONG filter = 0; filter < filters.size(); filter++)
+			{
+				if (typeMatches[filter] && buffers.nameMatches[filter]) methodMatches.push_back(filter);
 			}
+			if (methodMatches.empty()) continue;
+
+			//parse signature, only of the methods found
+			auto mSigP = unique_ptr<SigParser>(new SigParser(className, methodSig, methodSigSize, methodName, modMeta.Get(), methods[methodIt], methodImplFlags, methodAttrFlags));
+
+			AddFoundMethod(scan, filters, methodMatches, mdClass, className, typeDefFlags, methods[methodIt], methodName, methodAttrFlags,
+				methodSig, methodSigSize, methodImplFlags, mSigP->Signature(), nullptr, buffers);
 		}
+	}
+	modMeta->CloseEnum(methodEnum);
+}
 
-		//do something with the object (read its fields) if we have it
-		if (thisPtr)
-		{
-			LOG(L"Method entry: %s.%s::%s\n", mInfo->assemblyName, mInfo->className, mInfo->methodName);
-			ComPtr<ICorDebugClass> thisClass;
-			if (thisPtr->GetClass(&thisClass) == S_OK)
-			{
-				for (auto fieldIt = mInfo->fieldsToReadOnBP.begin(); fieldIt != mInfo->fieldsToReadOnBP.end(); fieldIt++)
-				{
-					auto fieldInfo = *fieldIt;
-					if (fieldInfo->IsStatic()) continue;
+//one module of a method search that's in the instrumentation plan: its methods are read by token, nothing is enumerated
+void Debugger::ReplayModule(ModuleScan &scan, const vector<MethodFilter> &filters)
+{
+	auto &modMeta = scan.meta;
+	ScanBuffers buffers;
 
-					ComPtr<ICorDebugValue> fieldValue;
-					if (thisPtr->GetFieldValue(thisClass.Get(), fieldInfo->fieldToken, &fieldValue) == S_OK)
-					{
-						VERIFY(DumpFieldValue(fieldInfo->parsedSignature, fieldValue) == S_OK);
-					}
-				}
-			}
+	vector<ULONG> methodMatches;
+	for (auto plannedIt = scan.plan->methods.begin(); plannedIt != scan.plan->methods.end(); ++plannedIt)
+	{
+		auto &planned = *plannedIt->second;
+
+		mdTypeDef mdClass;
+		DWORD methodAttrFlags;
+		PCCOR_SIGNATURE methodSig;
+		ULONG methodSigSize;
+		DWORD methodImplFlags;
+		DWORD typeDefFlags;
+		if ((ReadMethod(modMeta.Get(), planned.methodToken, &mdClass, buffers.methodName, &methodAttrFlags, &methodSig, &methodSigSize, &methodImplFlags) != S_OK)
+			|| (ReadTypeDef(modMeta.Get(), mdClass, buffers.className, &typeDefFlags) != S_OK))
+		{
+			scan.Log(L"Planned method %s not found, the plan doesn't match the module\n", planned.signature.c_str());
+			continue;
 		}
-		else
+
+		methodMatches.clear();
+		for (auto filterIt = planned.filters.begin(); filterIt != planned.filters.end(); ++filterIt)
 		{
-			TRACE(L"Couldn't find 'this' pointer on stack, skipping instance field dump\n");
+			if (*filterIt < filters.size()) methodMatches.push_back(*filterIt);
 		}
+		if (methodMatches.empty()) continue;
+
+		AddFoundMethod(scan, filters, methodMatches, mdClass, buffers.className.data(), typeDefFlags, planned.methodToken, buffers.methodName.data(), methodAttrFlags,
+			methodSig, methodSigSize, methodImplFlags, planned.signature.c_str(), &planned.fields, buffers);
 	}
+}
 
-	//dump static fields we want
-	ComPtr<ICorDebugClass> classForStatics;
-	ComPtr<ICorDebugFrame> frame;
-	if (mInfo->corFunction->GetClass(&classForStatics) == S_OK)
+//a method matched by the filters in methodMatches: the fields dumped are looked up by the filters' field names, or taken from the plan
+//className and methodName may be in buffers, only its field buffers are used here
+void Debugger::AddFoundMethod(ModuleScan &scan, const vector<MethodFilter> &filters, const vector<ULONG> &methodMatches, mdTypeDef typeDef, const wchar_t *className, DWORD typeDefFlags,
+	mdMethodDef methodToken, const wchar_t *methodName, DWORD methodAttrFlags, PCCOR_SIGNATURE methodSig, ULONG methodSigSize, DWORD methodImplFlags, const wchar_t *signature,
+	const vector<mdFieldDef> *plannedFields, ScanBuffers &buffers)
+{
+	auto &modMeta = scan.meta;
+
+	//methods with no implementation in managed code can't be breaked into
+	if (IsMiForwardRef(methodImplFlags))
 	{
-		if (Thread.GetActiveFrame(&frame) == S_OK)
-		{
-			ComPtr<ICorDebugValue> staticField;
+		scan.Log(L"Can not instrument method %s because it's a Forward Reference\n", methodName);
+		return;
+	}
 
-			auto fieldsToRead = mInfo->fieldsToReadOnBP;
-			for (auto fieldIt = fieldsToRead.begin(); fieldIt != fieldsToRead.end(); ++fieldIt)
-			{
-				auto fieldInfo = *fieldIt;
-				if (!fieldInfo->IsStatic()) continue;
+	if (IsMiInternalCall(methodImplFlags))
+	{
+		scan.Log(L"Can not instrument method %s because it's an internal call (ECALL)\n", methodName);
+		return;
+	}
 
-				if (classForStatics->GetStaticFieldValue(fieldInfo->fieldToken, frame.Get(), &staticField) == S_OK)
-				{
-					VERIFY(DumpFieldValue(fieldInfo->parsedSignature, staticField) == S_OK);
-				}
-			}
-		}
+	if (IsMiUnmanaged(methodImplFlags))
+	{
+		scan.Log(L"Can not instrument method %s because it's unmanaged\n", methodName);
+		return;
 	}
 
-	//dump const fields we want
-	auto fieldsToRead = mInfo->fieldsToReadOnBP;
-	for (auto fieldIt = fieldsToRead.begin(); fieldIt != fieldsToRead.end(); ++fieldIt)
+	//abstract methods have no bodies
+	if (IsMdAbstract(methodAttrFlags))
 	{
-		auto fieldInfo = *fieldIt;
-		if (!fieldInfo->IsConst()) continue;
+		scan.Log(L"Can not instrument method %s because it's abstract (no body)\n", methodName);
+		return;
+	}
 
-		TRACE(L"Field: %s Value: %s (const)\n", fieldInfo->parsedSignature, fieldInfo->fieldConstValue);
-		LOG(L"Field: %s, Value: %s (const)\n", fieldInfo->parsedSignature, fieldInfo->fieldConstValue);
+	//the debug function is looked up on the main thread, the workers only read metadata
+	TRACE(L"Found method: %s\n", signature);
+
+	auto newMethodInfo = shared_ptr<MethodInfo>(new MethodInfo(scan.domainId, scan.moduleToken, typeDef, methodToken, nullptr,
+		typeDefFlags, methodAttrFlags, methodImplFlags, *methodSig, methodSigSize, signature));
+
+	//resolve calling convention
+	ULONG nativeCallingConv;
+	if (modMeta->GetNativeCallConvFromSig(methodSig, methodSigSize, &nativeCallingConv) == S_OK)
+	{
+		newMethodInfo->nativeCallConv = (CorPinvokeMap)nativeCallingConv;
+	}
+	ULONG manCallConv;
+	if (CorSigUncompressCallingConv(methodSig, methodSigSize, &manCallConv) == S_OK)
+	{
+		newMethodInfo->callConv = (CorCallingConvention)manCallConv;
 	}
-}
 
-// Rich logging of some exceptions.		
-void Debugger::LogExceptionDetails(ICorDebugAppDomain &AppDomain, ICorDebugThread &Thread, ICorDebugFrame &Frame, ULONG32 nOffset, CorDebugExceptionCallbackType dwEventType, DWORD dwFlags)
-{
-	ComPtr<ICorDebugValue> exRawVal;
-	ComPtr<ICorDebugReferenceValue> exRawRef;
-	ComPtr<ICorDebugValue> exRaw;
-	ComPtr<ICorDebugObjectValue> current_exception;
-	ComPtr<ICorDebugClass> exClass;
-	mdTypeDef exToken;
+	//one method info however many filters match it, they're told which ones when merging
+	for (auto filterIt = methodMatches.begin(); filterIt != methodMatches.end(); ++filterIt)
+	{
+		scan.matches.push_back(std::make_pair(*filterIt, (ULONG)scan.found.size()));
+	}
+	scan.found.push_back(newMethodInfo);
 
-	// Get exception metadata token.
-	if ((Thread.GetCurrentException(&exRawVal) == S_OK)
-		&& (exRawVal.As(&exRawRef) == S_OK)
-		&& (exRawRef->Dereference(&exRaw) == S_OK)
-		&& (exRaw.As(&current_exception) == S_OK)
-		&& (current_exception->GetClass(&exClass) == S_OK)
-		&& (exClass->GetToken(&exToken) == S_OK))
+	if (buffers.fieldsType != typeDef)
 	{
-		// Try to resolve NullReference (or any other exception - extend).
-		static mdToken NullReferenceToken = mdTokenNil;
+		buffers.fieldsType = typeDef;
+		buffers.typeFieldTokens.clear();
+		buffers.typeFields.clear();
+	}
 
-		if (NullReferenceToken == mdTokenNil)
+	auto &fieldTokens = buffers.fieldTokens;
+	fieldTokens.clear();
+	for (auto filterIt = methodMatches.begin(); filterIt != methodMatches.end(); ++filterIt)
+	{
+		auto &filter = filters[*filterIt];
+
+		//operands of the filter's predicate, by name in this method and class, the first filter with one decides
+		if (filter.predicate && !newMethodInfo->predicate) ResolvePredicate(modMeta.Get(), typeDef, *newMethodInfo, filter.predicate, scan);
+		else if (filter.predicate && (filter.predicate->Text() != newMethodInfo->predicate->Text())) scan.Log(L"Condition %s ignored for %s, it already has condition %s\n", filter.predicate->Text().c_str(), signature, newMethodInfo->predicate->Text().c_str());
+
+		if (plannedFields) continue;
+
+		//find fields to load on BP hit, each name is looked up once per type
+		auto &fields = buffers.fields;
+		for (auto searchFieldIt = filter.fields.begin(); searchFieldIt != filter.fields.end(); ++searchFieldIt)
 		{
-			ComPtr<ICorDebugModule> exModule;
-			ComPtr<IMetaDataImport> exModMeta;
-			if ((exClass->GetModule(&exModule) == S_OK)
-				&& (exModule->GetMetaDataInterface(IID_IMetaDataImport, &exModMeta) == S_OK))
+			auto namedIt = buffers.typeFieldTokens.find(*searchFieldIt);
+			if (namedIt == buffers.typeFieldTokens.end())
 			{
-				wchar_t className[2048];
-				ULONG classNameLen;
-				DWORD typeDefFlags;
-				mdToken baseClass;
-				if (exModMeta->GetTypeDefProps(exToken, className, sizeof(className), &classNameLen, &typeDefFlags, &baseClass) == S_OK)
+				namedIt = buffers.typeFieldTokens.insert(std::make_pair(std::wstring(*searchFieldIt), vector<mdFieldDef>())).first;
+
+				HCORENUM fieldEnum = nullptr;
+				ULONG foundFields;
+				while ((modMeta->EnumFieldsWithName(&fieldEnum, typeDef, *searchFieldIt, fields.data(), (ULONG)fields.size(), &foundFields) == S_OK) && foundFields)
 				{
-					if (wcscmp(className, L"System.NullReferenceException") == 0)
-					{
-						NullReferenceToken = exToken;
-					}
+					namedIt->second.insert(namedIt->second.end(), fields.begin(), fields.begin() + foundFields);
 				}
+				modMeta->CloseEnum(fieldEnum);
 			}
+			fieldTokens.insert(fieldTokens.end(), namedIt->second.begin(), namedIt->second.end());
 		}
+	}
+	if (plannedFields) fieldTokens = *plannedFields;
 
-		// Null reference handling.
-		if (exToken == NullReferenceToken)
+	for (auto fieldIt = fieldTokens.begin(); fieldIt != fieldTokens.end(); ++fieldIt)
+	{
+		//merged with the fields of other filters
+		auto dumped = false;
+		for (auto dumpedIt = newMethodInfo->fieldsToReadOnBP.begin(); dumpedIt != newMethodInfo->fieldsToReadOnBP.end(); ++dumpedIt)
 		{
-			// Find IP.		
-			BOOL hasIL = false;
+			if ((*dumpedIt)->fieldToken == *fieldIt) dumped = true;
+		}
+		if (dumped) continue;
 
-			ComPtr<ICorDebugILFrame> ILFrame;
-			ComPtr<ICorDebugCode> ILCode;
-			ULONG32 ILip;
-			CorDebugMappingResult ILMappingType;
-			if ((Frame.QueryInterface(IID_ICorDebugILFrame, &ILFrame) == S_OK)
-				&& (ILFrame->GetCode(&ILCode) == S_OK)
-				&& (ILFrame->GetIP(&ILip, &ILMappingType) == S_OK))
-			{
-				hasIL = true;
-			}
+		auto resolvedIt = buffers.typeFields.find(*fieldIt);
+		if (resolvedIt == buffers.typeFields.end()) resolvedIt = buffers.typeFields.insert(std::make_pair(*fieldIt, ResolveField(modMeta.Get(), *fieldIt, className, buffers.fieldName))).first;
 
-			// Get the IL code.
-			byte ILBuffer[5000];
-			ULONG32 ILBytes = 0;
-			if (hasIL && (GetCode(ILCode.Get(), 5000, ILBuffer, &ILBytes) == S_OK))
-			{
-				// somehow the returned IL from getcode is always shifted by 1.
-				auto ilPtr = nOffset + 1;
+		auto &fieldInfo = resolvedIt->second;
+		if (!fieldInfo) continue;
 
-				if (ILMappingType == CorDebugMappingResult::MAPPING_APPROXIMATE)
+		if (IsMdStatic(methodAttrFlags) && !IsFdStatic(fieldInfo->fieldAttr))
+		{
+			TRACE(L"Found an instance field: %s but it can't be reached by static method %s::%s\n", fieldInfo->fieldName, className, methodName);
+			continue;
+		}
+
+		newMethodInfo->fieldsToReadOnBP.push_back(fieldInfo);
+	}
+}
+
+//the field info of a dump field, shared by all methods of its type that dump it, nullptr if its metadata can't be read
+shared_ptr<FieldInfo> Debugger::ResolveField(IMetaDataImport *modMeta, mdFieldDef fieldToken, const wchar_t *className, vector<wchar_t> &fieldNameBuffer)
+{
+	DWORD fieldAttr;
+	PCCOR_SIGNATURE fieldSig;
+	ULONG fieldSigSize;
+	DWORD CPlusTypeFlags; //value type of field
+	UVCP_CONSTANT fieldValue;
+	ULONG fieldValueSize;
+	if (ReadField(modMeta, fieldToken, fieldNameBuffer, &fieldAttr, &fieldSig, &fieldSigSize, &CPlusTypeFlags, &fieldValue, &fieldValueSize) != S_OK) return nullptr;
+
+	auto fieldName = fieldNameBuffer.data();
+
+	//if the field is a constant parse its value as a string
+	wchar_t * constantFieldString = nullptr;
+	if (CPlusTypeFlags && fieldValue)
+	{
+		VERIFY(GetConstValue(CPlusTypeFlags, fieldValue, fieldValueSize, &constantFieldString) == S_OK);
+	}
+
+	auto sigP = unique_ptr<SigParser>(new SigParser(className, fieldSig, fieldSigSize, fieldName, modMeta, fieldToken, 0, fieldAttr));
+
+	TRACE(L"Found field: %s\n", sigP->Signature());
+
+	return shared_ptr<FieldInfo>(new FieldInfo(fieldToken, fieldName, fieldAttr, *fieldSig, fieldSigSize, CPlusTypeFlags, constantFieldString, sigP->Signature()));
+}
+
+HRESULT Debugger::SetBPAtEntry(shared_ptr<MethodInfo> pFunction, customHandler handler)
+{
+	//direct (high level) function breakpoint
+	ICorDebugFunctionBreakpoint *newBP;
+	if (pFunction->corFunction->CreateBreakpoint(&newBP) == S_OK)
+	{
+		auto bpInfo = shared_ptr<BreakpointInfo>(new BreakpointInfo{});
+		bpInfo->method = pFunction;
+		bpInfo->ilOffset = 0;
+		bpInfo->userHandler = handler;
+		bpInfo->CILInstruction = CEE_NOP;
+
+		//global cache of BPs
+		RegisterBreakpoint(newBP, bpInfo);
+
+		return S_OK;
+	}
+
+	//IL BP
+	ComPtr<ICorDebugCode> code;
+	if (pFunction->corFunction->GetILCode(&code) == S_OK)
+	{
+		if (code->CreateBreakpoint(0, &newBP) == S_OK)
+		{
+			auto bpInfo = shared_ptr<BreakpointInfo>(new BreakpointInfo{});
+			bpInfo->method = pFunction;
+			bpInfo->ilOffset = 0;
+			bpInfo->userHandler = handler;
+			bpInfo->CILInstruction = CEE_NOP;
+
+			//global cache of BPs
+			RegisterBreakpoint(newBP, bpInfo);
+
+			return S_OK;
+		}
+	}
+
+	//native breakpoint
+	if (pFunction->corFunction->GetNativeCode(&code) == S_OK)
+	{
+		if (code->CreateBreakpoint(0, &newBP) == S_OK)
+		{
+			auto bpInfo = shared_ptr<BreakpointInfo>(new BreakpointInfo{});
+			bpInfo->method = pFunction;
+			bpInfo->ilOffset = 0;
+			bpInfo->userHandler = handler;
+			bpInfo->CILInstruction = CEE_NOP;
+
+			//global cache of BPs
+			RegisterBreakpoint(newBP, bpInfo);
+
+			return S_OK;
+		}
+	}
+
+	//ultimate fallback, leverage native debugger
+
+	TRACE(L"Failed to set breakpoint at function entry\n");
+	return E_FAIL;
+}
+
+int Debugger::SetBPAtExit(shared_ptr<MethodInfo> pFunction, customHandler handler)
+{
+	//the exits an earlier attach to this build found
+	if (pFunction->plan && pFunction->plan->Scanned(CEE_RET)) return ReplayBreakpoints(pFunction, handler, CEE_RET);
+
+	ComPtr<ICorDebugCode> ilCode;
+	BOOL isIL;
+	int retval = 0;
+
+	if ((pFunction->corFunction->GetILCode(&ilCode) == S_OK) && (ilCode != nullptr) && (ilCode->IsIL(&isIL) == S_OK) && isIL)
+	{
+		//todo: use the non-deprecated GetCode
+		ULONG32 codeSize;
+		if (ilCode->GetSize(&codeSize) == S_OK)
+		{
+			auto buffer = new byte[codeSize];
+			ULONG32 returnedCode;
+			if (GetCode(ilCode.Get(), codeSize, buffer, &returnedCode) == S_OK)
+			{
+				int lastExitBP = -1;
+				for (ULONG32 codeIt = 0; codeIt < returnedCode; codeIt++)
 				{
-					auto i = ilPtr - 1;
-					do
+					if (EXITOPCODE(buffer[codeIt]))
 					{
-						i++;
-					} while (i < ILBytes && !CEE_CANNULLREF(ILBuffer[i]));
+						ICorDebugFunctionBreakpoint *bp;
+						if (ilCode->CreateBreakpoint(codeIt, &bp) == S_OK)
+						{
+							auto bpInfo = shared_ptr<BreakpointInfo>(new BreakpointInfo{});
+							bpInfo->method = pFunction;
+							bpInfo->ilOffset = codeIt;
+							bpInfo->userHandler = handler;
+							bpInfo->CILInstruction = buffer[codeIt];
 
-					// final check.
-					if (i < ILBytes && CEE_CANNULLREF(ILBuffer[i]))
-						ilPtr = i;
+							RegisterBreakpoint(bp, bpInfo);
+							if (pFunction->plan) pFunction->plan->Record(codeIt, codeIt, 0, buffer[codeIt], CEE_RET);
+
+							lastExitBP = codeIt;
+							retval++;
+						}
+						else
+						{
+							LOG(L"Failed to set breakpoint at location %u, trying to find new bind location in the range %u<%u\n", codeIt, lastExitBP + 1, codeIt - 1);
+							//todo: set breakpoint at highest possible IL offset before this one...or get native sequence points and select the right one
+							for (int backIt = codeIt - 1; backIt > lastExitBP; backIt--)
+							{
+								if (ilCode->CreateBreakpoint(backIt, &bp) == S_OK)
+								{
+									auto bpInfo = shared_ptr<BreakpointInfo>(new BreakpointInfo{});
+									bpInfo->method = pFunction;
+									bpInfo->ilOffset = backIt;
+									bpInfo->userHandler = handler;
+									bpInfo->CILInstruction = buffer[codeIt];
+
+									RegisterBreakpoint(bp, bpInfo);
+									if (pFunction->plan) pFunction->plan->Record(backIt, backIt, 0, buffer[codeIt], CEE_RET);
+
+									lastExitBP = codeIt;
+									retval++;
+
+									LOG(L"Found available exit breakpoint location for IL location %u at location %u\n", codeIt, backIt);
+
+									break;
+								}
+							}
+						}
+					}
 				}
+				if (pFunction->plan) pFunction->plan->scans.push_back(CEE_RET);
+			}
+			delete[] buffer;
+		}
+	}
+	return retval;
+}
 
-				
-				auto opcode = ILBuffer[ilPtr];
-				mdToken typeToken = CEE_HASTYPETOKEN(opcode) ? *reinterpret_cast<mdToken*>(ILBuffer + ilPtr + CEE_OPBYTES(opcode)) : mdTokenNil;
-				
-				ComPtr<ICorDebugFunction> pFunction;
-				mdMethodDef functionToken;
-				if ((Frame.GetFunction(&pFunction) == S_OK)
-					&& (pFunction->GetToken(&functionToken) == S_OK))
+//sets the breakpoints an IL scan recorded in the plan, without reading the IL
+int Debugger::ReplayBreakpoints(shared_ptr<MethodInfo> pFunction, customHandler handler, CEE_OPCODE scan)
+{
+	ComPtr<ICorDebugCode> ilCode;
+	int retval = 0;
+
+	if ((pFunction->corFunction->GetILCode(&ilCode) != S_OK) || (ilCode == nullptr)) return retval;
+
+	auto &planned = pFunction->plan->breakpoints;
+	for (auto plannedIt = planned.begin(); plannedIt != planned.end(); ++plannedIt)
+	{
+		if (plannedIt->scan != scan) continue;
+
+		ICorDebugFunctionBreakpoint *bp;
+		if (ilCode->CreateBreakpoint(plannedIt->bindOffset, &bp) != S_OK)
+		{
+			LOG(L"Failed to set planned breakpoint at location %u of %s\n", plannedIt->bindOffset, pFunction->parsedSignature.get());
+			continue;
+		}
+
+		auto bpInfo = shared_ptr<BreakpointInfo>(new BreakpointInfo{});
+		bpInfo->method = pFunction;
+		bpInfo->ilOffset = plannedIt->ilOffset;
+		bpInfo->userHandler = handler;
+		bpInfo->CILInstruction = plannedIt->instruction;
+
+		if ((scan != CEE_RET) && CEE_HASTYPETOKEN(plannedIt->instruction))
+		{
+			bpInfo->typeToken = plannedIt->typeToken;
+			MetaInfo->ResolveTokenAndAddToCache(plannedIt->typeToken, pFunction->corFunction.Get());
+		}
+
+		RegisterBreakpoint(bp, bpInfo);
+		retval++;
+	}
+	return retval;
+}
+
+HRESULT Debugger::GetCode(ICorDebugCode *code, ULONG32 bufferSize, byte* buffer, ULONG32 *numBytes)
+{
+	ULONG32 maxChunks = 300;
+	ULONG32 numChunks = 0;
+	CodeChunkInfo chunkInfo[300];
+
+	ULONG32 bufferIndex = 0;
+	//try to do it with non deprecated ICorDebugCode2
+	ComPtr<ICorDebugCode2> code2;
+	if (code->QueryInterface(__uuidof(ICorDebugCode2), &code2) == S_OK)
+	{
+		if (code2->GetCodeChunks(maxChunks, &numChunks, chunkInfo) == S_OK)
+		{
+			ASSERT(DebugClientManaged);
+			auto pProcess = DebugClientManaged->CorProcess();
+			ASSERT(pProcess);
+
+			for (ULONG32 chunkId = 0; chunkId < numChunks; chunkId++)
+			{
+				auto thisChunk = chunkInfo[chunkId];
+
+				ULONG32 bytesRead = 0;
+				VERIFY(ReadMemory(pProcess, thisChunk.startAddr, buffer + bufferIndex, thisChunk.length, &bytesRead) == S_OK);
+
+				*numBytes += bytesRead;
+				bufferIndex += bytesRead;
+			}
+			return S_OK;
+		}
+	}
+	else
+	{ //fall back to deprecated v1 getcode
+		ULONG32 codeSize = 0;
+		if (code->GetSize(&codeSize) == S_OK)
+		{
+			return code->GetCode(0, codeSize, bufferSize, buffer, numBytes);
+		}
+	}
+	return E_FAIL;
+}
+
+int Debugger::SetBPAtOpCode(shared_ptr<MethodInfo> pFunction, customHandler handler, CEE_OPCODE opcode)
+{
+	if (pFunction->plan && pFunction->plan->Scanned(opcode)) return ReplayBreakpoints(pFunction, handler, opcode);
+
+	ComPtr<ICorDebugCode> ilCode;
+	BOOL isIL;
+	int retval = 0;
+
+	if ((pFunction->corFunction->GetILCode(&ilCode) == S_OK) && (ilCode != nullptr) && (ilCode->IsIL(&isIL) == S_OK) && isIL)
+	{
+		//todo: use the non-deprecated GetCode
+		ULONG32 codeSize;
+		if (ilCode->GetSize(&codeSize) == S_OK)
+		{
+			auto buffer = new byte[codeSize];
+			ULONG32 returnedCode;
+			if (GetCode(ilCode.Get(), codeSize, buffer, &returnedCode) == S_OK)
+			{
+				//retval = S_OK; // not all methods have newobj, getting the IL is enough for success
+				for (ULONG32 codeIt = 0; codeIt < returnedCode; codeIt++)
 				{
-					MetaInfo->ResolveTokenAndAddToCache(functionToken, pFunction.Get());
-				}			
+					if (buffer[codeIt] == opcode)
+					{
+						ICorDebugFunctionBreakpoint *bp;
+						//set bp at exact location or nearest greater IL IP
+						auto codeItDelta = codeIt;
+						HRESULT res;
+						do
+						{
+							res = ilCode->CreateBreakpoint(codeItDelta, &bp);
+							codeItDelta++;
+						} while (res != S_OK && codeItDelta < codeSize);
+
+						if (res == S_OK)
+						{
+							auto bpInfo = shared_ptr<BreakpointInfo>(new BreakpointInfo{});
+							bpInfo->method = pFunction;
+							bpInfo->ilOffset = codeIt;
+							bpInfo->userHandler = handler;
+							bpInfo->CILInstruction = opcode;
+
+							//optional type token
+							if (CEE_HASTYPETOKEN(opcode))
+							{
+								auto metaToken = load<mdToken>(&buffer[codeIt + CEE_OPBYTES(opcode)]);
+								bpInfo->typeToken = metaToken;
+
+								MetaInfo->ResolveTokenAndAddToCache(metaToken, pFunction->corFunction.Get());
+							}
+
+							RegisterBreakpoint(bp, bpInfo);
+							if (pFunction->plan) pFunction->plan->Record(codeItDelta - 1, codeIt, bpInfo->typeToken, opcode, opcode);
+
+							retval++;
+						}
+					}
+				}
+				if (pFunction->plan) pFunction->plan->scans.push_back(opcode);
+			}
+			delete[] buffer;
+		}
+	}
+	return retval;
+}
+
+
+//the breakpoints the mode needs, returns how many were set
+int Debugger::InstrumentMethod(shared_ptr<MethodInfo> pFunction)
+{
+	int numSet = 0;
+
+	if ((mode & OPMODE_FIELDS) || (mode & OPMODE_TIMINGS))
+	{
+		if (SetBPAtEntry(pFunction, []() -> void { /*do something here once we have our breakpoint to custom delegate mapping in place*/	return;	}) == S_OK) numSet++;
+	}
+	if (mode & OPMODE_TIMINGS)
+	{
+		auto numExits = SetBPAtExit(pFunction, nullptr);
+		TRACE(L"%u exit breakpoints set\n", numExits);
+		numSet += numExits;
+	}
+
+	if (mode & OPMODE_STATS)
+	{
+		const CEE_OPCODE allocations[] = { CEE_BOX, CEE_UNBOX, CEE_UNBOXANY, CEE_NEWOBJ, CEE_NEWARR };
+		for (size_t opcode = 0; opcode < _countof(allocations); opcode++)
+		{
+			auto numOpCodes = SetBPAtOpCode(pFunction, nullptr, allocations[opcode]);
+			TRACE(L"%u breakpoints set at opcode 0x%x\n", numOpCodes, allocations[opcode]);
+			numSet += numOpCodes;
+		}
+	}
+	return numSet;
+}
+
+void Debugger::BuildBreakpointIndex()
+{
+	bpSlots.clear();
+	bpSlots.reserve(managedBPs.size());
+
+	bpIndex.Clear();
+	bpIndex.Reserve(managedBPs.size() * 2);
+	addedBPs.clear();
+
+	for (auto bpIt = managedBPs.begin(); bpIt != managedBPs.end(); ++bpIt)
+	{
+		auto slot = (ULONG)bpSlots.size();
+		bpIt->second->slot = slot;
+		bpSlots.push_back(bpIt->second);
+
+		bpIndex.Insert(FlatIndex::KeyOf(bpIt->first), slot);
+
+		//callbacks hand us the ICorDebugBreakpoint interface, index that pointer as well so a hit doesn't need a QueryInterface
+		ComPtr<ICorDebugBreakpoint> baseBP;
+		if ((bpIt->first->QueryInterface(__uuidof(ICorDebugBreakpoint), &baseBP) == S_OK) && (FlatIndex::KeyOf(baseBP.Get()) != FlatIndex::KeyOf(bpIt->first)))
+		{
+			bpIndex.Insert(FlatIndex::KeyOf(baseBP.Get()), slot);
+		}
+	}
+
+	bpGroups.Build(managedBPs, bpSlots.size());
+
+	methodIndex.Clear();
+	methodIndex.Reserve(bpGroups.Size());
+	for (ULONG group = 0; group < bpGroups.Size(); group++)
+	{
+		IndexMethod(group);
+	}
+
+	TRACE(L"Indexed %u breakpoints (%u keys) of %u methods\n", bpSlots.size(), bpIndex.Size(), bpGroups.Size());
+}
+
+//method tokens repeat in every module, a method is indexed by its function object (the debugger hands out one per method)
+void Debugger::IndexMethod(ULONG group)
+{
+	auto function = bpGroups.At(group).method->corFunction.Get();
+	if (function) methodIndex.Insert(FlatIndex::KeyOf(function), group);
+}
+
+//breakpoint group of the method a frame runs, FlatIndex::NoSlot if it isn't instrumented
+ULONG Debugger::MethodGroupOf(ICorDebugFrame &Frame)
+{
+	ComPtr<ICorDebugFunction> function;
+	if (Frame.GetFunction(&function) != S_OK) return FlatIndex::NoSlot;
+
+	return methodIndex.Find(FlatIndex::KeyOf(function.Get()));
+}
+
+//the breakpoints registered since the index was built get the next slots and groups, the ones handed out stay valid
+void Debugger::ExtendBreakpointIndex()
+{
+	auto firstGroup = (ULONG)bpGroups.Size();
+	for (auto bpIt = addedBPs.begin(); bpIt != addedBPs.end(); ++bpIt)
+	{
+		auto slot = (ULONG)bpSlots.size();
+		(*bpIt)->slot = slot;
+		bpSlots.push_back(*bpIt);
+
+		bpIndex.Insert(FlatIndex::KeyOf((*bpIt)->corBreakpoint), slot);
+
+		ComPtr<ICorDebugBreakpoint> baseBP;
+		if (((*bpIt)->corBreakpoint->QueryInterface(__uuidof(ICorDebugBreakpoint), &baseBP) == S_OK) && (FlatIndex::KeyOf(baseBP.Get()) != FlatIndex::KeyOf((*bpIt)->corBreakpoint)))
+		{
+			bpIndex.Insert(FlatIndex::KeyOf(baseBP.Get()), slot);
+		}
+	}
+
+	bpGroups.Append(addedBPs, bpSlots.size());
+	for (auto group = firstGroup; group < bpGroups.Size(); group++)
+	{
+		IndexMethod(group);
+	}
+
+	TRACE(L"Indexed %u more breakpoints of %u methods\n", addedBPs.size(), bpGroups.Size() - firstGroup);
+	addedBPs.clear();
+}
+
+void Debugger::ActivateBPs(BOOL active)
+{
+	ActivateBPs(active, vector<shared_ptr<MethodInfo>>());
+}
+
+//held methods keep their breakpoints off (groups armed later by a rule), they're indexed all the same
+void Debugger::ActivateBPs(BOOL active, const vector<shared_ptr<MethodInfo>> &held)
+{
+	TRACE(L"%s all %u registered breakpoints, %u methods held\n", active ? L"Activate" : L"Deactivate", managedBPs.size(), held.size());
+
+	if (active)
+	{
+		//set with the others, so they're indexed with them
+		InstrumentPending();
+
+		//the aggregator holds on to the slots, drain it before they change
+		FlushEvents();
+
+		std::lock_guard<std::mutex> lock(callbackLock);
+		BuildBreakpointIndex();
+
+		LARGE_INTEGER now;
+		QueryPerformanceCounter(&now);
+
+		//method slots are renumbered with the breakpoint groups, so the edges and timelines of an earlier activation can't be kept
+		if (mode & OPMODE_CALLGRAPH) callGraph.Reset(settings.maxCallEdges);
+		if (settings.intervalMs) timeline.Reset(bpGroups, settings.intervalMs, (size_t)settings.timelineKB * 1024, timerFreq, now.QuadPart);
+		if (rules.Any()) rules.Bind(bpGroups);
+
+		aggregator = unique_ptr<EventAggregator>(new EventAggregator(mode, timerFreq, bpSlots, (mode & OPMODE_CALLGRAPH) ? &callGraph : nullptr, settings.intervalMs ? &timeline : nullptr,
+			rules.Any() ? &rules : nullptr, settings));
+		aggregator->Start();
+
+		if (settings.sampleHits)
+		{
+			sampler = unique_ptr<BreakpointSampler>(new BreakpointSampler(bpGroups, settings.sampleHits, settings.sampleWindowMs, timerFreq, now.QuadPart));
+		}
+		if (settings.overheadBudget > 0.0)
+		{
+			shedMethods.clear();
+			governor = unique_ptr<OverheadGovernor>(new OverheadGovernor(bpGroups, bpSlots, settings.overheadBudget, settings.hitCostMicroSeconds, timerFreq, now.QuadPart));
+		}
+	}
+
+	FlatIndex heldSet;
+	heldSet.Reserve(held.size());
+	for (auto methodIt = held.begin(); methodIt != held.end(); ++methodIt)
+	{
+		heldSet.Insert(FlatIndex::KeyOf(methodIt->get()), 0);
+	}
+
+	//only toggle what differs from the state we set last
+	//a module load callback can add breakpoints meanwhile, the map is only read under the lock
+	vector<BreakpointInfo*> changes;
+	{
+		std::lock_guard<std::mutex> lock(callbackLock);
+		for (auto bpIt = managedBPs.begin(); bpIt != managedBPs.end(); ++bpIt)
+		{
+			if (bpIt->second->unloaded || (active && (heldSet.Find(FlatIndex::KeyOf(bpIt->second->method.get())) != FlatIndex::NoSlot))) continue;
+			if (bpIt->second->active != (active != FALSE)) changes.push_back(bpIt->second.get());
+		}
+	}
+	ToggleBreakpoints(changes, active);
+
+	TRACE(L"Breakpoints %s\n", active ? L"activated" : L"deactivated");
+
+	return;
+}
+
+//activation set: the breakpoints of these methods get the requested state, all others are left as they are
+void Debugger::ActivateMethods(const vector<shared_ptr<MethodInfo>> &methods, BOOL active)
+{
+	FlatIndex methodSet;
+	methodSet.Reserve(methods.size());
+	for (auto methodIt = methods.begin(); methodIt != methods.end(); ++methodIt)
+	{
+		methodSet.Insert(FlatIndex::KeyOf(methodIt->get()), 0);
+	}
+
+	//the groups are flagged before toggling, so a sampling window ending meanwhile doesn't re-arm what's being deactivated
+	vector<BreakpointInfo*> changes;
+	{
+		std::lock_guard<std::mutex> lock(callbackLock);
+		for (auto bpIt = managedBPs.begin(); bpIt != managedBPs.end(); ++bpIt)
+		{
+			auto bpInfo = bpIt->second.get();
+			if (methodSet.Find(FlatIndex::KeyOf(bpInfo->method.get())) == FlatIndex::NoSlot) continue;
+
+			//groups only exist while tracing
+			if (bpInfo->methodSlot < bpGroups.Size()) bpGroups.At(bpInfo->methodSlot).disarmed = !active;
+			if (!bpInfo->unloaded && (bpInfo->active != (active != FALSE))) changes.push_back(bpInfo);
+		}
+	}
+
+	TRACE(L"%s %u breakpoints of %u methods\n", active ? L"Activate" : L"Deactivate", changes.size(), methods.size());
+	ToggleBreakpoints(changes, active);
+
+	//while tracing, calls of deactivated methods in flight won't see their exit breakpoint
+	if (active) return;
+
+	std::lock_guard<std::mutex> lock(callbackLock);
+	if (!aggregator) return;
+
+	for (auto bpIt = changes.begin(); bpIt != changes.end(); ++bpIt)
+	{
+		if ((*bpIt)->IsEntryBreakpoint() && !(*bpIt)->active) aggregator->EmitDisarmed((*bpIt)->slot);
+	}
+}
+
+//toggles the breakpoints in stop-the-world windows of at most settings.maxPauseMs
+void Debugger::ToggleBreakpoints(const vector<BreakpointInfo*> &changes, BOOL active)
+{
+	if (changes.empty()) return;
+
+	//a small batch between clock checks, callbacks can toggle breakpoints too (sampler, governor)
+	const size_t batchSize = 64;
+
+	BeginPauseWindow();
+	for (size_t batchStart = 0; batchStart < changes.size(); batchStart += batchSize)
+	{
+		{
+			std::lock_guard<std::mutex> lock(callbackLock);
+
+			auto batchEnd = batchStart + batchSize < changes.size() ? batchStart + batchSize : changes.size();
+			for (auto bpIt = changes.begin() + batchStart; bpIt != changes.begin() + batchEnd; ++bpIt)
+			{
+				auto bpInfo = *bpIt;
+				if (bpInfo->unloaded || (bpInfo->active == (active != FALSE))) continue;
+
+				if (bpInfo->corBreakpoint->Activate(active) == S_OK)
+				{
+					bpInfo->active = active != FALSE;
+					pauseStats.toggled++;
+				}
+				else
+				{
+					TRACE(L"Failed to %s breakpoint\n", active ? L"activate" : L"deactivate");
+				}
+			}
+		}
+
+		//let the target run for a moment if this window is up
+		if (PauseWindowExpired()) SplitPauseWindow();
+	}
+	EndPauseWindow();
+}
+
+//new breakpoints are created active, keep them off until they're activated (they'd only cost a round trip until then)
+void Debugger::RegisterBreakpoint(ICorDebugFunctionBreakpoint *corBreakpoint, shared_ptr<BreakpointInfo> bpInfo)
+{
+	bpInfo->corBreakpoint = corBreakpoint;
+	bpInfo->active = corBreakpoint->Activate(FALSE) != S_OK;
+
+	//global cache of BPs
+	managedBPs[corBreakpoint] = bpInfo;
+	addedBPs.push_back(bpInfo);
+
+	ComPtr<ICorDebugModule> module;
+	if (bpInfo->method->corFunction->GetModule(&module) == S_OK) moduleBPs[FlatIndex::KeyOf(module.Get())].push_back(corBreakpoint);
+}
+
+//stop-the-world windows: long running work while the target is stopped is split, so no single pause exceeds settings.maxPauseMs
+void Debugger::BeginPauseWindow()
+{
+	Stop();
+
+	LARGE_INTEGER now;
+	QueryPerformanceCounter(&now);
+	pauseStart = now.QuadPart;
+}
+
+bool Debugger::PauseWindowExpired() const
+{
+	LARGE_INTEGER now;
+	QueryPerformanceCounter(&now);
+
+	return (double)(now.QuadPart - pauseStart) * 1000.0 / timerFreq >= (double)settings.maxPauseMs;
+}
+
+void Debugger::SplitPauseWindow()
+{
+	EndPauseWindow();
+
+	//give the target a slice at least as long as the maximum pause
+	Sleep(settings.maxPauseMs);
+
+	BeginPauseWindow();
+}
+
+void Debugger::EndPauseWindow()
+{
+	LARGE_INTEGER now;
+	QueryPerformanceCounter(&now);
+	Continue();
+
+	auto pause = (double)(now.QuadPart - pauseStart) / timerFreq;
+	pauseStats.windows++;
+	pauseStats.totalPause += pause;
+	if (pause > pauseStats.maxPause) pauseStats.maxPause = pause;
+}
+
+PauseStats Debugger::GetPauseStats() const
+{
+	return pauseStats;
+}
+
+CallbackKind Debugger::OnBreakpointHit(ICorDebugAppDomain &AppDomain, ICorDebugThread &Thread, ICorDebugBreakpoint &Breakpoint)
+{
+	//time it before anything else
+	LARGE_INTEGER bpTime;
+	if (!QueryPerformanceCounter(&bpTime)) return CALLBACK_BREAKPOINT;
+
+	auto currentTime = bpTime.QuadPart;
+
+	std::lock_guard<std::mutex> lock(callbackLock);
+
+	//threads that aren't of interest are let go before any lookup, no events, sampling or field dumps for them
+	DWORD threadId = 0;
+	Thread.GetID(&threadId);
+	if (!ThreadTraced(Thread, threadId))
+	{
+		threadFilter.CountSkipped();
+		return CALLBACK_BREAKPOINT_SKIPPED;
+	}
+
+	//is it in our global cache ? (usually the callback passes the exact pointer we indexed)
+	auto slot = bpIndex.Find(FlatIndex::KeyOf(&Breakpoint));
+	if (slot == FlatIndex::NoSlot)
+	{
+		//is it a function breakpoint (only thing we support) ?
+		ComPtr<ICorDebugFunctionBreakpoint> fBP;
+		if (Breakpoint.QueryInterface(__uuidof(ICorDebugFunctionBreakpoint), &fBP) != S_OK) return CALLBACK_BREAKPOINT;
+
+		slot = bpIndex.Find(FlatIndex::KeyOf(fBP.Get()));
+		if (slot == FlatIndex::NoSlot) return CALLBACK_BREAKPOINT;
+	}
+
+	//hand it off, counting and timing is done by the aggregator
+	if (aggregator) aggregator->EmitBreakpoint(currentTime, slot, threadId);
+
+	//quota for this window used up ? (the breakpoints of the method are deactivated now)
+	if (sampler && sampler->OnHit(slot, currentTime) && aggregator) aggregator->EmitDisarmed(slot);
+
+	//find the details about this breakpoint
+	auto bpInfo = bpSlots[slot].get();
+
+	//field dumping on entry, a conditional breakpoint skips it (and all formatting) unless its predicate holds
+	if ((mode & OPMODE_FIELDS) && bpInfo->IsEntryBreakpoint() && (!bpInfo->method->predicate || TestPredicate(Thread, bpInfo->method.get()))) DumpFields(Thread, bpInfo->method.get());
+
+	//account the time the target was suspended for this hit, last so the field dump is included
+	if (governor)
+	{
+		LARGE_INTEGER endTime;
+		if (QueryPerformanceCounter(&endTime) && governor->OnHit(slot, endTime.QuadPart - currentTime, endTime.QuadPart)) EnforceBudget(endTime.QuadPart);
+	}
+
+	if (bpInfo->IsEntryBreakpoint()) return CALLBACK_BREAKPOINT_ENTRY;
+	if (bpInfo->IsExitBreakpoint()) return CALLBACK_BREAKPOINT_EXIT;
+	return CALLBACK_BREAKPOINT_OPCODE;
+}
+
+void Debugger::DumpFields(ICorDebugThread &Thread, MethodInfo *mInfo)
+{
+	auto process5 = DebugClientManaged->CorProcess5();
+	ASSERT(process5);
+
+	//do we need an object (for instance fields) ?
+	if (!mInfo->IsStatic() && mInfo->InstanceFieldsInToReadOnBP())
+	{
+		//try to get 'this' pointer
+		ComPtr<ICorDebugObjectValue> thisPtr = nullptr;
+
+		//1 - try to get it from the managed stack
+		ComPtr<ICorDebugFrame> frame2;
+		if (Thread.GetActiveFrame(&frame2) == S_OK)
+		{
+			ComPtr<ICorDebugILFrame> ilFrame;
+			if (frame2.As(&ilFrame) == S_OK)
+			{
+				ComPtr<ICorDebugValue> arg0;
+				if (ilFrame->GetArgument(0, &arg0) == S_OK)
+				{
+					//now to get the actual instance
+					ComPtr<ICorDebugReferenceValue> refThis;
+					if (arg0.As(&refThis) == S_OK)
+					{
+						ComPtr<ICorDebugValue> actualThis;
+						if (refThis->Dereference(&actualThis) == S_OK)
+						{
+							//double check it's an object
+							actualThis.As(&thisPtr);
+						}
+					}
+				}
+			}
+		}
+
+		//2 - try to get it from the register stack (ECX should have it)
+		if (!thisPtr)
+		{
+			//try to get a Process5...
+			ComPtr<ICorDebugRegisterSet> registers;
+			if (Thread.GetRegisterSet(&registers) == S_OK)
+			{
+				CONTEXT threadCtx = CONTEXT{};
+				threadCtx.ContextFlags = CONTEXT_INTEGER;
+
+				if (registers->GetThreadContext(sizeof(threadCtx), (BYTE*)&threadCtx) == S_OK)
+				{
+#ifdef _WIN64
+					auto Ecx = threadCtx.Rcx;
+#else
+					auto Ecx = threadCtx.Ecx;
+#endif
+					process5->GetObjectW(Ecx, &thisPtr);
+				}
+			}
+		}
+
+		//do something with the object (read its fields) if we have it
+		if (thisPtr)
+		{
+			LogEvent(L"Method entry: %s.%s::%s\n", mInfo->assemblyName, mInfo->className, mInfo->methodName);
+			ComPtr<ICorDebugClass> thisClass;
+			if (thisPtr->GetClass(&thisClass) == S_OK)
+			{
+				for (auto fieldIt = mInfo->fieldsToReadOnBP.begin(); fieldIt != mInfo->fieldsToReadOnBP.end(); fieldIt++)
+				{
+					auto fieldInfo = *fieldIt;
+					if (fieldInfo->IsStatic()) continue;
+
+					ComPtr<ICorDebugValue> fieldValue;
+					if (thisPtr->GetFieldValue(thisClass.Get(), fieldInfo->fieldToken, &fieldValue) == S_OK)
+					{
+						VERIFY(DumpFieldValue(fieldInfo->parsedSignature, fieldValue) == S_OK);
+					}
+				}
+			}
+		}
+		else
+		{
+			TRACE(L"Couldn't find 'this' pointer on stack, skipping instance field dump\n");
+		}
+	}
+
+	//dump static fields we want
+	ComPtr<ICorDebugClass> classForStatics;
+	ComPtr<ICorDebugFrame> frame;
+	if (mInfo->corFunction->GetClass(&classForStatics) == S_OK)
+	{
+		if (Thread.GetActiveFrame(&frame) == S_OK)
+		{
+			ComPtr<ICorDebugValue> staticField;
+
+			auto fieldsToRead = mInfo->fieldsToReadOnBP;
+			for (auto fieldIt = fieldsToRead.begin(); fieldIt != fieldsToRead.end(); ++fieldIt)
+			{
+				auto fieldInfo = *fieldIt;
+				if (!fieldInfo->IsStatic()) continue;
+
+				if (classForStatics->GetStaticFieldValue(fieldInfo->fieldToken, frame.Get(), &staticField) == S_OK)
+				{
+					VERIFY(DumpFieldValue(fieldInfo->parsedSignature, staticField) == S_OK);
+				}
+			}
+		}
+	}
+
+	//dump const fields we want
+	auto fieldsToRead = mInfo->fieldsToReadOnBP;
+	for (auto fieldIt = fieldsToRead.begin(); fieldIt != fieldsToRead.end(); ++fieldIt)
+	{
+		auto fieldInfo = *fieldIt;
+		if (!fieldInfo->IsConst()) continue;
+
+		TRACE(L"Field: %s Value: %s (const)\n", fieldInfo->parsedSignature, fieldInfo->fieldConstValue);
+		LogEvent(L"Field: %s, Value: %s (const)\n", fieldInfo->parsedSignature, fieldInfo->fieldConstValue);
+	}
+}
+
+//deactivate the methods costing the most suspension time if the last period went over the overhead budget
+void Debugger::EnforceBudget(long long now)
+{
+	vector<ULONG> shedGroups;
+	if (!governor->Enforce(now, shedGroups)) return;
+
+	auto &shed = governor->Shed();
+	for (auto groupIt = shedGroups.begin(); groupIt != shedGroups.end(); ++groupIt)
+	{
+		auto &group = bpGroups.At(*groupIt);
+		if (aggregator) aggregator->EmitDisarmed(group.firstSlot);
+	}
+
+	for (auto shedIt = shed.end() - shedGroups.size(); shedIt != shed.end(); ++shedIt)
+	{
+		TRACE(L"Overhead governor: shed %s after %.1f s, %.2f%% of wall time suspended\n", shedIt->method->parsedSignature.get(), shedIt->shedAfter, shedIt->overheadShare * 100.0);
+		LogEvent(L"Overhead governor: shed %s after %.1f s, %.2f%% of wall time suspended\n", shedIt->method->parsedSignature.get(), shedIt->shedAfter, shedIt->overheadShare * 100.0);
+	}
+}
+
+// Rich logging of some exceptions.		
+void Debugger::LogExceptionDetails(ICorDebugAppDomain &AppDomain, ICorDebugThread &Thread, ICorDebugFrame &Frame, ULONG32 nOffset, CorDebugExceptionCallbackType dwEventType, DWORD dwFlags)
+{
+	ComPtr<ICorDebugValue> exRawVal;
+	ComPtr<ICorDebugReferenceValue> exRawRef;
+	ComPtr<ICorDebugValue> exRaw;
+	ComPtr<ICorDebugObjectValue> current_exception;
+	ComPtr<ICorDebugClass> exClass;
+	mdTypeDef exToken;
+
+	// Get exception metadata token.
+	if ((Thread.GetCurrentException(&exRawVal) == S_OK)
+		&& (exRawVal.As(&exRawRef) == S_OK)
+		&& (exRawRef->Dereference(&exRaw) == S_OK)
+		&& (exRaw.As(&current_exception) == S_OK)
+		&& (current_exception->GetClass(&exClass) == S_OK)
+		&& (exClass->GetToken(&exToken) == S_OK))
+	{
+		// Try to resolve NullReference (or any other exception - extend).
+		static mdToken NullReferenceToken = mdTokenNil;
+
+		if (NullReferenceToken == mdTokenNil)
+		{
+			ComPtr<ICorDebugModule> exModule;
+			ComPtr<IMetaDataImport> exModMeta;
+			if ((exClass->GetModule(&exModule) == S_OK)
+				&& (exModule->GetMetaDataInterface(IID_IMetaDataImport, &exModMeta) == S_OK))
+			{
+				wchar_t className[2048];
+				ULONG classNameLen;
+				DWORD typeDefFlags;
+				mdToken baseClass;
+				if (exModMeta->GetTypeDefProps(exToken, className, _countof(className), &classNameLen, &typeDefFlags, &baseClass) == S_OK)
+				{
+					if (wcscmp(className, L"System.NullReferenceException") == 0)
+					{
+						NullReferenceToken = exToken;
+					}
+				}
+			}
+		}
+
+		// Null reference handling.
+		if (exToken == NullReferenceToken)
+		{
+			// Find IP.		
+			BOOL hasIL = false;
+
+			ComPtr<ICorDebugILFrame> ILFrame;
+			ComPtr<ICorDebugCode> ILCode;
+			ULONG32 ILip;
+			CorDebugMappingResult ILMappingType;
+			if ((Frame.QueryInterface(IID_ICorDebugILFrame, &ILFrame) == S_OK)
+				&& (ILFrame->GetCode(&ILCode) == S_OK)
+				&& (ILFrame->GetIP(&ILip, &ILMappingType) == S_OK))
+			{
+				hasIL = true;
+			}
+
+			// Get the IL code.
+			byte ILBuffer[5000];
+			ULONG32 ILBytes = 0;
+			if (hasIL && (GetCode(ILCode.Get(), 5000, ILBuffer, &ILBytes) == S_OK))
+			{
+				// somehow the returned IL from getcode is always shifted by 1.
+				auto ilPtr = nOffset + 1;
+
+				if (ILMappingType == CorDebugMappingResult::MAPPING_APPROXIMATE)
+				{
+					auto i = ilPtr - 1;
+					do
+					{
+						i++;
+					} while (i < ILBytes && !CEE_CANNULLREF(ILBuffer[i]));
+
+					// final check.
+					if (i < ILBytes && CEE_CANNULLREF(ILBuffer[i]))
+						ilPtr = i;
+				}
+
+				
+				auto opcode = ILBuffer[ilPtr];
+				mdToken typeToken = CEE_HASTYPETOKEN(opcode) ? *reinterpret_cast<mdToken*>(ILBuffer + ilPtr + CEE_OPBYTES(opcode)) : mdTokenNil;
+				
+				ComPtr<ICorDebugFunction> pFunction;
+				mdMethodDef functionToken;
+				if ((Frame.GetFunction(&pFunction) == S_OK)
+					&& (pFunction->GetToken(&functionToken) == S_OK))
+				{
+					MetaInfo->ResolveTokenAndAddToCache(functionToken, pFunction.Get());
+				}			
+
+				wchar_t* functionName = MetaInfo->GetName(functionToken);
+
+				TRACE(L"IL found: %u locations, dereferencing operation at %u - opcode %#x\n", ILBytes, nOffset, opcode);
+				//LOG(L"IL found: %u locations, dereferencing operation at %u - opcode %#x\n", ILBytes, nOffset, opcode);
+
+				switch (opcode)
+				{
+				case CEE_CALLVIRT:
+				{
+					MetaInfo->ResolveTokenAndAddToCache(typeToken, pFunction.Get());
+
+					TRACE(L"Attempted to call %s on an uninitialized type. In %s IL %u/%u (reported/actual).\n", MetaInfo->GetName(typeToken), functionName, nOffset, ilPtr - 1);
+					LogEvent(L"Attempted to call %s on an uninitialized type. In %s IL %u/%u (reported/actual).\n", MetaInfo->GetName(typeToken), functionName, nOffset, ilPtr - 1);
+					break;
+				}
+				case CEE_THROW:
+					TRACE(L"Attempted to throw an uninitialized exception object. In %s IL %u/%u (reported/actual).\n", functionName, nOffset, ilPtr - 1);
+					LogEvent(L"Attempted to throw an uninitialized exception object. In %s IL %u/%u (reported/actual).\n", functionName, nOffset, ilPtr - 1);
+					break;
+				case CEE_LDLEN:
+					TRACE(L"Attempted to get the length of an uninitialized array. In %s IL %u/%u (reported/actual).\n", functionName, nOffset, ilPtr - 1);
+					LogEvent(L"Attempted to get the length of an uninitialized array. In %s IL %u/%u (reported/actual).\n", functionName, nOffset, ilPtr - 1);
+					break;
+				case CEE_UNBOXANY:
+				{
+					MetaInfo->ResolveTokenAndAddToCache(typeToken, pFunction.Get());
+
+					TRACE(L"Attempted to cast/unbox a value/reference type of type %s using an uninitialized address. In %s IL %u/%u (reported/actual).\n", MetaInfo->GetName(typeToken), functionName, nOffset, ilPtr - 1);
+					LogEvent(L"Attempted to cast/unbox a value/reference type of type %s using an uninitialized address. In %s IL %u/%u (reported/actual).\n", MetaInfo->GetName(typeToken), functionName, nOffset, ilPtr - 1);
+					break;
+				}
+				case CEE_LDFLD:
+				case CEE_LDFLDA:
+				case CEE_STFLD:
+				{
+					MetaInfo->ResolveTokenAndAddToCache(typeToken, pFunction.Get());
+
+					// Todo resolve type/field.
+					auto store = opcode == CEE_STFLD;
+					TRACE(L"Attempted to %s non-static field %s %s an uninitialized type. In %s IL %u/%u (reported/actual).\n", store ? L"store" : L"load", MetaInfo->GetName(typeToken), store ? L"in" : L"from", functionName, nOffset, ilPtr - 1);
+					LogEvent(L"Attempted to %s non-static field %s %s an uninitialized type. In %s IL %u/%u (reported/actual).\n", store ? L"store" : L"load", MetaInfo->GetName(typeToken), store ? L"in" : L"from", functionName, nOffset, ilPtr - 1);
+					break;
+				}
+				case CEE_LDELEM:
+				case CEE_LDELEMA:
+				case CEE_STELEM:
+				{
+					MetaInfo->ResolveTokenAndAddToCache(typeToken, pFunction.Get());
+
+					auto store = opcode == CEE_STELEM;
+					TRACE(L"Attempted to %s elements of type %s %s an uninitialized array. In %s IL %u/%u (reported/actual).\n", store ? L"store" : L"load", MetaInfo->GetName(typeToken), store ? L"in" : L"from", functionName, nOffset, ilPtr - 1);
+					LogEvent(L"Attempted to %s elements of type %s %s an uninitialized array. In %s IL %u/%u (reported/actual).\n", store ? L"store" : L"load", MetaInfo->GetName(typeToken), store ? L"in" : L"from", functionName, nOffset, ilPtr - 1);
+					break;
+				}
+				default:
+					if (opcode >= CEE_LDELEM_I1 && opcode <= CEE_STELEM_REF)
+					{
+						auto typeStr = OpcodeResolver::BuiltInTypeStringByOpcode(opcode);
+						auto store = opcode >= CEE_STELEM_I;
+
+						TRACE(L"Attempted to %s elements of type %s %s an uninitialized array. In %s IL %u/%u (reported/actual).\n", store ? L"store" : L"load", typeStr, store ? L"in" : L"from", functionName, nOffset, ilPtr - 1);
+						LogEvent(L"Attempted to %s elements of type %s %s an uninitialized array. In %s IL %u/%u (reported/actual).\n", store ? L"store" : L"load", typeStr, store ? L"in" : L"from", functionName, nOffset, ilPtr - 1);
+						break;
+					}
+					if (opcode >= CEE_LDIND_I1 && opcode <= CEE_LDIND_REF)
+					{
+						auto typeStr = OpcodeResolver::BuiltInTypeStringByOpcode(opcode);
+
+						TRACE(L"Attempted to load elements of type %s indirectly from an illegal address. In %s IL %u/%u (reported/actual).\n", typeStr, functionName, nOffset, ilPtr - 1);
+						LogEvent(L"Attempted to load elements of type %s indirectly from an illegal address. In %s IL %u/%u (reported/actual).\n", typeStr, functionName, nOffset, ilPtr - 1);
+						break;
+					}
+					if (opcode >= CEE_STIND_REF && opcode <= CEE_STIND_R8)
+					{
+						auto typeStr = OpcodeResolver::BuiltInTypeStringByOpcode(opcode);
+
+						TRACE(L"Attempted to store elements of type %s indirectly to a misaligned or illegal address. In %s IL %u/%u (reported/actual).\n", typeStr, functionName, nOffset, ilPtr - 1);
+						LogEvent(L"Attempted to store elements of type %s indirectly to a misaligned or illegal address. In %s IL %u/%u (reported/actual).\n", typeStr, functionName, nOffset, ilPtr - 1);
+						break;
+					}
+
+
+					if (ILMappingType == CorDebugMappingResult::MAPPING_APPROXIMATE)
+					{
+						TRACE(L"Unable to get NullReference details - approximate mapping. In %s IL %u (reported).\n", functionName, nOffset);
+						LogEvent(L"Unable to get NullReference details - approximate mapping. In %s IL %u (reported).\n", functionName, nOffset);
+					}
+					else
+					{
+						TRACE(L"Unable to get NullReference details - unknown opcode %#x. In %s IL %u/%u (reported/actual).\n", opcode, functionName, nOffset, ilPtr - 1);
+						LogEvent(L"Unable to get NullReference details - unknown opcode %#x\n. In %s IL %u/%u (reported/actual)", opcode, functionName, nOffset, ilPtr - 1);
+					}
+
+					break;
+				}
+			}
+			else
+			{
+				TRACE(L"Null reference thrown in frame with no IL code.\n");
+				LogEvent(L"Null reference thrown in frame with no IL code.\n");
+			}
+		}
+		else
+		{
+			// No NullReference, other types here.
+		}
+	}
+	else
+	{
+		TRACE(L"Failed to get exception metadata.\n");
+		LogEvent(L"Failed to get exception metadata.\n");
+	}
+}
+
+//need to register this as methods can be exited by exception as well as regular returns
+void Debugger::OnException(ICorDebugAppDomain &AppDomain, ICorDebugThread &Thread, ICorDebugFrame &Frame, ULONG32 nOffset, CorDebugExceptionCallbackType dwEventType, DWORD dwFlags)
+{
+	LARGE_INTEGER exTime;
+	if (!QueryPerformanceCounter(&exTime)) return;
+
+	DWORD threadId = 0;
+	if (Thread.GetID(&threadId) != S_OK) return;
+
+	std::lock_guard<std::mutex> lock(callbackLock);
+
+	//skipped threads have no frames on the shadow stacks, only unhandled exceptions are still logged
+	auto traced = ThreadTraced(Thread, threadId);
+	if (!traced && (dwEventType != CorDebugExceptionCallbackType::DEBUG_EXCEPTION_UNHANDLED)) return;
+
+	switch (dwEventType)
+	{
+	case CorDebugExceptionCallbackType::DEBUG_EXCEPTION_FIRST_CHANCE:
+	{
+		// Try to do more rich logging of some special (CLR thrown) exceptions.
+		LogExceptionDetails(AppDomain, Thread, Frame, nOffset, dwEventType, dwFlags);
+
+		//rules on the exception type are evaluated by the aggregator, with the thread's shadow stack
+		auto exceptionId = (aggregator && rules.WatchesExceptions()) ? ExceptionIdOf(Thread) : RuleEngine::NoRule;
+
+		//the aggregator checks if the method in which the exception was thrown is being monitored
+		if (aggregator && ((mode & OPMODE_TIMINGS) || exceptionId != RuleEngine::NoRule)) aggregator->EmitThrown(exTime.QuadPart, threadId, MethodGroupOf(Frame), exceptionId);
+		return;
+	}
+	case CorDebugExceptionCallbackType::DEBUG_EXCEPTION_CATCH_HANDLER_FOUND:
+	{
+		//handler found, the frames in between are closed as abnormal exits once the unwind begins
+		if (aggregator && (mode & OPMODE_TIMINGS))
+		{
+			//a handler in an instrumented method is found on the shadow stack, otherwise count the frames the unwind passes
+			auto handlerGroup = MethodGroupOf(Frame);
+			auto unwindFrames = handlerGroup != FlatIndex::NoSlot ? EventAggregator::UnwindToHandler : CountUnwoundFrames(Thread, Frame);
+			aggregator->EmitHandlerFound(exTime.QuadPart, threadId, handlerGroup, unwindFrames);
+		}
+		return;
+	}
+	case CorDebugExceptionCallbackType::DEBUG_EXCEPTION_UNHANDLED:
+	{
+		//this will lead to failure, just log
+		TRACE(L"Unhandled exception on thread %u\n", threadId);
+		LogEvent(L"Unhandled exception on thread %u\n", threadId);
+
+		if (traced && aggregator && (mode & OPMODE_TIMINGS)) aggregator->EmitException(exTime.QuadPart, TRACE_EVENT_EXCEPTION_ABANDONED, threadId);
+		return;
+	}
+	case CorDebugExceptionCallbackType::DEBUG_EXCEPTION_USER_FIRST_CHANCE:
+	default:
+		return;
+	}
+}
+
+//rule exception id of the exception in flight on Thread: its type, or the nearest base type a rule names
+ULONG Debugger::ExceptionIdOf(ICorDebugThread &Thread)
+{
+	const int maxBaseTypes = 16;
+
+	ComPtr<ICorDebugValue> exRawVal;
+	ComPtr<ICorDebugReferenceValue> exRawRef;
+	ComPtr<ICorDebugValue> exRaw;
+	ComPtr<ICorDebugObjectValue> exObject;
+	ComPtr<ICorDebugClass> exClass;
+	ComPtr<ICorDebugModule> exModule;
+	mdTypeDef exToken;
+	if (!((Thread.GetCurrentException(&exRawVal) == S_OK)
+		&& (exRawVal.As(&exRawRef) == S_OK)
+		&& (exRawRef->Dereference(&exRaw) == S_OK)
+		&& (exRaw.As(&exObject) == S_OK)
+		&& (exObject->GetClass(&exClass) == S_OK)
+		&& (exClass->GetToken(&exToken) == S_OK)
+		&& (exClass->GetModule(&exModule) == S_OK))) return RuleEngine::NoRule;
+
+	//names are only resolved the first time a type is thrown
+	auto typeKey = std::make_pair(FlatIndex::KeyOf(exModule.Get()), exToken);
+	auto cachedIt = exceptionIds.find(typeKey);
+	if (cachedIt != exceptionIds.end()) return cachedIt->second;
+
+	ULONG exceptionId = RuleEngine::NoRule;
+	ComPtr<IMetaDataImport> exModMeta;
+	if (exModule->GetMetaDataInterface(IID_IMetaDataImport, &exModMeta) == S_OK)
+	{
+		//base types in the same module are followed, one in another module (a type ref) is only matched by name
+		mdToken typeToken = exToken;
+		for (int level = 0; (level < maxBaseTypes) && (exceptionId == RuleEngine::NoRule); level++)
+		{
+			wchar_t typeName[1024];
+			ULONG typeNameLen;
+			mdToken baseType = mdTokenNil;
+			if (TypeFromToken(typeToken) == mdtTypeDef)
+			{
+				DWORD typeDefFlags;
+				if (exModMeta->GetTypeDefProps(typeToken, typeName, _countof(typeName), &typeNameLen, &typeDefFlags, &baseType) != S_OK) break;
+			}
+			else if (TypeFromToken(typeToken) == mdtTypeRef)
+			{
+				mdToken resolutionScope;
+				if (exModMeta->GetTypeRefProps(typeToken, &resolutionScope, typeName, _countof(typeName), &typeNameLen) != S_OK) break;
+			}
+			else
+			{
+				break;
+			}
+
+			exceptionId = rules.ExceptionId(typeName);
+			typeToken = baseType;
+		}
+	}
+
+	exceptionIds[typeKey] = exceptionId;
+	return exceptionId;
+}
+
+//second pass of exception handling: the frames above the handler are left now
+void Debugger::OnExceptionUnwind(ICorDebugAppDomain &AppDomain, ICorDebugThread &Thread, CorDebugExceptionUnwindCallbackType dwEventType, DWORD dwFlags)
+{
+	LARGE_INTEGER unwindTime;
+	if (!QueryPerformanceCounter(&unwindTime)) return;
+
+	DWORD threadId = 0;
+	if (Thread.GetID(&threadId) != S_OK) return;
+
+	std::lock_guard<std::mutex> lock(callbackLock);
+
+	if (!aggregator || !(mode & OPMODE_TIMINGS) || !ThreadTraced(Thread, threadId)) return;
+
+	//an intercepted exception doesn't unwind to the handler we were told about
+	auto kind = dwEventType == DEBUG_EXCEPTION_UNWIND_BEGIN ? TRACE_EVENT_EXCEPTION_UNWIND : TRACE_EVENT_EXCEPTION_ABANDONED;
+	aggregator->EmitException(unwindTime.QuadPart, kind, threadId);
+}
+
+//number of frames of armed, instrumented methods the unwind to Handler will leave (they're the top of the thread's shadow stack)
+//walks the real stack, only needed when the handler isn't instrumented
+ULONG Debugger::CountUnwoundFrames(ICorDebugThread &Thread, ICorDebugFrame &Handler)
+{
+	const int maxFrames = 1024;
+
+	CORDB_ADDRESS handlerStart = 0, handlerEnd = 0;
+	if (Handler.GetStackRange(&handlerStart, &handlerEnd) != S_OK) return 0;
+
+	ComPtr<ICorDebugFrame> frame;
+	if (Thread.GetActiveFrame(&frame) != S_OK) return 0;
+
+	ULONG unwound = 0;
+	for (int walked = 0; frame.Get() != nullptr && walked < maxFrames; walked++)
+	{
+		//frames are identified by their stack range, the handler can be a recursive activation of an unwound method
+		CORDB_ADDRESS start = 0, end = 0;
+		if ((frame->GetStackRange(&start, &end) != S_OK) || (start == handlerStart)) break;
+
+		auto group = MethodGroupOf(*frame.Get());
+		if ((group != FlatIndex::NoSlot) && bpGroups.Armed(group)) unwound++;
+
+		ComPtr<ICorDebugFrame> caller;
+		if (frame->GetCaller(&caller) != S_OK) break;
+		frame = caller;
+	}
+
+	return unwound;
+}
+
+//main thread, a module load callback can add breakpoints meanwhile
+void Debugger::GetBPStats(vector<shared_ptr<BreakpointInfo>> &BPStats)
+{
+	std::lock_guard<std::mutex> lock(callbackLock);
+	for (auto bpIt = managedBPs.begin(); bpIt != managedBPs.end(); ++bpIt)
+	{
+		BPStats.push_back((*bpIt).second);
+	}
+}
+
+//breakpoint hits counted so far, the aggregator can be a few events behind the target
+//main thread, it's the one replacing the aggregator
+ULONG64 Debugger::GetTotalHits() const
+{
+	return aggregator ? aggregator->Hits() : 0;
+}
+
+void Debugger::ApplySettings(const TraceSettings &settings)
+{
+	this->settings = settings;
+}
+
+//before the breakpoints are activated, they're bound to the methods then
+void Debugger::ApplyRules(const vector<TraceRule> &rules)
+{
+	std::lock_guard<std::mutex> lock(callbackLock);
+	this->rules.SetRules(rules);
+	exceptionIds.clear();
+
+	//entries and returns are only seen on the shadow stacks when timing
+	if (!rules.empty() && !(mode & OPMODE_TIMINGS)) LOG(L"Rules on methods need timings mode, only exception rules are evaluated\n");
+}
+
+//before tracing, threads are classified when they first hit a breakpoint
+void Debugger::ApplyThreadFilter(const vector<ThreadSelector> &selectors)
+{
+	std::lock_guard<std::mutex> lock(callbackLock);
+	threadFilter.SetSelectors(selectors);
+}
+
+ULONG64 Debugger::GetSkippedThreadHits() const
+{
+	return threadFilter.SkippedHits();
+}
+
+//renamed threads are classified again by their new name, the OS id of an exited one may be reused
+void Debugger::OnThreadChanged(ICorDebugThread &Thread, bool exited)
+{
+	DWORD threadId = 0;
+	if (Thread.GetID(&threadId) != S_OK) return;
+
+	std::lock_guard<std::mutex> lock(callbackLock);
+	if (threadFilter.Any()) threadFilter.Forget(threadId);
+}
+
+//first hit of a thread: reads its managed id and name from the System.Threading.Thread object if a selector needs them
+bool Debugger::ClassifyThread(ICorDebugThread &Thread, DWORD threadId)
+{
+	LONG managedId = -1;
+	std::wstring name;
+	auto named = false;
+
+	ComPtr<ICorDebugValue> threadRaw;
+	ComPtr<ICorDebugReferenceValue> threadRef;
+	ComPtr<ICorDebugValue> threadValue;
+	ComPtr<ICorDebugObjectValue> threadObject;
+	ComPtr<ICorDebugClass> threadClass;
+	ComPtr<ICorDebugModule> threadModule;
+	ComPtr<IMetaDataImport> threadMeta;
+	mdTypeDef threadToken;
+	if (threadFilter.NeedsIdentity()
+		&& (Thread.GetObject(&threadRaw) == S_OK)
+		&& (threadRaw.As(&threadRef) == S_OK)
+		&& (threadRef->Dereference(&threadValue) == S_OK)
+		&& (threadValue.As(&threadObject) == S_OK)
+		&& (threadObject->GetClass(&threadClass) == S_OK)
+		&& (threadClass->GetToken(&threadToken) == S_OK)
+		&& (threadClass->GetModule(&threadModule) == S_OK)
+		&& (threadModule->GetMetaDataInterface(IID_IMetaDataImport, &threadMeta) == S_OK))
+	{
+		//private fields of System.Threading.Thread
+		mdFieldDef idField;
+		ComPtr<ICorDebugValue> idValue;
+		PredicateValue id = { PREDICATE_VALUE_OTHER, 0, 0.0, nullptr, 0 };
+		if ((threadMeta->FindField(threadToken, L"m_ManagedThreadId", nullptr, 0, &idField) == S_OK)
+			&& (threadObject->GetFieldValue(threadClass.Get(), idField, &idValue) == S_OK)
+			&& (ReadPredicateValue(idValue, id) == S_OK)
+			&& (id.kind == PREDICATE_VALUE_SIGNED)) managedId = (LONG)id.integer;
+
+		mdFieldDef nameField;
+		ComPtr<ICorDebugValue> nameValue;
+		PredicateValue threadName = { PREDICATE_VALUE_OTHER, 0, 0.0, nullptr, 0 };
+		if ((threadMeta->FindField(threadToken, L"m_Name", nullptr, 0, &nameField) == S_OK)
+			&& (threadObject->GetFieldValue(threadClass.Get(), nameField, &nameValue) == S_OK)
+			&& (ReadPredicateValue(nameValue, threadName) == S_OK)
+			&& (threadName.kind == PREDICATE_VALUE_TEXT))
+		{
+			name.assign(threadName.text, threadName.length);
+			named = true;
+		}
+	}
+
+	auto traced = threadFilter.Classify(threadId, managedId, named ? name.c_str() : nullptr);
+	LogEvent(L"Thread %u (managed id %d, %s): %s\n", threadId, managedId, (named && !name.empty()) ? name.c_str() : L"unnamed", traced ? L"traced" : L"skipped");
+	return traced;
+}
+
+//signaled when a rule fired that has actions for the main thread, nullptr without rules
+//a module loaded after the search is searched on its own: queued until the breakpoints are activated, while tracing its
+//breakpoints are set, indexed and activated before the callback returns, so its first calls are already seen
+//the cost is the module's, the other modules aren't looked at
+void Debugger::OnModuleChanged(ICorDebugAppDomain &AppDomain, ICorDebugModule &Module, bool unloaded)
+{
+	std::lock_guard<std::mutex> lock(callbackLock);
+	if (!watchLoads) return;
+
+	if (unloaded)
+	{
+		ForgetModule(Module);
+		return;
+	}
+
+	PendingLoad load = { 0, &Module, mdTypeDefNil };
+	if (AppDomain.GetID(&load.domainId) != S_OK) return;
+
+	if (!aggregator)
+	{
+		pendingLoads.push_back(load);
+		return;
+	}
+
+	LARGE_INTEGER startTime;
+	QueryPerformanceCounter(&startTime);
+
+	auto numMethods = InstrumentLoaded(load);
+	TraceAddedBreakpoints();
+
+	LARGE_INTEGER endTime;
+	QueryPerformanceCounter(&endTime);
+
+	vector<wchar_t> name(256);
+	LogEvent(L"Module %s loaded while tracing: %u methods instrumented in %.1f ms\n", NameOf(&Module, name), numMethods, (double)(endTime.QuadPart - startTime.QuadPart) * 1000.0 / timerFreq);
+}
+
+//the types of a dynamic module are defined after it loaded, each one is searched when it's loaded
+void Debugger::OnClassLoaded(ICorDebugAppDomain &AppDomain, ICorDebugClass &Class)
+{
+	std::lock_guard<std::mutex> lock(callbackLock);
+	if (!watchLoads) return;
+
+	PendingLoad load = { 0, nullptr, mdTypeDefNil };
+	BOOL dynamic = FALSE;
+	if ((AppDomain.GetID(&load.domainId) != S_OK) || (Class.GetModule(&load.module) != S_OK) || (Class.GetToken(&load.typeDef) != S_OK)) return;
+	if ((load.module->IsDynamic(&dynamic) != S_OK) || !dynamic) return;
+
+	if (!aggregator)
+	{
+		pendingLoads.push_back(load);
+		return;
+	}
+
+	if (InstrumentLoaded(load)) TraceAddedBreakpoints();
+}
+
+//the modules and classes loaded since the search, before the breakpoints are activated
+void Debugger::InstrumentPending()
+{
+	{
+		std::lock_guard<std::mutex> lock(callbackLock);
+		if (pendingLoads.empty()) return;
+	}
+
+	//setting breakpoints needs a synchronized process, stopped before taking the lock (a callback might be waiting for it)
+	BeginPauseWindow();
+	{
+		std::lock_guard<std::mutex> lock(callbackLock);
+
+		vector<PendingLoad> loads;
+		loads.swap(pendingLoads);
+
+		size_t numMethods = 0;
+		for (auto loadIt = loads.begin(); loadIt != loads.end(); ++loadIt)
+		{
+			numMethods += InstrumentLoaded(*loadIt);
+		}
+		LOG(L"%u modules and types loaded since the search, %u methods instrumented\n", loads.size(), numMethods);
+	}
+	EndPauseWindow();
+}
+
+//searches a loaded module (or a type of a dynamic one) with the filters of the search and sets the breakpoints of the
+//methods it finds, returns their number
+//callback lock held, process synchronized
+size_t Debugger::InstrumentLoaded(const PendingLoad &load)
+{
+	ModuleScan scan{};
+	scan.domainId = load.domainId;
+	scan.module = load.module;
+	VERIFY(scan.module->GetToken(&scan.moduleToken) == S_OK);
+	if (scan.module->GetMetaDataInterface(IID_IMetaDataImport, &scan.meta) != S_OK)
+	{
+		LogEvent(L"Failed to get metadata for module\n");
+		return 0;
+	}
+	scan.module->IsDynamic(&scan.dynamic);
+
+	ComPtr<ICorDebugAssembly> assembly;
+	vector<wchar_t> name(256);
+	if (scan.module->GetAssembly(&assembly) == S_OK) scan.assemblyName = AssemblyFileName(NameOf(assembly.Get(), name));
+
+	auto moduleKey = FlatIndex::KeyOf(scan.module.Get());
+	if (load.typeDef == mdTypeDefNil)
+	{
+		//searched by the search already, or reported twice (a load while the search enumerated the modules)
+		if (!knownModules.insert(moduleKey).second) return 0;
+
+		ScanModule(scan, loadFilters, loadPatterns);
+		MetaInfo->AddModule(scan.meta.Get());
+	}
+	else
+	{
+		if (!SelectFilters(scan, loadFilters, loadPatterns)) return 0;
+
+		ScanBuffers buffers;
+		buffers.typeMatches.resize(loadFilters.size());
+		ScanType(scan, loadFilters, loadPatterns, load.typeDef, buffers);
+	}
+
+	for (auto messageIt = scan.messages.begin(); messageIt != scan.messages.end(); ++messageIt)
+	{
+		LogEvent(L"%s", messageIt->c_str());
+	}
+
+	//the rules arming held methods only know the ones found at attach, these would never be armed
+	vector<bool> held(scan.found.size());
+	for (auto matchIt = scan.matches.begin(); matchIt != scan.matches.end(); ++matchIt)
+	{
+		if (loadFilters[matchIt->first].held) held[matchIt->second] = true;
+	}
 
-				wchar_t* functionName = MetaInfo->GetName(functionToken);
+	size_t numInstrumented = 0;
+	for (size_t found = 0; found < scan.found.size(); found++)
+	{
+		auto &method = scan.found[found];
+		if (!knownMethods.insert(std::make_pair(moduleKey, method->methodToken)).second || held[found]) continue;
 
-				TRACE(L"IL found: %u locations, dereferencing operation at %u - opcode %#x\n", ILBytes, nOffset, opcode);
-				//LOG(L"IL found: %u locations, dereferencing operation at %u - opcode %#x\n", ILBytes, nOffset, opcode);
+		ICorDebugFunction *pFunction;
+		if (scan.module->GetFunctionFromToken(method->methodToken, &pFunction) != S_OK) continue;
+		method->corFunction.Attach(pFunction);
 
-				switch (opcode)
-				{
-				case CEE_CALLVIRT:
-				{
-					MetaInfo->ResolveTokenAndAddToCache(typeToken, pFunction.Get());
+		LogEvent(L"Found method: %s\n", method->parsedSignature.get());
+		if (InstrumentMethod(method)) numInstrumented++;
+	}
+	return numInstrumented;
+}
 
-					TRACE(L"Attempted to call %s on an uninitialized type. In %s IL %u/%u (reported/actual).\n", MetaInfo->GetName(typeToken), functionName, nOffset, ilPtr - 1);
-					LOG(L"Attempted to call %s on an uninitialized type. In %s IL %u/%u (reported/actual).\n", MetaInfo->GetName(typeToken), functionName, nOffset, ilPtr - 1);
-					break;
-				}
-				case CEE_THROW:
-					TRACE(L"Attempted to throw an uninitialized exception object. In %s IL %u/%u (reported/actual).\n", functionName, nOffset, ilPtr - 1);
-					LOG(L"Attempted to throw an uninitialized exception object. In %s IL %u/%u (reported/actual).\n", functionName, nOffset, ilPtr - 1);
-					break;
-				case CEE_LDLEN:
-					TRACE(L"Attempted to get the length of an uninitialized array. In %s IL %u/%u (reported/actual).\n", functionName, nOffset, ilPtr - 1);
-					LOG(L"Attempted to get the length of an uninitialized array. In %s IL %u/%u (reported/actual).\n", functionName, nOffset, ilPtr - 1);
-					break;
-				case CEE_UNBOXANY:
-				{
-					MetaInfo->ResolveTokenAndAddToCache(typeToken, pFunction.Get());
+//the breakpoints set while tracing join the slot table, the groups and the tracing state sized by them, then are activated
+//callback lock held, process synchronized
+void Debugger::TraceAddedBreakpoints()
+{
+	if (addedBPs.empty() || !aggregator) return;
 
-					TRACE(L"Attempted to cast/unbox a value/reference type of type %s using an uninitialized address. In %s IL %u/%u (reported/actual).\n", MetaInfo->GetName(typeToken), functionName, nOffset, ilPtr - 1);
-					LOG(L"Attempted to cast/unbox a value/reference type of type %s using an uninitialized address. In %s IL %u/%u (reported/actual).\n", MetaInfo->GetName(typeToken), functionName, nOffset, ilPtr - 1);
-					break;
-				}
-				case CEE_LDFLD:
-				case CEE_LDFLDA:
-				case CEE_STFLD:
-				{
-					MetaInfo->ResolveTokenAndAddToCache(typeToken, pFunction.Get());
+	//the aggregator reads the slot table, it's drained and restarted around the change (its shadow stacks are kept)
+	aggregator->Stop();
 
-					// Todo resolve type/field.
-					auto store = opcode == CEE_STFLD;
-					TRACE(L"Attempted to %s non-static field %s %s an uninitialized type. In %s IL %u/%u (reported/actual).\n", store ? L"store" : L"load", MetaInfo->GetName(typeToken), store ? L"in" : L"from", functionName, nOffset, ilPtr - 1);
-					LOG(L"Attempted to %s non-static field %s %s an uninitialized type. In %s IL %u/%u (reported/actual).\n", store ? L"store" : L"load", MetaInfo->GetName(typeToken), store ? L"in" : L"from", functionName, nOffset, ilPtr - 1);
-					break;
-				}
-				case CEE_LDELEM:
-				case CEE_LDELEMA:
-				case CEE_STELEM:
-				{
-					MetaInfo->ResolveTokenAndAddToCache(typeToken, pFunction.Get());
+	auto firstGroup = (ULONG)bpGroups.Size();
+	ExtendBreakpointIndex();
+	if (sampler) sampler->Extend();
+	if (governor) governor->Extend();
+	if (settings.intervalMs) timeline.Extend(bpGroups);
+	if (rules.Any()) rules.Extend(bpGroups);
 
-					auto store = opcode == CEE_STELEM;
-					TRACE(L"Attempted to %s elements of type %s %s an uninitialized array. In %s IL %u/%u (reported/actual).\n", store ? L"store" : L"load", MetaInfo->GetName(typeToken), store ? L"in" : L"from", functionName, nOffset, ilPtr - 1);
-					LOG(L"Attempted to %s elements of type %s %s an uninitialized array. In %s IL %u/%u (reported/actual).\n", store ? L"store" : L"load", MetaInfo->GetName(typeToken), store ? L"in" : L"from", functionName, nOffset, ilPtr - 1);
-					break;
-				}
-				default:
-					if (opcode >= CEE_LDELEM_I1 && opcode <= CEE_STELEM_REF)
-					{
-						auto typeStr = OpcodeResolver::BuiltInTypeStringByOpcode(opcode);
-						auto store = opcode >= CEE_STELEM_I;
+	aggregator->Start();
 
-						TRACE(L"Attempted to %s elements of type %s %s an uninitialized array. In %s IL %u/%u (reported/actual).\n", store ? L"store" : L"load", typeStr, store ? L"in" : L"from", functionName, nOffset, ilPtr - 1);
-						LOG(L"Attempted to %s elements of type %s %s an uninitialized array. In %s IL %u/%u (reported/actual).\n", store ? L"store" : L"load", typeStr, store ? L"in" : L"from", functionName, nOffset, ilPtr - 1);
-						break;
-					}
-					if (opcode >= CEE_LDIND_I1 && opcode <= CEE_LDIND_REF)
-					{
-						auto typeStr = OpcodeResolver::BuiltInTypeStringByOpcode(opcode);
+	for (auto group = firstGroup; group < bpGroups.Size(); group++)
+	{
+		bpGroups.Activate(group, TRUE);
+	}
+}
 
-						TRACE(L"Attempted to load elements of type %s indirectly from an illegal address. In %s IL %u/%u (reported/actual).\n", typeStr, functionName, nOffset, ilPtr - 1);
-						LOG(L"Attempted to load elements of type %s indirectly from an illegal address. In %s IL %u/%u (reported/actual).\n", typeStr, functionName, nOffset, ilPtr - 1);
-						break;
-					}
-					if (opcode >= CEE_STIND_REF && opcode <= CEE_STIND_R8)
-					{
-						auto typeStr = OpcodeResolver::BuiltInTypeStringByOpcode(opcode);
+//an unloaded module: its breakpoints are left for the stats but taken out of the index, its names out of the cache
+//callback lock held
+void Debugger::ForgetModule(ICorDebugModule &Module)
+{
+	auto moduleKey = FlatIndex::KeyOf(&Module);
+	knownModules.erase(moduleKey);
+	knownMethods.erase(knownMethods.lower_bound(std::make_pair(moduleKey, (mdMethodDef)0)), knownMethods.lower_bound(std::make_pair(moduleKey + 1, (mdMethodDef)0)));
+	exceptionIds.erase(exceptionIds.lower_bound(std::make_pair(moduleKey, (mdTypeDef)0)), exceptionIds.lower_bound(std::make_pair(moduleKey + 1, (mdTypeDef)0)));
 
-						TRACE(L"Attempted to store elements of type %s indirectly to a misaligned or illegal address. In %s IL %u/%u (reported/actual).\n", typeStr, functionName, nOffset, ilPtr - 1);
-						LOG(L"Attempted to store elements of type %s indirectly to a misaligned or illegal address. In %s IL %u/%u (reported/actual).\n", typeStr, functionName, nOffset, ilPtr - 1);
-						break;
-					}
+	for (auto loadIt = pendingLoads.begin(); loadIt != pendingLoads.end();)
+	{
+		if (loadIt->module.Get() == &Module) loadIt = pendingLoads.erase(loadIt);
+		else ++loadIt;
+	}
 
+	auto bpsIt = moduleBPs.find(moduleKey);
+	if (bpsIt != moduleBPs.end())
+	{
+		for (auto corBPIt = bpsIt->second.begin(); corBPIt != bpsIt->second.end(); ++corBPIt)
+		{
+			auto bpIt = managedBPs.find(*corBPIt);
+			if (bpIt == managedBPs.end()) continue;
 
-					if (ILMappingType == CorDebugMappingResult::MAPPING_APPROXIMATE)
-					{
-						TRACE(L"Unable to get NullReference details - approximate mapping. In %s IL %u (reported).\n", functionName, nOffset);
-						LOG(L"Unable to get NullReference details - approximate mapping. In %s IL %u (reported).\n", functionName, nOffset);
-					}
-					else
-					{
-						TRACE(L"Unable to get NullReference details - unknown opcode %#x. In %s IL %u/%u (reported/actual).\n", opcode, functionName, nOffset, ilPtr - 1);
-						LOG(L"Unable to get NullReference details - unknown opcode %#x\n. In %s IL %u/%u (reported/actual)", opcode, functionName, nOffset, ilPtr - 1);
-					}
+			auto bpInfo = bpIt->second.get();
+			if (bpInfo->active) (*corBPIt)->Activate(FALSE);
+			bpInfo->active = false;
+			bpInfo->unloaded = true;
 
-					break;
-				}
-			}
-			else
+			//a function of a module loaded later can get the address of this one
+			auto function = bpInfo->method->corFunction.Get();
+			if (function && (methodIndex.Find(FlatIndex::KeyOf(function)) != FlatIndex::NoSlot)) methodIndex.Insert(FlatIndex::KeyOf(function), FlatIndex::NoSlot);
+
+			//hits still in flight find no slot and are let go
+			if (bpIndex.Find(FlatIndex::KeyOf(*corBPIt)) != FlatIndex::NoSlot) bpIndex.Insert(FlatIndex::KeyOf(*corBPIt), FlatIndex::NoSlot);
+
+			ComPtr<ICorDebugBreakpoint> baseBP;
+			if (((*corBPIt)->QueryInterface(__uuidof(ICorDebugBreakpoint), &baseBP) == S_OK) && (bpIndex.Find(FlatIndex::KeyOf(baseBP.Get())) != FlatIndex::NoSlot))
 			{
-				TRACE(L"Null reference thrown in frame with no IL code.\n");
-				LOG(L"Null reference thrown in frame with no IL code.\n");
+				bpIndex.Insert(FlatIndex::KeyOf(baseBP.Get()), FlatIndex::NoSlot);
 			}
 		}
-		else
+
+		LogEvent(L"Module unloaded, %u breakpoints removed\n", bpsIt->second.size());
+		moduleBPs.erase(bpsIt);
+	}
+
+	ComPtr<IMetaDataImport> modMeta;
+	if (Module.GetMetaDataInterface(IID_IMetaDataImport, &modMeta) == S_OK) MetaInfo->RemoveModule(modMeta.Get());
+}
+
+HANDLE Debugger::RuleEvent() const
+{
+	return rules.Any() ? rules.FiredEvent() : nullptr;
+}
+
+void Debugger::TakeFiredRules(vector<FiredRule> &fired)
+{
+	rules.TakeFired(fired);
+}
+
+//process all outstanding events (so hit counts and timings are complete) and stop aggregating
+void Debugger::FlushEvents()
+{
+	std::lock_guard<std::mutex> lock(callbackLock);
+
+	if (sampler)
+	{
+		LARGE_INTEGER now;
+		QueryPerformanceCounter(&now);
+		sampler->Finish(now.QuadPart);
+
+		TRACE(L"Sampling finished, %llu pauses\n", sampler->Pauses());
+		sampler.reset();
+	}
+
+	if (governor)
+	{
+		auto &shed = governor->Shed();
+		shedMethods.insert(shedMethods.end(), shed.begin(), shed.end());
+		governor.reset();
+	}
+
+	if (!aggregator) return;
+
+	aggregator->Stop();
+	lastEventStats = aggregator->Stats();
+	aggregator.reset();
+
+	//the worker is done with it, close the interval in progress
+	if (settings.intervalMs)
+	{
+		LARGE_INTEGER now;
+		QueryPerformanceCounter(&now);
+		timeline.Finish(now.QuadPart);
+	}
+}
+
+//the events queued so far are processed (and their text written), tracing goes on
+void Debugger::DrainEvents()
+{
+	std::lock_guard<std::mutex> lock(callbackLock);
+	if (!aggregator) return;
+
+	aggregator->Stop();
+	aggregator->Start();
+}
+
+//periodic housekeeping from the main thread while tracing: re-arms sampled breakpoints every window
+void Debugger::Maintain()
+{
+	LARGE_INTEGER now;
+	if (!QueryPerformanceCounter(&now)) return;
+
+	{
+		std::lock_guard<std::mutex> lock(callbackLock);
+		if (!sampler || !sampler->WindowElapsed(now.QuadPart)) return;
+
+		//nothing to re-arm, only reset the quotas
+		if (!sampler->PausedGroups())
 		{
-			// No NullReference, other types here.
+			sampler->NextWindow(now.QuadPart);
+			return;
 		}
 	}
-	else
+
+	//activating breakpoints needs a synchronized process, don't hold the lock while stopping (a callback might be waiting for it)
+	BeginPauseWindow();
 	{
-		TRACE(L"Failed to get exception metadata.\n");
-		LOG(L"Failed to get exception metadata.\n");
+		std::lock_guard<std::mutex> lock(callbackLock);
+		if (sampler) sampler->NextWindow(now.QuadPart);
 	}
+	EndPauseWindow();
 }
 
-//need to register this as methods can be exited by exception as well as regular returns
-void Debugger::OnException(ICorDebugAppDomain &AppDomain, ICorDebugThread &Thread, ICorDebugFrame &Frame, ULONG32 nOffset, CorDebugExceptionCallbackType dwEventType, DWORD dwFlags)
+void Debugger::GetShedMethods(vector<ShedMethod> &shed)
 {
-	DWORD threadId = 0;
-	mdMethodDef methodToken = 0;
-	if ((Thread.GetID(&threadId) != S_OK) || (Frame.GetFunctionToken(&methodToken) != S_OK)) return;
+	shed.insert(shed.end(), shedMethods.begin(), shedMethods.end());
+}
 
-	switch (dwEventType)
+//only consistent once the events are flushed, the aggregator thread writes it
+const CallGraph &Debugger::GetCallGraph() const
+{
+	return callGraph;
+}
+
+//same, empty unless TraceSettings::intervalMs is set
+const Timeline &Debugger::GetTimeline() const
+{
+	return timeline;
+}
+
+CallbackProfiler* Debugger::Profiler()
+{
+	return &profiler;
+}
+
+EventStats Debugger::GetEventStats() const
+{
+	return aggregator ? aggregator->Stats() : lastEventStats;
+}
+
+//operands are this, a parameter name or argN (IL argument N), otherwise a field of the method's class
+void Debugger::ResolvePredicate(IMetaDataImport *modMeta, mdTypeDef typeDef, MethodInfo &method, shared_ptr<Predicate> predicate, ModuleScan &scan)
+{
+	const ULONG maxParams = 256;
+
+	//IL argument 0 is this for instance methods
+	auto firstArgument = method.IsStatic() ? 0u : 1u;
+
+	map<std::wstring, ULONG> parameters;
+	HCORENUM paramEnum = nullptr;
+	mdParamDef params[maxParams];
+	ULONG numParams = 0;
+	if (modMeta->EnumParams(&paramEnum, method.methodToken, params, maxParams, &numParams) == S_OK)
 	{
-	case CorDebugExceptionCallbackType::DEBUG_EXCEPTION_FIRST_CHANCE:
+		for (ULONG param = 0; param < numParams; param++)
+		{
+			mdMethodDef owner;
+			ULONG sequence;
+			wchar_t paramName[512];
+			ULONG paramNameLen;
+			DWORD paramAttr;
+			DWORD cplusTypeFlag;
+			UVCP_CONSTANT constValue;
+			ULONG constValueLen;
+
+			//sequence 0 is the return value
+			if ((modMeta->GetParamProps(params[param], &owner, &sequence, paramName, _countof(paramName), &paramNameLen, &paramAttr, &cplusTypeFlag, &constValue, &constValueLen) == S_OK) && sequence)
+			{
+				parameters[paramName] = sequence - 1 + firstArgument;
+			}
+		}
+		modMeta->CloseEnum(paramEnum);
+	}
+
+	method.predicate = predicate;
+	method.predicateOperands.clear();
+
+	auto &clauses = predicate->Clauses();
+	for (auto clauseIt = clauses.begin(); clauseIt != clauses.end(); ++clauseIt)
 	{
-		// Try to do more rich logging of some special (CLR thrown) exceptions.
-		LogExceptionDetails(AppDomain, Thread, Frame, nOffset, dwEventType, dwFlags);
+		auto &name = clauseIt->operand;
+		PredicateOperand operand = { PREDICATE_UNRESOLVED, 0, mdFieldDefNil, false };
 
-		//is the method in which the exception was thrown in our pending timer list ? (is it being monitored)
-		auto hash = methodToken ^ threadId;
-		auto timerSearch = pendingTimers.find(hash);
-		if (timerSearch == pendingTimers.end()) return;
+		auto paramIt = parameters.find(name);
+		unsigned int argument = 0;
+		if ((name == L"this") && firstArgument)
+		{
+			operand.source = PREDICATE_ARGUMENT;
+		}
+		else if (paramIt != parameters.end())
+		{
+			operand.source = PREDICATE_ARGUMENT;
+			operand.argument = paramIt->second;
+		}
+		else if ((name.compare(0, 3, L"arg") == 0) && (name.size() > 3) && iswdigit(name[3]) && (swscanf_s(name.c_str() + 3, L"%u", &argument) == 1))
+		{
+			operand.source = PREDICATE_ARGUMENT;
+			operand.argument = argument;
+		}
+		else
+		{
+			HCORENUM fieldEnum = nullptr;
+			mdFieldDef field;
+			ULONG numFields = 0;
+			if ((modMeta->EnumFieldsWithName(&fieldEnum, typeDef, name.c_str(), &field, 1, &numFields) == S_OK) && numFields)
+			{
+				mdTypeDef fieldClass;
+				DWORD fieldAttr;
+				if (modMeta->GetFieldProps(field, &fieldClass, nullptr, 0, nullptr, &fieldAttr, nullptr, nullptr, nullptr, nullptr, nullptr) == S_OK)
+				{
+					//static methods can only reach static fields
+					if (IsFdStatic(fieldAttr) || firstArgument)
+					{
+						operand.source = PREDICATE_FIELD;
+						operand.field = field;
+						operand.staticField = IsFdStatic(fieldAttr) != 0;
+					}
+				}
+			}
+			if (fieldEnum) modMeta->CloseEnum(fieldEnum);
+		}
 
-		//yes, register the exception
-		knownExceptions.push_back(KnownException{ methodToken, threadId });
-		return;
+		if (operand.source == PREDICATE_UNRESOLVED) scan.Log(L"Predicate: %s is no argument or field of %s, the predicate never holds\n", name.c_str(), method.parsedSignature.get());
+		method.predicateOperands.push_back(operand);
 	}
-	case CorDebugExceptionCallbackType::DEBUG_EXCEPTION_CATCH_HANDLER_FOUND:
+}
+
+//evaluates a method's predicate at its entry breakpoint, only the operands of the clauses up to the first failing one are read
+bool Debugger::TestPredicate(ICorDebugThread &Thread, MethodInfo *mInfo)
+{
+	mInfo->predicateTested++;
+
+	ComPtr<ICorDebugFrame> frame;
+	ComPtr<ICorDebugILFrame> ilFrame;
+	if ((Thread.GetActiveFrame(&frame) != S_OK) || (frame.As(&ilFrame) != S_OK)) return false;
+
+	//this and the classes are only looked up when a clause needs them
+	ComPtr<ICorDebugObjectValue> thisObject;
+	ComPtr<ICorDebugClass> thisClass;
+	ComPtr<ICorDebugClass> staticClass;
+
+	auto &operands = mInfo->predicateOperands;
+	auto holds = mInfo->predicate->Test([&](size_t clause, PredicateValue &predicateValue) -> bool
 	{
-		//check in known exceptions if this handler is in the same method as it was thrown
-		for (auto keIt = knownExceptions.begin(); keIt != knownExceptions.end(); ++keIt)
+		auto &operand = operands[clause];
+
+		ComPtr<ICorDebugValue> value;
+		switch (operand.source)
 		{
-			auto thisKe = *keIt;
-			if (thisKe.thrownInMethod == methodToken && thisKe.thrownOnThreadId == threadId)
+		case PREDICATE_ARGUMENT:
+			if (ilFrame->GetArgument(operand.argument, &value) != S_OK) return false;
+			break;
+		case PREDICATE_FIELD:
+			if (operand.staticField)
+			{
+				if (!staticClass && (mInfo->corFunction->GetClass(&staticClass) != S_OK)) return false;
+				if (staticClass->GetStaticFieldValue(operand.field, frame.Get(), &value) != S_OK) return false;
+			}
+			else
 			{
-				//found, remove it, this is handled and didn't lead to exit from method
-				knownExceptions.erase(keIt);
-				return;
+				if (!thisObject)
+				{
+					ComPtr<ICorDebugValue> arg0;
+					ComPtr<ICorDebugReferenceValue> thisRef;
+					ComPtr<ICorDebugValue> thisValue;
+					if (!((ilFrame->GetArgument(0, &arg0) == S_OK)
+						&& (arg0.As(&thisRef) == S_OK)
+						&& (thisRef->Dereference(&thisValue) == S_OK)
+						&& (thisValue.As(&thisObject) == S_OK)
+						&& (thisObject->GetClass(&thisClass) == S_OK))) return false;
+				}
+				if (thisObject->GetFieldValue(thisClass.Get(), operand.field, &value) != S_OK) return false;
 			}
+			break;
+		default:
+			return false;
 		}
 
-		//not found yet, so it must be this exception was handled in another frame			
-		//assumption: there can only be 1 known exception per thread. throwing while searching for handler is impossible, would mean the CLR throws
+		return ReadPredicateValue(value, predicateValue) == S_OK;
+	});
 
-		//find the known exception for this thread
-		for (auto keIt = knownExceptions.begin(); keIt != knownExceptions.end(); ++keIt)
-		{
-			auto thisKe = *keIt;
-			if (thisKe.thrownOnThreadId != threadId) continue;
+	if (holds) mInfo->predicatePassed++;
+	return holds;
+}
 
-			//now find the pending timer for the method it was originally thrown in
-			auto hash = thisKe.thrownInMethod ^ thisKe.thrownOnThreadId;
-			auto timerSearch = pendingTimers.find(hash);
+//the raw value of an operand: primitives widened, strings copied into predicateText (truncated to its size)
+HRESULT Debugger::ReadPredicateValue(ComPtr<ICorDebugValue> &value, PredicateValue &predicateValue)
+{
+	const ULONG32 maxChars = 4096;
 
-			//not found, exit handling (this is bad)
-			if (timerSearch == pendingTimers.end()) return;
+	CorElementType eType;
+	if (value->GetType(&eType) != S_OK) return E_FAIL;
 
-			//register abnormal exit
-			InterlockedIncrement(&(timerSearch->second.method->methodExitThroughException));
+	switch (eType)
+	{
+	case ELEMENT_TYPE_STRING:
+	case ELEMENT_TYPE_CLASS:
+	case ELEMENT_TYPE_OBJECT:
+	{
+		ComPtr<ICorDebugReferenceValue> reference;
+		if (value.As(&reference) != S_OK)
+		{
+			predicateValue.kind = PREDICATE_VALUE_OTHER;
+			return S_OK;
+		}
 
-			//remove from pending and knownexceptions
-			pendingTimers.erase(timerSearch);
-			knownExceptions.erase(keIt);
-			return;
+		BOOL isNull = FALSE;
+		if (reference->IsNull(&isNull) != S_OK) return E_FAIL;
+		if (isNull)
+		{
+			predicateValue.kind = PREDICATE_VALUE_NULL;
+			return S_OK;
 		}
-		return;
+
+		ComPtr<ICorDebugValue> target;
+		ComPtr<ICorDebugStringValue> stringValue;
+		if ((reference->Dereference(&target) != S_OK) || (target.As(&stringValue) != S_OK))
+		{
+			predicateValue.kind = PREDICATE_VALUE_REFERENCE;
+			return S_OK;
+		}
+
+		ULONG32 length = 0;
+		if (stringValue->GetLength(&length) != S_OK) return E_FAIL;
+		if (length > maxChars) length = maxChars;
+		if (predicateText.size() < (size_t)length + 1) predicateText.resize(length + 1);
+
+		ULONG32 fetched = 0;
+		if (stringValue->GetString(length + 1, &fetched, predicateText.data()) != S_OK) return E_FAIL;
+
+		predicateValue.kind = PREDICATE_VALUE_TEXT;
+		predicateValue.text = predicateText.data();
+		predicateValue.length = fetched < length ? fetched : length;
+		return S_OK;
 	}
-	case CorDebugExceptionCallbackType::DEBUG_EXCEPTION_UNHANDLED:
+	case ELEMENT_TYPE_BOOLEAN:
+	case ELEMENT_TYPE_CHAR:
+	case ELEMENT_TYPE_I1:
+	case ELEMENT_TYPE_U1:
+	case ELEMENT_TYPE_I2:
+	case ELEMENT_TYPE_U2:
+	case ELEMENT_TYPE_I4:
+	case ELEMENT_TYPE_U4:
+	case ELEMENT_TYPE_I8:
+	case ELEMENT_TYPE_U8:
+	case ELEMENT_TYPE_I:
+	case ELEMENT_TYPE_U:
+	case ELEMENT_TYPE_R4:
+	case ELEMENT_TYPE_R8:
 	{
-		//this will lead to failure, just log
-		TRACE(L"Unhandled exception on thread %u\n", threadId);
-		LOG(L"Unhandled exception on thread %u\n", threadId);
-		return;
+		ComPtr<ICorDebugGenericValue> generic;
+		ULONG32 size = 0;
+		BYTE raw[8] = {};
+		if ((value.As(&generic) != S_OK) || (value->GetSize(&size) != S_OK) || (size > sizeof(raw)) || (generic->GetValue(raw) != S_OK)) return E_FAIL;
+
+		switch (eType)
+		{
+		case ELEMENT_TYPE_R4:
+			predicateValue.kind = PREDICATE_VALUE_REAL;
+			predicateValue.real = load<float>(raw);
+			break;
+		case ELEMENT_TYPE_R8:
+			predicateValue.kind = PREDICATE_VALUE_REAL;
+			predicateValue.real = load<double>(raw);
+			break;
+		case ELEMENT_TYPE_I1:
+		case ELEMENT_TYPE_I2:
+		case ELEMENT_TYPE_I4:
+		case ELEMENT_TYPE_I8:
+		case ELEMENT_TYPE_I:
+		{
+			//sign extend from the value's size
+			auto shift = 64 - size * 8;
+			predicateValue.kind = PREDICATE_VALUE_SIGNED;
+			predicateValue.integer = (load<LONG64>(raw) << shift) >> shift;
+			break;
+		}
+		default:
+			predicateValue.kind = PREDICATE_VALUE_UNSIGNED;
+			predicateValue.integer = load<LONG64>(raw);
+			break;
+		}
+		return S_OK;
 	}
-	case CorDebugExceptionCallbackType::DEBUG_EXCEPTION_USER_FIRST_CHANCE:
 	default:
-		return;
-	}
-}
-
-void Debugger::GetBPStats(vector<shared_ptr<BreakpointInfo>> &BPStats)
-{
-	for (auto bpIt = managedBPs.begin(); bpIt != managedBPs.end(); ++bpIt)
 	{
-		BPStats.push_back((*bpIt).second);
+		//arrays, generic instances, ...: a reference still compares to null
+		ComPtr<ICorDebugReferenceValue> reference;
+		BOOL isNull = FALSE;
+		if ((value.As(&reference) == S_OK) && (reference->IsNull(&isNull) == S_OK)) predicateValue.kind = isNull ? PREDICATE_VALUE_NULL : PREDICATE_VALUE_REFERENCE;
+		else predicateValue.kind = PREDICATE_VALUE_OTHER;
+		return S_OK;
+	}
 	}
 }
 
 HRESULT Debugger::DumpFieldValue(const wchar_t* fieldSig, ComPtr<ICorDebugValue> &pVal)
 {
-	ULONG32 stringLen = 300000;
-	auto staticAsString = unique_ptr<wchar_t[]>(new wchar_t[stringLen]);
+	//a longer value wouldn't fit in the log line (or the payload buffer's text) anyway
+	if (fieldText.empty()) fieldText.resize(maxLog);
+	auto stringLen = (ULONG32)fieldText.size();
 
-	if (TryGetStringFromObject(pVal, staticAsString.get(), stringLen, &stringLen) == S_OK)
+	if (TryGetStringFromObject(pVal, fieldText.data(), stringLen, &stringLen) == S_OK)
 	{
-		TRACE(L"Field: %s Value: %s\n", fieldSig, staticAsString.get());
-		LOG(L"Field: %s, Value: %s\n", fieldSig, staticAsString.get());
+		TRACE(L"Field: %s Value: %s\n", fieldSig, fieldText.data());
+		LogEvent(L"Field: %s, Value: %s\n", fieldSig, fieldText.data());
 
 		return S_OK;
 	}
@@ -1266,10 +2963,13 @@ HRESULT Debugger::TryGetStringFromObject(ComPtr<ICorDebugValue> &pObj, wchar_t *
 			ULONG32 dBytesRead;
 			if ((ReadMemory(nullptr, string_length_addr, (BYTE*)&length, 4, &dBytesRead) == S_OK) && (dBytesRead == 4))
 			{
-				auto toRead = (length + 1)*stringArrayLayout.elementSize;
+				//cut to the buffer, the terminator is ours
+				auto chars = length < maxChars ? length : maxChars - 1;
+				auto toRead = chars*stringArrayLayout.elementSize;
 
-				if ((ReadMemory(nullptr, string_char_data_addr, (BYTE*)stringValue, toRead, &dBytesRead) == S_OK) && (toRead == dBytesRead))
+				if ((toRead == 0) || ((ReadMemory(nullptr, string_char_data_addr, (BYTE*)stringValue, toRead, &dBytesRead) == S_OK) && (toRead == dBytesRead)))
 				{
+					stringValue[chars] = L'\0';
 					retval = S_OK;
 				}
 			}
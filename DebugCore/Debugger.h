@@ -7,21 +7,121 @@
 #include "..\Shared\Logger.h"
 #include "MemoryInfo.h"
 #include "MetaHelpers.h"
+#include "FlatIndex.h"
+#include "EventAggregator.h"
+#include "BreakpointSampler.h"
+#include "OverheadGovernor.h"
+#include "RuleEngine.h"
+#include "ThreadFilter.h"
+#include "PatternSet.h"
+#include "InstrumentationPlan.h"
+#include <mutex>
+#include <thread>
+#include <atomic>
 
 #pragma once
 
-struct PendingTimer
+//stop-the-world windows spent on (de)activating or setting breakpoints
+struct PauseStats
 {
-	long long timeStamp;
-	DWORD threadId;
-	mdMethodDef functionToken;
-	shared_ptr<MethodInfo> method;
+	ULONG windows;
+	ULONG toggled;		//breakpoints activated or deactivated
+	double totalPause;	//seconds
+	double maxPause;	//seconds
 };
 
-struct KnownException
+//methods in the namespaces matching namespaceFilter, of the types whose full name matches classFilter, named as methodFilter,
+//in the assemblies matching assemblyFilter
+//filters are patterns (see PatternSet): plain text is a prefix, * and ? are globs, /.../ a regex, !term excludes
+struct MethodFilter
 {
-	mdMethodDef thrownInMethod;
-	DWORD thrownOnThreadId;
+	const wchar_t *namespaceFilter;		//nullptr: any
+	const wchar_t *classFilter;
+	const wchar_t *methodFilter;
+	const wchar_t *assemblyFilter;		//file name without extension
+	vector<const wchar_t *> fields;		//dumped on entry
+	shared_ptr<Predicate> predicate;	//fields are only dumped when it holds
+	bool held;							//its methods stay off until a rule arms them, ones of modules loaded while tracing are left out
+
+	vector<shared_ptr<MethodInfo>> matched;	//filled by the search, shared with other filters matching the same method
+};
+
+//the parts of all filters of a search compiled, pattern i is filter i
+struct FilterPatterns
+{
+	PatternSet namespaces;
+	PatternSet classes;
+	PatternSet methods;
+	PatternSet assemblies;
+};
+
+//one module's part of a method search: found on the main thread, its metadata scanned on a worker
+struct ModuleScan
+{
+	ULONG32 domainId;
+	mdModule moduleToken;
+	ComPtr<ICorDebugModule> module;
+	ComPtr<IMetaDataImport2> meta;
+	BOOL dynamic;
+	GUID mvid;
+	shared_ptr<ModulePlan> plan;	//nullptr without a plan file, or for a dynamic module
+	bool replay;					//the plan has the module, its methods are looked up by token instead of searched
+	std::wstring assemblyName;		//as the filters see it, see AssemblyFileName
+
+	//the filters that can match in the module (assembly, namespaces), decided before its types are enumerated
+	vector<bool> filters;
+	bool skipped;					//none can, its types weren't enumerated
+	long long scanTicks;
+
+	//output, merged on the main thread in module order
+	vector<shared_ptr<MethodInfo>> found;	//corFunction isn't set yet
+	vector<std::pair<ULONG, ULONG>> matches;	//(filter, index in found)
+	vector<std::wstring> messages;
+
+	//the log isn't thread safe, messages are written when the scan is merged
+	template<typename... Args>
+	void Log(wchar_t const * format, Args... args)
+	{
+		wchar_t buffer[2048];
+		_snwprintf_s(buffer, _TRUNCATE, format, args...);
+		messages.push_back(buffer);
+	}
+};
+
+//a module loaded after the search, or a type of a dynamic module, waiting for the breakpoints to be activated
+struct PendingLoad
+{
+	ULONG32 domainId;
+	ComPtr<ICorDebugModule> module;
+	mdTypeDef typeDef;	//mdTypeDefNil: the whole module
+};
+
+//reused by the types and methods of a module scan: pages of tokens, and names that grow to the longest one seen
+struct ScanBuffers
+{
+	static const ULONG TokenPage = 256;
+
+	ScanBuffers() : methods(TokenPage), fields(TokenPage), className(256), methodName(256), fieldName(256), fieldsType(mdTypeDefNil) {}
+
+	vector<mdMethodDef> methods;
+	vector<mdFieldDef> fields;
+	vector<mdFieldDef> fieldTokens;	//of the method found
+	vector<wchar_t> className;
+	vector<wchar_t> methodName;
+	vector<wchar_t> fieldName;
+
+	//filters the current type, and the current method, pass
+	vector<bool> typeMatches;
+	vector<bool> namespaceMatches;
+	vector<bool> nameMatches;
+	vector<ULONG> methodMatches;
+	std::wstring namespaceName;
+
+	//the dump fields of the current type, resolved for the first of its methods found and shared by the others
+	//(a scan has buffers of its own, so the type is enough of a key)
+	mdTypeDef fieldsType;
+	map<std::wstring, vector<mdFieldDef>> typeFieldTokens;	//field name => its fields
+	map<mdFieldDef, shared_ptr<FieldInfo>> typeFields;		//nullptr if the field's metadata can't be read
 };
 
 class Debugger : public IDebugger
@@ -33,36 +133,165 @@ public:
 	bool DoAttach(DWORD pId);
 	void Detach();
 	bool IsAttached() const;
-	void FindManagedMethods(wchar_t * namespaceFilterName, const wchar_t * classFilterName, const wchar_t * methodFilterName, const vector<const wchar_t *> &fields, vector<shared_ptr<MethodInfo>> &functions);
+	void FindManagedMethods(vector<MethodFilter> &filters, vector<shared_ptr<MethodInfo>> &functions);
+	void SearchScopes(vector<MethodFilter> &filters, const vector<ComPtr<IMetaDataImport2>> &scopes, bool parallel, vector<shared_ptr<MethodInfo>> &found);
+	void UsePlanFile(const wchar_t *path);
+	bool SavePlan();
 	HRESULT SetBPAtEntry(shared_ptr<MethodInfo> pFunction, customHandler handler);
 	int SetBPAtExit(shared_ptr<MethodInfo> pFunction, customHandler handler);
 	int SetBPAtOpCode(shared_ptr<MethodInfo> pFunction, customHandler handler, CEE_OPCODE opcode);
+	int InstrumentMethod(shared_ptr<MethodInfo> pFunction);
 	void ActivateBPs(BOOL active);
+	void ActivateBPs(BOOL active, const vector<shared_ptr<MethodInfo>> &held);
+	void ActivateMethods(const vector<shared_ptr<MethodInfo>> &methods, BOOL active);
+	void BeginPauseWindow();
+	bool PauseWindowExpired() const;
+	void SplitPauseWindow();
+	void EndPauseWindow();
+	PauseStats GetPauseStats() const;
 	void Continue();
 	void Stop();
-	void OnBreakpointHit(ICorDebugAppDomain &AppDomain, ICorDebugThread &Thread, ICorDebugBreakpoint &Breakpoint) override;
+	CallbackKind OnBreakpointHit(ICorDebugAppDomain &AppDomain, ICorDebugThread &Thread, ICorDebugBreakpoint &Breakpoint) override;
 	void OnException(ICorDebugAppDomain &AppDomain, ICorDebugThread &Thread, ICorDebugFrame &Frame, ULONG32 nOffset, CorDebugExceptionCallbackType dwEventType, DWORD dwFlags) override;
+	void OnExceptionUnwind(ICorDebugAppDomain &AppDomain, ICorDebugThread &Thread, CorDebugExceptionUnwindCallbackType dwEventType, DWORD dwFlags) override;
+	void OnThreadChanged(ICorDebugThread &Thread, bool exited) override;
+	void OnModuleChanged(ICorDebugAppDomain &AppDomain, ICorDebugModule &Module, bool unloaded) override;
+	void OnClassLoaded(ICorDebugAppDomain &AppDomain, ICorDebugClass &Class) override;
 	void GetBPStats(vector<shared_ptr<BreakpointInfo>> &BPStats);
+	ULONG64 GetTotalHits() const;
+	void ApplySettings(const TraceSettings &settings);
+	void ApplyRules(const vector<TraceRule> &rules);
+	void ApplyThreadFilter(const vector<ThreadSelector> &selectors);
+	ULONG64 GetSkippedThreadHits() const;
+	HANDLE RuleEvent() const;
+	void TakeFiredRules(vector<FiredRule> &fired);
+	void FlushEvents();
+	void DrainEvents();
+	EventStats GetEventStats() const;
+	void Maintain();
+	void GetShedMethods(vector<ShedMethod> &shed);
+	const CallGraph &GetCallGraph() const;
+	const Timeline &GetTimeline() const;
+	CallbackProfiler* Profiler() override;
 	
 	MemoryInfo* GetMemoryInfo();
 
 	wchar_t* GetName(mdToken token) {
 		return MetaInfo->GetName(token);
 	}
+
+	//log text from the main thread: while tracing it's queued behind the trace events and the aggregator writes it
+	template<typename... Args>
+	void LogText(wchar_t const * format, Args... args)
+	{
+		std::lock_guard<std::mutex> lock(callbackLock);
+		LogEvent(format, args...);
+	}
 private:
 	DWORD pId;	
 	ComPtr<IDebugClient> DebugClient;						//native debug client controller
 	unique_ptr<IDebuggerImplementation> DebugClientManaged;	//managed debug client controller
 	unique_ptr<MetaHelpers> MetaInfo;						//metadata resolver
 	map<ICorDebugFunctionBreakpoint*, shared_ptr<BreakpointInfo>> managedBPs;
+	void RegisterBreakpoint(ICorDebugFunctionBreakpoint *corBreakpoint, shared_ptr<BreakpointInfo> bpInfo);
+	void ToggleBreakpoints(const vector<BreakpointInfo*> &changes, BOOL active);
+
+	long long pauseStart;
+	PauseStats pauseStats;
+	
+	//hot path lookup: breakpoint interface pointer => slot in bpSlots, built when activating
+	FlatIndex bpIndex;
+	vector<shared_ptr<BreakpointInfo>> bpSlots;
+	FlatIndex methodIndex;	//method (its ICorDebugFunction) => breakpoint group
+	void BuildBreakpointIndex();
+	void IndexMethod(ULONG group);
+	ULONG MethodGroupOf(ICorDebugFrame &Frame);
+	vector<shared_ptr<BreakpointInfo>> addedBPs;	//registered since the index was built
+	void ExtendBreakpointIndex();
+	ULONG CountUnwoundFrames(ICorDebugThread &Thread, ICorDebugFrame &Handler);
+
+	//bookkeeping and log output of hits happens on the aggregator thread, only exists while breakpoints are active
+	TraceSettings settings;
+	unique_ptr<EventAggregator> aggregator;
+	EventStats lastEventStats;
+	BreakpointGroups bpGroups;
+	unique_ptr<BreakpointSampler> sampler;
+	unique_ptr<OverheadGovernor> governor;
+	vector<ShedMethod> shedMethods;
+	CallGraph callGraph;	//filled by the aggregator, covers the last activation
+	Timeline timeline;		//same
+	RuleEngine rules;		//bound to the breakpoint groups on activation, evaluated by the aggregator
+	map<std::pair<ULONG64, mdTypeDef>, ULONG> exceptionIds;	//(module, exception type) => rule exception id, callback thread only
+	ULONG ExceptionIdOf(ICorDebugThread &Thread);
+	void EnforceBudget(long long now);
+
+	//threads the callbacks ignore, callback thread only (set before tracing)
+	ThreadFilter threadFilter;
+	inline bool ThreadTraced(ICorDebugThread &Thread, DWORD threadId)
+	{
+		if (!threadFilter.Any()) return true;
+
+		auto verdict = threadFilter.Find(threadId);
+		return verdict == FlatIndex::NoSlot ? ClassifyThread(Thread, threadId) : verdict != 0;
+	}
+	bool ClassifyThread(ICorDebugThread &Thread, DWORD threadId);
+
+	//latency each callback adds to the target, recorded by the managed callback
+	CallbackProfiler profiler;
+
+	//callbacks run on the debugger's callback thread, aggregator and sampler are replaced from the main thread
+	std::mutex callbackLock;
+
+	template<typename... Args>
+	void LogEvent(wchar_t const * format, Args... args)
+	{
+		if (aggregator) aggregator->EmitText(format, args...);
+		else LOG(format, args...);
+	}
 
 	OPMODE mode;
 
-	HRESULT GetAppDomains(ICorDebugProcess *pProcess, ICorDebugAppDomain **ppDomains, ULONG maxDomains, ULONG *loadedDomains);
-	HRESULT GetRuntimeAssemblies(ICorDebugAppDomain *pAppDomain, ICorDebugAssembly **ppAssemblies, ULONG maxAssemblies, ULONG *loadedAssemblies);
-	HRESULT GetRuntimeModules(ICorDebugAssembly *pAssembly, ICorDebugModule **ppModules, ULONG maxModules, ULONG *loadedModules);
+	HRESULT GetAppDomains(ICorDebugProcess *pProcess, vector<ComPtr<ICorDebugAppDomain>> &domains);
+	HRESULT GetRuntimeAssemblies(ICorDebugAppDomain *pAppDomain, vector<ComPtr<ICorDebugAssembly>> &assemblies);
+	HRESULT GetRuntimeModules(ICorDebugAssembly *pAssembly, vector<ComPtr<ICorDebugModule>> &modules);
+
+	void DumpFields(ICorDebugThread &Thread, MethodInfo *mInfo);
+	void ScanModule(ModuleScan &scan, const vector<MethodFilter> &filters, const FilterPatterns &patterns);
+	bool SelectFilters(ModuleScan &scan, const vector<MethodFilter> &filters, const FilterPatterns &patterns);
+	shared_ptr<vector<std::wstring>> NamespacesOf(ModuleScan &scan);
+	map<std::pair<ULONG64, ULONG64>, shared_ptr<vector<std::wstring>>> namespaceCache;	//by MVID, a module listed again isn't read again
+	std::mutex namespaceLock;	//the workers of a search share it
+	void ScanType(ModuleScan &scan, const vector<MethodFilter> &filters, const FilterPatterns &patterns, mdTypeDef typeDef, ScanBuffers &buffers);
+	void ReplayModule(ModuleScan &scan, const vector<MethodFilter> &filters);
+	void AddFoundMethod(ModuleScan &scan, const vector<MethodFilter> &filters, const vector<ULONG> &methodMatches, mdTypeDef typeDef, const wchar_t *className, DWORD typeDefFlags,
+		mdMethodDef methodToken, const wchar_t *methodName, DWORD methodAttrFlags, PCCOR_SIGNATURE methodSig, ULONG methodSigSize, DWORD methodImplFlags, const wchar_t *signature,
+		const vector<mdFieldDef> *plannedFields, ScanBuffers &buffers);
+	shared_ptr<FieldInfo> ResolveField(IMetaDataImport *modMeta, mdFieldDef fieldToken, const wchar_t *className, vector<wchar_t> &fieldNameBuffer);
+	int ReplayBreakpoints(shared_ptr<MethodInfo> pFunction, customHandler handler, CEE_OPCODE scan);
+
+	//modules loaded after the search are searched on their own with its filters: queued until the breakpoints are activated,
+	//while tracing right in the load callback, callback lock
+	bool watchLoads;
+	vector<MethodFilter> loadFilters;
+	FilterPatterns loadPatterns;
+	vector<PendingLoad> pendingLoads;
+	set<ULONG64> knownModules;							//searched
+	set<std::pair<ULONG64, mdMethodDef>> knownMethods;	//(module, method) found
+	map<ULONG64, vector<ICorDebugFunctionBreakpoint*>> moduleBPs;	//torn down when their module unloads
+	void InstrumentPending();
+	size_t InstrumentLoaded(const PendingLoad &load);
+	void TraceAddedBreakpoints();
+	void ForgetModule(ICorDebugModule &Module);
 
+	//what the search and the IL scans found, saved for the next attach to the same build
+	InstrumentationPlan plan;
+	std::wstring planFile;
+	void ResolvePredicate(IMetaDataImport *modMeta, mdTypeDef typeDef, MethodInfo &method, shared_ptr<Predicate> predicate, ModuleScan &scan);
+	bool TestPredicate(ICorDebugThread &Thread, MethodInfo *mInfo);
+	HRESULT ReadPredicateValue(ComPtr<ICorDebugValue> &value, PredicateValue &predicateValue);
+	vector<wchar_t> predicateText;	//string operands, callback thread only
 	HRESULT DumpFieldValue(const wchar_t* fieldSignature, ComPtr<ICorDebugValue> &pVal);
+	vector<wchar_t> fieldText;		//formatted field values, a log line long, callback thread only
 	HRESULT DereferenceIfPossible(ICorDebugValue **pVal);
 
 	HRESULT TryGetStringFromObject(ComPtr<ICorDebugValue> &pObj, wchar_t *stringValue, ULONG32 maxChars, ULONG32 *actualChars);
@@ -74,7 +303,5 @@ private:
 	void LogExceptionDetails(ICorDebugAppDomain &AppDomain, ICorDebugThread &Thread, ICorDebugFrame &Frame, ULONG32 nOffset, CorDebugExceptionCallbackType dwEventType, DWORD dwFlags);
 	
 	double timerFreq;
-	map<ULONG64, PendingTimer> pendingTimers;
-	vector<KnownException> knownExceptions;
 };
 
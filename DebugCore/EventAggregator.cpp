@@ -0,0 +1,284 @@
+#include "precompiled.h"
+#include "EventAggregator.h"
+
+EventAggregator::EventAggregator(OPMODE mode, double timerFreq, const vector<shared_ptr<BreakpointInfo>> &bpSlots, CallGraph *callGraph, Timeline *timeline, RuleEngine *rules, const TraceSettings &settings)
+	: mode(mode), timerFreq(timerFreq), nsPerTick(1000000000.0 / timerFreq), bpSlots(bpSlots), callGraph(callGraph), timeline(timeline), rules(rules), blockWhenFull(settings.blockWhenBufferFull),
+	events(settings.eventBufferSize), payload(settings.eventBufferSize * 16),
+	emitted(0), dropped(0), droppedText(0), maxDepth(0)
+{
+	stopping.store(false);
+	hits.store(0);
+	text.resize(maxLog + 1);
+}
+
+EventAggregator::~EventAggregator()
+{
+	Stop();
+}
+
+void EventAggregator::Start()
+{
+	if (worker.joinable()) return;
+
+	TRACE(L"Start event aggregation, buffer for %u events\n", events.Capacity());
+
+	stopping.store(false);
+	worker = std::thread(&EventAggregator::Run, this);
+}
+
+void EventAggregator::Stop()
+{
+	if (!worker.joinable()) return;
+
+	stopping.store(true);
+	worker.join();
+
+	TRACE(L"Event aggregation stopped, %llu events, %llu dropped\n", emitted, dropped);
+}
+
+EventStats EventAggregator::Stats() const
+{
+	EventStats stats = { emitted, dropped, droppedText, maxDepth, events.Capacity(), blockWhenFull };
+	return stats;
+}
+
+void EventAggregator::EmitPayload(const wchar_t *text, ULONG length)
+{
+	if (length == 0) return;
+
+	//reserve the event first: text without its event would sit in the payload buffer until the next text finds it
+	while (!events.HasRoom(1))
+	{
+		if (!blockWhenFull)
+		{
+			dropped++;
+			droppedText++;
+			return;
+		}
+		YieldProcessor();
+	}
+
+	size_t position;
+	while (!payload.TryPushMany(text, length, position))
+	{
+		if (!blockWhenFull || length > payload.Capacity())
+		{
+			droppedText++;
+			return;
+		}
+		YieldProcessor();
+	}
+
+	TraceEvent event = { 0, 0, 0, (ULONG)position, length, TRACE_EVENT_TEXT, mdTokenNil };
+	Emit(event);
+}
+
+void EventAggregator::Run()
+{
+	TraceEvent event;
+	for (;;)
+	{
+		auto processed = false;
+		while (events.TryPop(event))
+		{
+			Process(event);
+			processed = true;
+		}
+
+		if (!processed)
+		{
+			//only stop on an empty buffer, so everything emitted before Stop gets processed
+			if (stopping.load()) break;
+
+			Sleep(1);
+		}
+	}
+}
+
+void EventAggregator::Process(const TraceEvent &event)
+{
+	switch (event.kind)
+	{
+	case TRACE_EVENT_BREAKPOINT:
+		OnBreakpoint(event);
+		break;
+	case TRACE_EVENT_EXCEPTION_THROWN:
+		OnExceptionThrown(event);
+		break;
+	case TRACE_EVENT_EXCEPTION_CAUGHT:
+		OnExceptionCaught(event);
+		break;
+	case TRACE_EVENT_EXCEPTION_UNWIND:
+	case TRACE_EVENT_EXCEPTION_ABANDONED:
+		OnExceptionUnwind(event);
+		break;
+	case TRACE_EVENT_TEXT:
+		OnText(event);
+		break;
+	case TRACE_EVENT_METHOD_DISARMED:
+		OnMethodDisarmed(event);
+		break;
+	default:
+		break;
+	}
+}
+
+void EventAggregator::OnBreakpoint(const TraceEvent &event)
+{
+	if (event.slot >= bpSlots.size()) return;
+
+	auto bpInfo = bpSlots[event.slot].get();
+	auto mInfo = bpInfo->method.get();
+
+	//register hit
+	InterlockedIncrement(&(bpInfo->hitCount));
+	hits.fetch_add(1, std::memory_order_relaxed);
+
+	//an exit is the same call as its entry
+	if (timeline && !bpInfo->IsExitBreakpoint()) timeline->OnHit(bpInfo->methodSlot, event.timeStamp);
+
+	//timing
+	if ((mode & OPMODE_TIMINGS) == 0) return;
+
+	auto entryBP = bpInfo->IsEntryBreakpoint();
+	auto exitBP = bpInfo->IsExitBreakpoint();
+	if (!(exitBP || entryBP) || !event.threadId) return;
+
+	auto stack = threadStacks.Get(event.threadId);
+
+	if (exitBP)
+	{
+		//close the innermost activation of this method, frames above it never saw their exit
+		auto depth = stack->Find(mInfo);
+		if (depth != ShadowStack::NotFound)
+		{
+			stack->Truncate(depth + 1);
+			CloseFrame(*stack, event.timeStamp, event.threadId, false);
+		}
+	}
+	else
+	{
+		//intern the stack this call makes
+		auto context = CallGraph::NoContext;
+		if (callGraph) context = callGraph->Enter(stack->Depth() ? stack->Top().context : CallGraph::RootContext, bpInfo->methodSlot, mInfo);
+
+		auto callers = stack->Depth() ? stack->Top().callers : 0;
+		stack->Push(mInfo, bpInfo->methodSlot, context, rules ? callers | rules->CallerBits(bpInfo->methodSlot) : 0, event.timeStamp);
+
+		//increment method entered count
+		InterlockedIncrement(&(mInfo->methodEntered));
+
+		if (rules) rules->OnEnter(bpInfo->methodSlot, callers, *stack, event.threadId);
+	}
+}
+
+void EventAggregator::OnExceptionThrown(const TraceEvent &event)
+{
+	//a new exception replaces one that never got to its unwind (thrown from a filter)
+	auto stack = threadStacks.Get(event.threadId);
+	stack->exception = ExceptionState{ true, stack->FindGroup(event.token), ShadowStack::NotFound };
+
+	if (rules && event.slot != RuleEngine::NoRule) rules->OnException(event.slot, stack->Depth() ? stack->Top().callers : 0, *stack, event.threadId);
+}
+
+void EventAggregator::OnExceptionCaught(const TraceEvent &event)
+{
+	auto stack = threadStacks.Get(event.threadId);
+	auto &exception = stack->exception;
+	if (!exception.pending) exception = ExceptionState{ true, ShadowStack::NotFound, ShadowStack::NotFound };
+
+	if (event.slot != UnwindToHandler)
+	{
+		//the debugger counted the instrumented frames between the throw and the handler, they are the top of the shadow stack
+		auto depth = (ULONG)stack->Depth();
+		exception.unwindTo = depth > event.slot ? (int)(depth - event.slot) : 0;
+		return;
+	}
+
+	//the handler is at or below the throwing frame, a handler in the throwing method itself unwinds nothing
+	auto from = exception.thrownAt != ShadowStack::NotFound ? exception.thrownAt : (int)stack->Depth() - 1;
+	auto handlerDepth = stack->FindGroup(event.token, from);
+	if (handlerDepth != ShadowStack::NotFound) exception.unwindTo = handlerDepth + 1;
+	else exception.unwindTo = exception.thrownAt;	//handler's activation predates tracing, at least the throwing frame is left
+}
+
+void EventAggregator::OnExceptionUnwind(const TraceEvent &event)
+{
+	auto stack = threadStacks.Get(event.threadId);
+	auto exception = stack->exception;
+	stack->exception.pending = false;
+
+	if (event.kind != TRACE_EVENT_EXCEPTION_UNWIND || !exception.pending || exception.unwindTo == ShadowStack::NotFound) return;
+
+	//register the abnormal exits, innermost first so every caller's child time is complete
+	while (stack->Depth() > (size_t)exception.unwindTo)
+	{
+		CloseFrame(*stack, event.timeStamp, event.threadId, true);
+	}
+}
+
+void EventAggregator::OnText(const TraceEvent &event)
+{
+	//every text has its event (EmitPayload reserves it), realign anyway should the positions ever disagree
+	auto skipped = (ULONG)(event.payloadOffset - (ULONG)payload.ReadPosition());
+	if (skipped) payload.Discard(skipped);
+
+	if (event.payloadLength > maxLog)
+	{
+		payload.Discard(event.payloadLength);
+		return;
+	}
+
+	if (!payload.TryPopMany(text.data(), event.payloadLength)) return;
+	text[event.payloadLength] = L'\0';
+
+	LOG(L"%s", text.data());
+}
+
+void EventAggregator::OnMethodDisarmed(const TraceEvent &event)
+{
+	if (event.slot >= bpSlots.size()) return;
+
+	//calls in flight won't see their exit breakpoint, they can't be timed
+	threadStacks.Remove(bpSlots[event.slot]->method.get());
+}
+
+//pop the top frame of a thread's shadow stack and account its inclusive and exclusive time
+void EventAggregator::CloseFrame(ShadowStack &stack, long long time, DWORD threadId, bool throughException)
+{
+	auto frame = stack.Pop();
+	auto inclusive = time - frame.entryTime;
+	auto exclusive = inclusive - frame.childTime;
+
+	//the caller's self time excludes this call, also when it left through an exception
+	if (stack.Depth()) stack.Top().childTime += inclusive;
+
+	auto totalTime = (double)inclusive / timerFreq;
+	auto selfTime = (double)exclusive / timerFreq;
+	auto latency = (ULONG64)((double)inclusive * nsPerTick);
+
+	if (throughException)
+	{
+		InterlockedIncrement(&(frame.method->methodExitThroughException));
+		frame.method->RecordExceptionLatency(latency);
+	}
+	else
+	{
+		frame.method->methodReturned++;
+		frame.method->totalTimeInMethod += totalTime;
+		frame.method->selfTimeInMethod += selfTime;
+		frame.method->RecordLatency(latency);
+		if (timeline) timeline->OnReturn(frame.methodSlot, latency, time);
+		if (rules) rules->OnReturn(frame.methodSlot, latency, stack.Depth() ? stack.Top().callers : 0, stack, threadId);
+	}
+
+	//the caller is the next instrumented frame down, if any. a call left through an exception is still on its edge and
+	//in its context, or the edges and the flame graph no longer add up to the time of the outermost call
+	if (callGraph)
+	{
+		callGraph->Leave(frame.context, selfTime);
+
+		if (stack.Depth()) callGraph->Record(stack.Top().methodSlot, stack.Top().method, frame.methodSlot, frame.method, totalTime, selfTime, throughException);
+		else callGraph->Record(CallGraph::NoCaller, nullptr, frame.methodSlot, frame.method, totalTime, selfTime, throughException);
+	}
+}
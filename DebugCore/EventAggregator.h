@@ -0,0 +1,171 @@
+#include "precompiled.h"
+#include "..\Shared\DebugMode.h"
+#include "..\Shared\TraceSettings.h"
+#include "EventRing.h"
+#include "CallStack.h"
+#include "CallGraph.h"
+#include "Timeline.h"
+#include "RuleEngine.h"
+#include <thread>
+
+#pragma once
+
+enum TraceEventKind
+{
+	TRACE_EVENT_BREAKPOINT,			//breakpoint hit, slot is the breakpoint slot
+	TRACE_EVENT_EXCEPTION_THROWN,	//first chance exception, token is the group of the method it was thrown in (or FlatIndex::NoSlot), slot the rule exception id (or RuleEngine::NoRule)
+	TRACE_EVENT_EXCEPTION_CAUGHT,	//catch handler found, token is the group of the method with the handler, slot the number of frames to unwind (or UnwindToHandler)
+	TRACE_EVENT_EXCEPTION_UNWIND,	//second pass started, the frames above the handler are left now
+	TRACE_EVENT_EXCEPTION_ABANDONED,//unhandled or intercepted, there won't be an unwind to a handler
+	TRACE_EVENT_TEXT,				//payload text for the log
+	TRACE_EVENT_METHOD_DISARMED		//the breakpoints of the method of slot got deactivated (sampling, overhead governor)
+};
+
+//fixed size record handed from the debugger callbacks to the aggregation thread
+struct TraceEvent
+{
+	long long timeStamp;	//QPC ticks
+	ULONG slot;				//breakpoint slot
+	DWORD threadId;
+	ULONG payloadOffset;	//ring position of the text in the payload buffer (low 32 bits)
+	ULONG payloadLength;	//characters, 0 = no payload
+	ULONG kind;				//TraceEventKind
+	mdToken token;
+};
+
+struct EventStats
+{
+	ULONG64 emitted;
+	ULONG64 dropped;		//events lost because the buffer was full
+	ULONG64 droppedText;	//log text lost because the payload buffer was full
+	size_t maxDepth;		//high water mark of the event buffer (sampled)
+	size_t capacity;
+	bool blocking;
+};
+
+//consumes breakpoint/exception events on a background thread and does all bookkeeping (hit counts, timing) and log output,
+//so a callback only costs a timestamp, a lookup and a push before the target continues
+class EventAggregator
+{
+public:
+	EventAggregator(OPMODE mode, double timerFreq, const vector<shared_ptr<BreakpointInfo>> &bpSlots, CallGraph *callGraph, Timeline *timeline, RuleEngine *rules, const TraceSettings &settings);
+	~EventAggregator();
+
+	void Start();
+	void Stop();	//processes all outstanding events, then ends the worker
+
+	//the handler's method is instrumented, the aggregator finds its frame on the shadow stack
+	static const ULONG UnwindToHandler = (ULONG)-1;
+
+	//producer side, only called from the debugger callback thread
+	inline void EmitBreakpoint(long long time, ULONG slot, DWORD threadId)
+	{
+		TraceEvent event = { time, slot, threadId, 0, 0, TRACE_EVENT_BREAKPOINT, mdTokenNil };
+		Emit(event);
+	}
+
+	inline void EmitException(long long time, TraceEventKind kind, DWORD threadId)
+	{
+		TraceEvent event = { time, 0, threadId, 0, 0, (ULONG)kind, mdTokenNil };
+		Emit(event);
+	}
+
+	inline void EmitThrown(long long time, DWORD threadId, ULONG methodGroup, ULONG exceptionId)
+	{
+		TraceEvent event = { time, exceptionId, threadId, 0, 0, TRACE_EVENT_EXCEPTION_THROWN, methodGroup };
+		Emit(event);
+	}
+
+	inline void EmitHandlerFound(long long time, DWORD threadId, ULONG handlerGroup, ULONG unwindFrames)
+	{
+		TraceEvent event = { time, unwindFrames, threadId, 0, 0, TRACE_EVENT_EXCEPTION_CAUGHT, handlerGroup };
+		Emit(event);
+	}
+
+	inline void EmitDisarmed(ULONG slot)
+	{
+		TraceEvent event = { 0, slot, 0, 0, 0, TRACE_EVENT_METHOD_DISARMED, mdTokenNil };
+		Emit(event);
+	}
+
+	//formats on the callback thread (cheap), writing the log happens on the worker
+	template<typename... Args>
+	void EmitText(wchar_t const * format, Args... args)
+	{
+		wchar_t buffer[maxLog];
+
+		auto count = _snwprintf_s(buffer, maxLog, maxLog - 1, format, args...);
+		if (count < 0) count = (int)wcslen(buffer);
+
+		EmitPayload(buffer, (ULONG)count);
+	}
+
+	EventStats Stats() const;
+
+	//breakpoint hits processed so far, any thread
+	ULONG64 Hits() const
+	{
+		return hits.load(std::memory_order_relaxed);
+	}
+private:
+	EventAggregator(EventAggregator const&);
+	void operator=(EventAggregator const&);
+
+	OPMODE mode;
+	double timerFreq;
+	double nsPerTick;
+	const vector<shared_ptr<BreakpointInfo>> &bpSlots;
+	CallGraph *callGraph;	//nullptr unless OPMODE_CALLGRAPH, only touched by the worker
+	Timeline *timeline;		//nullptr unless intervals are configured, only touched by the worker
+	RuleEngine *rules;		//nullptr without rules, evaluated by the worker
+	bool blockWhenFull;
+
+	EventRing<TraceEvent> events;
+	EventRing<wchar_t> payload;
+
+	std::thread worker;
+	std::atomic<bool> stopping;
+	std::atomic<ULONG64> hits;	//running total of the hit counts, so the session's hit limit doesn't walk the breakpoints
+
+	//producer counters
+	ULONG64 emitted;
+	ULONG64 dropped;
+	ULONG64 droppedText;
+	size_t maxDepth;
+
+	inline void Emit(const TraceEvent &event)
+	{
+		while (!events.TryPush(event))
+		{
+			if (!blockWhenFull)
+			{
+				dropped++;
+				return;
+			}
+			YieldProcessor();
+		}
+
+		//sample the queue depth, reading the consumer position on every push would bounce its cache line
+		if ((++emitted & 63) == 0)
+		{
+			auto depth = events.Size();
+			if (depth > maxDepth) maxDepth = depth;
+		}
+	}
+
+	void EmitPayload(const wchar_t *text, ULONG length);
+
+	//worker side
+	ThreadStacks threadStacks;
+	vector<wchar_t> text;
+
+	void Run();
+	void Process(const TraceEvent &event);
+	void OnBreakpoint(const TraceEvent &event);
+	void OnExceptionThrown(const TraceEvent &event);
+	void OnExceptionCaught(const TraceEvent &event);
+	void OnExceptionUnwind(const TraceEvent &event);
+	void OnText(const TraceEvent &event);
+	void OnMethodDisarmed(const TraceEvent &event);
+	void CloseFrame(ShadowStack &stack, long long time, DWORD threadId, bool throughException);
+};
@@ -0,0 +1,140 @@
+#include "precompiled.h"
+#include <atomic>
+
+#pragma once
+
+//lock-free single producer/single consumer ring buffer
+//positions only ever grow, the slot for a position is (position & mask). capacity is rounded up to a power of 2
+template<typename T> class EventRing
+{
+public:
+	EventRing(size_t minCapacity) : cachedTail(0), cachedHead(0)
+	{
+		capacity = 16;
+		while (capacity < minCapacity) capacity <<= 1;
+		mask = capacity - 1;
+
+		buffer = unique_ptr<T[]>(new T[capacity]);
+		head.store(0);
+		tail.store(0);
+	}
+
+	//producer
+	inline bool TryPush(const T &item)
+	{
+		auto position = head.load(std::memory_order_relaxed);
+		if (position - cachedTail >= capacity)
+		{
+			cachedTail = tail.load(std::memory_order_acquire);
+			if (position - cachedTail >= capacity) return false;
+		}
+
+		buffer[position & mask] = item;
+		head.store(position + 1, std::memory_order_release);
+		return true;
+	}
+
+	//producer, all or nothing. position receives the ring position of the first item
+	inline bool TryPushMany(const T *items, size_t num, size_t &position)
+	{
+		position = head.load(std::memory_order_relaxed);
+		if (position + num - cachedTail > capacity)
+		{
+			cachedTail = tail.load(std::memory_order_acquire);
+			if (position + num - cachedTail > capacity) return false;
+		}
+
+		auto start = position & mask;
+		auto firstPart = num < capacity - start ? num : capacity - start;
+		memcpy(&buffer[start], items, firstPart * sizeof(T));
+		if (num > firstPart) memcpy(&buffer[0], items + firstPart, (num - firstPart) * sizeof(T));
+
+		head.store(position + num, std::memory_order_release);
+		return true;
+	}
+
+	//producer, true when num items can be pushed. only the consumer frees space, so it stays true until the producer pushes
+	inline bool HasRoom(size_t num)
+	{
+		auto position = head.load(std::memory_order_relaxed);
+		if (position + num - cachedTail > capacity)
+		{
+			cachedTail = tail.load(std::memory_order_acquire);
+			if (position + num - cachedTail > capacity) return false;
+		}
+		return true;
+	}
+
+	//consumer
+	inline bool TryPop(T &item)
+	{
+		auto position = tail.load(std::memory_order_relaxed);
+		if (position == cachedHead)
+		{
+			cachedHead = head.load(std::memory_order_acquire);
+			if (position == cachedHead) return false;
+		}
+
+		item = buffer[position & mask];
+		tail.store(position + 1, std::memory_order_release);
+		return true;
+	}
+
+	//consumer, all or nothing
+	inline bool TryPopMany(T *items, size_t num)
+	{
+		auto position = tail.load(std::memory_order_relaxed);
+		if (cachedHead - position < num)
+		{
+			cachedHead = head.load(std::memory_order_acquire);
+			if (cachedHead - position < num) return false;
+		}
+
+		auto start = position & mask;
+		auto firstPart = num < capacity - start ? num : capacity - start;
+		memcpy(items, &buffer[start], firstPart * sizeof(T));
+		if (num > firstPart) memcpy(items + firstPart, &buffer[0], (num - firstPart) * sizeof(T));
+
+		tail.store(position + num, std::memory_order_release);
+		return true;
+	}
+
+	//consumer, skip items without copying them
+	inline void Discard(size_t num)
+	{
+		tail.store(tail.load(std::memory_order_relaxed) + num, std::memory_order_release);
+	}
+
+	//consumer, position of the next item to pop
+	inline size_t ReadPosition() const
+	{
+		return tail.load(std::memory_order_relaxed);
+	}
+
+	//approximate when called concurrently
+	size_t Size() const
+	{
+		return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+	}
+
+	size_t Capacity() const
+	{
+		return capacity;
+	}
+private:
+	EventRing(EventRing const&);
+	void operator=(EventRing const&);
+
+	unique_ptr<T[]> buffer;
+	size_t capacity;
+	size_t mask;
+
+	//keep producer and consumer state on their own cache lines
+	char padHead[64];
+	std::atomic<size_t> head;
+	size_t cachedTail;		//producer's last view of tail
+	char padTail[64];
+	std::atomic<size_t> tail;
+	size_t cachedHead;		//consumer's last view of head
+	char padEnd[64];
+};
@@ -0,0 +1,110 @@
+#include "precompiled.h"
+
+#pragma once
+
+//open addressing (linear probing) index from a 64 bit key to a compact slot number
+//keys and slots are stored inline in one flat array, so a lookup is a multiply and (mostly) a single cache line
+//key 0 marks an empty entry and can't be indexed
+class FlatIndex
+{
+public:
+	static const ULONG NoSlot = (ULONG)-1;
+
+	FlatIndex() : mask(0), shift(64), count(0) {}
+
+	//size the table for numKeys keys up front, so building the index never rehashes
+	void Reserve(size_t numKeys)
+	{
+		size_t capacity = 16;
+		while (capacity < numKeys * 2) capacity <<= 1;
+		if (capacity > entries.size()) Rehash(capacity);
+	}
+
+	void Insert(ULONG64 key, ULONG slot)
+	{
+		ASSERT(key != 0);
+
+		if ((count + 1) * 2 > entries.size()) Rehash(entries.size() ? entries.size() * 2 : 16);
+
+		for (auto pos = Hash(key);; pos = (pos + 1) & mask)
+		{
+			auto &entry = entries[pos];
+			if (entry.key == key)
+			{
+				entry.slot = slot;
+				return;
+			}
+			if (entry.key == 0)
+			{
+				entry.key = key;
+				entry.slot = slot;
+				count++;
+				return;
+			}
+		}
+	}
+
+	//load factor is kept <= 0.5, so the probe always ends at an empty entry
+	inline ULONG Find(ULONG64 key) const
+	{
+		if (count == 0) return NoSlot;
+
+		for (auto pos = Hash(key);; pos = (pos + 1) & mask)
+		{
+			const auto &entry = entries[pos];
+			if (entry.key == key) return entry.slot;
+			if (entry.key == 0) return NoSlot;
+		}
+	}
+
+	void Clear()
+	{
+		entries.clear();
+		mask = 0;
+		shift = 64;
+		count = 0;
+	}
+
+	size_t Size() const
+	{
+		return count;
+	}
+
+	static inline ULONG64 KeyOf(const void *ptr)
+	{
+		return (ULONG64)(ULONG_PTR)ptr;
+	}
+private:
+	struct Entry
+	{
+		ULONG64 key;
+		ULONG slot;
+	};
+
+	vector<Entry> entries;
+	size_t mask;
+	unsigned int shift;
+	size_t count;
+
+	//fibonacci hashing: pointers are aligned, the multiply moves the entropy into the high bits we keep
+	inline size_t Hash(ULONG64 key) const
+	{
+		return (size_t)((key * 0x9E3779B97F4A7C15ULL) >> shift) & mask;
+	}
+
+	void Rehash(size_t capacity)
+	{
+		auto old = std::move(entries);
+		entries = vector<Entry>(capacity, Entry{ 0, NoSlot });
+		mask = capacity - 1;
+
+		shift = 64;
+		for (auto bits = capacity; bits > 1; bits >>= 1) shift--;
+
+		count = 0;
+		for (auto entryIt = old.begin(); entryIt != old.end(); ++entryIt)
+		{
+			if (entryIt->key != 0) Insert(entryIt->key, entryIt->slot);
+		}
+	}
+};
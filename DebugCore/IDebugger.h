@@ -1,8 +1,14 @@
 #include "precompiled.h"
+#include "CallbackProfiler.h"
 
 #pragma once
 struct IDebugger
 {
-	virtual void OnBreakpointHit(ICorDebugAppDomain &AppDomain, ICorDebugThread &Thread, ICorDebugBreakpoint &Breakpoint) = 0;
+	virtual CallbackKind OnBreakpointHit(ICorDebugAppDomain &AppDomain, ICorDebugThread &Thread, ICorDebugBreakpoint &Breakpoint) = 0;
 	virtual void OnException(ICorDebugAppDomain &AppDomain, ICorDebugThread &Thread, ICorDebugFrame &Frame, ULONG32 nOffset, CorDebugExceptionCallbackType dwEventType, DWORD dwFlags) = 0;
+	virtual void OnExceptionUnwind(ICorDebugAppDomain &AppDomain, ICorDebugThread &Thread, CorDebugExceptionUnwindCallbackType dwEventType, DWORD dwFlags) = 0;
+	virtual void OnThreadChanged(ICorDebugThread &Thread, bool exited) = 0;
+	virtual void OnModuleChanged(ICorDebugAppDomain &AppDomain, ICorDebugModule &Module, bool unloaded) = 0;
+	virtual void OnClassLoaded(ICorDebugAppDomain &AppDomain, ICorDebugClass &Class) = 0;
+	virtual CallbackProfiler* Profiler() = 0;
 };
\ No newline at end of file
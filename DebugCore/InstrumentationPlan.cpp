@@ -0,0 +1,201 @@
+#include "precompiled.h"
+#include "InstrumentationPlan.h"
+
+static const DWORD PlanMagic = 0x4E4C5054;	//TPLN
+static const DWORD PlanVersion = 1;
+
+//bounds checked reads from the mapped file
+struct PlanReader
+{
+	const BYTE *pos;
+	const BYTE *end;
+
+	template<typename T>
+	bool Read(T &value)
+	{
+		if ((size_t)(end - pos) < sizeof(T)) return false;
+		memcpy(&value, pos, sizeof(T));
+		pos += sizeof(T);
+		return true;
+	}
+
+	template<typename T>
+	bool Read(vector<T> &values)
+	{
+		ULONG count;
+		if (!Read(count) || ((size_t)(end - pos) / sizeof(T) < count)) return false;
+		values.resize(count);
+		if (count) memcpy(&values[0], pos, count * sizeof(T));
+		pos += count * sizeof(T);
+		return true;
+	}
+
+	bool Read(std::wstring &text)
+	{
+		vector<wchar_t> chars;
+		if (!Read(chars)) return false;
+		text.assign(chars.begin(), chars.end());
+		return true;
+	}
+};
+
+template<typename T>
+static void Put(vector<BYTE> &buffer, const T &value)
+{
+	auto bytes = reinterpret_cast<const BYTE*>(&value);
+	buffer.insert(buffer.end(), bytes, bytes + sizeof(T));
+}
+
+template<typename T>
+static void Put(vector<BYTE> &buffer, const vector<T> &values)
+{
+	Put(buffer, (ULONG)values.size());
+	if (values.empty()) return;
+
+	auto bytes = reinterpret_cast<const BYTE*>(&values[0]);
+	buffer.insert(buffer.end(), bytes, bytes + values.size() * sizeof(T));
+}
+
+static void Put(vector<BYTE> &buffer, const std::wstring &text)
+{
+	Put(buffer, vector<wchar_t>(text.begin(), text.end()));
+}
+
+static bool ParsePlan(PlanReader &reader, ULONG64 configHash, vector<shared_ptr<ModulePlan>> &modules)
+{
+	DWORD magic;
+	DWORD version;
+	ULONG64 hash;
+	ULONG numModules;
+	if (!reader.Read(magic) || (magic != PlanMagic) || !reader.Read(version) || (version != PlanVersion)) return false;
+	if (!reader.Read(hash) || (hash != configHash) || !reader.Read(numModules)) return false;
+
+	for (ULONG moduleIt = 0; moduleIt < numModules; moduleIt++)
+	{
+		auto module = shared_ptr<ModulePlan>(new ModulePlan{});
+		module->loaded = true;
+
+		ULONG numMethods;
+		if (!reader.Read(module->mvid) || !reader.Read(numMethods)) return false;
+		for (ULONG methodIt = 0; methodIt < numMethods; methodIt++)
+		{
+			auto method = shared_ptr<PlannedMethod>(new PlannedMethod{});
+			if (!reader.Read(method->methodToken) || !reader.Read(method->filters) || !reader.Read(method->fields) || !reader.Read(method->signature)
+				|| !reader.Read(method->scans) || !reader.Read(method->breakpoints)) return false;
+
+			module->methods[method->methodToken] = method;
+		}
+		modules.push_back(module);
+	}
+	return true;
+}
+
+bool InstrumentationPlan::Load(const wchar_t *path, ULONG64 configHash)
+{
+	this->configHash = configHash;
+	modules.clear();
+
+	auto file = CreateFileW(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE) return false;
+
+	auto loaded = false;
+	LARGE_INTEGER size;
+	if (GetFileSizeEx(file, &size) && (size.QuadPart > 0) && (size.HighPart == 0))
+	{
+		auto mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (mapping)
+		{
+			auto view = static_cast<const BYTE*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+			if (view)
+			{
+				PlanReader reader = { view, view + size.LowPart };
+				loaded = ParsePlan(reader, configHash, modules);
+				UnmapViewOfFile(view);
+			}
+			CloseHandle(mapping);
+		}
+	}
+	CloseHandle(file);
+
+	//a plan for other filters, or a damaged one, is rebuilt from scratch
+	if (!loaded) modules.clear();
+	return loaded;
+}
+
+bool InstrumentationPlan::Save(const wchar_t *path) const
+{
+	ULONG numModules = 0;
+	for (auto moduleIt = modules.begin(); moduleIt != modules.end(); ++moduleIt)
+	{
+		if ((*moduleIt)->used) numModules++;
+	}
+
+	vector<BYTE> buffer;
+	Put(buffer, PlanMagic);
+	Put(buffer, PlanVersion);
+	Put(buffer, configHash);
+	Put(buffer, numModules);
+	for (auto moduleIt = modules.begin(); moduleIt != modules.end(); ++moduleIt)
+	{
+		auto &module = **moduleIt;
+		if (!module.used) continue;
+
+		Put(buffer, module.mvid);
+		Put(buffer, (ULONG)module.methods.size());
+		for (auto methodIt = module.methods.begin(); methodIt != module.methods.end(); ++methodIt)
+		{
+			auto &method = *methodIt->second;
+			Put(buffer, method.methodToken);
+			Put(buffer, method.filters);
+			Put(buffer, method.fields);
+			Put(buffer, method.signature);
+			Put(buffer, method.scans);
+			Put(buffer, method.breakpoints);
+		}
+	}
+
+	//written aside and swapped in, so an attach reading the old plan never sees half of the new one
+	std::wstring written(path);
+	written += L".new";
+
+	auto file = CreateFileW(written.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE) return false;
+
+	DWORD bytesWritten = 0;
+	auto ok = WriteFile(file, buffer.data(), (DWORD)buffer.size(), &bytesWritten, nullptr) && (bytesWritten == buffer.size());
+	CloseHandle(file);
+
+	return ok && MoveFileExW(written.c_str(), path, MOVEFILE_REPLACE_EXISTING);
+}
+
+shared_ptr<ModulePlan> InstrumentationPlan::Record(const GUID &mvid)
+{
+	for (auto moduleIt = modules.begin(); moduleIt != modules.end(); ++moduleIt)
+	{
+		if (IsEqualGUID((*moduleIt)->mvid, mvid))
+		{
+			(*moduleIt)->used = true;
+			return *moduleIt;
+		}
+	}
+
+	auto module = shared_ptr<ModulePlan>(new ModulePlan{});
+	module->mvid = mvid;
+	module->used = true;
+	modules.push_back(module);
+	return module;
+}
+
+ULONG64 InstrumentationPlan::Hash(const wchar_t *text, ULONG64 hash)
+{
+	for (; text && *text; text++)
+	{
+		hash ^= *text;
+		hash *= 1099511628211ULL;
+	}
+
+	//a terminator, so ("ab", "c") and ("a", "bc") differ
+	hash ^= 0xFFFF;
+	hash *= 1099511628211ULL;
+	return hash;
+}
@@ -0,0 +1,71 @@
+#include "precompiled.h"
+#include <algorithm>
+
+#pragma once
+
+//a breakpoint an IL scan of a method found
+struct PlannedBreakpoint
+{
+	ULONG32 bindOffset;		//where it could be set, at or near the instruction
+	ULONG32 ilOffset;		//reported
+	mdToken typeToken;		//operand of the instruction, if it has a type token
+	CEE_OPCODE instruction;
+	CEE_OPCODE scan;		//CEE_RET for the exits, else the opcode searched for
+};
+
+//what the search and the IL scans worked out for a method
+struct PlannedMethod
+{
+	mdMethodDef methodToken;
+	vector<ULONG> filters;			//the filters that matched it
+	vector<mdFieldDef> fields;		//dumped on entry
+	std::wstring signature;
+	vector<CEE_OPCODE> scans;		//done, the breakpoints they found are in breakpoints
+	vector<PlannedBreakpoint> breakpoints;
+
+	bool Scanned(CEE_OPCODE scan) const
+	{
+		return std::find(scans.begin(), scans.end(), scan) != scans.end();
+	}
+
+	void Record(ULONG32 bindOffset, ULONG32 ilOffset, mdToken typeToken, CEE_OPCODE instruction, CEE_OPCODE scan)
+	{
+		PlannedBreakpoint planned = { bindOffset, ilOffset, typeToken, instruction, scan };
+		breakpoints.push_back(planned);
+	}
+};
+
+struct ModulePlan
+{
+	GUID mvid;
+	bool loaded;	//read from the file, its methods are looked up by token instead of searched
+	bool used;		//by this attach, only those are saved
+	map<mdMethodDef, shared_ptr<PlannedMethod>> methods;
+};
+
+//the instrumentation plan of an attach, saved so a later attach to the same build with the same filters skips the
+//metadata search and the IL scans: modules are matched by MVID (it changes with every build), the whole plan by a
+//hash of the filters
+class InstrumentationPlan
+{
+public:
+	InstrumentationPlan() : configHash(0) {}
+
+	//reads the file through a mapped view, false (and an empty plan) if it has no plan for configHash
+	bool Load(const wchar_t *path, ULONG64 configHash);
+	bool Save(const wchar_t *path) const;
+
+	//the module's plan, added if the plan doesn't have it yet
+	shared_ptr<ModulePlan> Record(const GUID &mvid);
+
+	size_t Size() const
+	{
+		return modules.size();
+	}
+
+	//FNV-1a, chained over the texts that make up a config, nullptr hashes as an empty text
+	static ULONG64 Hash(const wchar_t *text, ULONG64 hash = 14695981039346656037ULL);
+private:
+	ULONG64 configHash;
+	vector<shared_ptr<ModulePlan>> modules;
+};
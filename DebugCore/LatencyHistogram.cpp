@@ -0,0 +1,72 @@
+#include "precompiled.h"
+#include "LatencyHistogram.h"
+
+LatencyHistogram::LatencyHistogram()
+{
+	Reset();
+}
+
+void LatencyHistogram::Reset()
+{
+	memset(counts, 0, sizeof(counts));
+	count = 0;
+	sum = 0;
+	max = 0;
+	min = MaxValue;
+}
+
+ULONG64 LatencyHistogram::BucketLowerBound(unsigned int bucket)
+{
+	if (bucket < SubBucketCount) return bucket;
+
+	auto shift = (bucket - SubBucketCount) / SubBucketCount;
+	auto subBucket = (bucket - SubBucketCount) % SubBucketCount;
+	return (ULONG64)(SubBucketCount + subBucket) << shift;
+}
+
+ULONG64 LatencyHistogram::BucketUpperBound(unsigned int bucket)
+{
+	if (bucket < SubBucketCount) return bucket;
+
+	auto shift = (bucket - SubBucketCount) / SubBucketCount;
+	return BucketLowerBound(bucket) + (1ULL << shift) - 1;
+}
+
+ULONG64 LatencyHistogram::ValueAtPercentile(double percentile) const
+{
+	if (count == 0) return 0;
+
+	if (percentile > 100.0) percentile = 100.0;
+	if (percentile < 0.0) percentile = 0.0;
+
+	//rank of the value we're looking for (at least the first one)
+	auto rank = (ULONG64)((percentile / 100.0) * (double)count + 0.5);
+	if (rank < 1) rank = 1;
+
+	ULONG64 seen = 0;
+	for (unsigned int bucket = 0; bucket < BucketCount; bucket++)
+	{
+		seen += counts[bucket];
+		if (seen >= rank)
+		{
+			auto value = BucketUpperBound(bucket);
+			return value > max ? max : value;
+		}
+	}
+
+	return max;
+}
+
+void LatencyHistogram::Add(const LatencyHistogram &other)
+{
+	if (other.count == 0) return;
+
+	for (unsigned int bucket = 0; bucket < BucketCount; bucket++)
+	{
+		counts[bucket] += other.counts[bucket];
+	}
+	count += other.count;
+	sum += other.sum;
+	if (other.max > max) max = other.max;
+	if (other.min < min) min = other.min;
+}
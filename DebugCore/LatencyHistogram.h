@@ -0,0 +1,75 @@
+#pragma once
+
+#include <intrin.h>
+
+//log-linear (HDR style) latency histogram with fixed memory and O(1) recording
+//values (nanoseconds) below 2^SubBucketBits are exact, above that every power of 2 is split into SubBucketCount linear buckets,
+//so any recorded value is reported with a relative error below 1/SubBucketCount
+class LatencyHistogram
+{
+public:
+	LatencyHistogram();
+
+	inline void Record(ULONG64 value)
+	{
+		if (value > MaxValue) value = MaxValue;
+
+		counts[BucketOf(value)]++;
+		count++;
+		sum += value;
+		if (value > max) max = value;
+		if (value < min) min = value;
+	}
+
+	//highest value equivalent to the value at this percentile (0-100), clamped to the recorded maximum
+	ULONG64 ValueAtPercentile(double percentile) const;
+	void Add(const LatencyHistogram &other);
+	void Reset();
+
+	ULONG64 Count() const { return count; }
+	ULONG64 Max() const { return count ? max : 0; }
+	ULONG64 Min() const { return count ? min : 0; }
+	double Mean() const { return count ? (double)sum / (double)count : 0.0; }
+
+	static const unsigned int SubBucketBits = 5;
+	static const unsigned int SubBucketCount = 1 << SubBucketBits;
+	static const unsigned int MaxMagnitude = 37;	//highest power of 2 tracked, larger values are clamped (~4.5 minutes)
+	static const ULONG64 MaxValue = (1ULL << (MaxMagnitude + 1)) - 1;
+	static const unsigned int BucketCount = SubBucketCount + (MaxMagnitude - SubBucketBits + 1) * SubBucketCount;
+private:
+	ULONG counts[BucketCount];
+	ULONG64 count;
+	ULONG64 sum;
+	ULONG64 max;
+	ULONG64 min;
+
+	static inline unsigned int MostSignificantBit(ULONG64 value)
+	{
+		unsigned long index;
+#ifdef _WIN64
+		_BitScanReverse64(&index, value);
+#else
+		if (value >> 32)
+		{
+			_BitScanReverse(&index, (unsigned long)(value >> 32));
+			index += 32;
+		}
+		else
+		{
+			_BitScanReverse(&index, (unsigned long)value);
+		}
+#endif
+		return index;
+	}
+
+	static inline unsigned int BucketOf(ULONG64 value)
+	{
+		if (value < SubBucketCount) return (unsigned int)value;
+
+		auto shift = MostSignificantBit(value) - SubBucketBits;
+		return SubBucketCount + shift * SubBucketCount + (unsigned int)(value >> shift) - SubBucketCount;
+	}
+
+	static ULONG64 BucketLowerBound(unsigned int bucket);
+	static ULONG64 BucketUpperBound(unsigned int bucket);
+};
@@ -131,11 +131,11 @@ ICorDebugProcess5* const LegacyManagedDebugger::CorProcess5()
 	return CorDebugProcess5.Get();
 }
 
-void LegacyManagedDebugger::OnBreakpointHit(ICorDebugAppDomain &AppDomain, ICorDebugThread &Thread, ICorDebugBreakpoint &Breakpoint)
+CallbackKind LegacyManagedDebugger::OnBreakpointHit(ICorDebugAppDomain &AppDomain, ICorDebugThread &Thread, ICorDebugBreakpoint &Breakpoint)
 {	
 	ASSERT(debugger);
 
-	debugger->OnBreakpointHit(AppDomain, Thread, Breakpoint);
+	return debugger->OnBreakpointHit(AppDomain, Thread, Breakpoint);
 }
 
 void LegacyManagedDebugger::OnException(ICorDebugAppDomain &AppDomain, ICorDebugThread &Thread, ICorDebugFrame &Frame, ULONG32 nOffset, CorDebugExceptionCallbackType dwEventType, DWORD dwFlags)
@@ -143,4 +143,39 @@ void LegacyManagedDebugger::OnException(ICorDebugAppDomain &AppDomain, ICorDebug
 	ASSERT(debugger);
 
 	debugger->OnException(AppDomain, Thread, Frame, nOffset, dwEventType, dwFlags);
+}
+
+void LegacyManagedDebugger::OnExceptionUnwind(ICorDebugAppDomain &AppDomain, ICorDebugThread &Thread, CorDebugExceptionUnwindCallbackType dwEventType, DWORD dwFlags)
+{
+	ASSERT(debugger);
+
+	debugger->OnExceptionUnwind(AppDomain, Thread, dwEventType, dwFlags);
+}
+
+void LegacyManagedDebugger::OnThreadChanged(ICorDebugThread &Thread, bool exited)
+{
+	ASSERT(debugger);
+
+	debugger->OnThreadChanged(Thread, exited);
+}
+
+void LegacyManagedDebugger::OnModuleChanged(ICorDebugAppDomain &AppDomain, ICorDebugModule &Module, bool unloaded)
+{
+	ASSERT(debugger);
+
+	debugger->OnModuleChanged(AppDomain, Module, unloaded);
+}
+
+void LegacyManagedDebugger::OnClassLoaded(ICorDebugAppDomain &AppDomain, ICorDebugClass &Class)
+{
+	ASSERT(debugger);
+
+	debugger->OnClassLoaded(AppDomain, Class);
+}
+
+CallbackProfiler* LegacyManagedDebugger::Profiler()
+{
+	ASSERT(debugger);
+
+	return debugger->Profiler();
 }
\ No newline at end of file
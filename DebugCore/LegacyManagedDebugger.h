@@ -14,8 +14,13 @@ public:
 	~LegacyManagedDebugger() override;
 	ICorDebugProcess* const CorProcess(void) override;
 	ICorDebugProcess5* const CorProcess5(void) override;
-	void OnBreakpointHit(ICorDebugAppDomain &AppDomain, ICorDebugThread &Thread, ICorDebugBreakpoint &Breakpoint) override;
+	CallbackKind OnBreakpointHit(ICorDebugAppDomain &AppDomain, ICorDebugThread &Thread, ICorDebugBreakpoint &Breakpoint) override;
 	void OnException(ICorDebugAppDomain &AppDomain, ICorDebugThread &Thread, ICorDebugFrame &Frame, ULONG32 nOffset, CorDebugExceptionCallbackType dwEventType, DWORD dwFlags) override;
+	void OnExceptionUnwind(ICorDebugAppDomain &AppDomain, ICorDebugThread &Thread, CorDebugExceptionUnwindCallbackType dwEventType, DWORD dwFlags) override;
+	void OnThreadChanged(ICorDebugThread &Thread, bool exited) override;
+	void OnModuleChanged(ICorDebugAppDomain &AppDomain, ICorDebugModule &Module, bool unloaded) override;
+	void OnClassLoaded(ICorDebugAppDomain &AppDomain, ICorDebugClass &Class) override;
+	CallbackProfiler* Profiler() override;
 private:
 	IDebugger* debugger;
 
@@ -6,13 +6,17 @@ ManagedCallback::ManagedCallback(IDebuggerImplementation* debugger)
 	ASSERT(debugger);
 
 	pDebugger = debugger;
+	profiler = debugger->Profiler();
 }
 
-void ManagedCallback::Continue()
+void ManagedCallback::Continue(CallbackKind kind, long long start)
 {
 	ASSERT(pDebugger);
 
 	pDebugger->CorProcess()->Continue(false);
+
+	//including the continue itself, the target thread can only run after it
+	if (profiler) profiler->Record(kind, start);
 }
 
 HRESULT STDMETHODCALLTYPE ManagedCallback::QueryInterface(/* [in] */ REFIID riid, /* [iid_is][out] */ _COM_Outptr_ void __RPC_FAR *__RPC_FAR *ppvObject)
@@ -60,73 +64,89 @@ ULONG STDMETHODCALLTYPE ManagedCallback::Release(void)
 
 HRESULT STDMETHODCALLTYPE ManagedCallback::Breakpoint(/* [in] */ ICorDebugAppDomain *pAppDomain,	/* [in] */ ICorDebugThread *pThread, /* [in] */ ICorDebugBreakpoint *pBreakpoint)
 { 
+	//timed until the target is continued
+	auto start = CallbackProfiler::Now();
+
 	TRACE(L"Breakpoint hit\n");
 	
 	ASSERT(pAppDomain);
 	ASSERT(pThread);
 	ASSERT(pBreakpoint);
 
+	auto kind = CALLBACK_BREAKPOINT;
 	try
 	{
 		ASSERT(pDebugger);
 
-		pDebugger->OnBreakpointHit(*pAppDomain, *pThread, *pBreakpoint);
+		kind = pDebugger->OnBreakpointHit(*pAppDomain, *pThread, *pBreakpoint);
 	}
 	catch (...)
 	{
 		TRACE(L"Exception in breakpoint handler\n");
 	}
 
-	Continue();
+	Continue(kind, start);
 
 	return S_OK; 
 }
 
 HRESULT STDMETHODCALLTYPE ManagedCallback::StepComplete(	/* [in] */ ICorDebugAppDomain *pAppDomain,/* [in] */ ICorDebugThread *pThread,	/* [in] */ ICorDebugStepper *pStepper,	/* [in] */ CorDebugStepReason reason)
 { 
+	auto start = CallbackProfiler::Now();
+
 	TRACE(L"StepCompleted\n");
 
-	Continue();
+	Continue(CALLBACK_OTHER, start);
 	return S_OK; 
 }
 
 HRESULT STDMETHODCALLTYPE ManagedCallback::Break(/* [in] */ ICorDebugAppDomain *pAppDomain, /* [in] */ ICorDebugThread *thread)
 {
+	auto start = CallbackProfiler::Now();
+
 	TRACE(L"Break instruction hit\n");
 
-	Continue(); 
+	Continue(CALLBACK_OTHER, start);
 	return S_OK;
 }
 
 HRESULT STDMETHODCALLTYPE ManagedCallback::Exception(/* [in] */ ICorDebugAppDomain *pAppDomain,	/* [in] */ ICorDebugThread *pThread, /* [in] */ BOOL unhandled)
 {
+	auto start = CallbackProfiler::Now();
+
 	TRACE(L"%s exception\n", unhandled ? L"Unhandled" : L"First chance");
 
-	Continue(); 
+	Continue(CALLBACK_EXCEPTION, start);
 	return S_OK;
 }
 
 HRESULT STDMETHODCALLTYPE ManagedCallback::EvalComplete(/* [in] */ ICorDebugAppDomain *pAppDomain, /* [in] */ ICorDebugThread *pThread, /* [in] */ ICorDebugEval *pEval)
 { 
+	auto start = CallbackProfiler::Now();
+
 	TRACE(L"EvalCompleted\n");
 
-	Continue();
+	Continue(CALLBACK_OTHER, start);
 	return S_OK; 
 }
 
 HRESULT STDMETHODCALLTYPE ManagedCallback::EvalException(/* [in] */ ICorDebugAppDomain *pAppDomain, /* [in] */ ICorDebugThread *pThread,	/* [in] */ ICorDebugEval *pEval)
 { 
+	auto start = CallbackProfiler::Now();
+
 	TRACE(L"EvalException\n");
 
-	Continue();
+	Continue(CALLBACK_OTHER, start);
 	return S_OK; 
 }
 
 HRESULT STDMETHODCALLTYPE ManagedCallback::CreateProcess(/* [in] */ ICorDebugProcess *pProcess)
 { 
+	auto start = CallbackProfiler::Now();
+
 	TRACE(L"ProcessCreated\n");
 
-	Continue(); 
+	Continue(CALLBACK_OTHER, start);
 	return S_OK;
 }
 
@@ -139,31 +159,48 @@ HRESULT STDMETHODCALLTYPE ManagedCallback::ExitProcess(/* [in] */ ICorDebugProce
 
 HRESULT STDMETHODCALLTYPE ManagedCallback::CreateThread(/* [in] */ ICorDebugAppDomain *pAppDomain, /* [in] */ ICorDebugThread *thread)
 { 
+	auto start = CallbackProfiler::Now();
+
 	DWORD threadId = 0;
 	thread->GetID(&threadId);
 
 	TRACE(L"ThreadCreated: %u\n", threadId);
 
-	Continue(); 
+	Continue(CALLBACK_CREATE_THREAD, start);
 	return S_OK;
 }
 
 HRESULT STDMETHODCALLTYPE ManagedCallback::ExitThread(/* [in] */ ICorDebugAppDomain *pAppDomain,	/* [in] */ ICorDebugThread *thread)
 { 
+	auto start = CallbackProfiler::Now();
+
 	DWORD threadId = 0;
 	thread->GetID(&threadId);
 
 	TRACE(L"ThreadExit: %u\n", threadId);
 
-	Continue(); 
+	try
+	{
+		ASSERT(pDebugger);
+
+		pDebugger->OnThreadChanged(*thread, true);
+	}
+	catch (...)
+	{
+		TRACE(L"Exception in thread exit handler\n");
+	}
+
+	Continue(CALLBACK_EXIT_THREAD, start);
 	return S_OK;
 }
 
 HRESULT STDMETHODCALLTYPE ManagedCallback::LoadModule(/* [in] */ ICorDebugAppDomain *pAppDomain,	/* [in] */ ICorDebugModule *pModule)
 { 
+	auto start = CallbackProfiler::Now();
+
 	wchar_t moduleName[2048];
 	ULONG32 moduleNameLen;
-	if (pModule->GetName(sizeof(moduleName), &moduleNameLen, moduleName) == S_OK)
+	if (pModule->GetName(_countof(moduleName), &moduleNameLen, moduleName) == S_OK)
 	{
 		TRACE(L"ModuleLoad: %s\n", moduleName);
 	}
@@ -171,8 +208,6 @@ HRESULT STDMETHODCALLTYPE ManagedCallback::LoadModule(/* [in] */ ICorDebugAppDom
 	{
 		TRACE(L"ModuleLoad: ?\n");
 	}
-	//todo: enable class load notifications
-
 
 	//disable optimizations
 	ComPtr<ICorDebugModule2> Module2;
@@ -186,15 +221,29 @@ HRESULT STDMETHODCALLTYPE ManagedCallback::LoadModule(/* [in] */ ICorDebugAppDom
 		}		
 	}
 
-	Continue(); 
+	//a module loaded after the search is searched (and instrumented) on its own
+	try
+	{
+		ASSERT(pDebugger);
+
+		pDebugger->OnModuleChanged(*pAppDomain, *pModule, false);
+	}
+	catch (...)
+	{
+		TRACE(L"Exception in module load handler\n");
+	}
+
+	Continue(CALLBACK_LOAD_MODULE, start);
 	return S_OK;
 }
 
 HRESULT STDMETHODCALLTYPE ManagedCallback::UnloadModule(	/* [in] */ ICorDebugAppDomain *pAppDomain, /* [in] */ ICorDebugModule *pModule)
 { 
+	auto start = CallbackProfiler::Now();
+
 	wchar_t moduleName[2048];
 	ULONG32 moduleNameLen;
-	if (pModule->GetName(sizeof(moduleName), &moduleNameLen, moduleName) == S_OK)
+	if (pModule->GetName(_countof(moduleName), &moduleNameLen, moduleName) == S_OK)
 	{
 		TRACE(L"ModuleUNLoad: %s\n", moduleName);
 	}
@@ -203,52 +252,87 @@ HRESULT STDMETHODCALLTYPE ManagedCallback::UnloadModule(	/* [in] */ ICorDebugApp
 		TRACE(L"ModuleUNLoad: ?\n");
 	}
 
-	Continue(); 
+	try
+	{
+		ASSERT(pDebugger);
+
+		pDebugger->OnModuleChanged(*pAppDomain, *pModule, true);
+	}
+	catch (...)
+	{
+		TRACE(L"Exception in module unload handler\n");
+	}
+
+	Continue(CALLBACK_UNLOAD_MODULE, start);
 	return S_OK;
 }
 
 HRESULT STDMETHODCALLTYPE ManagedCallback::LoadClass(/* [in] */ ICorDebugAppDomain *pAppDomain, /* [in] */ ICorDebugClass *c)
 { 
+	auto start = CallbackProfiler::Now();
+
 	TRACE(L"ClassLoad\n");
 
-	Continue(); 
+	//only dynamic modules report their classes, their types are added after the module loaded
+	try
+	{
+		ASSERT(pDebugger);
+
+		pDebugger->OnClassLoaded(*pAppDomain, *c);
+	}
+	catch (...)
+	{
+		TRACE(L"Exception in class load handler\n");
+	}
+
+	Continue(CALLBACK_LOAD_CLASS, start);
 	return S_OK;
 }
 
 HRESULT STDMETHODCALLTYPE ManagedCallback::UnloadClass(/* [in] */ ICorDebugAppDomain *pAppDomain, /* [in] */ ICorDebugClass *c)
 { 
+	auto start = CallbackProfiler::Now();
+
 	TRACE(L"ClassUnload\n");
 
-	Continue(); 
+	Continue(CALLBACK_LOAD_CLASS, start);
 	return S_OK;
 }
 
 HRESULT STDMETHODCALLTYPE ManagedCallback::DebuggerError(/* [in] */ ICorDebugProcess *pProcess, /* [in] */ HRESULT errorHR, /* [in] */ DWORD errorCode)
 { 
+	auto start = CallbackProfiler::Now();
+
 	TRACE(L"DebuggerError. Debugging services disabled.\n");
 
-	Continue(); 
+	Continue(CALLBACK_OTHER, start);
 	return S_OK;
 }
 
 HRESULT STDMETHODCALLTYPE ManagedCallback::LogMessage(/* [in] */ ICorDebugAppDomain *pAppDomain,	/* [in] */ ICorDebugThread *pThread, /* [in] */ LONG lLevel, /* [in] */ WCHAR *pLogSwitchName, /* [in] */ WCHAR *pMessage)
 { 
+	auto start = CallbackProfiler::Now();
+
 	TRACE(L"A thread used the System.Diagnostics.EventLog\n");
 
-	Continue(); 
+	Continue(CALLBACK_OTHER, start);
 	return S_OK;
 }
 
 HRESULT STDMETHODCALLTYPE ManagedCallback::LogSwitch(/* [in] */ ICorDebugAppDomain *pAppDomain, /* [in] */ ICorDebugThread *pThread,	/* [in] */ LONG lLevel,	/* [in] */ ULONG ulReason, /* [in] */ WCHAR *pLogSwitchName, /* [in] */ WCHAR *pParentName)
 { 
+	auto start = CallbackProfiler::Now();
+
 	TRACE(L"A thread used the System.Diagnostics.Switch class\n");
 
-	Continue(); 
+	Continue(CALLBACK_OTHER, start);
 	return S_OK;
 }
 
 HRESULT STDMETHODCALLTYPE ManagedCallback::CreateAppDomain( /* [in] */ ICorDebugProcess *pProcess, /* [in] */ ICorDebugAppDomain *pAppDomain)
 { 
+	auto start = CallbackProfiler::Now();
+
 	wchar_t adName[2048];
 	ULONG32 adNameLen;
 	if (pAppDomain->GetName(sizeof(adName), &adNameLen, adName) == S_OK)
@@ -262,13 +346,15 @@ HRESULT STDMETHODCALLTYPE ManagedCallback::CreateAppDomain( /* [in] */ ICorDebug
 
 	pAppDomain->Attach();
 
-	Continue(); 
+	Continue(CALLBACK_APPDOMAIN, start);
 
 	return S_OK;
 }
 
 HRESULT STDMETHODCALLTYPE ManagedCallback::ExitAppDomain(/* [in] */ ICorDebugProcess *pProcess,	/* [in] */ ICorDebugAppDomain *pAppDomain)
 { 
+	auto start = CallbackProfiler::Now();
+
 	wchar_t adName[2048];
 	ULONG32 adNameLen;
 	if (pAppDomain->GetName(sizeof(adName), &adNameLen, adName) == S_OK)
@@ -280,12 +366,14 @@ HRESULT STDMETHODCALLTYPE ManagedCallback::ExitAppDomain(/* [in] */ ICorDebugPro
 		TRACE(L"AppDomainUNLoad: <noname>\n");
 	}
 
-	Continue(); 
+	Continue(CALLBACK_APPDOMAIN, start);
 	return S_OK;
 }
 
 HRESULT STDMETHODCALLTYPE ManagedCallback::LoadAssembly(	/* [in] */ ICorDebugAppDomain *pAppDomain,	/* [in] */ ICorDebugAssembly *pAssembly)
 { 
+	auto start = CallbackProfiler::Now();
+
 	wchar_t asmName[2048];
 	ULONG32 asmNameLen;
 	if (pAssembly->GetName(sizeof(asmName), &asmNameLen, asmName) == S_OK)
@@ -297,12 +385,14 @@ HRESULT STDMETHODCALLTYPE ManagedCallback::LoadAssembly(	/* [in] */ ICorDebugApp
 		TRACE(L"AssemblyLoad: <noname>\n");
 	}
 
-	Continue(); 
+	Continue(CALLBACK_ASSEMBLY, start);
 	return S_OK;
 }
 
 HRESULT STDMETHODCALLTYPE ManagedCallback::UnloadAssembly(/* [in] */ ICorDebugAppDomain *pAppDomain,	/* [in] */ ICorDebugAssembly *pAssembly)
 { 
+	auto start = CallbackProfiler::Now();
+
 	wchar_t asmName[2048];
 	ULONG32 asmNameLen;
 	if (pAssembly->GetName(sizeof(asmName), &asmNameLen, asmName) == S_OK)
@@ -314,83 +404,118 @@ HRESULT STDMETHODCALLTYPE ManagedCallback::UnloadAssembly(/* [in] */ ICorDebugAp
 		TRACE(L"AssemblyUNLoad: <noname>\n");
 	}
 
-	Continue(); 
+	Continue(CALLBACK_ASSEMBLY, start);
 	return S_OK;
 }
 
 HRESULT STDMETHODCALLTYPE ManagedCallback::ControlCTrap(	/* [in] */ ICorDebugProcess *pProcess)
 { 
+	auto start = CallbackProfiler::Now();
+
 	TRACE(L"A CTRL+C was trapped in the process\n");
 
-	Continue(); 
+	Continue(CALLBACK_OTHER, start);
 	return S_OK; 
 }
 
 HRESULT STDMETHODCALLTYPE ManagedCallback::NameChange(/* [in] */ ICorDebugAppDomain *pAppDomain,	/* [in] */ ICorDebugThread *pThread)
 { 
+	auto start = CallbackProfiler::Now();
+
 	TRACE(L"An AppDomain and/or thread changed name\n");
 
-	Continue();
+	//only thread names matter (to the thread filter), pThread is null for an AppDomain
+	if (pThread)
+	{
+		try
+		{
+			ASSERT(pDebugger);
+
+			pDebugger->OnThreadChanged(*pThread, false);
+		}
+		catch (...)
+		{
+			TRACE(L"Exception in name change handler\n");
+		}
+	}
+
+	Continue(CALLBACK_NAME_CHANGE, start);
 	return S_OK; 
 }
 
 HRESULT STDMETHODCALLTYPE ManagedCallback::UpdateModuleSymbols( /* [in] */ ICorDebugAppDomain *pAppDomain,/* [in] */ ICorDebugModule *pModule, /* [in] */ IStream *pSymbolStream)
 { 
+	auto start = CallbackProfiler::Now();
+
 	TRACE(L"The symbols for a CLR module have changed\n");
 
-	Continue(); 
+	Continue(CALLBACK_OTHER, start);
 	return S_OK;
 }
 
 HRESULT STDMETHODCALLTYPE ManagedCallback::EditAndContinueRemap(	/* [in] */ ICorDebugAppDomain *pAppDomain, /* [in] */ ICorDebugThread *pThread,	/* [in] */ ICorDebugFunction *pFunction, /* [in] */ BOOL fAccurate)
 { 
+	auto start = CallbackProfiler::Now();
+
 	//deprecated event
-	Continue(); 
+	Continue(CALLBACK_OTHER, start);
 	return S_OK;
 }
 
 HRESULT STDMETHODCALLTYPE ManagedCallback::BreakpointSetError(/* [in] */ ICorDebugAppDomain *pAppDomain,	/* [in] */ ICorDebugThread *pThread, /* [in] */ ICorDebugBreakpoint *pBreakpoint,/* [in] */ DWORD dwError)
 { 
+	auto start = CallbackProfiler::Now();
+
 	TRACE(L"The common language runtime was unable to accurately bind a breakpoint that was set before a function was just - in - time(JIT) compiled\n");	
 
-	Continue(); 
+	Continue(CALLBACK_OTHER, start);
 	return S_OK;
 }
 
 HRESULT STDMETHODCALLTYPE ManagedCallback::FunctionRemapOpportunity(/* [in] */ ICorDebugAppDomain *pAppDomain,/* [in] */ ICorDebugThread *pThread,/* [in] */ ICorDebugFunction *pOldFunction,/* [in] */ ICorDebugFunction *pNewFunction,	/* [in] */ ULONG32 oldILOffset) 
 { 
+	auto start = CallbackProfiler::Now();
+
 	TRACE(L"Code execution has reached a sequence point in an older version of an edited function\n");
 
-	Continue(); 
+	Continue(CALLBACK_OTHER, start);
 	return S_OK;
 }
 
 HRESULT STDMETHODCALLTYPE ManagedCallback::CreateConnection(/* [in] */ ICorDebugProcess *pProcess, /* [in] */ CONNID dwConnectionId,	/* [in] */ WCHAR *pConnName) 
 { 
+	auto start = CallbackProfiler::Now();
+
 	TRACE(L"A new (debugger) connection has been created\n");	
 
-	Continue(); 
+	Continue(CALLBACK_OTHER, start);
 	return S_OK;
 }
 
 HRESULT STDMETHODCALLTYPE ManagedCallback::ChangeConnection(/* [in] */ ICorDebugProcess *pProcess, /* [in] */ CONNID dwConnectionId) 
 { 
+	auto start = CallbackProfiler::Now();
+
 	TRACE(L"The set of tasks associated with a debugger connection has changed\n");
 
-	Continue(); 
+	Continue(CALLBACK_OTHER, start);
 	return S_OK;
 }
 
 HRESULT STDMETHODCALLTYPE ManagedCallback::DestroyConnection(/* [in] */ ICorDebugProcess *pProcess, /* [in] */ CONNID dwConnectionId) 
 { 
+	auto start = CallbackProfiler::Now();
+
 	TRACE(L"A debugger connection has been terminated.\n");
 
-	Continue(); 
+	Continue(CALLBACK_OTHER, start);
 	return S_OK;
 }
 
 HRESULT STDMETHODCALLTYPE ManagedCallback::Exception(/* [in] */ ICorDebugAppDomain *pAppDomain,	/* [in] */ ICorDebugThread *pThread, /* [in] */ ICorDebugFrame *pFrame,	/* [in] */ ULONG32 nOffset,	/* [in] */ CorDebugExceptionCallbackType dwEventType, /* [in] */ DWORD dwFlags) 
 { 
+	auto start = CallbackProfiler::Now();
+
 	TRACE(L"A search for an exception handler has started.\n");
 
 	try
@@ -404,49 +529,72 @@ HRESULT STDMETHODCALLTYPE ManagedCallback::Exception(/* [in] */ ICorDebugAppDoma
 		TRACE(L"Exception in exception handler\n");
 	}
 
-	Continue(); 
+	Continue(CALLBACK_EXCEPTION, start);
 	return S_OK;
 }
 
 HRESULT STDMETHODCALLTYPE ManagedCallback::ExceptionUnwind(/* [in] */ ICorDebugAppDomain *pAppDomain, /* [in] */ ICorDebugThread *pThread, /* [in] */ CorDebugExceptionUnwindCallbackType dwEventType, /* [in] */ DWORD dwFlags) 
 { 
+	auto start = CallbackProfiler::Now();
+
 	TRACE(L"Exception unwind status info:\n");
 
-	Continue(); 
+	try
+	{
+		ASSERT(pDebugger);
+
+		pDebugger->OnExceptionUnwind(*pAppDomain, *pThread, dwEventType, dwFlags);
+	}
+	catch (...)
+	{
+		TRACE(L"Exception in exception unwind handler\n");
+	}
+
+	Continue(CALLBACK_EXCEPTION_UNWIND, start);
 	return S_OK;
 }
 
 HRESULT STDMETHODCALLTYPE ManagedCallback::FunctionRemapComplete(/* [in] */ ICorDebugAppDomain *pAppDomain,	/* [in] */ ICorDebugThread *pThread, /* [in] */ ICorDebugFunction *pFunction) 
 { 
+	auto start = CallbackProfiler::Now();
+
 	TRACE(L"Code execution has switched to a new version of an edited function.\n");	
 
-	Continue(); 
+	Continue(CALLBACK_OTHER, start);
 	return S_OK;
 }
 
 HRESULT STDMETHODCALLTYPE ManagedCallback::MDANotification(/* [in] */ ICorDebugController *pController,	/* [in] */ ICorDebugThread *pThread,/* [in] */ ICorDebugMDA *pMDA) 
 { 
+	auto start = CallbackProfiler::Now();
+
 	TRACE(L"Code execution has encountered a managed debugging assistant (MDA)\n");
 
-	Continue(); 
+	Continue(CALLBACK_OTHER, start);
 	return S_OK;
 }
 //3
 HRESULT STDMETHODCALLTYPE ManagedCallback::CustomNotification(/* [in] */ ICorDebugThread *pThread, /* [in] */ ICorDebugAppDomain *pAppDomain)
 { 
+	auto start = CallbackProfiler::Now();
+
 	TRACE(L"A custom debugger notification has been raised.\n");
 
-	Continue(); 
+	Continue(CALLBACK_OTHER, start);
 	return S_OK;
 }
 
 HRESULT STDMETHODCALLTYPE ManagedCallback::DebugEvent(/* [in] */ LPDEBUG_EVENT pDebugEvent,/* [in] */ BOOL fOutOfBand)
 {
+	auto start = CallbackProfiler::Now();
+
 	TRACE(L"Unmanaged callback received\n");
 
 	ASSERT(pDebugger);
 
 	pDebugger->CorProcess()->Continue(fOutOfBand);
 
+	if (profiler) profiler->Record(CALLBACK_UNMANAGED, start);
+
 	return S_OK;
 }
\ No newline at end of file
@@ -1,5 +1,6 @@
 #include "precompiled.h"
 #include "IDebuggerImplementation.h"
+#include "CallbackProfiler.h"
 
 using namespace Microsoft::WRL;
 
@@ -55,5 +56,6 @@ public:
 	HRESULT STDMETHODCALLTYPE DebugEvent(/* [in] */ LPDEBUG_EVENT pDebugEvent,/* [in] */ BOOL fOutOfBand);
 private:
 	IDebuggerImplementation* pDebugger;
-	void Continue();
+	CallbackProfiler* profiler;
+	void Continue(CallbackKind kind, long long start);
 };
\ No newline at end of file
@@ -13,10 +13,30 @@ MetaHelpers::~MetaHelpers()
 
 wchar_t * MetaHelpers::GetName(const mdToken &token)
 {
+	std::lock_guard<std::mutex> lock(cacheLock);
+
 	auto findName = tokenCache.find(token);
-	if (findName == tokenCache.end()) return nullptr;
+	if (findName != tokenCache.end()) return findName->second.get();
+
+	// Typedef and methoddef names of the searched modules are formatted on first use.
+	auto typeToken = TypeFromToken(token);
+	if ((typeToken != mdtTypeDef) && (typeToken != mdtMethodDef))
+		return nullptr;
+
+	for (auto moduleIt = modules.rbegin(); moduleIt != modules.rend(); ++moduleIt)
+	{
+		if (!(*moduleIt)->IsValidToken(token))
+			continue;
+
+		auto nameCopy = typeToken == mdtTypeDef ? GetTypeDefName(token, moduleIt->Get()) : GetMethodDefName(token, moduleIt->Get());
+		if (nameCopy == nullptr)
+			return nullptr;
 
-	return findName->second.get();
+		tokenCache[token] = nameCopy;
+		TrackToken(moduleIt->Get(), token);
+		return nameCopy.get();
+	}
+	return nullptr;
 }
 
 void MetaHelpers::ResolveTokenAndAddToCache(mdToken token, ICorDebugFunction *enclosingMethod)
@@ -75,7 +95,46 @@ void MetaHelpers::ResolveTokenAndAddToCache(mdToken token, ICorDebugFunction *en
 	if (nameCopy == nullptr)
 		return;
 
-	AddToCache(token, nameCopy);
+	std::lock_guard<std::mutex> lock(cacheLock);
+	tokenCache[token] = nameCopy;
+	TrackToken(modmeta.Get(), token);
+}
+
+void MetaHelpers::RemoveModule(IMetaDataImport *modmeta)
+{
+	ComPtr<IUnknown> identity;
+	if (modmeta->QueryInterface(IID_IUnknown, &identity) != S_OK)
+		return;
+
+	std::lock_guard<std::mutex> lock(cacheLock);
+
+	for (auto moduleIt = modules.begin(); moduleIt != modules.end();)
+	{
+		ComPtr<IUnknown> moduleIdentity;
+		if (((*moduleIt)->QueryInterface(IID_IUnknown, &moduleIdentity) == S_OK) && (moduleIdentity.Get() == identity.Get()))
+			moduleIt = modules.erase(moduleIt);
+		else
+			++moduleIt;
+	}
+
+	// Tokens are per module, another module's name for the same token is resolved again when it's asked for.
+	auto tokensIt = moduleTokens.find(identity.Get());
+	if (tokensIt == moduleTokens.end())
+		return;
+
+	for (auto tokenIt = tokensIt->second.begin(); tokenIt != tokensIt->second.end(); ++tokenIt)
+	{
+		tokenCache.erase(*tokenIt);
+	}
+	moduleTokens.erase(tokensIt);
+}
+
+// Called with the cache locked.
+void MetaHelpers::TrackToken(IMetaDataImport *modmeta, mdToken token)
+{
+	ComPtr<IUnknown> identity;
+	if (modmeta->QueryInterface(IID_IUnknown, &identity) == S_OK)
+		moduleTokens[identity.Get()].push_back(token);
 }
 
 
@@ -164,7 +223,8 @@ shared_ptr<wchar_t> MetaHelpers::GetMethodDefName(mdToken token, IMetaDataImport
 	if (modmeta->GetTypeDefProps(enclosingTypeToken, enclosingTypeName, _countof(enclosingTypeName), &enclosingTypeNameLen, &typeDefFlags, &scopeToken) != S_OK)
 		return nullptr;
 
-	auto sigP = unique_ptr<SigParser>(new SigParser(enclosingTypeName, memberSig, memberSigBytes, memberName, modmeta, token, 0, 0));
+	// Formatted as the method search does.
+	auto sigP = unique_ptr<SigParser>(new SigParser(enclosingTypeName, memberSig, memberSigBytes, memberName, modmeta, token, implFlags, pAttr));
 
 	auto sig = sigP->Signature();
 	auto sigLen = wcslen(sig);
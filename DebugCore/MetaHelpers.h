@@ -1,4 +1,6 @@
 #pragma once
+#include <mutex>
+
 class MetaHelpers
 {
 public:
@@ -8,18 +10,39 @@ public:
 	// Directly add and get from cache.
 	void AddToCache(const mdTypeDef token, const shared_ptr<wchar_t> name)
 	{
+		std::lock_guard<std::mutex> lock(cacheLock);
 		tokenCache[token] = name;
 	}
 	wchar_t * GetName(const mdToken &token);
 
 	// Add to cache but let MetaHelpers resolve the name.
 	void ResolveTokenAndAddToCache(mdToken refToken, ICorDebugFunction *enclosingMethod);
+
+	// A searched module: its typedef and methoddef names are only formatted when GetName is asked for them.
+	void AddModule(IMetaDataImport *modmeta)
+	{
+		std::lock_guard<std::mutex> lock(cacheLock);
+		modules.push_back(modmeta);
+	}
+
+	// An unloaded module: its tokens aren't resolved against it anymore, the names it resolved are dropped.
+	void RemoveModule(IMetaDataImport *modmeta);
 private:
 	ComPtr<ICorDebugProcess> pProcess;
 	
 	// Lookup table for typedef and methoddef. Needed for resolution of tokens in breakpoints
 	map<mdToken, shared_ptr<wchar_t>> tokenCache;	
 
+	// In the order they were searched, a token is resolved in the last one that has it.
+	vector<ComPtr<IMetaDataImport>> modules;
+
+	// The tokens cached from each module, by its COM identity (a module's importers can be different interface pointers).
+	map<IUnknown*, vector<mdToken>> moduleTokens;
+	void TrackToken(IMetaDataImport *modmeta, mdToken token);
+
+	// Names are looked up from the callback thread and the main thread.
+	std::mutex cacheLock;
+
 	shared_ptr<wchar_t> GetTypeDefName(mdToken token, IMetaDataImport* modmeta);
 	shared_ptr<wchar_t> GetTypeRefName(mdToken token, IMetaDataImport* modmeta);
 	shared_ptr<wchar_t> GetMemberRefName(mdToken token, IMetaDataImport* modmeta);
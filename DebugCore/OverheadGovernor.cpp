@@ -0,0 +1,58 @@
+#include "precompiled.h"
+#include "OverheadGovernor.h"
+
+OverheadGovernor::OverheadGovernor(BreakpointGroups &groups, const vector<shared_ptr<BreakpointInfo>> &bpSlots, double budget, double hitCostMicroSeconds, double timerFreq, long long now)
+	: groups(groups), bpSlots(bpSlots), periodSuspended(0), periodStart(now), activatedAt(now), budget(budget), timerFreq(timerFreq)
+{
+	hitCostTicks = (long long)(hitCostMicroSeconds * timerFreq / 1000000.0);
+	periodTicks.resize(groups.Size(), 0);
+
+	TRACE(L"Overhead governor: budget %.2f%% of wall time, estimated %.0f us per hit\n", budget * 100.0, hitCostMicroSeconds);
+}
+
+size_t OverheadGovernor::Enforce(long long now, vector<ULONG> &shedGroups)
+{
+	auto elapsed = now - periodStart;
+	auto allowed = (long long)(budget * (double)elapsed);
+
+	size_t numShed = 0;
+	if (elapsed > 0 && periodSuspended > allowed)
+	{
+		//worst offenders first
+		vector<ULONG> candidates;
+		for (ULONG group = 0; group < periodTicks.size(); group++)
+		{
+			if (periodTicks[group] && !groups.At(group).shed) candidates.push_back(group);
+		}
+		std::sort(candidates.begin(), candidates.end(), [this](ULONG g1, ULONG g2) { return periodTicks[g1] > periodTicks[g2]; });
+
+		for (auto groupIt = candidates.begin(); groupIt != candidates.end() && periodSuspended > allowed; ++groupIt)
+		{
+			auto &group = groups.At(*groupIt);
+
+			//the process is synchronized during a callback, so the breakpoints can be deactivated right away
+			groups.Activate(*groupIt, FALSE);
+			group.shed = true;
+
+			//total suspension over all breakpoints of the method
+			long long suspended = 0;
+			for (auto bpIt = group.breakpoints.begin(); bpIt != group.breakpoints.end(); ++bpIt)
+			{
+				suspended += (*bpIt)->suspendedTicks;
+			}
+
+			shed.push_back(ShedMethod{ group.method, (double)(now - activatedAt) / timerFreq, (double)periodTicks[*groupIt] / (double)elapsed, (double)suspended / timerFreq });
+			shedGroups.push_back(*groupIt);
+			numShed++;
+
+			periodSuspended -= periodTicks[*groupIt];
+		}
+	}
+
+	//next period
+	std::fill(periodTicks.begin(), periodTicks.end(), 0);
+	periodSuspended = 0;
+	periodStart = now;
+
+	return numShed;
+}
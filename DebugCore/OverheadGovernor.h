@@ -0,0 +1,71 @@
+#include "precompiled.h"
+#include "BreakpointGroups.h"
+
+#pragma once
+
+//a method the governor deactivated
+struct ShedMethod
+{
+	MethodInfo *method;
+	double shedAfter;		//seconds since the breakpoints were activated
+	double overheadShare;	//fraction of wall time the target was suspended for this method in the period it got shed
+	double suspended;		//seconds, total over all its breakpoints
+};
+
+//keeps the time the target is suspended by breakpoints under a budget (fraction of wall time)
+//every period the groups with the most suspension time are deactivated for good until the period fits the budget again
+//not thread safe, only used from the (serialized) callbacks
+class OverheadGovernor
+{
+public:
+	OverheadGovernor(BreakpointGroups &groups, const vector<shared_ptr<BreakpointInfo>> &bpSlots, double budget, double hitCostMicroSeconds, double timerFreq, long long now);
+
+	//account the suspension of a hit (callback handling time, the debugger round trip is estimated), true when the period is over
+	inline bool OnHit(ULONG slot, long long callbackTicks, long long now)
+	{
+		auto suspended = callbackTicks + hitCostTicks;
+
+		bpSlots[slot]->suspendedTicks += suspended;
+		periodTicks[groups.GroupOf(slot)] += suspended;
+		periodSuspended += suspended;
+
+		return now - periodStart >= PeriodTicks();
+	}
+
+	//groups appended while tracing (a module loaded), they're accounted from the current period on
+	void Extend()
+	{
+		periodTicks.resize(groups.Size(), 0);
+	}
+
+	//deactivates the worst offenders if the period went over budget, returns the number of groups shed
+	size_t Enforce(long long now, vector<ULONG> &shedGroups);
+
+	const vector<ShedMethod> &Shed() const
+	{
+		return shed;
+	}
+
+	static const unsigned int PeriodMs = 1000;
+private:
+	OverheadGovernor(OverheadGovernor const&);
+	void operator=(OverheadGovernor const&);
+
+	BreakpointGroups &groups;
+	const vector<shared_ptr<BreakpointInfo>> &bpSlots;
+	vector<long long> periodTicks;	//suspension by group in the current period
+	long long periodSuspended;
+	long long periodStart;
+	long long activatedAt;
+
+	double budget;
+	long long hitCostTicks;
+	double timerFreq;
+
+	vector<ShedMethod> shed;
+
+	inline long long PeriodTicks() const
+	{
+		return (long long)(timerFreq * PeriodMs / 1000.0);
+	}
+};
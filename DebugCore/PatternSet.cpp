@@ -0,0 +1,189 @@
+#include "precompiled.h"
+#include "PatternSet.h"
+
+PatternSet::PatternSet()
+{
+	PatternNode root = { L'\0', None, None, None };
+	includeTrie.push_back(root);
+	excludeTrie.push_back(root);
+}
+
+bool PatternSet::Add(const wchar_t *pattern, std::wstring &error)
+{
+	auto index = (ULONG)patterns.size();
+	Pattern compiled = { true };
+
+	std::wstring text(pattern ? pattern : L"");
+	for (size_t start = 0; start <= text.size();)
+	{
+		auto end = text.find(L',', start);
+		if (end == std::wstring::npos) end = text.size();
+
+		auto term = text.substr(start, end - start);
+		start = end + 1;
+		if (term.empty()) continue;
+
+		auto exclude = term[0] == L'!';
+		if (exclude) term.erase(0, 1);
+		if (term.empty()) continue;
+
+		if (!exclude) compiled.matchAll = false;
+
+		PatternTerm compiledTerm = { index, exclude, PATTERN_PREFIX, L"", nullptr };
+		if ((term.size() > 2) && (term.front() == L'/') && (term.back() == L'/'))
+		{
+			compiledTerm.kind = PATTERN_REGEX;
+			try
+			{
+				compiledTerm.regex = shared_ptr<std::wregex>(new std::wregex(term.substr(1, term.size() - 2), std::regex::ECMAScript | std::regex::optimize));
+			}
+			catch (const std::regex_error&)
+			{
+				error = L"invalid regular expression " + term;
+				return false;
+			}
+			terms.push_back(compiledTerm);
+		}
+		else if (term.find_first_of(L"*?") != std::wstring::npos)
+		{
+			//a glob ending in * with no other wildcards is just a prefix
+			auto wildcard = term.find_first_of(L"*?");
+			if ((wildcard == term.size() - 1) && (term[wildcard] == L'*'))
+			{
+				AddPrefix(exclude ? excludeTrie : includeTrie, term.substr(0, wildcard), index);
+			}
+			else
+			{
+				compiledTerm.kind = PATTERN_GLOB;
+				compiledTerm.glob = term;
+				terms.push_back(compiledTerm);
+			}
+		}
+		else
+		{
+			AddPrefix(exclude ? excludeTrie : includeTrie, term, index);
+		}
+	}
+
+	patterns.push_back(compiled);
+	return true;
+}
+
+void PatternSet::AddPrefix(vector<PatternNode> &trie, const std::wstring &prefix, ULONG pattern)
+{
+	ULONG node = 0;
+	for (auto chIt = prefix.begin(); chIt != prefix.end(); ++chIt)
+	{
+		auto child = trie[node].firstChild;
+		while ((child != None) && (trie[child].ch != *chIt)) child = trie[child].nextSibling;
+
+		if (child == None)
+		{
+			PatternNode newNode = { *chIt, None, trie[node].firstChild, None };
+			child = (ULONG)trie.size();
+			trie.push_back(newNode);
+			trie[node].firstChild = child;
+		}
+		node = child;
+	}
+
+	terminals.push_back(std::make_pair(pattern, trie[node].firstTerminal));
+	trie[node].firstTerminal = (ULONG)terminals.size() - 1;
+}
+
+void PatternSet::Walk(const vector<PatternNode> &trie, const wchar_t *name, wchar_t continuation, vector<bool> &matches, bool exclude) const
+{
+	ULONG node = 0;
+	auto pos = name;
+	for (;;)
+	{
+		//every prefix ending at this node matches
+		for (auto terminal = trie[node].firstTerminal; terminal != None; terminal = terminals[terminal].second)
+		{
+			matches[terminals[terminal].first] = !exclude;
+		}
+
+		wchar_t ch;
+		if (*pos)
+		{
+			ch = *pos++;
+		}
+		else if (continuation)
+		{
+			ch = continuation;
+			continuation = L'\0';
+		}
+		else
+		{
+			return;
+		}
+
+		auto child = trie[node].firstChild;
+		while ((child != None) && (trie[child].ch != ch)) child = trie[child].nextSibling;
+		if (child == None) return;
+
+		node = child;
+	}
+}
+
+void PatternSet::Classify(const wchar_t *name, vector<bool> &matches, wchar_t continuation) const
+{
+	matches.assign(patterns.size(), false);
+	for (size_t pattern = 0; pattern < patterns.size(); pattern++)
+	{
+		if (patterns[pattern].matchAll) matches[pattern] = true;
+	}
+
+	//includes first, then the exclusions clear what they match
+	Walk(includeTrie, name, continuation, matches, false);
+	for (auto termIt = terms.begin(); termIt != terms.end(); ++termIt)
+	{
+		if (termIt->exclude || matches[termIt->pattern]) continue;
+
+		if (termIt->kind == PATTERN_GLOB) matches[termIt->pattern] = GlobMatch(termIt->glob.c_str(), name);
+		else matches[termIt->pattern] = std::regex_search(name, *termIt->regex);
+	}
+
+	Walk(excludeTrie, name, continuation, matches, true);
+	for (auto termIt = terms.begin(); termIt != terms.end(); ++termIt)
+	{
+		if (!termIt->exclude || !matches[termIt->pattern]) continue;
+
+		if (termIt->kind == PATTERN_GLOB) matches[termIt->pattern] = !GlobMatch(termIt->glob.c_str(), name);
+		else matches[termIt->pattern] = !std::regex_search(name, *termIt->regex);
+	}
+}
+
+//* is any run of characters, ? any single one, the whole name has to match
+//on a mismatch only the last * backtracks, so it can't go exponential on many *
+bool PatternSet::GlobMatch(const wchar_t *glob, const wchar_t *name)
+{
+	const wchar_t *star = nullptr;
+	const wchar_t *starName = nullptr;
+
+	while (*name)
+	{
+		if (*glob == L'*')
+		{
+			star = glob++;
+			starName = name;
+		}
+		else if ((*glob == L'?') || (*glob == *name))
+		{
+			glob++;
+			name++;
+		}
+		else if (star)
+		{
+			glob = star + 1;
+			name = ++starName;
+		}
+		else
+		{
+			return false;
+		}
+	}
+
+	while (*glob == L'*') glob++;
+	return !*glob;
+}
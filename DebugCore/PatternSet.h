@@ -0,0 +1,72 @@
+#include "precompiled.h"
+#include <regex>
+
+#pragma once
+
+//how a single pattern is matched, plain text stays a prefix as the filters always were
+enum PatternKind
+{
+	PATTERN_PREFIX,		//Foo
+	PATTERN_GLOB,		//*Repository, Get?y*, the whole name has to match
+	PATTERN_REGEX		///^get_\w+$/, searched for anywhere in the name
+};
+
+//a glob or regex term of a pattern, prefixes are in the tries
+struct PatternTerm
+{
+	ULONG pattern;
+	bool exclude;
+	PatternKind kind;
+	std::wstring glob;
+	shared_ptr<std::wregex> regex;
+};
+
+//one trie node, children are a sibling list (names are short and the fan out is small)
+struct PatternNode
+{
+	wchar_t ch;
+	ULONG firstChild;
+	ULONG nextSibling;
+	ULONG firstTerminal;	//into terminals, the patterns a prefix ending here belongs to
+};
+
+//the filters' patterns for one part of a name (namespace, class or method), compiled once: a name is classified against
+//all of them with one walk down a prefix trie, plus the glob and regex terms
+//a pattern is a comma separated list of terms, !term excludes, a pattern without include terms matches every name
+//that no exclusion matches, an empty pattern (or nullptr) matches everything
+class PatternSet
+{
+public:
+	static const ULONG None = (ULONG)-1;
+
+	PatternSet();
+
+	//compiles the next pattern (its index is the number of patterns added before), false with error set if a regex is invalid
+	bool Add(const wchar_t *pattern, std::wstring &error);
+
+	size_t Size() const
+	{
+		return patterns.size();
+	}
+
+	//matches[pattern] is set if name matches it, safe to call from several threads
+	//continuation is walked through the tries after the name: a namespace is classified with '.', so a prefix
+	//like System.Data. still matches the System.Data namespace itself
+	void Classify(const wchar_t *name, vector<bool> &matches, wchar_t continuation = L'\0') const;
+
+	static bool GlobMatch(const wchar_t *glob, const wchar_t *name);
+private:
+	struct Pattern
+	{
+		bool matchAll;		//no include terms
+	};
+	vector<Pattern> patterns;
+
+	vector<PatternNode> includeTrie;	//node 0 is the root
+	vector<PatternNode> excludeTrie;
+	vector<std::pair<ULONG, ULONG>> terminals;	//(pattern, next)
+	vector<PatternTerm> terms;
+
+	void AddPrefix(vector<PatternNode> &trie, const std::wstring &prefix, ULONG pattern);
+	void Walk(const vector<PatternNode> &trie, const wchar_t *name, wchar_t continuation, vector<bool> &matches, bool exclude) const;
+};
@@ -0,0 +1,229 @@
+#include "precompiled.h"
+#include "Predicate.h"
+
+static inline bool IsNameStart(wchar_t c)
+{
+	return iswalpha(c) || c == L'_';
+}
+
+static inline bool IsNameChar(wchar_t c)
+{
+	return iswalnum(c) || c == L'_';
+}
+
+static inline void SkipSpace(const wchar_t *&pos)
+{
+	while (iswspace(*pos)) pos++;
+}
+
+//keyword at pos, not followed by more of a name
+static bool MatchWord(const wchar_t *&pos, const wchar_t *word)
+{
+	auto length = wcslen(word);
+	if ((_wcsnicmp(pos, word, length) != 0) || IsNameChar(pos[length])) return false;
+
+	pos += length;
+	return true;
+}
+
+static bool ParseOp(const wchar_t *&pos, PredicateOp &op)
+{
+	if (pos[0] == L'=' && pos[1] == L'=') { op = PREDICATE_EQ; pos += 2; return true; }
+	if (pos[0] == L'!' && pos[1] == L'=') { op = PREDICATE_NE; pos += 2; return true; }
+	if (pos[0] == L'<' && pos[1] == L'=') { op = PREDICATE_LE; pos += 2; return true; }
+	if (pos[0] == L'>' && pos[1] == L'=') { op = PREDICATE_GE; pos += 2; return true; }
+	if (pos[0] == L'<') { op = PREDICATE_LT; pos++; return true; }
+	if (pos[0] == L'>') { op = PREDICATE_GT; pos++; return true; }
+	if (MatchWord(pos, L"contains")) { op = PREDICATE_CONTAINS; return true; }
+	if (MatchWord(pos, L"startswith")) { op = PREDICATE_STARTS_WITH; return true; }
+	if (MatchWord(pos, L"endswith")) { op = PREDICATE_ENDS_WITH; return true; }
+	return false;
+}
+
+static bool ParseConstant(const wchar_t *&pos, PredicateClause &clause)
+{
+	//quoted string, " or ' (less escaping in an xml attribute), backslash escapes the next character
+	if (*pos == L'"' || *pos == L'\'')
+	{
+		auto quote = *pos++;
+		clause.constantKind = PREDICATE_VALUE_TEXT;
+		while (*pos && *pos != quote)
+		{
+			if (*pos == L'\\' && pos[1]) pos++;
+			clause.text.push_back(*pos++);
+		}
+		if (*pos != quote) return false;
+
+		pos++;
+		return true;
+	}
+
+	auto isTrue = MatchWord(pos, L"true");
+	if (isTrue || MatchWord(pos, L"false"))
+	{
+		clause.constantKind = PREDICATE_VALUE_SIGNED;
+		clause.integer = isTrue ? 1 : 0;
+		clause.real = (double)clause.integer;
+		return true;
+	}
+	if (MatchWord(pos, L"null"))
+	{
+		clause.constantKind = PREDICATE_VALUE_NULL;
+		return true;
+	}
+
+	//integers (also hex) unless it only parses completely as a real
+	wchar_t *integerEnd;
+	wchar_t *realEnd;
+	auto integer = _wcstoi64(pos, &integerEnd, 0);
+	auto real = wcstod(pos, &realEnd);
+	if (integerEnd == pos && realEnd == pos) return false;
+
+	if (realEnd > integerEnd)
+	{
+		clause.constantKind = PREDICATE_VALUE_REAL;
+		clause.real = real;
+		pos = realEnd;
+	}
+	else
+	{
+		clause.constantKind = PREDICATE_VALUE_SIGNED;
+		clause.integer = integer;
+		clause.real = (double)integer;
+		pos = integerEnd;
+	}
+	return !IsNameChar(*pos);
+}
+
+shared_ptr<Predicate> Predicate::Parse(const wchar_t *text, std::wstring &error)
+{
+	ASSERT(text);
+
+	auto predicate = shared_ptr<Predicate>(new Predicate());
+	predicate->text = text;
+
+	auto pos = text;
+	for (;;)
+	{
+		PredicateClause clause = { L"", PREDICATE_EQ, PREDICATE_VALUE_NULL, 0, 0.0, L"" };
+
+		SkipSpace(pos);
+		if (!IsNameStart(*pos))
+		{
+			error = L"expected an argument or field name at: " + std::wstring(pos);
+			return nullptr;
+		}
+		auto nameStart = pos;
+		while (IsNameChar(*pos)) pos++;
+		clause.operand.assign(nameStart, pos);
+
+		SkipSpace(pos);
+		if (!ParseOp(pos, clause.op))
+		{
+			error = L"expected ==, !=, <, <=, >, >=, contains, startswith or endswith at: " + std::wstring(pos);
+			return nullptr;
+		}
+
+		SkipSpace(pos);
+		if (!ParseConstant(pos, clause))
+		{
+			error = L"expected a number, a quoted string, true, false or null after " + clause.operand;
+			return nullptr;
+		}
+		if (clause.op >= PREDICATE_CONTAINS && clause.constantKind != PREDICATE_VALUE_TEXT)
+		{
+			error = L"contains, startswith and endswith need a string, after " + clause.operand;
+			return nullptr;
+		}
+
+		predicate->clauses.push_back(clause);
+
+		SkipSpace(pos);
+		if (!*pos) break;
+
+		if (pos[0] == L'&' && pos[1] == L'&') pos += 2;
+		else if (!MatchWord(pos, L"and"))
+		{
+			error = L"expected && or and at: " + std::wstring(pos);
+			return nullptr;
+		}
+	}
+
+	return predicate;
+}
+
+//outcome of an ordering op for a comparison result (<0, 0, >0)
+static inline bool Holds(PredicateOp op, int order)
+{
+	switch (op)
+	{
+	case PREDICATE_EQ: return order == 0;
+	case PREDICATE_NE: return order != 0;
+	case PREDICATE_LT: return order < 0;
+	case PREDICATE_LE: return order <= 0;
+	case PREDICATE_GT: return order > 0;
+	case PREDICATE_GE: return order >= 0;
+	default: return false;
+	}
+}
+
+template<typename T> static inline int Order(T a, T b)
+{
+	return a < b ? -1 : (b < a ? 1 : 0);
+}
+
+bool PredicateClause::Test(const PredicateValue &value) const
+{
+	//null only equals null, any value read (a string, a number, a reference) differs from it
+	if ((value.kind == PREDICATE_VALUE_NULL) || (constantKind == PREDICATE_VALUE_NULL))
+	{
+		auto same = (value.kind == PREDICATE_VALUE_NULL) && (constantKind == PREDICATE_VALUE_NULL);
+		if (op == PREDICATE_EQ) return same;
+		if (op == PREDICATE_NE) return !same && (value.kind != PREDICATE_VALUE_OTHER);
+		return false;
+	}
+
+	switch (value.kind)
+	{
+	case PREDICATE_VALUE_TEXT:
+	{
+		if (constantKind != PREDICATE_VALUE_TEXT) return false;
+
+		auto textEnd = value.text + value.length;
+		auto size = (ULONG)text.size();
+		switch (op)
+		{
+		case PREDICATE_CONTAINS:
+			return std::search(value.text, textEnd, text.begin(), text.end()) != textEnd || size == 0;
+		case PREDICATE_STARTS_WITH:
+			return value.length >= size && wmemcmp(value.text, text.c_str(), size) == 0;
+		case PREDICATE_ENDS_WITH:
+			return value.length >= size && wmemcmp(textEnd - size, text.c_str(), size) == 0;
+		default:
+		{
+			//ordinal, like String.CompareOrdinal
+			auto common = value.length < size ? value.length : size;
+			auto order = wmemcmp(value.text, text.c_str(), common);
+			if (order == 0) order = Order(value.length, size);
+			return Holds(op, order);
+		}
+		}
+	}
+	case PREDICATE_VALUE_SIGNED:
+	case PREDICATE_VALUE_UNSIGNED:
+	case PREDICATE_VALUE_REAL:
+	{
+		if (constantKind == PREDICATE_VALUE_TEXT) return false;
+
+		if (value.kind == PREDICATE_VALUE_REAL) return Holds(op, Order(value.real, real));
+		if (constantKind == PREDICATE_VALUE_REAL) return Holds(op, Order(value.kind == PREDICATE_VALUE_SIGNED ? (double)value.integer : (double)(ULONG64)value.integer, real));
+		if (value.kind == PREDICATE_VALUE_SIGNED) return Holds(op, Order(value.integer, integer));
+
+		//unsigned, a negative constant is below every value
+		if (integer < 0) return Holds(op, 1);
+		return Holds(op, Order((ULONG64)value.integer, (ULONG64)integer));
+	}
+	default:
+		return false;
+	}
+}
@@ -0,0 +1,101 @@
+#include "precompiled.h"
+
+#pragma once
+
+enum PredicateOp
+{
+	PREDICATE_EQ,
+	PREDICATE_NE,
+	PREDICATE_LT,
+	PREDICATE_LE,
+	PREDICATE_GT,
+	PREDICATE_GE,
+	PREDICATE_CONTAINS,		//strings only
+	PREDICATE_STARTS_WITH,
+	PREDICATE_ENDS_WITH
+};
+
+enum PredicateValueKind
+{
+	PREDICATE_VALUE_SIGNED,
+	PREDICATE_VALUE_UNSIGNED,	//also booleans (0/1) and chars
+	PREDICATE_VALUE_REAL,
+	PREDICATE_VALUE_TEXT,
+	PREDICATE_VALUE_NULL,
+	PREDICATE_VALUE_REFERENCE,	//non-null reference to anything but a string, it only compares to null (!=)
+	PREDICATE_VALUE_OTHER		//structs, values that couldn't be classified, ... nothing compares to them
+};
+
+//value of an operand as read from the target, primitives are widened, text points into the reader's buffer
+struct PredicateValue
+{
+	PredicateValueKind kind;
+	LONG64 integer;			//signed and unsigned (as bit pattern)
+	double real;
+	const wchar_t *text;
+	ULONG length;
+};
+
+//operand op constant, the constant is converted once when parsing
+struct PredicateClause
+{
+	std::wstring operand;	//this, a parameter name, argN (IL argument N) or a field name
+	PredicateOp op;
+	PredicateValueKind constantKind;	//SIGNED (also true/false), REAL, TEXT or NULL
+	LONG64 integer;
+	double real;
+	std::wstring text;
+
+	bool Test(const PredicateValue &value) const;
+};
+
+//where the operand of a clause is read from, resolved per method
+enum PredicateSource
+{
+	PREDICATE_UNRESOLVED,	//not an argument or field of the method, the clause never holds
+	PREDICATE_ARGUMENT,
+	PREDICATE_FIELD
+};
+
+struct PredicateOperand
+{
+	PredicateSource source;
+	ULONG argument;			//IL argument index, 0 is this for instance methods
+	mdFieldDef field;
+	bool staticField;
+};
+
+//condition on the arguments or fields of a method, clauses joined by && (or "and"), e.g. _commandText contains "Orders" && id == 42
+//parsed once from the config, evaluated on every hit against the raw values, so nothing is formatted unless it holds
+class Predicate
+{
+public:
+	//nullptr with error set if text doesn't parse
+	static shared_ptr<Predicate> Parse(const wchar_t *text, std::wstring &error);
+
+	const vector<PredicateClause> &Clauses() const
+	{
+		return clauses;
+	}
+
+	const std::wstring &Text() const
+	{
+		return text;
+	}
+
+	//read(clause, value) fetches the operand of a clause, false if it can't be read (the predicate doesn't hold then)
+	//clauses are tested in order and the first failing one ends it, so later operands aren't read at all
+	template<typename Reader>
+	bool Test(Reader read) const
+	{
+		for (size_t clause = 0; clause < clauses.size(); clause++)
+		{
+			PredicateValue value = { PREDICATE_VALUE_OTHER, 0, 0.0, nullptr, 0 };
+			if (!read(clause, value) || !clauses[clause].Test(value)) return false;
+		}
+		return true;
+	}
+private:
+	std::wstring text;
+	vector<PredicateClause> clauses;
+};
@@ -0,0 +1,219 @@
+#include "precompiled.h"
+#include "RuleEngine.h"
+#include "..\Shared\Logger.h"
+
+RuleEngine::RuleEngine()
+{
+	firedEvent = CreateEvent(nullptr, FALSE, FALSE, nullptr);
+}
+
+RuleEngine::~RuleEngine()
+{
+	if (firedEvent) CloseHandle(firedEvent);
+}
+
+void RuleEngine::SetRules(const vector<TraceRule> &rules)
+{
+	ULONG noRule = NoRule;
+
+	definitions = rules;
+	exceptionTypes.clear();
+	ruleExceptions.assign(definitions.size(), noRule);
+
+	//rules on the same exception type share its id
+	for (size_t rule = 0; rule < definitions.size(); rule++)
+	{
+		auto &type = definitions[rule].exception;
+		if (type.empty()) continue;
+
+		auto typeIt = std::find(exceptionTypes.begin(), exceptionTypes.end(), type);
+		ruleExceptions[rule] = (ULONG)(typeIt - exceptionTypes.begin());
+		if (typeIt == exceptionTypes.end()) exceptionTypes.push_back(type);
+	}
+
+	states.clear();
+	links.clear();
+	enterRules.clear();
+	returnRules.clear();
+	exceptionRules.clear();
+	callerBits.clear();
+}
+
+void RuleEngine::Bind(BreakpointGroups &groups)
+{
+	ULONG noRule = NoRule;
+
+	states.clear();
+	links.clear();
+	enterRules.clear();
+	returnRules.clear();
+	exceptionRules.assign(exceptionTypes.size(), noRule);
+	callerBits.clear();
+
+	//every distinct caller gets a bit, the shadow frames carry the bits of the callers below them
+	vector<std::wstring> callers;
+
+	for (ULONG rule = 0; rule < definitions.size(); rule++)
+	{
+		auto &def = definitions[rule];
+		states.push_back(RuleState{ 0, (ULONG64)(def.latencyMs * 1000000.0), 0, def.hits ? def.hits : 1, def.caller.empty(), false, false });
+		auto &state = states.back();
+
+		if (!def.caller.empty())
+		{
+			auto callerIt = std::find(callers.begin(), callers.end(), def.caller);
+			auto bit = (size_t)(callerIt - callers.begin());
+			if (callerIt == callers.end()) callers.push_back(def.caller);
+
+			//without a bit the caller is never found, the rule stays inactive
+			if (bit >= MaxCallers) LOG(L"Rule %s: more than %u distinct callers in the rules, ignored\n", def.name.c_str(), (ULONG)MaxCallers);
+			else state.callerMask = 1ULL << bit;
+		}
+
+		if (ruleExceptions[rule] != NoRule)
+		{
+			Link(exceptionRules, ruleExceptions[rule], rule);
+			state.methodFound = true;
+		}
+	}
+
+	LinkGroups(groups, 0);
+
+	//never evaluated, a condition refers to a method without breakpoints
+	for (ULONG rule = 0; rule < definitions.size(); rule++)
+	{
+		auto &state = states[rule];
+		if (state.callerFound && state.methodFound) continue;
+
+		state.done = true;
+		LOG(L"Rule %s: no instrumented method matches, the rule is inactive\n", definitions[rule].name.c_str());
+	}
+
+	TRACE(L"Bound %u rules, %u links, %u callers\n", definitions.size(), links.size(), callers.size());
+}
+
+void RuleEngine::Extend(BreakpointGroups &groups)
+{
+	auto firstGroup = (ULONG)enterRules.size();
+	if (firstGroup >= groups.Size()) return;
+
+	vector<bool> wasBound;
+	for (auto stateIt = states.begin(); stateIt != states.end(); ++stateIt)
+	{
+		wasBound.push_back(stateIt->callerFound && stateIt->methodFound);
+	}
+
+	LinkGroups(groups, firstGroup);
+
+	//an inactive rule never fired, it's evaluated from now on
+	for (ULONG rule = 0; rule < definitions.size(); rule++)
+	{
+		auto &state = states[rule];
+		if (wasBound[rule] || !state.callerFound || !state.methodFound) continue;
+
+		state.done = false;
+		LOG(L"Rule %s: its methods are instrumented now, the rule is active\n", definitions[rule].name.c_str());
+	}
+}
+
+//rule chains and caller bits of the groups from firstGroup on
+void RuleEngine::LinkGroups(BreakpointGroups &groups, ULONG firstGroup)
+{
+	ULONG noRule = NoRule;
+	auto numGroups = groups.Size();
+
+	enterRules.resize(numGroups, noRule);
+	returnRules.resize(numGroups, noRule);
+	callerBits.resize(numGroups, 0);
+
+	for (ULONG rule = 0; rule < definitions.size(); rule++)
+	{
+		auto &def = definitions[rule];
+		auto &state = states[rule];
+
+		if (state.callerMask)
+		{
+			for (auto group = firstGroup; group < numGroups; group++)
+			{
+				if (!Matches(groups.At(group).method->parsedSignature.get(), def.caller)) continue;
+
+				callerBits[group] |= state.callerMask;
+				state.callerFound = true;
+			}
+		}
+
+		if (ruleExceptions[rule] != NoRule) continue;
+
+		for (auto group = firstGroup; group < numGroups; group++)
+		{
+			if (!Matches(groups.At(group).method->parsedSignature.get(), def.method)) continue;
+
+			Link(def.latencyMs > 0.0 ? returnRules : enterRules, group, rule);
+			state.methodFound = true;
+		}
+	}
+}
+
+void RuleEngine::Link(vector<ULONG> &heads, ULONG head, ULONG rule)
+{
+	links.push_back(RuleLink{ rule, heads[head] });
+	heads[head] = (ULONG)links.size() - 1;
+}
+
+ULONG RuleEngine::ExceptionId(const wchar_t *typeName) const
+{
+	for (size_t type = 0; type < exceptionTypes.size(); type++)
+	{
+		if (exceptionTypes[type] == typeName) return (ULONG)type;
+	}
+	return NoRule;
+}
+
+void RuleEngine::Fire(ULONG rule, ShadowStack &stack, DWORD threadId)
+{
+	auto &def = definitions[rule];
+	if (!def.repeat) states[rule].done = true;
+
+	LOG(L"Rule %s fired on thread %u\n", def.name.c_str(), threadId);
+
+	//the target runs on while the worker gets here, the shadow stack is what the thread looked like at the event
+	if (def.captureStack)
+	{
+		for (auto depth = (int)stack.Depth() - 1; depth >= 0; depth--)
+		{
+			auto method = stack.At(depth).method;
+			LOG(L"  at %s\n", method->parsedSignature ? method->parsedSignature.get() : L"?");
+		}
+	}
+
+	//the rest needs the process stopped
+	if (def.activate.empty() && def.deactivate.empty() && !def.heapHistogram && !def.stopSession) return;
+
+	{
+		std::lock_guard<std::mutex> lock(firedLock);
+		fired.push_back(FiredRule{ &def, threadId });
+	}
+	SetEvent(firedEvent);
+}
+
+void RuleEngine::TakeFired(vector<FiredRule> &taken)
+{
+	std::lock_guard<std::mutex> lock(firedLock);
+	taken.insert(taken.end(), fired.begin(), fired.end());
+	fired.clear();
+}
+
+bool RuleEngine::Matches(const wchar_t *signature, const std::wstring &method)
+{
+	if (!signature || method.empty()) return false;
+
+	auto length = method.size();
+	for (auto found = wcsstr(signature, method.c_str()); found; found = wcsstr(found + 1, method.c_str()))
+	{
+		//whole names only, Cart::Add shouldn't match MyCart::Add or Cart::AddRange (a namespace may be left out)
+		auto before = found == signature ? L' ' : found[-1];
+		auto after = found[length];
+		if ((before == L' ' || before == L'.') && (after == L'(' || after == L'<')) return true;
+	}
+	return false;
+}
@@ -0,0 +1,151 @@
+#include "precompiled.h"
+#include "..\Shared\TraceRule.h"
+#include "BreakpointGroups.h"
+#include "CallStack.h"
+#include <mutex>
+
+#pragma once
+
+//a rule whose conditions held, its actions that need the process stopped are run from the main thread
+struct FiredRule
+{
+	const TraceRule *rule;
+	DWORD threadId;
+};
+
+//runtime state of a rule, only touched by the aggregation thread
+struct RuleState
+{
+	ULONG64 callerMask;		//bits of the callers that have to be on the stack
+	ULONG64 latencyNs;
+	ULONG64 matched;		//times the conditions held
+	ULONG hits;
+	bool callerFound;		//its caller is instrumented (or it has none)
+	bool methodFound;		//its method is instrumented (or it's triggered by an exception)
+	bool done;
+};
+
+//one method slot (or exception type) a rule is evaluated for, rules of the same slot are chained
+struct RuleLink
+{
+	ULONG rule;
+	ULONG next;
+};
+
+//evaluates the trace rules on the aggregation thread: rules are bound to method slots (breakpoint groups) when the breakpoints
+//are activated, so a hit only looks at the rules of its own method, and callers on the stack are a bit mask carried on the
+//shadow frames, so neither needs a search
+class RuleEngine
+{
+public:
+	static const ULONG NoRule = (ULONG)-1;
+	static const size_t MaxCallers = 64;
+
+	RuleEngine();
+	~RuleEngine();
+
+	//main thread, before tracing
+	void SetRules(const vector<TraceRule> &rules);
+
+	//main thread, while the aggregator isn't running: binds the rules to the method slots of groups
+	void Bind(BreakpointGroups &groups);
+
+	//main thread, while the aggregator isn't running: links the groups appended since (a module loaded while tracing),
+	//rules that were inactive become active once all of their methods and callers are instrumented
+	void Extend(BreakpointGroups &groups);
+
+	bool Any() const
+	{
+		return !definitions.empty();
+	}
+
+	bool WatchesExceptions() const
+	{
+		return !exceptionTypes.empty();
+	}
+
+	//callback thread, exception type (full name) => its exception id, NoRule if no rule is interested
+	ULONG ExceptionId(const wchar_t *typeName) const;
+
+	//aggregation thread
+	inline ULONG64 CallerBits(ULONG methodSlot) const
+	{
+		return methodSlot < callerBits.size() ? callerBits[methodSlot] : 0;
+	}
+
+	//callers are the bits of the frames below the entered one, the entered method is on top of stack
+	inline void OnEnter(ULONG methodSlot, ULONG64 callers, ShadowStack &stack, DWORD threadId)
+	{
+		if (methodSlot >= enterRules.size()) return;
+
+		for (auto link = enterRules[methodSlot]; link != NoRule; link = links[link].next)
+		{
+			Check(links[link].rule, callers, stack, threadId);
+		}
+	}
+
+	//the returning frame is popped already, callers are the bits of the frames below it
+	inline void OnReturn(ULONG methodSlot, ULONG64 nanoSeconds, ULONG64 callers, ShadowStack &stack, DWORD threadId)
+	{
+		if (methodSlot >= returnRules.size()) return;
+
+		for (auto link = returnRules[methodSlot]; link != NoRule; link = links[link].next)
+		{
+			if (nanoSeconds > states[links[link].rule].latencyNs) Check(links[link].rule, callers, stack, threadId);
+		}
+	}
+
+	inline void OnException(ULONG exceptionId, ULONG64 callers, ShadowStack &stack, DWORD threadId)
+	{
+		if (exceptionId >= exceptionRules.size()) return;
+
+		for (auto link = exceptionRules[exceptionId]; link != NoRule; link = links[link].next)
+		{
+			Check(links[link].rule, callers, stack, threadId);
+		}
+	}
+
+	//main thread, signaled when a rule with actions for the main thread fired
+	HANDLE FiredEvent() const
+	{
+		return firedEvent;
+	}
+
+	void TakeFired(vector<FiredRule> &taken);
+
+	//methods are matched on the Class::Method part of their signature
+	static bool Matches(const wchar_t *signature, const std::wstring &method);
+private:
+	RuleEngine(RuleEngine const&);
+	void operator=(RuleEngine const&);
+
+	vector<TraceRule> definitions;
+	vector<RuleState> states;
+	vector<std::wstring> exceptionTypes;	//by exception id
+	vector<ULONG> ruleExceptions;			//by rule, NoRule for rules that aren't triggered by an exception
+
+	//chains of rules by method slot, or exception id
+	vector<RuleLink> links;
+	vector<ULONG> enterRules;
+	vector<ULONG> returnRules;
+	vector<ULONG> exceptionRules;
+	vector<ULONG64> callerBits;	//by method slot, the bit of every rule caller the method is
+
+	inline void Check(ULONG rule, ULONG64 callers, ShadowStack &stack, DWORD threadId)
+	{
+		auto &state = states[rule];
+		if (state.done || ((callers & state.callerMask) != state.callerMask)) return;
+		if (++state.matched % state.hits) return;
+
+		Fire(rule, stack, threadId);
+	}
+
+	void Fire(ULONG rule, ShadowStack &stack, DWORD threadId);
+	void Link(vector<ULONG> &heads, ULONG head, ULONG rule);
+	void LinkGroups(BreakpointGroups &groups, ULONG firstGroup);
+
+	//fired rules waiting for the main thread
+	std::mutex firedLock;
+	vector<FiredRule> fired;
+	HANDLE firedEvent;
+};
@@ -0,0 +1,57 @@
+#include "precompiled.h"
+#include "ThreadFilter.h"
+
+void ThreadFilter::SetSelectors(const vector<ThreadSelector> &selectors)
+{
+	this->selectors = selectors;
+	verdicts.Clear();
+
+	anyAllow = false;
+	needsIdentity = false;
+	for (auto selectorIt = selectors.begin(); selectorIt != selectors.end(); ++selectorIt)
+	{
+		if (!selectorIt->skip) anyAllow = true;
+		if (selectorIt->kind != THREAD_BY_OS_ID) needsIdentity = true;
+	}
+}
+
+bool ThreadFilter::Classify(DWORD osThreadId, LONG managedId, const wchar_t *name)
+{
+	//with allow selectors a thread has to match one of them, a skip selector always wins
+	auto traced = !anyAllow;
+	for (auto selectorIt = selectors.begin(); selectorIt != selectors.end(); ++selectorIt)
+	{
+		if (!Matches(*selectorIt, osThreadId, managedId, name)) continue;
+
+		if (selectorIt->skip)
+		{
+			traced = false;
+			break;
+		}
+		traced = true;
+	}
+
+	verdicts.Insert(KeyOf(osThreadId), traced ? 1 : 0);
+	return traced;
+}
+
+bool ThreadFilter::Matches(const ThreadSelector &selector, DWORD osThreadId, LONG managedId, const wchar_t *name)
+{
+	switch (selector.kind)
+	{
+	case THREAD_BY_OS_ID:
+		return selector.id == osThreadId;
+	case THREAD_BY_MANAGED_ID:
+		return (managedId >= 0) && (selector.id == (unsigned long)managedId);
+	case THREAD_BY_NAME:
+	{
+		if (!name) return false;
+
+		auto &pattern = selector.name;
+		if (!pattern.empty() && pattern.back() == L'*') return wcsncmp(name, pattern.c_str(), pattern.size() - 1) == 0;
+		return pattern == name;
+	}
+	default:
+		return false;
+	}
+}
@@ -0,0 +1,68 @@
+#include "precompiled.h"
+#include "..\Shared\ThreadSelector.h"
+#include "FlatIndex.h"
+
+#pragma once
+
+//decides which threads are traced: the verdict of a thread is cached by OS thread id, so a breakpoint hit only pays a
+//hash lookup, its managed id and name are only read the first time it hits (and again after it's renamed)
+//callback thread only, except for SetSelectors
+class ThreadFilter
+{
+public:
+	ThreadFilter() : anyAllow(false), needsIdentity(false), skippedHits(0) {}
+
+	//before tracing, drops the cached verdicts
+	void SetSelectors(const vector<ThreadSelector> &selectors);
+
+	bool Any() const
+	{
+		return !selectors.empty();
+	}
+
+	//the managed id or name is needed to classify a thread, not just its OS id
+	bool NeedsIdentity() const
+	{
+		return needsIdentity;
+	}
+
+	//1 traced, 0 skipped, FlatIndex::NoSlot not classified yet
+	inline ULONG Find(DWORD osThreadId) const
+	{
+		return verdicts.Find(KeyOf(osThreadId));
+	}
+
+	//decides and caches, managedId -1 or name nullptr if they couldn't be read
+	//nothing is logged here, the caller is on the callback thread and logs through the aggregator
+	bool Classify(DWORD osThreadId, LONG managedId, const wchar_t *name);
+
+	//renamed, or exited (the OS id may be reused), classified again on its next hit
+	void Forget(DWORD osThreadId)
+	{
+		if (verdicts.Find(KeyOf(osThreadId)) != FlatIndex::NoSlot) verdicts.Insert(KeyOf(osThreadId), FlatIndex::NoSlot);
+	}
+
+	inline void CountSkipped()
+	{
+		skippedHits++;
+	}
+
+	ULONG64 SkippedHits() const
+	{
+		return skippedHits;
+	}
+private:
+	vector<ThreadSelector> selectors;
+	bool anyAllow;
+	bool needsIdentity;
+	FlatIndex verdicts;
+	ULONG64 skippedHits;
+
+	//key 0 is reserved by the index
+	static inline ULONG64 KeyOf(DWORD osThreadId)
+	{
+		return 0x100000000ULL | osThreadId;
+	}
+
+	static bool Matches(const ThreadSelector &selector, DWORD osThreadId, LONG managedId, const wchar_t *name);
+};
@@ -0,0 +1,176 @@
+#include "precompiled.h"
+#include "Timeline.h"
+
+void TimeSeries::PutVarint(vector<BYTE> &data, ULONG64 value)
+{
+	while (value >= 0x80)
+	{
+		data.push_back((BYTE)(value | 0x80));
+		value >>= 7;
+	}
+	data.push_back((BYTE)value);
+}
+
+ULONG64 TimeSeries::GetVarint(const vector<BYTE> &data, size_t &pos)
+{
+	ULONG64 value = 0;
+	for (unsigned int shift = 0; pos < data.size() && shift < 64; shift += 7)
+	{
+		auto b = data[pos++];
+		value |= (ULONG64)(b & 0x7f) << shift;
+		if (!(b & 0x80)) break;
+	}
+	return value;
+}
+
+void TimeSeries::Encode(const TimelinePoint &point)
+{
+	//hit counts of consecutive intervals are close, the sign of the delta goes in the lowest bit
+	auto hitsDelta = (LONG64)(point.hits - lastHits);
+
+	PutVarint(data, point.interval - lastInterval);
+	PutVarint(data, (ULONG64)((hitsDelta << 1) ^ (hitsDelta >> 63)));
+	PutVarint(data, point.p99 ^ lastP99);
+
+	lastInterval = point.interval;
+	lastHits = point.hits;
+	lastP99 = point.p99;
+}
+
+void TimeSeries::Append(ULONG interval, ULONG64 hits, ULONG64 p99)
+{
+	if (hasPending && pending.interval == interval)
+	{
+		pending.hits += hits;
+		if (p99 > pending.p99) pending.p99 = p99;
+		return;
+	}
+
+	if (hasPending) Encode(pending);
+
+	pending = TimelinePoint{ interval, hits, p99 };
+	hasPending = true;
+}
+
+void TimeSeries::Decode(vector<TimelinePoint> &points) const
+{
+	ULONG interval = 0;
+	ULONG64 hits = 0;
+	ULONG64 p99 = 0;
+
+	size_t pos = 0;
+	while (pos < data.size())
+	{
+		interval += (ULONG)GetVarint(data, pos);
+
+		auto zigzag = GetVarint(data, pos);
+		hits += (ULONG64)((LONG64)(zigzag >> 1) ^ -(LONG64)(zigzag & 1));
+
+		p99 ^= GetVarint(data, pos);
+
+		points.push_back(TimelinePoint{ interval, hits, p99 });
+	}
+
+	if (hasPending) points.push_back(pending);
+}
+
+void TimeSeries::Downsample()
+{
+	vector<TimelinePoint> points;
+	Decode(points);
+
+	data.clear();
+	hasPending = false;
+	lastInterval = 0;
+	lastHits = 0;
+	lastP99 = 0;
+
+	for (auto pointIt = points.begin(); pointIt != points.end(); ++pointIt)
+	{
+		Append(pointIt->interval / 2, pointIt->hits, pointIt->p99);
+	}
+
+	data.shrink_to_fit();
+}
+
+void Timeline::Reset(BreakpointGroups &groups, unsigned int intervalMs, size_t maxBytes, double timerFreq, long long now)
+{
+	this->intervalMs = intervalMs;
+	this->maxBytes = maxBytes;
+	intervalTicks = (long long)(timerFreq * (double)intervalMs / 1000.0);
+	if (intervalTicks < 1) intervalTicks = 1;
+	startTime = now;
+	currentInterval = 0;
+	bytes = 0;
+
+	touched.clear();
+	latencies.clear();
+	latencies.resize(groups.Size());
+	methods.clear();
+	methods.resize(groups.Size());
+	for (ULONG group = 0; group < groups.Size(); group++)
+	{
+		methods[group].method = groups.At(group).method;
+		methods[group].hits = 0;
+		methods[group].touched = false;
+	}
+
+	TRACE(L"Timeline of %u methods, %u ms intervals, %u KB\n", methods.size(), intervalMs, maxBytes / 1024);
+}
+
+void Timeline::Extend(BreakpointGroups &groups)
+{
+	auto first = (ULONG)methods.size();
+	latencies.resize(groups.Size());
+	methods.resize(groups.Size());
+	for (auto group = first; group < groups.Size(); group++)
+	{
+		methods[group].method = groups.At(group).method;
+		methods[group].hits = 0;
+		methods[group].touched = false;
+	}
+}
+
+void Timeline::CloseInterval(long long now)
+{
+	for (auto slotIt = touched.begin(); slotIt != touched.end(); ++slotIt)
+	{
+		auto &method = methods[*slotIt];
+		auto &latency = latencies[*slotIt];
+		auto p99 = latency ? latency->ValueAtPercentile(99.0) : 0;
+
+		auto before = method.series.Bytes();
+		method.series.Append(currentInterval, method.hits, p99);
+		bytes += method.series.Bytes() - before;
+
+		method.hits = 0;
+		method.touched = false;
+		if (latency) latency->Reset();
+	}
+	touched.clear();
+
+	//half the resolution until it fits again, recent and old intervals alike
+	while (bytes > maxBytes && intervalMs < 0x40000000) Downsample();
+
+	currentInterval = (ULONG)((now - startTime) / intervalTicks);
+}
+
+void Timeline::Downsample()
+{
+	bytes = 0;
+	for (auto methodIt = methods.begin(); methodIt != methods.end(); ++methodIt)
+	{
+		methodIt->series.Downsample();
+		bytes += methodIt->series.Bytes();
+	}
+
+	intervalTicks *= 2;
+	intervalMs *= 2;
+
+	TRACE(L"Timeline downsampled to %u ms intervals, %u KB\n", intervalMs, bytes / 1024);
+}
+
+void Timeline::Finish(long long now)
+{
+	CloseInterval(now);
+}
@@ -0,0 +1,145 @@
+#include "precompiled.h"
+#include "LatencyHistogram.h"
+#include "BreakpointGroups.h"
+
+#pragma once
+
+//one interval of a method's timeline
+struct TimelinePoint
+{
+	ULONG interval;		//interval number since the timeline started
+	ULONG64 hits;		//entries (or opcode breakpoint hits for methods without entry breakpoint)
+	ULONG64 p99;		//ns, 0 when no call returned in the interval
+};
+
+//compressed series of the non-empty intervals of one method
+//per point: interval gap and hits delta (zigzag) as varints, p99 xor'ed with the previous p99 as varint
+//the last point is kept decoded, so a point for the same interval (after downsampling) can still be merged into it
+class TimeSeries
+{
+public:
+	TimeSeries() : pending(), hasPending(false), lastInterval(0), lastHits(0), lastP99(0) {}
+
+	void Append(ULONG interval, ULONG64 hits, ULONG64 p99);
+	void Decode(vector<TimelinePoint> &points) const;
+
+	//halves the resolution: intervals 2n and 2n+1 become n, hits are summed, the highest p99 is kept
+	void Downsample();
+
+	size_t Bytes() const
+	{
+		return data.size();
+	}
+private:
+	vector<BYTE> data;
+	TimelinePoint pending;
+	bool hasPending;
+
+	//previous encoded point, the deltas are against it
+	ULONG lastInterval;
+	ULONG64 lastHits;
+	ULONG64 lastP99;
+
+	void Encode(const TimelinePoint &point);
+	static void PutVarint(vector<BYTE> &data, ULONG64 value);
+	static ULONG64 GetVarint(const vector<BYTE> &data, size_t &pos);
+};
+
+//hits and p99 latency of every instrumented method per fixed interval, on top of the totals since attach
+//only used by the aggregation thread, memory is bounded by halving the resolution of the whole timeline when full
+class Timeline
+{
+public:
+	Timeline() : intervalTicks(0), startTime(0), currentInterval(0), intervalMs(0), maxBytes(0), bytes(0) {}
+
+	void Reset(BreakpointGroups &groups, unsigned int intervalMs, size_t maxBytes, double timerFreq, long long now);
+
+	inline void OnHit(ULONG methodSlot, long long now)
+	{
+		Advance(now);
+		Touch(methodSlot);
+
+		methods[methodSlot].hits++;
+	}
+
+	inline void OnReturn(ULONG methodSlot, ULONG64 nanoSeconds, long long now)
+	{
+		Advance(now);
+		Touch(methodSlot);
+
+		auto &latency = latencies[methodSlot];
+		if (!latency) latency = unique_ptr<LatencyHistogram>(new LatencyHistogram());
+		latency->Record(nanoSeconds);
+	}
+
+	//groups appended while tracing (a module loaded), their series start in the interval in progress
+	void Extend(BreakpointGroups &groups);
+
+	//closes the interval in progress
+	void Finish(long long now);
+
+	size_t Size() const
+	{
+		return methods.size();
+	}
+
+	MethodInfo *Method(ULONG methodSlot) const
+	{
+		return methods[methodSlot].method;
+	}
+
+	void Series(ULONG methodSlot, vector<TimelinePoint> &points) const
+	{
+		methods[methodSlot].series.Decode(points);
+	}
+
+	//current resolution, grows when the timeline gets downsampled
+	unsigned int IntervalMs() const
+	{
+		return intervalMs;
+	}
+
+	size_t Bytes() const
+	{
+		return bytes;
+	}
+private:
+	Timeline(Timeline const&);
+	void operator=(Timeline const&);
+
+	//interval in progress and compressed history of one method
+	struct MethodTimeline
+	{
+		MethodInfo *method;
+		ULONG64 hits;
+		bool touched;
+		TimeSeries series;
+	};
+
+	vector<MethodTimeline> methods;					//by method slot
+	vector<unique_ptr<LatencyHistogram>> latencies;	//by method slot, allocated on the first return and reused every interval
+	vector<ULONG> touched;							//method slots with hits or returns in the interval in progress
+
+	long long intervalTicks;
+	long long startTime;
+	ULONG currentInterval;
+	unsigned int intervalMs;
+	size_t maxBytes;
+	size_t bytes;
+
+	inline void Touch(ULONG methodSlot)
+	{
+		if (methods[methodSlot].touched) return;
+
+		methods[methodSlot].touched = true;
+		touched.push_back(methodSlot);
+	}
+
+	inline void Advance(long long now)
+	{
+		if (now - startTime >= (long long)(currentInterval + 1) * intervalTicks) CloseInterval(now);
+	}
+
+	void CloseInterval(long long now);
+	void Downsample();
+};
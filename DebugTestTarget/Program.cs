@@ -84,7 +84,7 @@ namespace DebugTestTarget
             sleepCount++;
             try
             {
-                throw new Exception("First chance");
+                ThrowFirstChance();
             }
             catch (Exception)
             {                               
@@ -102,6 +102,13 @@ namespace DebugTestTarget
             testGeneric.NestedGenericMethod<int>();
         }
 
+        //a traced call that leaves through an exception
+        [MethodImpl(MethodImplOptions.NoInlining)]
+        public void ThrowFirstChance()
+        {
+            throw new Exception("First chance");
+        }
+
         [DllImport("kernel32.dll", SetLastError = true)]
         [return: MarshalAs(UnmanagedType.Bool)]
         public static extern bool GetPhysicallyInstalledSystemMemory(out long MemoryInKilobytes);
@@ -5,3 +5,4 @@
 #define OPMODE_TIMINGS (OPMODE)1	//time in method (will set entry + exit BP) + hitcount
 #define OPMODE_FIELDS (OPMODE)2		//field dump (will set entry BP)
 #define OPMODE_STATS (OPMODE)4		//newobj/newarr/box/unbox are monitored to get stats about object allocation and boxing
+#define OPMODE_CALLGRAPH (OPMODE)8	//caller => callee call counts and times (needs OPMODE_TIMINGS)
@@ -1,7 +1,7 @@
 #include "Logger.h"
 #include "tracing.h"
 
-FILE* Logger::logFile;
+std::recursive_mutex Logger::fileLock;
 const wchar_t* Logger::fileName = L"tracer.log";
 
 Logger::Logger() {}
@@ -10,11 +10,18 @@ bool Logger::CreateLog(const wchar_t* file)
 {
 	if (file != nullptr) fileName = file;
 
+	std::lock_guard<std::recursive_mutex> lock(fileLock);
+
 	//create it
+	FILE *logFile;
 	if (_wfopen_s(&logFile, fileName, L"w+") == 0)
 	{
 		VERIFY(fclose(logFile) == 0);
 		return true;
 	}
 	return false;
+}
+const wchar_t* Logger::FileName()
+{
+	return fileName;
 }
\ No newline at end of file
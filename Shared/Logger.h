@@ -1,12 +1,14 @@
 #pragma once
 
 #include <stdio.h>
+#include <mutex>
 
 struct Logger
 {
 	Logger();
 	
 	static bool CreateLog(const wchar_t* file);
+	static const wchar_t* FileName();
 
 #define maxLog 10240
 
@@ -23,15 +25,25 @@ struct Logger
 
 		auto success = _snwprintf_s(buffer + count, maxLog - count, maxLog - count - 1, format, args...) != -1;
 
+		//the callback thread, the aggregator and the main thread all log, a line is written whole or not at all
+		std::lock_guard<std::recursive_mutex> lock(fileLock);
+
+		FILE *logFile;
 		if (_wfopen_s(&logFile, fileName, L"a") == 0)
 		{
-			fwprintf_s(logFile, buffer);
+			fwprintf_s(logFile, L"%s", buffer);
 			if (!success) fwprintf_s(logFile, L"\nTRUNCATED after %u characters\n", maxLog);
 			fclose(logFile);
 		}
 	}
+
+	//held across several lines that belong together (a snapshot), the lines of other threads wait
+	static std::recursive_mutex& Lock()
+	{
+		return fileLock;
+	}
 private:
-	static FILE* logFile;
+	static std::recursive_mutex fileLock;
 	static const wchar_t* fileName;
 };
 
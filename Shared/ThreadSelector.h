@@ -0,0 +1,54 @@
+#include <string>
+#include <vector>
+#include <stdlib.h>
+
+#pragma once
+
+enum ThreadSelectorKind
+{
+	THREAD_BY_OS_ID,		//as in a dump or process explorer
+	THREAD_BY_MANAGED_ID,	//Thread.ManagedThreadId
+	THREAD_BY_NAME			//Thread.Name, a trailing * matches a prefix
+};
+
+//selects threads to trace (or to skip), with allow selectors only the threads matching one of them are traced
+struct ThreadSelector
+{
+	ThreadSelectorKind kind;
+	unsigned long id;
+	std::wstring name;
+	bool skip;
+};
+
+//comma separated list: 1234 is an OS thread id, #12 a managed thread id, anything else a thread name (Worker* for a prefix)
+inline void ParseThreadSelectors(const wchar_t *list, bool skip, std::vector<ThreadSelector> &selectors)
+{
+	std::wstring items(list);
+	for (size_t start = 0; start <= items.size();)
+	{
+		auto end = items.find(L',', start);
+		if (end == std::wstring::npos) end = items.size();
+
+		auto item = items.substr(start, end - start);
+		start = end + 1;
+
+		//trim
+		auto first = item.find_first_not_of(L" \t");
+		if (first == std::wstring::npos) continue;
+		item = item.substr(first, item.find_last_not_of(L" \t") - first + 1);
+
+		ThreadSelector selector = { THREAD_BY_NAME, 0, item, skip };
+
+		wchar_t *idEnd;
+		auto isManaged = item[0] == L'#';
+		auto id = wcstoul(item.c_str() + (isManaged ? 1 : 0), &idEnd, 10);
+		if (!*idEnd && idEnd != item.c_str() + (isManaged ? 1 : 0))
+		{
+			selector.kind = isManaged ? THREAD_BY_MANAGED_ID : THREAD_BY_OS_ID;
+			selector.id = id;
+			selector.name.clear();
+		}
+
+		selectors.push_back(selector);
+	}
+}
@@ -0,0 +1,28 @@
+#include <string>
+#include <vector>
+
+#pragma once
+
+//conditional instrumentation: when the conditions of a rule hold, its actions run
+//methods are named as in the log (Namespace.Class::Method), groups are the group names of the filters
+struct TraceRule
+{
+	std::wstring name;
+
+	//conditions, all of the given ones have to hold
+	std::wstring method;		//entered, or returned when latencyMs is set
+	std::wstring caller;		//has an (instrumented) activation on the thread's stack
+	std::wstring exception;		//type thrown (or derived from it), method isn't used then
+	double latencyMs;			//a call of method took longer than this
+	unsigned int hits;			//fires on every hits-th time the other conditions hold
+	bool repeat;				//keeps firing instead of once
+
+	//actions
+	std::vector<std::wstring> activate;		//breakpoint groups
+	std::vector<std::wstring> deactivate;
+	bool heapHistogram;
+	bool captureStack;			//instrumented frames of the thread the rule fired on
+	bool stopSession;
+
+	TraceRule() : latencyMs(0.0), hits(1), repeat(false), heapHistogram(false), captureStack(false), stopSession(false) {}
+};
@@ -0,0 +1,30 @@
+#pragma once
+
+//tunables of a tracing session, filled in by the config providers and handed to the debugger
+struct TraceSettings
+{
+	//buffer between the breakpoint callbacks and the aggregation thread
+	unsigned int eventBufferSize;	//events, rounded up to a power of 2
+	bool blockWhenBufferFull;		//stall the target until there's room instead of dropping events
+
+	//sampling: a method's breakpoints are deactivated after sampleHits hits and re-armed on the next window
+	unsigned int sampleHits;		//0 = trace every hit
+	unsigned int sampleWindowMs;
+
+	//overhead governor: methods are deactivated when breakpoints suspend the target longer than this fraction of wall time
+	double overheadBudget;			//0 = no governor
+	double hitCostMicroSeconds;		//estimated debugger round trip of a hit on top of the measured callback time
+
+	//longest the target is stopped at a time while setting or (de)activating breakpoints
+	unsigned int maxPauseMs;
+
+	//call graph: distinct caller => callee edges (and distinct stacks) kept, calls beyond that are only counted
+	unsigned int maxCallEdges;
+
+	//timeline: hits and p99 per method per interval, older intervals are merged when it outgrows its memory
+	unsigned int intervalMs;		//0 = totals only
+	unsigned int timelineKB;
+
+	TraceSettings() : eventBufferSize(65536), blockWhenBufferFull(false), sampleHits(0), sampleWindowMs(1000), overheadBudget(0.0), hitCostMicroSeconds(50.0), maxPauseMs(100), maxCallEdges(65536),
+		intervalMs(1000), timelineKB(8192) {}
+};